@@ -31,6 +31,27 @@ def deser_uint256(f):
         r += t << (i * 32)
     return r
 
+def deser_compact_size(f):
+    nit = unpack(b"<B", f.read(1))[0]
+    if nit == 253:
+        nit = unpack(b"<H", f.read(2))[0]
+    elif nit == 254:
+        nit = unpack(b"<I", f.read(4))[0]
+    elif nit == 255:
+        nit = unpack(b"<Q", f.read(8))[0]
+    return nit
+
+def deser_string(f):
+    nit = deser_compact_size(f)
+    return f.read(nit)
+
+def deser_string_vector(f):
+    nit = deser_compact_size(f)
+    r = []
+    for i in range(nit):
+        r.append(deser_string(f))
+    return r
+
 #allows simple http get calls with a request body
 def http_get_call(host, port, path, requestdata = '', response_object = 0):
     conn = httplib.HTTPConnection(host, port)
@@ -49,7 +70,7 @@ class RESTTest (BitcoinTestFramework):
         initialize_chain_clean(self.options.tmpdir, 3)
 
     def setup_network(self, split=False):
-        self.nodes = start_nodes(3, self.options.tmpdir)
+        self.nodes = start_nodes(3, self.options.tmpdir, [["-restaddrutxos"], [], []])
         connect_nodes_bi(self.nodes,0,1)
         connect_nodes_bi(self.nodes,1,2)
         connect_nodes_bi(self.nodes,0,2)
@@ -284,5 +305,119 @@ class RESTTest (BitcoinTestFramework):
         json_obj = json.loads(json_string)
         assert_equal(json_obj['bestblockhash'], bb_hash)
 
+        ##################
+        # /rest/alliance #
+        ##################
+        member_list = self.nodes[0].getmemberlist()
+        json_string = http_get_call(url.hostname, url.port, '/rest/alliance'+self.FORMAT_SEPARATOR+'json')
+        json_obj = json.loads(json_string)
+        assert_equal(json_obj, member_list)
+
+        response = http_get_call(url.hostname, url.port, '/rest/alliance'+self.FORMAT_SEPARATOR+'bin', '', True)
+        assert_equal(response.status, 200)
+        response_str = response.read()
+        assert_equal(deser_string_vector(StringIO.StringIO(response_str)), sorted(member_list['member_list']))
+
+        response_hex = http_get_call(url.hostname, url.port, '/rest/alliance'+self.FORMAT_SEPARATOR+'hex', '', True)
+        assert_equal(response_hex.status, 200)
+        assert_equal(response_hex.read().strip(), response_str.encode("hex"))
+
+        ################
+        # /rest/miners #
+        ################
+        miner_list = self.nodes[0].getminerlist()
+        json_string = http_get_call(url.hostname, url.port, '/rest/miners'+self.FORMAT_SEPARATOR+'json')
+        json_obj = json.loads(json_string)
+        assert_equal(json_obj, miner_list)
+
+        response = http_get_call(url.hostname, url.port, '/rest/miners'+self.FORMAT_SEPARATOR+'bin', '', True)
+        assert_equal(response.status, 200)
+        response_str = response.read()
+        assert_equal(deser_string_vector(StringIO.StringIO(response_str)), sorted(miner_list['miner_list']))
+
+        response_hex = http_get_call(url.hostname, url.port, '/rest/miners'+self.FORMAT_SEPARATOR+'hex', '', True)
+        assert_equal(response_hex.status, 200)
+        assert_equal(response_hex.read().strip(), response_str.encode("hex"))
+
+        #####################################
+        # /rest/licenses and /rest/license/ #
+        #####################################
+        license_list = self.nodes[0].getlicenselist(1)
+        json_string = http_get_call(url.hostname, url.port, '/rest/licenses'+self.FORMAT_SEPARATOR+'json')
+        json_obj = json.loads(json_string)
+        assert_equal(sorted(json_obj.keys()), sorted(license_list.keys()))
+
+        response = http_get_call(url.hostname, url.port, '/rest/licenses'+self.FORMAT_SEPARATOR+'bin', '', True)
+        assert_equal(response.status, 200)
+        response_str = response.read()
+        assert_equal(deser_compact_size(StringIO.StringIO(response_str)), len(license_list))
+
+        response_hex = http_get_call(url.hostname, url.port, '/rest/licenses'+self.FORMAT_SEPARATOR+'hex', '', True)
+        assert_equal(response_hex.status, 200)
+        assert_equal(response_hex.read().strip(), response_str.encode("hex"))
+
+        for color in license_list.keys():
+            json_string = http_get_call(url.hostname, url.port, '/rest/license/'+color+self.FORMAT_SEPARATOR+'json')
+            json_obj = json.loads(json_string)
+            assert_equal(json_obj['Owner'], license_list[color]['address'])
+
+            response = http_get_call(url.hostname, url.port, '/rest/license/'+color+self.FORMAT_SEPARATOR+'bin', '', True)
+            assert_equal(response.status, 200)
+            response_str = response.read()
+            assert_equal(deser_string(StringIO.StringIO(response_str)), license_list[color]['address'])
+
+            response_hex = http_get_call(url.hostname, url.port, '/rest/license/'+color+self.FORMAT_SEPARATOR+'hex', '', True)
+            assert_equal(response_hex.status, 200)
+            assert_equal(response_hex.read().strip(), response_str.encode("hex"))
+
+        response = http_get_call(url.hostname, url.port, '/rest/license/notacolor'+self.FORMAT_SEPARATOR+'json', '', True)
+        assert_equal(response.status, 400)
+        response = http_get_call(url.hostname, url.port, '/rest/license/4294967295'+self.FORMAT_SEPARATOR+'json', '', True)
+        assert_equal(response.status, 404)
+
+        #####################
+        # /rest/addrutxos/  #
+        #####################
+        json_string = http_get_call(url.hostname, url.port, '/rest/tx/'+txs[0]+self.FORMAT_SEPARATOR+"json")
+        json_obj = json.loads(json_string)
+        address = json_obj['vout'][0]['scriptPubKey']['addresses'][0]
+
+        # addrutxos reads the coins database without flushing; gettxoutaddress flushes it
+        addr_utxos = self.nodes[0].gettxoutaddress(address, False)
+        assert_greater_than(len(addr_utxos), 0)
+        bb_hash = self.nodes[0].getbestblockhash()
+        bb_height = self.nodes[0].getblockcount()
+
+        json_string = http_get_call(url.hostname, url.port, '/rest/addrutxos/'+address+self.FORMAT_SEPARATOR+'json')
+        json_obj = json.loads(json_string)
+        assert_equal(json_obj['chaintipHash'], bb_hash)
+        assert_equal(json_obj['chainHeight'], bb_height)
+        assert_equal(sorted([(u['txid'], u['vout']) for u in json_obj['utxos']]),
+                     sorted([(u['txid'], u['vout']) for u in addr_utxos]))
+
+        response = http_get_call(url.hostname, url.port, '/rest/addrutxos/'+address+self.FORMAT_SEPARATOR+'bin', '', True)
+        assert_equal(response.status, 200)
+        response_str = response.read()
+        output = StringIO.StringIO(response_str)
+        assert_equal(unpack("i", output.read(4))[0], bb_height)
+        assert_equal(hex(deser_uint256(output))[2:].zfill(65).rstrip("L"), bb_hash)
+        assert_equal(deser_compact_size(output), len(addr_utxos))
+
+        response_hex = http_get_call(url.hostname, url.port, '/rest/addrutxos/'+address+self.FORMAT_SEPARATOR+'hex', '', True)
+        assert_equal(response_hex.status, 200)
+        assert_equal(response_hex.read().strip(), response_str.encode("hex"))
+
+        # the flushed database cannot be combined with the current mempool
+        response = http_get_call(url.hostname, url.port, '/rest/addrutxos/checkmempool/'+address+self.FORMAT_SEPARATOR+'json', '', True)
+        assert_equal(response.status, 400)
+
+        response = http_get_call(url.hostname, url.port, '/rest/addrutxos/'+self.FORMAT_SEPARATOR+'json', '', True)
+        assert_equal(response.status, 400)
+
+        # served only with -restaddrutxos
+        url1 = urlparse.urlparse(self.nodes[1].url)
+        response = http_get_call(url1.hostname, url1.port, '/rest/addrutxos/'+address+self.FORMAT_SEPARATOR+'json', '', True)
+        assert_equal(response.status, 403)
+
 if __name__ == '__main__':
     RESTTest ().main ()
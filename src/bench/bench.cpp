@@ -0,0 +1,138 @@
+// Copyright (c) 2014-2016 The Gcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include <exception>
+#include <limits>
+
+#include <sys/time.h>
+
+using namespace json_spirit;
+
+benchmark::BenchRunner::BenchmarkMap& benchmark::BenchRunner::benchmarks()
+{
+    // Function-local so registration from other translation units does not
+    // depend on static initialization order.
+    static BenchmarkMap benchmarks_map;
+    return benchmarks_map;
+}
+
+double benchmark::gettimedouble()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_usec * 1e-6 + tv.tv_sec;
+}
+
+benchmark::State::State(const std::string& _name, double _maxElapsed) :
+    name(_name), maxElapsed(_maxElapsed), beginTime(0), lastTime(0), pausedTime(0), pauseBegin(0), count(0)
+{
+    minTime = std::numeric_limits<double>::max();
+    maxTime = 0;
+    countMask = 1;
+    countMaskInv = 1./(countMask + 1);
+}
+
+bool benchmark::State::KeepRunning()
+{
+    if (!error.empty())
+        return false;
+
+    if (count & countMask) {
+        ++count;
+        return true;
+    }
+    // The clock stands still while timing is paused
+    double now;
+    if (count == 0) {
+        lastTime = beginTime = now = gettimedouble() - pausedTime;
+    } else {
+        now = gettimedouble() - pausedTime;
+        double elapsed = now - lastTime;
+        double elapsedOne = elapsed * countMaskInv;
+        if (elapsedOne < minTime) minTime = elapsedOne;
+        if (elapsedOne > maxTime) maxTime = elapsedOne;
+        if (elapsed * 128 < maxElapsed) {
+            // If the execution was much too fast (1/128th of maxElapsed),
+            // increase the count mask by 8x and restart timing. The restart
+            // avoids including the overhead of this code in the measurement.
+            countMask = ((countMask << 3) | 7) & ((1LL << 60) - 1);
+            countMaskInv = 1./(countMask + 1);
+            count = 0;
+            minTime = std::numeric_limits<double>::max();
+            maxTime = 0;
+            return true;
+        }
+        if (elapsed * 16 < maxElapsed) {
+            int64_t newCountMask = ((countMask << 1) | 1) & ((1LL << 60) - 1);
+            if ((count & newCountMask) == 0) {
+                countMask = newCountMask;
+                countMaskInv = 1./(countMask + 1);
+            }
+        }
+    }
+    lastTime = now;
+    ++count;
+
+    if (now - beginTime < maxElapsed)
+        return true; // Keep going
+
+    --count;
+    return false;
+}
+
+void benchmark::State::PauseTiming()
+{
+    pauseBegin = gettimedouble();
+}
+
+void benchmark::State::ResumeTiming()
+{
+    pausedTime += gettimedouble() - pauseBegin;
+}
+
+void benchmark::State::SkipWithError(const std::string& strError)
+{
+    error = strError;
+}
+
+benchmark::BenchRunner::BenchRunner(const std::string& name, benchmark::BenchFunction func)
+{
+    benchmarks().insert(std::make_pair(name, func));
+}
+
+int benchmark::BenchRunner::RunAll(Array& results, double elapsedTimeForOne, const std::string& strFilter)
+{
+    int nErrors = 0;
+    for (BenchmarkMap::iterator it = benchmarks().begin(); it != benchmarks().end(); ++it) {
+        if (!strFilter.empty() && it->first.find(strFilter) == std::string::npos)
+            continue;
+
+        State state(it->first, elapsedTimeForOne);
+        try {
+            it->second(state);
+        } catch (const std::exception& e) {
+            state.SkipWithError(e.what());
+        }
+        if (state.error.empty() && state.Iterations() == 0)
+            state.SkipWithError("benchmark did not run");
+
+        Object entry;
+        entry.push_back(Pair("name", it->first));
+        if (!state.error.empty()) {
+            entry.push_back(Pair("error", state.error));
+            nErrors++;
+        } else {
+            double average = state.Elapsed() / state.Iterations();
+            entry.push_back(Pair("iterations", state.Iterations()));
+            entry.push_back(Pair("total_s", state.Elapsed()));
+            entry.push_back(Pair("ns_per_op", average * 1e9));
+            entry.push_back(Pair("min_ns", state.MinTime() == std::numeric_limits<double>::max() ? average * 1e9 : state.MinTime() * 1e9));
+            entry.push_back(Pair("max_ns", state.MaxTime() == 0 ? average * 1e9 : state.MaxTime() * 1e9));
+        }
+        results.push_back(entry);
+    }
+    return nErrors;
+}
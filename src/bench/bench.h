@@ -0,0 +1,110 @@
+// Copyright (c) 2014-2016 The Gcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef GCOIN_BENCH_BENCH_H
+#define GCOIN_BENCH_BENCH_H
+
+#include <map>
+#include <string>
+
+#include <stdint.h>
+
+#include "json/json_spirit_value.h"
+
+#include <boost/function.hpp>
+#include <boost/preprocessor/cat.hpp>
+#include <boost/preprocessor/stringize.hpp>
+
+// Simple micro-benchmarking framework; API mostly matches a subset of the Google Benchmark
+// framework (see https://github.com/google/benchmark)
+// Why not use the Google Benchmark framework? Because adding Yet Another Dependency
+// (that uses cmake as its build system and has lots of features we don't need) isn't
+// worth it.
+
+/*
+ * Usage:
+
+static void CODE_TO_TIME(benchmark::State& state)
+{
+    ... do any setup needed...
+    while (state.KeepRunning()) {
+       ... do stuff you want to time...
+       state.PauseTiming();
+       ... per-iteration setup that should not be timed...
+       state.ResumeTiming();
+    }
+    ... do any cleanup needed...
+}
+
+BENCHMARK(CODE_TO_TIME);
+
+ */
+
+namespace benchmark {
+
+    /*!
+     * @brief   Timing state of one benchmark run.
+     *
+     * KeepRunning() is called once per iteration and samples the clock only
+     * every 2^k iterations, so the timing overhead stays negligible even for
+     * operations that take a few nanoseconds.
+     */
+    class State {
+        std::string name;
+        double maxElapsed;
+        double beginTime;
+        double lastTime, minTime, maxTime;
+        double pausedTime, pauseBegin;
+        int64_t count;
+        int64_t countMask;
+        double countMaskInv;
+    public:
+        State(const std::string& _name, double _maxElapsed);
+
+        bool KeepRunning();
+
+        //! Leave the time until ResumeTiming() out of the measurement.
+        void PauseTiming();
+        void ResumeTiming();
+
+        //! Record a failure; the runner reports it instead of the timings.
+        void SkipWithError(const std::string& strError);
+
+        int64_t Iterations() const { return count; }
+        double Elapsed() const { return lastTime - beginTime; }
+        double MinTime() const { return minTime; }
+        double MaxTime() const { return maxTime; }
+
+        std::string error;
+    };
+
+    typedef boost::function<void(State&)> BenchFunction;
+
+    class BenchRunner
+    {
+        typedef std::map<std::string, BenchFunction> BenchmarkMap;
+        static BenchmarkMap& benchmarks();
+
+    public:
+        BenchRunner(const std::string& name, BenchFunction func);
+
+        /*!
+         * @brief   Run every registered benchmark whose name contains strFilter.
+         * @param   results     Receives one JSON object per benchmark run.
+         * @param   elapsedTimeForOne   Wall clock seconds spent on each benchmark.
+         * @param   strFilter   Substring a benchmark name must contain, empty for all.
+         * @return  Number of benchmarks that reported an error.
+         */
+        static int RunAll(json_spirit::Array& results, double elapsedTimeForOne = 1.0, const std::string& strFilter = "");
+    };
+
+    //! Wall clock time in seconds, with microsecond resolution.
+    double gettimedouble();
+}
+
+// BENCHMARK(foo) expands to:  benchmark::BenchRunner bench_11foo("foo", foo);
+#define BENCHMARK(n) \
+    benchmark::BenchRunner BOOST_PP_CAT(bench_, BOOST_PP_CAT(__LINE__, n))(BOOST_PP_STRINGIZE(n), n);
+
+#endif // GCOIN_BENCH_BENCH_H
@@ -0,0 +1,61 @@
+// Copyright (c) 2014-2016 The Gcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "crypto/sha256.h"
+#include "key.h"
+#include "util.h"
+
+#include "json/json_spirit_writer_template.h"
+
+#include <iostream>
+
+#include <boost/lexical_cast.hpp>
+
+using namespace json_spirit;
+
+static const double DEFAULT_BENCH_TIME = 1.0;
+
+int main(int argc, char** argv)
+{
+    SetupEnvironment();
+    ParseParameters(argc, argv);
+    if (mapArgs.count("-?") || mapArgs.count("-h") || mapArgs.count("-help")) {
+        std::cout << "Usage: bench_gcoin [options]\n\n"
+                  << "Runs the benchmarks on a synthetic regtest chain and prints the results as JSON.\n\n"
+                  << "Options:\n"
+                  << "  -filter=<str>  Only run benchmarks whose name contains <str>\n"
+                  << "  -time=<n>      Seconds to spend on each benchmark (default: "
+                  << DEFAULT_BENCH_TIME << ")\n";
+        return 0;
+    }
+
+    std::string sha256_algo = SHA256AutoDetect();
+    ECC_Start();
+    fPrintToDebugLog = false; // don't want to write to debug.log file
+    SelectParams(CBaseChainParams::REGTEST);
+
+    double nTime = DEFAULT_BENCH_TIME;
+    try {
+        nTime = boost::lexical_cast<double>(GetArg("-time", boost::lexical_cast<std::string>(DEFAULT_BENCH_TIME)));
+    } catch (const boost::bad_lexical_cast&) {
+        std::cerr << "Error: invalid -time value\n";
+        ECC_Stop();
+        return 1;
+    }
+
+    Array results;
+    int nErrors = benchmark::BenchRunner::RunAll(results, nTime, GetArg("-filter", ""));
+
+    Object report;
+    report.push_back(Pair("sha256", sha256_algo));
+    report.push_back(Pair("time_per_benchmark", nTime));
+    report.push_back(Pair("benchmarks", results));
+    std::cout << write_string(Value(report), true) << std::endl;
+
+    ECC_Stop();
+    return nErrors == 0 ? 0 : 1;
+}
@@ -0,0 +1,129 @@
+// Copyright (c) 2014-2016 The Gcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "setup.h"
+
+#include "base58.h"
+#include "cache.h"
+#include "hash.h"
+#include "util.h"
+
+namespace {
+
+const unsigned int NUM_LICENSES = 1000;
+const unsigned int NUM_MINERS = 1000;
+
+void FillLicenses(benchmark::ChainSetup& setup, unsigned int nLicenses = NUM_LICENSES)
+{
+    for (unsigned int i = 0; i < nLicenses; i++)
+        setup.AddLicense(i + 2, strprintf("bench-license-owner-%u", i));
+}
+
+void FillMiners()
+{
+    for (unsigned int i = 0; i < NUM_MINERS; i++) {
+        std::string seed = strprintf("bench-miner-%u", i);
+        pminer->Add(CBitcoinAddress(CKeyID(Hash160(seed.begin(), seed.end()))).ToString());
+    }
+}
+
+}
+
+static void ColorLicense_WriteDisk(benchmark::State& state)
+{
+    benchmark::ChainSetup setup;
+    FillLicenses(setup);
+    while (state.KeepRunning())
+        plicense->WriteDisk(1);
+}
+
+static void ColorLicense_ReadDisk(benchmark::State& state)
+{
+    benchmark::ChainSetup setup;
+    FillLicenses(setup);
+    if (!plicense->WriteDisk(1)) {
+        state.SkipWithError("WriteDisk failed");
+        return;
+    }
+    while (state.KeepRunning())
+        plicense->ReadDisk();
+}
+
+// The color of every output of a block's worth of transactions, one in ten
+// of them without a license.
+static void ColorLicense_IsColorExist_100k(benchmark::State& state)
+{
+    const unsigned int nLicenses = 100000;
+    benchmark::ChainSetup setup;
+    FillLicenses(setup, nLicenses);
+    std::vector<type_Color> vColor;
+    for (unsigned int i = 0; i < 4000; i++) {
+        uint256 hash = Hash(BEGIN(i), END(i));
+        vColor.push_back(2 + hash.GetCheapHash() % (nLicenses + nLicenses / 9));
+    }
+    while (state.KeepRunning()) {
+        for (unsigned int i = 0; i < vColor.size(); i++)
+            plicense->IsColorExist(vColor[i]);
+    }
+}
+
+// Replaying license blocks adds the colors in no particular order.
+static void ColorLicense_SetOwner_100k(benchmark::State& state)
+{
+    const unsigned int nLicenses = 100000;
+    benchmark::ChainSetup setup;
+    std::vector<type_Color> vColor;
+    for (unsigned int i = 0; i < nLicenses; i++) {
+        uint256 hash = Hash(BEGIN(i), END(i));
+        vColor.push_back(2 + hash.GetCheapHash() % (nLicenses * 16));
+    }
+    while (state.KeepRunning()) {
+        plicense->RemoveAll();
+        for (unsigned int i = 0; i < vColor.size(); i++) {
+            if (!plicense->IsColorExist(vColor[i]))
+                setup.AddLicense(vColor[i], "bench-license-owner");
+        }
+    }
+}
+
+// Looking up the owner of colors without a license must not add them.
+static void ColorLicense_GetOwner_Unknown(benchmark::State& state)
+{
+    benchmark::ChainSetup setup;
+    FillLicenses(setup);
+    type_Color color = NUM_LICENSES + 2;
+    while (state.KeepRunning())
+        plicense->GetOwner(color++);
+    if (plicense->ListLicense().size() != NUM_LICENSES)
+        state.SkipWithError("GetOwner added colors");
+}
+
+static void Miner_WriteDisk(benchmark::State& state)
+{
+    benchmark::ChainSetup setup;
+    FillMiners();
+    while (state.KeepRunning())
+        pminer->WriteDisk(1);
+}
+
+static void Miner_ReadDisk(benchmark::State& state)
+{
+    benchmark::ChainSetup setup;
+    FillMiners();
+    if (!pminer->WriteDisk(1)) {
+        state.SkipWithError("WriteDisk failed");
+        return;
+    }
+    while (state.KeepRunning())
+        pminer->ReadDisk();
+}
+
+BENCHMARK(ColorLicense_WriteDisk);
+BENCHMARK(ColorLicense_ReadDisk);
+BENCHMARK(ColorLicense_IsColorExist_100k);
+BENCHMARK(ColorLicense_SetOwner_100k);
+BENCHMARK(ColorLicense_GetOwner_Unknown);
+BENCHMARK(Miner_WriteDisk);
+BENCHMARK(Miner_ReadDisk);
@@ -0,0 +1,239 @@
+// Copyright (c) 2014-2016 The Gcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "setup.h"
+
+#include "base58.h"
+#include "cache.h"
+#include "consensus/validation.h"
+#include "main.h"
+#include "policy/licenseinfo.h"
+#include "script/standard.h"
+
+using namespace type_transaction_handler;
+
+namespace {
+
+const type_Color BENCH_COLOR = 2;
+
+std::string AddressOf(const CKey& key)
+{
+    return CBitcoinAddress(key.GetPubKey().GetID()).ToString();
+}
+
+CScript ScriptOf(const std::string& addr)
+{
+    return GetScriptForDestination(CBitcoinAddress(addr).Get());
+}
+
+/*!
+ * A license owner with a signed transfer of the licensed color.
+ */
+struct TransferSetup : public benchmark::ChainSetup
+{
+    TransferSetup()
+    {
+        owner = MakeKey("bench-owner");
+        AddLicense(BENCH_COLOR, AddressOf(owner));
+        tx = CreateTransfer(owner, BENCH_COLOR, 10 * COIN, ScriptOf(AddressOf(MakeKey("bench-receiver"))));
+    }
+
+    CKey owner;
+    CTransaction tx;
+};
+
+/*!
+ * A transaction spending the admin color minted to a consensus address.
+ */
+CMutableTransaction AdminSpend(benchmark::ChainSetup& setup, tx_type type, const std::string& strConsensusAddr)
+{
+    CMutableTransaction mtx;
+    mtx.type = type;
+    mtx.vin.push_back(CTxIn(setup.AddCoin(ScriptOf(strConsensusAddr), DEFAULT_ADMIN_COLOR, COIN, MINT)));
+    return mtx;
+}
+
+bool CheckValid(benchmark::State& state, const CTransaction& tx, const CBlock *pblock = NULL)
+{
+    CValidationState vstate;
+    if (!GetHandler(tx.type)->CheckValid(tx, vstate, pblock)) {
+        state.SkipWithError("CheckValid rejected the fixture: " + vstate.GetRejectReason());
+        return false;
+    }
+    return true;
+}
+
+}
+
+static void CheckTxFeeAndColor_Normal(benchmark::State& state)
+{
+    TransferSetup setup;
+    if (!CheckTxFeeAndColor(setup.tx, NULL))
+        state.SkipWithError("CheckTxFeeAndColor rejected the fixture");
+    while (state.KeepRunning())
+        CheckTxFeeAndColor(setup.tx, NULL);
+}
+
+static void HandlerNormal_CheckValid(benchmark::State& state)
+{
+    TransferSetup setup;
+    if (!CheckValid(state, setup.tx))
+        return;
+    while (state.KeepRunning()) {
+        CValidationState vstate;
+        GetHandler(NORMAL)->CheckValid(setup.tx, vstate, NULL);
+    }
+}
+
+static void HandlerMint_CheckValid(benchmark::State& state)
+{
+    TransferSetup setup;
+    CMutableTransaction mtx;
+    mtx.type = MINT;
+    mtx.vin.resize(1);
+    mtx.vout.push_back(CTxOut(100 * COIN, ScriptOf(AddressOf(setup.owner)), BENCH_COLOR));
+    CTransaction tx(mtx);
+    if (!CheckValid(state, tx))
+        return;
+    while (state.KeepRunning()) {
+        CValidationState vstate;
+        GetHandler(MINT)->CheckValid(tx, vstate, NULL);
+    }
+}
+
+// A block's worth of admin color mints, alternating between the license and
+// the miner consensus address.
+static void HandlerMint_CheckValid_AdminBlock(benchmark::State& state)
+{
+    benchmark::ChainSetup setup;
+    std::vector<CTransaction> vtx;
+    for (unsigned int i = 0; i < 1000; i++) {
+        CMutableTransaction mtx;
+        mtx.type = MINT;
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout.n = i;
+        mtx.vout.push_back(CTxOut(COIN, ScriptOf(i % 2 ? ConsensusAddressForMiner : ConsensusAddressForLicense), DEFAULT_ADMIN_COLOR));
+        vtx.push_back(CTransaction(mtx));
+        if (!CheckValid(state, vtx.back()))
+            return;
+    }
+    HandlerInterface *handler = GetHandler(MINT);
+    while (state.KeepRunning()) {
+        for (unsigned int i = 0; i < vtx.size(); i++) {
+            CValidationState vstate;
+            handler->CheckValid(vtx[i], vstate, NULL);
+        }
+    }
+}
+
+static void HandlerMint_ApplyUndo(benchmark::State& state)
+{
+    TransferSetup setup;
+    CMutableTransaction mtx;
+    mtx.type = MINT;
+    mtx.vin.resize(1);
+    mtx.vout.push_back(CTxOut(100 * COIN, ScriptOf(AddressOf(setup.owner)), BENCH_COLOR));
+    CTransaction tx(mtx);
+    HandlerInterface *handler = GetHandler(MINT);
+    while (state.KeepRunning()) {
+        handler->Apply(tx, NULL);
+        handler->Undo(tx, NULL);
+    }
+}
+
+static void HandlerLicense_CheckValid(benchmark::State& state)
+{
+    benchmark::ChainSetup setup;
+    CLicenseInfo info;
+    info.name = "bench";
+    info.issuer = "bench";
+    std::string strInfo = info.EncodeInfo();
+
+    // New license: admin color input from the license consensus address,
+    // license info carried in the OP_RETURN output.
+    CMutableTransaction mtx = AdminSpend(setup, LICENSE, ConsensusAddressForLicense);
+    mtx.vout.push_back(CTxOut(COIN, ScriptOf(AddressOf(setup.MakeKey("bench-issuer"))), BENCH_COLOR));
+    mtx.vout.push_back(CTxOut(0, CScript() << OP_RETURN << std::vector<unsigned char>(strInfo.begin(), strInfo.end()), BENCH_COLOR));
+    CTransaction tx(mtx);
+    if (!CheckValid(state, tx))
+        return;
+    while (state.KeepRunning()) {
+        CValidationState vstate;
+        GetHandler(LICENSE)->CheckValid(tx, vstate, NULL);
+    }
+}
+
+static void HandlerLicense_Apply(benchmark::State& state)
+{
+    TransferSetup setup;
+    // Transfer of an existing license back to its owner; applying it is
+    // idempotent so every iteration does the same work.
+    CMutableTransaction mtx;
+    mtx.type = LICENSE;
+    mtx.vin.resize(1);
+    mtx.vout.push_back(CTxOut(COIN, ScriptOf(AddressOf(setup.owner)), BENCH_COLOR));
+    CTransaction tx(mtx);
+    HandlerInterface *handler = GetHandler(LICENSE);
+    if (!handler->Apply(tx, NULL))
+        state.SkipWithError("LICENSE Apply rejected the fixture");
+    while (state.KeepRunning())
+        handler->Apply(tx, NULL);
+}
+
+static void HandlerVote_CheckValidApply(benchmark::State& state)
+{
+    benchmark::ChainSetup setup;
+    if (!CheckValid(state, setup.txAlliance))
+        return;
+    // Re-applying the alliance vote keeps the alliance unchanged but redoes
+    // the redeem script parsing and consensus address derivation.
+    HandlerInterface *handler = GetHandler(VOTE);
+    while (state.KeepRunning()) {
+        CValidationState vstate;
+        handler->CheckValid(setup.txAlliance, vstate, NULL);
+        handler->Apply(setup.txAlliance, NULL);
+    }
+}
+
+static void HandlerMiner_CheckValid(benchmark::State& state)
+{
+    benchmark::ChainSetup setup;
+    CMutableTransaction mtx = AdminSpend(setup, MINER, ConsensusAddressForMiner);
+    mtx.vout.push_back(CTxOut(COIN, ScriptOf(AddressOf(setup.MakeKey("bench-miner"))), DEFAULT_ADMIN_COLOR));
+    CTransaction tx(mtx);
+    if (!CheckValid(state, tx))
+        return;
+    while (state.KeepRunning()) {
+        CValidationState vstate;
+        GetHandler(MINER)->CheckValid(tx, vstate, NULL);
+    }
+}
+
+static void HandlerMinerDeminer_Apply(benchmark::State& state)
+{
+    benchmark::ChainSetup setup;
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vout.push_back(CTxOut(COIN, ScriptOf(AddressOf(setup.MakeKey("bench-miner"))), DEFAULT_ADMIN_COLOR));
+    mtx.type = MINER;
+    CTransaction txMiner(mtx);
+    mtx.type = DEMINER;
+    CTransaction txDeminer(mtx);
+    while (state.KeepRunning()) {
+        GetHandler(MINER)->Apply(txMiner, NULL);
+        GetHandler(DEMINER)->Apply(txDeminer, NULL);
+    }
+}
+
+BENCHMARK(CheckTxFeeAndColor_Normal);
+BENCHMARK(HandlerNormal_CheckValid);
+BENCHMARK(HandlerMint_CheckValid);
+BENCHMARK(HandlerMint_CheckValid_AdminBlock);
+BENCHMARK(HandlerMint_ApplyUndo);
+BENCHMARK(HandlerLicense_CheckValid);
+BENCHMARK(HandlerLicense_Apply);
+BENCHMARK(HandlerVote_CheckValidApply);
+BENCHMARK(HandlerMiner_CheckValid);
+BENCHMARK(HandlerMinerDeminer_Apply);
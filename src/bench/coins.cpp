@@ -0,0 +1,68 @@
+// Copyright (c) 2014-2016 The Gcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "setup.h"
+
+#include "base58.h"
+#include "coins.h"
+#include "main.h"
+#include "script/standard.h"
+#include "util.h"
+
+#include <vector>
+
+namespace {
+
+const unsigned int NUM_ADDRESSES = 20;
+const unsigned int NUM_COINS = 2000;
+const unsigned int NUM_CACHED_COINS = 100;
+const unsigned int NUM_FLUSH_COINS = 1000;
+
+}
+
+// Address lookup over a coins database of NUM_COINS outputs spread over
+// NUM_ADDRESSES addresses, the last NUM_CACHED_COINS still unflushed.
+static void GetAddrCoins(benchmark::State& state)
+{
+    benchmark::ChainSetup setup;
+    std::vector<CScript> scripts;
+    for (unsigned int i = 0; i < NUM_ADDRESSES; i++)
+        scripts.push_back(GetScriptForDestination(setup.MakeKey(strprintf("bench-addr-%u", i)).GetPubKey().GetID()));
+
+    for (unsigned int i = 0; i < NUM_COINS; i++) {
+        if (i == NUM_COINS - NUM_CACHED_COINS)
+            pcoinsTip->Flush();
+        setup.AddCoin(scripts[i % NUM_ADDRESSES], TxFee.GetColor(), COIN);
+    }
+
+    std::string addr = GetDestination(scripts[0]);
+    CTxOutMap mapTxOut;
+    pcoinsTip->GetAddrCoins(addr, mapTxOut, false);
+    if (mapTxOut.size() != NUM_COINS / NUM_ADDRESSES)
+        state.SkipWithError(strprintf("GetAddrCoins found %u coins", mapTxOut.size()));
+
+    while (state.KeepRunning()) {
+        mapTxOut.clear();
+        pcoinsTip->GetAddrCoins(addr, mapTxOut, false);
+    }
+}
+
+// Writes NUM_FLUSH_COINS fresh coins from the tip cache to the database.
+// Only the flush is timed, not crediting the coins.
+static void CoinsViewCache_Flush(benchmark::State& state)
+{
+    benchmark::ChainSetup setup;
+    CScript script = GetScriptForDestination(setup.MakeKey("bench-flush").GetPubKey().GetID());
+    while (state.KeepRunning()) {
+        state.PauseTiming();
+        for (unsigned int i = 0; i < NUM_FLUSH_COINS; i++)
+            setup.AddCoin(script, TxFee.GetColor(), COIN);
+        state.ResumeTiming();
+        pcoinsTip->Flush();
+    }
+}
+
+BENCHMARK(GetAddrCoins);
+BENCHMARK(CoinsViewCache_Flush);
@@ -0,0 +1,63 @@
+// Copyright (c) 2014-2016 The Gcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "crypto/sha256.h"
+#include "hash.h"
+#include "primitives/block.h"
+
+#include <vector>
+
+/* Number of bytes to hash per iteration */
+static const uint64_t BUFFER_SIZE = 1000*1000;
+
+static void SHA256_1MB(benchmark::State& state)
+{
+    uint8_t hash[CSHA256::OUTPUT_SIZE];
+    std::vector<uint8_t> in(BUFFER_SIZE,0);
+    while (state.KeepRunning())
+        CSHA256().Write(begin_ptr(in), in.size()).Finalize(hash);
+}
+
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0);
+    std::vector<uint8_t> out(32 * 1024);
+    while (state.KeepRunning())
+        SHA256D64(begin_ptr(out), begin_ptr(in), 1024);
+}
+
+// Merkle root of a 2000 transaction block, from scratch and after the
+// coinbase changed as the miner does on every extra nonce.
+static CBlock MerkleBlock()
+{
+    CBlock block;
+    for (unsigned int i = 0; i < 2000; i++) {
+        CMutableTransaction mtx;
+        mtx.nLockTime = i;
+        block.vtx.push_back(CTransaction(mtx));
+    }
+    return block;
+}
+
+static void MerkleRoot_Build(benchmark::State& state)
+{
+    CBlock block = MerkleBlock();
+    while (state.KeepRunning())
+        block.BuildMerkleTree();
+}
+
+static void MerkleRoot_UpdateLeaf(benchmark::State& state)
+{
+    CBlock block = MerkleBlock();
+    block.BuildMerkleTree();
+    while (state.KeepRunning())
+        block.UpdateMerkleLeaf(0);
+}
+
+BENCHMARK(SHA256_1MB);
+BENCHMARK(SHA256D64_1024);
+BENCHMARK(MerkleRoot_Build);
+BENCHMARK(MerkleRoot_UpdateLeaf);
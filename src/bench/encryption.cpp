@@ -0,0 +1,97 @@
+// Copyright (c) 2014-2016 The Gcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "setup.h"
+
+#include "main.h"
+#include "primitives/transaction.h"
+#include "script/standard.h"
+#include "util.h"
+
+#include <vector>
+
+namespace {
+
+/*!
+ * A signed transfer and nRecipients keys it can be encrypted to.
+ */
+struct EncryptionSetup : public benchmark::ChainSetup
+{
+    EncryptionSetup(unsigned int nRecipients)
+    {
+        CKey owner = MakeKey("bench-owner");
+        tx = CreateTransfer(owner, TxFee.GetColor(), 10 * COIN,
+                            GetScriptForDestination(MakeKey("bench-receiver").GetPubKey().GetID()));
+        for (unsigned int i = 0; i < nRecipients; i++) {
+            keys.push_back(MakeKey(strprintf("bench-recipient-%u", i)));
+            pubkeys.push_back(keys.back().GetPubKey());
+        }
+    }
+
+    CTransaction tx;
+    std::vector<CKey> keys;
+    std::vector<CPubKey> pubkeys;
+};
+
+void EncryptTx(benchmark::State& state, unsigned int nRecipients)
+{
+    EncryptionSetup setup(nRecipients);
+    CMutableTransaction mtx(setup.tx);
+    while (state.KeepRunning()) {
+        // Encrypt() is a no-op on an already encrypted transaction.
+        CMutableTransaction mtxCopy(mtx);
+        mtxCopy.Encrypt(setup.pubkeys);
+    }
+}
+
+void DecryptTx(benchmark::State& state, unsigned int nRecipients)
+{
+    EncryptionSetup setup(nRecipients);
+    CMutableTransaction mtx(setup.tx);
+    if (!mtx.Encrypt(setup.pubkeys)) {
+        state.SkipWithError("Encrypt failed");
+        return;
+    }
+    const CTransaction txEncrypted(mtx);
+    const CKey& key = setup.keys.back();
+    unsigned int index = setup.keys.size() - 1;
+
+    CTransaction txCheck(txEncrypted);
+    if (!txCheck.Decrypt(index, key) || txCheck.vout != setup.tx.vout) {
+        state.SkipWithError("Decrypt did not recover the transaction");
+        return;
+    }
+    while (state.KeepRunning()) {
+        CTransaction tx(txEncrypted);
+        tx.Decrypt(index, key);
+    }
+}
+
+}
+
+static void EncryptTx_1Recipient(benchmark::State& state)
+{
+    EncryptTx(state, 1);
+}
+
+static void EncryptTx_3Recipients(benchmark::State& state)
+{
+    EncryptTx(state, 3);
+}
+
+static void DecryptTx_1Recipient(benchmark::State& state)
+{
+    DecryptTx(state, 1);
+}
+
+static void DecryptTx_3Recipients(benchmark::State& state)
+{
+    DecryptTx(state, 3);
+}
+
+BENCHMARK(EncryptTx_1Recipient);
+BENCHMARK(EncryptTx_3Recipients);
+BENCHMARK(DecryptTx_1Recipient);
+BENCHMARK(DecryptTx_3Recipients);
@@ -0,0 +1,142 @@
+// Copyright (c) 2014-2016 The Gcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "consensus/validation.h"
+#include "main.h"
+#include "txmempool.h"
+
+#include <list>
+
+namespace {
+
+// One in LICENSE_INTERVAL pool entries is a license transaction.
+const unsigned int LICENSE_INTERVAL = 100;
+
+// A one input, one output transaction spending a synthetic outpoint. Transfer
+// fees grow with n so the fee rate index is not degenerate; the special types
+// pay no fee, as on the network, and sit at the bottom of it.
+CTxMemPoolEntry PoolEntry(unsigned int n, tx_type type = NORMAL)
+{
+    CMutableTransaction mtx;
+    mtx.type = type;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout.hash = Hash(BEGIN(n), END(n));
+    mtx.vin[0].prevout.n = 0;
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = COIN;
+    mtx.vout[0].color = type == LICENSE ? 1000 + n : 2;
+    mtx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    return CTxMemPoolEntry(mtx, type == NORMAL ? n : 0, n, 0.0, 1);
+}
+
+void FillPool(CTxMemPool& pool, unsigned int nEntries)
+{
+    for (unsigned int i = 0; i < nEntries; i++) {
+        CTxMemPoolEntry entry = PoolEntry(i, i % LICENSE_INTERVAL ? NORMAL : LICENSE);
+        pool.addUnchecked(entry.GetTx().GetHash(), entry);
+    }
+}
+
+// Add and remove one transaction on a pool of nEntries.
+void AddRemove(benchmark::State& state, unsigned int nEntries)
+{
+    CTxMemPool pool(CFeeRate(0));
+    FillPool(pool, nEntries);
+    CTxMemPoolEntry entry = PoolEntry(nEntries);
+    const uint256 hash = entry.GetTx().GetHash();
+    while (state.KeepRunning()) {
+        std::list<CTransaction> removed;
+        pool.addUnchecked(hash, entry);
+        pool.remove(entry.GetTx(), removed);
+    }
+}
+
+// Add one better paying transaction and trim the pool back to its size,
+// evicting the cheapest entry.
+void TrimToSize(benchmark::State& state, unsigned int nEntries)
+{
+    CTxMemPool pool(CFeeRate(0));
+    FillPool(pool, nEntries);
+    const size_t nLimit = pool.DynamicMemoryUsage();
+    unsigned int n = nEntries;
+    while (state.KeepRunning()) {
+        CTxMemPoolEntry entry = PoolEntry(n++);
+        pool.addUnchecked(entry.GetTx().GetHash(), entry);
+        pool.TrimToSize(nLimit);
+    }
+    if (pool.size() >= nEntries + 1)
+        state.SkipWithError("TrimToSize did not evict");
+}
+
+// Check a new license against the licenses already in the pool.
+void CheckRepeatedType(benchmark::State& state, unsigned int nEntries)
+{
+    CTxMemPool pool(CFeeRate(0));
+    FillPool(pool, nEntries);
+    CTransaction tx = PoolEntry(nEntries, LICENSE).GetTx();
+    while (state.KeepRunning()) {
+        CValidationState vstate;
+        if (!CheckRepeatedTypeTransactionInPool(pool, vstate, tx))
+            state.SkipWithError("CheckRepeatedTypeTransactionInPool rejected the fixture");
+    }
+}
+
+}
+
+static void Mempool_AddRemove_10k(benchmark::State& state)
+{
+    AddRemove(state, 10000);
+}
+
+static void Mempool_AddRemove_100k(benchmark::State& state)
+{
+    AddRemove(state, 100000);
+}
+
+static void Mempool_AddRemove_1M(benchmark::State& state)
+{
+    AddRemove(state, 1000000);
+}
+
+static void Mempool_TrimToSize_10k(benchmark::State& state)
+{
+    TrimToSize(state, 10000);
+}
+
+static void Mempool_TrimToSize_100k(benchmark::State& state)
+{
+    TrimToSize(state, 100000);
+}
+
+static void Mempool_TrimToSize_1M(benchmark::State& state)
+{
+    TrimToSize(state, 1000000);
+}
+
+static void Mempool_CheckRepeatedType_10k(benchmark::State& state)
+{
+    CheckRepeatedType(state, 10000);
+}
+
+static void Mempool_CheckRepeatedType_100k(benchmark::State& state)
+{
+    CheckRepeatedType(state, 100000);
+}
+
+static void Mempool_CheckRepeatedType_1M(benchmark::State& state)
+{
+    CheckRepeatedType(state, 1000000);
+}
+
+BENCHMARK(Mempool_AddRemove_10k);
+BENCHMARK(Mempool_AddRemove_100k);
+BENCHMARK(Mempool_AddRemove_1M);
+BENCHMARK(Mempool_TrimToSize_10k);
+BENCHMARK(Mempool_TrimToSize_100k);
+BENCHMARK(Mempool_TrimToSize_1M);
+BENCHMARK(Mempool_CheckRepeatedType_10k);
+BENCHMARK(Mempool_CheckRepeatedType_100k);
+BENCHMARK(Mempool_CheckRepeatedType_1M);
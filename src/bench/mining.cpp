@@ -0,0 +1,78 @@
+// Copyright (c) 2014-2016 The Gcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "setup.h"
+
+#include "base58.h"
+#include "cache.h"
+#include "chainparams.h"
+#include "main.h"
+#include "miner.h"
+#include "script/standard.h"
+#include "txmempool.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <boost/scoped_ptr.hpp>
+
+namespace {
+
+const type_Color BENCH_COLOR = 2;
+
+// Block template assembly over a mempool of nTx independent transfers. Every
+// transfer has its inputs script-checked, so this is dominated by
+// CheckInputs and the final TestBlockValidity.
+void CreateNewBlockWithPool(benchmark::State& state, unsigned int nTx)
+{
+    benchmark::ChainSetup setup;
+    CKey owner = setup.MakeKey("bench-owner");
+    setup.AddLicense(BENCH_COLOR, CBitcoinAddress(owner.GetPubKey().GetID()).ToString());
+
+    CKey minerKey = setup.MakeKey("bench-miner");
+    CScript scriptMiner = GetScriptForDestination(minerKey.GetPubKey().GetID());
+    pminer->Add(CBitcoinAddress(minerKey.GetPubKey().GetID()).ToString());
+
+    CScript scriptTo = GetScriptForDestination(setup.MakeKey("bench-receiver").GetPubKey().GetID());
+    for (unsigned int i = 0; i < nTx; i++) {
+        CTransaction tx = setup.CreateTransfer(owner, BENCH_COLOR, COIN + i, scriptTo);
+        mempool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, TxFee.GetFee(), GetTime(), 0, chainActive.Height()));
+    }
+
+    boost::scoped_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(scriptMiner));
+    if (!pblocktemplate || pblocktemplate->block.vtx.size() != nTx + 1) {
+        state.SkipWithError("CreateNewBlock did not include the whole mempool");
+        return;
+    }
+    while (state.KeepRunning())
+        pblocktemplate.reset(CreateNewBlock(scriptMiner));
+}
+
+}
+
+static void CreateNewBlock_100(benchmark::State& state)
+{
+    CreateNewBlockWithPool(state, 100);
+}
+
+static void CreateNewBlock_1000(benchmark::State& state)
+{
+    CreateNewBlockWithPool(state, 1000);
+}
+
+// One ScanHash call over the regtest genesis header: up to 4096 nonces
+// double-SHA256'd from a shared midstate.
+static void Miner_ScanHash(benchmark::State& state)
+{
+    CBlockHeader header = Params().GenesisBlock().GetBlockHeader();
+    uint256 hash;
+    while (state.KeepRunning()) {
+        uint32_t nNonce = 0;
+        ScanHash(&header, nNonce, &hash);
+    }
+}
+
+BENCHMARK(CreateNewBlock_100);
+BENCHMARK(CreateNewBlock_1000);
+BENCHMARK(Miner_ScanHash);
@@ -0,0 +1,138 @@
+// Copyright (c) 2014-2016 The Gcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "setup.h"
+
+#include "arith_uint256.h"
+#include "cache.h"
+#include "chainparams.h"
+#include "hash.h"
+#include "main.h"
+#include "policy/licenseinfo.h"
+#include "random.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "txdb.h"
+#include "util.h"
+#include "utilstrencodings.h"
+
+#include <math.h>
+
+#include <stdexcept>
+
+namespace benchmark {
+
+ChainSetup::ChainSetup() : nFunding(0)
+{
+    ClearDatadirCache();
+    pathTemp = GetTempPath() / strprintf("bench_gcoin_%lu_%i", (unsigned long)GetTime(), (int)(GetRand(100000)));
+    boost::filesystem::create_directories(pathTemp);
+    mapArgs["-datadir"] = pathTemp.string();
+
+    palliance = new alliance_member::AllianceMember();
+    plicense = new color_license::ColorLicense();
+    pblkminer = new block_miner::BlockMiner();
+    pminer = new miner::Miner();
+
+    pblocktree = new CBlockTreeDB(1 << 20, true);
+    pcoinsdbview = new CCoinsViewDB(1 << 23, true);
+    pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+    pcoinsDBView = pcoinsdbview;
+    if (!InitBlockIndex())
+        throw std::runtime_error("ChainSetup: InitBlockIndex failed");
+
+    std::vector<std::string> vAlliance;
+    for (unsigned int i = 0; i < 3; i++)
+        vAlliance.push_back(HexStr(MakeKey(strprintf("bench-alliance-%u", i)).GetPubKey()));
+    CMutableTransaction txVote;
+    txVote.type = VOTE;
+    txVote.vin.resize(1);
+    txVote.vout.push_back(CTxOut(COIN, _createmultisig_redeemScript(ceil(vAlliance.size() * Params().AllianceThreshold()), vAlliance), DEFAULT_ADMIN_COLOR));
+    txAlliance = CTransaction(txVote);
+    if (!type_transaction_handler::GetHandler(VOTE)->Apply(txAlliance, NULL))
+        throw std::runtime_error("ChainSetup: alliance vote failed");
+}
+
+ChainSetup::~ChainSetup()
+{
+    mempool.clear();
+    UnloadBlockIndex();
+    delete pcoinsTip;
+    pcoinsDBView = NULL;
+    delete pcoinsdbview;
+    delete pblocktree;
+    pcoinsTip = NULL;
+    pblocktree = NULL;
+
+    delete palliance;
+    delete plicense;
+    delete pblkminer;
+    delete pminer;
+    palliance = NULL;
+    plicense = NULL;
+    pblkminer = NULL;
+    pminer = NULL;
+    SetConsensusAddresses(CScriptID(), CScriptID());
+
+    boost::filesystem::remove_all(pathTemp);
+    mapArgs.erase("-datadir");
+    ClearDatadirCache();
+}
+
+CKey ChainSetup::MakeKey(const std::string& seed)
+{
+    uint256 secret = Hash(seed.begin(), seed.end());
+    CKey key;
+    key.Set(secret.begin(), secret.end(), true);
+    if (!key.IsValid())
+        throw std::runtime_error("ChainSetup: invalid key for seed " + seed);
+    keystore.AddKey(key);
+    return key;
+}
+
+COutPoint ChainSetup::AddCoin(const CScript& scriptPubKey, type_Color color, CAmount nValue, tx_type type)
+{
+    // The funding transaction only needs to be unique and not a coinbase;
+    // its input is never looked up.
+    CMutableTransaction txFund;
+    txFund.type = type;
+    txFund.vin.resize(1);
+    txFund.vin[0].prevout = COutPoint(ArithToUint256(arith_uint256(++nFunding)), 0);
+    txFund.vout.push_back(CTxOut(nValue, scriptPubKey, color));
+
+    CTransaction tx(txFund);
+    pcoinsTip->ModifyCoins(tx.GetHash())->FromTx(tx, chainActive.Height());
+    return COutPoint(tx.GetHash(), 0);
+}
+
+void ChainSetup::AddLicense(type_Color color, const std::string& addr)
+{
+    CLicenseInfo info;
+    info.name = strprintf("bench%u", color);
+    info.issuer = "bench";
+    if (!plicense->SetOwner(color, addr, &info))
+        throw std::runtime_error(strprintf("ChainSetup: license %u already exists", color));
+}
+
+CTransaction ChainSetup::CreateTransfer(const CKey& key, type_Color color, CAmount nValue, const CScript& scriptTo)
+{
+    CScript scriptFrom = GetScriptForDestination(key.GetPubKey().GetID());
+
+    CMutableTransaction mtx;
+    mtx.type = NORMAL;
+    if (color == TxFee.GetColor()) {
+        mtx.vin.push_back(CTxIn(AddCoin(scriptFrom, color, nValue + TxFee.GetFee())));
+    } else {
+        mtx.vin.push_back(CTxIn(AddCoin(scriptFrom, color, nValue)));
+        mtx.vin.push_back(CTxIn(AddCoin(scriptFrom, TxFee.GetColor(), TxFee.GetFee())));
+    }
+    mtx.vout.push_back(CTxOut(nValue, scriptTo, color));
+
+    for (unsigned int i = 0; i < mtx.vin.size(); i++)
+        if (!SignSignature(keystore, scriptFrom, mtx, i))
+            throw std::runtime_error("ChainSetup: signing transfer failed");
+    return CTransaction(mtx);
+}
+
+}
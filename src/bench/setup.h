@@ -0,0 +1,73 @@
+// Copyright (c) 2014-2016 The Gcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef GCOIN_BENCH_SETUP_H
+#define GCOIN_BENCH_SETUP_H
+
+#include "amount.h"
+#include "key.h"
+#include "keystore.h"
+#include "primitives/transaction.h"
+#include "script/script.h"
+
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+class CCoinsViewDB;
+
+namespace benchmark {
+
+/*!
+ * @brief   A synthetic regtest chain in a temporary data directory.
+ *
+ * Sets up the block tree, the coins database and the alliance, license and
+ * miner caches the same way the node does and connects the regtest genesis
+ * block. A three member alliance is then voted in with txAlliance so the
+ * consensus addresses for licenses and miners are set. Everything is torn
+ * down and the data directory removed on destruction.
+ */
+struct ChainSetup
+{
+    ChainSetup();
+    ~ChainSetup();
+
+    /*!
+     * @brief   Deterministic key derived from a seed string.
+     */
+    CKey MakeKey(const std::string& seed);
+
+    /*!
+     * @brief   Credit a synthetic unspent output to the coins view.
+     * @param   scriptPubKey    The script the output pays to.
+     * @param   color           The color of the output.
+     * @param   nValue          The value of the output.
+     * @param   type            Type of the funding transaction.
+     * @return  The outpoint of the new coin.
+     */
+    COutPoint AddCoin(const CScript& scriptPubKey, type_Color color, CAmount nValue, tx_type type = NORMAL);
+
+    /*!
+     * @brief   Grant the license of a color to an address.
+     */
+    void AddLicense(type_Color color, const std::string& addr);
+
+    /*!
+     * @brief   Build a signed NORMAL transaction moving nValue of color to
+     *          scriptTo, paying the transaction fee from the same key.
+     */
+    CTransaction CreateTransfer(const CKey& key, type_Color color, CAmount nValue, const CScript& scriptTo);
+
+    CBasicKeyStore keystore;
+    CTransaction txAlliance;
+    CCoinsViewDB *pcoinsdbview;
+    boost::filesystem::path pathTemp;
+
+private:
+    unsigned int nFunding;
+};
+
+}
+
+#endif // GCOIN_BENCH_SETUP_H
@@ -8,6 +8,8 @@
 #include "util.h"
 #include "utilerror.h"
 
+#include <iterator>
+
 using std::set;
 using std::string;
 using std::map;
@@ -20,63 +22,176 @@ alliance_member::AllianceMember *palliance = NULL;
 color_license::ColorLicense *plicense = NULL;
 block_miner::BlockMiner *pblkminer = NULL;
 miner::Miner *pminer = NULL;
+boost::shared_mutex cs_cacheApply;
 
 // Namespace for cache of license structure.
 namespace color_license
 {
 
+namespace
+{
+bool ColorLess(const Te_t &entry, const type_Color &color)
+{
+    return entry.first < color;
+}
+
+// Orders the vector entries and the added ones alike, without converting.
+struct ColorPairLess
+{
+    template <typename A, typename B>
+    bool operator()(const A &a, const B &b) const
+    {
+        return a.first < b.first;
+    }
+};
+
+const size_t MIN_ADDED_LICENSES = 64;
+}
+
+const Owner_ *ColorLicense::Find(const type_Color &color) const
+{
+    Tc_t::const_iterator it = std::lower_bound(pcontainer_->begin(), pcontainer_->end(), color, ColorLess);
+    if (it != pcontainer_->end() && it->first == color)
+        return &it->second;
+    map<type_Color, Owner_>::const_iterator itAdded = added_.find(color);
+    if (itAdded != added_.end())
+        return &itAdded->second;
+    return NULL;
+}
+
+Owner_ *ColorLicense::Find(const type_Color &color)
+{
+    return const_cast<Owner_ *>(static_cast<const ColorLicense *>(this)->Find(color));
+}
+
+Owner_ &ColorLicense::FindOrAdd(const type_Color &color)
+{
+    Owner_ *powner = Find(color);
+    if (powner)
+        return *powner;
+    if (added_.size() >= std::max(MIN_ADDED_LICENSES, pcontainer_->size() / 8))
+        MergeAdded();
+    return added_[color];
+}
+
+void ColorLicense::MergeAdded()
+{
+    if (added_.empty())
+        return;
+    size_t nSorted = pcontainer_->size();
+    pcontainer_->reserve(nSorted + added_.size());
+    for (map<type_Color, Owner_>::iterator it = added_.begin(); it != added_.end(); it++)
+        pcontainer_->push_back(make_pair(it->first, Owner_()));
+    Tc_t::iterator itNew = pcontainer_->begin() + nSorted;
+    for (map<type_Color, Owner_>::iterator it = added_.begin(); it != added_.end(); it++, itNew++)
+        std::swap(itNew->second, it->second);
+    added_.clear();
+    std::inplace_merge(pcontainer_->begin(), pcontainer_->begin() + nSorted, pcontainer_->end(), ColorPairLess());
+}
+
+Tc_t ColorLicense::Snapshot() const
+{
+    ReadLock lock(cs_cache_);
+    Tc_t container;
+    container.reserve(pcontainer_->size() + added_.size());
+    std::merge(pcontainer_->begin(), pcontainer_->end(), added_.begin(), added_.end(),
+               std::back_inserter(container), ColorPairLess());
+    return container;
+}
+
+bool ColorLicense::WriteDisk(const int height)
+{
+    {
+        WriteLock lock(cs_cache_);
+        MergeAdded();
+    }
+    return CacheInterface<Tc_t, Te_t>::WriteDisk(height);
+}
+
+bool ColorLicense::RemoveColor(const type_Color &color)
+{
+    WriteLock lock(cs_cache_);
+    if (added_.erase(color))
+        return true;
+    Tc_t::iterator it = std::lower_bound(pcontainer_->begin(), pcontainer_->end(), color, ColorLess);
+    if (it != pcontainer_->end() && it->first == color)
+        pcontainer_->erase(it);
+    return true;
+}
+
 bool ColorLicense::SetOwner(const type_Color &color, const string addr, const CLicenseInfo *pinfo)
 {
     // If the owner is assigned for the first time, license info should be assigned at the same time.
     // If the license already exists, license info should not be assigned.
-    if (IsColorExist(color)) {
+    WriteLock lock(cs_cache_);
+    if (color == DEFAULT_ADMIN_COLOR || Find(color)) {
         if (pinfo)
             return false;
     } else {
         if (pinfo)
-            (*pcontainer_)[color].info_ = *pinfo;
+            FindOrAdd(color).info_ = *pinfo;
         else
             return false;
     }
-    (*pcontainer_)[color].address_ = addr;
+    FindOrAdd(color).address_ = addr;
     return true;
 }
 
 string ColorLicense::GetOwner(const type_Color &color) const
 {
-    return (*pcontainer_)[color].address_;
+    ReadLock lock(cs_cache_);
+    const Owner_ *powner = Find(color);
+    return powner ? powner->address_ : "";
 }
 
 bool ColorLicense::IsColorExist(const type_Color &color) const
 {
     if (color == DEFAULT_ADMIN_COLOR)
         return true;
-    return (pcontainer_->find(color) != pcontainer_->end());
+    ReadLock lock(cs_cache_);
+    return Find(color) != NULL;
 }
 
 int64_t ColorLicense::NumOfCoins(const type_Color &color) const
 {
-    Tc_t::iterator it = pcontainer_->find(color);
-    if (it == pcontainer_->end()) {
+    ReadLock lock(cs_cache_);
+    const Owner_ *powner = Find(color);
+    if (!powner) {
         return 0;
     }
-    return it->second.num_of_coins_;
+    return powner->num_of_coins_;
 }
 
 map<type_Color, pair<string, int64_t> > ColorLicense::ListLicense() const
 {
     map<type_Color, pair<string, int64_t> > list;
+    ReadLock lock(cs_cache_);
     for (Tc_t::const_iterator it = pcontainer_->begin(); it != pcontainer_->end(); it++) {
         list[it->first] = make_pair(it->second.address_, it->second.num_of_coins_);
     }
+    for (map<type_Color, Owner_>::const_iterator it = added_.begin(); it != added_.end(); it++) {
+        list[it->first] = make_pair(it->second.address_, it->second.num_of_coins_);
+    }
     return list;
 }
 
 bool ColorLicense::GetLicenseInfo(const type_Color &color, CLicenseInfo &info) const
 {
-    Tc_t::iterator it = pcontainer_->find(color);
-    if (it != pcontainer_->end()) {
-        info = it->second.info_;
+    ReadLock lock(cs_cache_);
+    const Owner_ *powner = Find(color);
+    if (powner) {
+        info = powner->info_;
+        return true;
+    } else
+        return false;
+}
+
+bool ColorLicense::GetEntry(const type_Color &color, Owner_ &owner) const
+{
+    ReadLock lock(cs_cache_);
+    const Owner_ *powner = Find(color);
+    if (powner) {
+        owner = *powner;
         return true;
     } else
         return false;
@@ -89,14 +204,17 @@ namespace block_miner
 {
 bool BlockMiner::Add(const string &addr)
 {
+    unsigned int nMiners = pminer->NumOfMiners();
+    WriteLock lock(cs_cache_);
     while (pcontainer_->size() >= 100) pcontainer_->pop_back();
-    pcontainer_->push_front(make_pair(addr, pminer->NumOfMiners()));
+    pcontainer_->push_front(make_pair(addr, nMiners));
     return true;
 }
 
 unsigned int BlockMiner::NumOfMined(string addr, unsigned int nAlliance) const
 {
     unsigned int count = 1, nSameMiner = 0;
+    ReadLock lock(cs_cache_);
     for (list<pair<string, unsigned int> >::iterator it = pcontainer_->begin();
          count <= Params().DynamicMiner() && count < nAlliance && it != pcontainer_->end(); it++) {
         if (it->first == addr) nSameMiner++;
@@ -24,12 +24,20 @@
 
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/shared_mutex.hpp>
 #include <boost/unordered_map.hpp>
 
 class TxInfo;
 
 /*!
  * @brief The interface for all kinds of cache.
+ *
+ * The caches are only modified while connecting or disconnecting blocks
+ * with cs_main and cs_cacheApply held. Every access also takes the cache's
+ * own shared mutex, so queries and Snapshot() are safe without cs_main and
+ * don't block one another. Hold cs_cacheApply shared to read more than one
+ * of them as of the same block.
  */
 template <class Tc, class Te>
 class CacheInterface
@@ -79,6 +87,7 @@ public:
      */
     int BackupHeight() const
     {
+        ReadLock lock(cs_cache_);
         return backupheight_;
     }
 
@@ -94,13 +103,16 @@ public:
         unsigned short randv = 0;
         GetRandBytes((unsigned char*)&randv, sizeof(randv));
         std::string tmpfn = strprintf("%s.%04x", filename_, randv);
-        backupheight_ = height;
 
         // serialize addresses, checksum data up to that point, then append csum
         CDataStream ssPeers(SER_DISK, CLIENT_VERSION);
-        ssPeers << FLATDATA(Params().MessageStart());
-        ssPeers << backupheight_;
-        ssPeers << *pcontainer_;
+        {
+            WriteLock lock(cs_cache_);
+            backupheight_ = height;
+            ssPeers << FLATDATA(Params().MessageStart());
+            ssPeers << backupheight_;
+            ssPeers << *pcontainer_;
+        }
         uint256 hash = Hash(ssPeers.begin(), ssPeers.end());
         ssPeers << hash;
 
@@ -184,8 +196,13 @@ public:
                 return false;
 
             // de-serialize address data into one CAddrMan object
-            ssPeers >> backupheight_;
-            ssPeers >> *pcontainer_;
+            int height;
+            Tc container;
+            ssPeers >> height;
+            ssPeers >> container;
+            WriteLock lock(cs_cache_);
+            backupheight_ = height;
+            pcontainer_->swap(container);
         } catch (const std::exception& e) {
             //return error("%s: Deserialize or I/O error - %s", __func__, e.what());
             return false;
@@ -194,8 +211,21 @@ public:
         return true;
     }
 
+    /*!
+     * @brief   Copy the content of the cache.
+     * @return  The copy, consistent with itself even if the cache is
+     *          modified meanwhile.
+     */
+    Tc Snapshot() const
+    {
+        ReadLock lock(cs_cache_);
+        return *pcontainer_;
+    }
+
     typedef typename Tc::const_iterator CIterator;
 
+    // Iterating requires cs_main, which keeps the cache from being modified.
+    // Use Snapshot() without it.
     inline CIterator IteratorBegin()
     {
         return pcontainer_->begin();
@@ -207,6 +237,11 @@ public:
     }
 
 protected:
+    typedef boost::shared_lock<boost::shared_mutex> ReadLock;
+    typedef boost::unique_lock<boost::shared_mutex> WriteLock;
+
+    // Guards the container and the backed up height.
+    mutable boost::shared_mutex cs_cache_;
     // The pointer to the container.
     Tc *pcontainer_;
     // Disk backed up height.
@@ -243,18 +278,21 @@ public:
 
     inline bool Add(const Te_t &addr)
     {
+        WriteLock lock(cs_cache_);
         pcontainer_->insert(addr);
         return true;
     }
 
     inline bool Remove(const Te_t &addr)
     {
+        WriteLock lock(cs_cache_);
         pcontainer_->erase(addr);
         return true;
     }
 
     inline bool RemoveAll()
     {
+        WriteLock lock(cs_cache_);
         pcontainer_->clear();
         return true;
     }
@@ -266,6 +304,7 @@ public:
      */
     inline bool IsMember(const std::string &addr) const
     {
+        ReadLock lock(cs_cache_);
         return (pcontainer_->find(addr) != pcontainer_->end());
     }
 
@@ -274,6 +313,7 @@ public:
      */
     inline size_t NumOfMembers() const
     {
+        ReadLock lock(cs_cache_);
         return pcontainer_->size();
     }
 
@@ -281,6 +321,7 @@ public:
      * @ replace alliance list by given.
      */
     inline void UpdateAllianceList(Tc_t& newlist) {
+        WriteLock lock(cs_cache_);
         *pcontainer_ = newlist;
     }
 };
@@ -314,12 +355,17 @@ struct Owner_
 
 namespace
 {
-typedef std::map<type_Color, Owner_> Tc_t;
+typedef std::vector<std::pair<type_Color, Owner_> > Tc_t;
 typedef std::pair<type_Color, Owner_> Te_t;
 }
 
 /*!
  * @brief   The structure for license.
+ *
+ * The licenses are kept in a vector sorted by color, so lookups are binary
+ * searches over contiguous memory. New colors go into a small map first and
+ * are merged into the vector in bulk, so replaying many license blocks costs
+ * O(n log n) instead of shifting the vector on every insert.
  */
 class ColorLicense : public CacheInterface<Tc_t, Te_t>
 {
@@ -338,11 +384,7 @@ public:
      * @brief   Remove the color from the cache.
      * @param   color   The color to be removed.
      */
-    inline bool RemoveColor(const type_Color &color)
-    {
-        pcontainer_->erase(color);
-        return true;
-    }
+    bool RemoveColor(const type_Color &color);
 
     /*!
      * @brief   Remove the owner of the given color.
@@ -350,16 +392,33 @@ public:
      */
     inline bool RemoveOwner(const type_Color &color)
     {
-        (*pcontainer_)[color].address_ = "";
+        WriteLock lock(cs_cache_);
+        Owner_ *powner = Find(color);
+        if (powner)
+            powner->address_ = "";
         return true;
     }
 
     inline bool RemoveAll()
     {
+        WriteLock lock(cs_cache_);
         pcontainer_->clear();
+        added_.clear();
         return true;
     }
 
+    /*!
+     * @brief   Copy all the licenses, sorted by color.
+     */
+    Tc_t Snapshot() const;
+
+    /*!
+     * @brief   Merge the added licenses and write the cache into disk.
+     * @param   height  The backing up height to be recorded.
+     * @return  True if the writing process is successful.
+     */
+    bool WriteDisk(const int height);
+
     /*!
      * @brief   Set the owner information of the color.
      * @param   color   The color to be processed.
@@ -384,7 +443,8 @@ public:
      */
     inline void AddNumOfCoins(const type_Color &color, int64_t num_of_coins)
     {
-        (*pcontainer_)[color].num_of_coins_ += num_of_coins;
+        WriteLock lock(cs_cache_);
+        FindOrAdd(color).num_of_coins_ += num_of_coins;
     }
 
     /*!
@@ -401,8 +461,9 @@ public:
      */
     inline bool HasColorOwner(const type_Color &color) const
     {
-        Tc_t::iterator it = pcontainer_->find(color);
-        return (it != pcontainer_->end() && it->second.address_ != "");
+        ReadLock lock(cs_cache_);
+        const Owner_ *powner = Find(color);
+        return (powner && powner->address_ != "");
     }
 
     /*!
@@ -413,8 +474,9 @@ public:
      */
     inline bool IsColorOwner(const type_Color &color, std::string &addr) const
     {
-        Tc_t::iterator it = pcontainer_->find(color);
-        return (it != pcontainer_->end() && it->second.address_ == addr);
+        ReadLock lock(cs_cache_);
+        const Owner_ *powner = Find(color);
+        return (powner && powner->address_ == addr);
     }
 
     /*!
@@ -438,6 +500,14 @@ public:
      */
     bool GetLicenseInfo(const type_Color &color, CLicenseInfo &info) const;
 
+    /*!
+     * @brief   Copy the whole entry of the given color under one lock.
+     * @param   color   The color to be checked.
+     * @param   owner   The referenced owner address, minted amount and info.
+     * @return  True if the color has a license.
+     */
+    bool GetEntry(const type_Color &color, Owner_ &owner) const;
+
     /*!
      * @brief   Check the upper limit of minting amount of the given color.
      * @param   color   The color to be checked.
@@ -445,8 +515,33 @@ public:
      */
     inline int64_t GetUpperLimit(const type_Color &color) const
     {
-        return (*pcontainer_)[color].info_.nLimit;
+        ReadLock lock(cs_cache_);
+        const Owner_ *powner = Find(color);
+        return powner ? powner->info_.nLimit : 0;
     }
+
+private:
+    /*!
+     * @brief   Look up the entry of the color, the cache lock must be held.
+     * @return  The entry, or NULL if the color has no license.
+     */
+    const Owner_ *Find(const type_Color &color) const;
+    Owner_ *Find(const type_Color &color);
+
+    /*!
+     * @brief   Look up the entry of the color, adding an empty one if there
+     *          is none. The cache lock must be held exclusively.
+     */
+    Owner_ &FindOrAdd(const type_Color &color);
+
+    /*!
+     * @brief   Move the added licenses into the sorted vector. The cache lock
+     *          must be held exclusively.
+     */
+    void MergeAdded();
+
+    // Licenses of colors added since the last merge.
+    std::map<type_Color, Owner_> added_;
 };
 }
 
@@ -479,6 +574,7 @@ public:
 
     inline bool Remove()
     {
+        WriteLock lock(cs_cache_);
         if (!pcontainer_->empty())
             pcontainer_->pop_front();
         return true;
@@ -486,6 +582,7 @@ public:
 
     inline bool RemoveAll()
     {
+        WriteLock lock(cs_cache_);
         pcontainer_->clear();
         return true;
     }
@@ -530,18 +627,21 @@ public:
 
     inline bool Add(const Te_t &addr)
     {
+        WriteLock lock(cs_cache_);
         pcontainer_->insert(addr);
         return true;
     }
 
     inline bool Remove(const Te_t &addr)
     {
+        WriteLock lock(cs_cache_);
         pcontainer_->erase(addr);
         return true;
     }
 
     inline bool RemoveAll()
     {
+        WriteLock lock(cs_cache_);
         pcontainer_->clear();
         return true;
     }
@@ -553,6 +653,7 @@ public:
      */
     inline bool IsMiner(const std::string &addr) const
     {
+        ReadLock lock(cs_cache_);
         return (pcontainer_->find(addr) != pcontainer_->end());
     }
 
@@ -561,6 +662,7 @@ public:
      */
     inline size_t NumOfMiners() const
     {
+        ReadLock lock(cs_cache_);
         return pcontainer_->size();
     }
 };
@@ -571,4 +673,15 @@ extern color_license::ColorLicense *plicense;
 extern block_miner::BlockMiner *pblkminer;
 extern miner::Miner *pminer;
 
+/*!
+ * Held exclusively while the transactions of one block are applied to or
+ * undone from the caches, so they only ever change a whole block at a time.
+ * Readers that need several entries or several caches as of the same block
+ * take it shared and read under it. Block connection takes it with cs_main
+ * held, so never take cs_main while holding it.
+ */
+extern boost::shared_mutex cs_cacheApply;
+typedef boost::unique_lock<boost::shared_mutex> CacheApplyLock;
+typedef boost::shared_lock<boost::shared_mutex> CacheReadLock;
+
 #endif // GCOIN_CACHE_H
@@ -5,6 +5,9 @@
 #include "coins.h"
 #include "main.h"
 
+#include "arith_uint256.h"
+#include "clientversion.h"
+#include "hash.h"
 #include "memusage.h"
 #include "random.h"
 
@@ -44,10 +47,50 @@ bool CCoins::Spend(uint32_t nPos)
     return true;
 }
 
+void CCoinsStats::AddCoins(const uint256 &txid, const CCoins &coins)
+{
+    if (coins.IsPruned())
+        return;
+
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << txid;
+    ss << VARINT(coins.nVersion);
+    ss << (coins.fCoinBase ? 'c' : 'n');
+    ss << VARINT(coins.nHeight);
+    for (unsigned int i=0; i<coins.vout.size(); i++) {
+        const CTxOut &out = coins.vout[i];
+        if (!out.IsNull()) {
+            nTransactionOutputs++;
+            mapTotalAmount[out.color] += out.nValue;
+            ss << VARINT(i+1);
+            ss << out;
+        }
+    }
+    ss << VARINT(0);
+
+    nTransactions++;
+    nSerializedSize += 32 + ::GetSerializeSize(coins, SER_DISK, CLIENT_VERSION);
+    hashSerialized = ArithToUint256(UintToArith256(hashSerialized) + UintToArith256(ss.GetHash()));
+}
+
+void CCoinsStats::Subtract(const CCoinsStats &other)
+{
+    nTransactions -= other.nTransactions;
+    nTransactionOutputs -= other.nTransactionOutputs;
+    nSerializedSize -= other.nSerializedSize;
+    hashSerialized = ArithToUint256(UintToArith256(hashSerialized) - UintToArith256(other.hashSerialized));
+    for (colorAmount_t::const_iterator it = other.mapTotalAmount.begin(); it != other.mapTotalAmount.end(); it++) {
+        CAmount &nTotal = mapTotalAmount[it->first];
+        nTotal -= it->second;
+        if (nTotal == 0)
+            mapTotalAmount.erase(it->first);
+    }
+}
+
 bool CCoinsView::GetCoins(const uint256 &txid, CCoins &coins) const { return false; }
 bool CCoinsView::HaveCoins(const uint256 &txid) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
-bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return false; }
+bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsStats &statsReplaced) { return false; }
 bool CCoinsView::GetStats(CCoinsStats &stats) const { return false; }
 bool CCoinsView::GetAddrCoins(const string &addr, CTxOutMap &mapTxOut, bool fLicense) const { return false; }
 
@@ -57,7 +100,8 @@ bool CCoinsViewBacked::GetCoins(const uint256 &txid, CCoins &coins) const { retu
 bool CCoinsViewBacked::HaveCoins(const uint256 &txid) const { return base->HaveCoins(txid); }
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
-bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
+CCoinsView *CCoinsViewBacked::GetBackend() const { return base; }
+bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsStats &statsReplaced) { return base->BatchWrite(mapCoins, hashBlock, statsReplaced); }
 bool CCoinsViewBacked::GetStats(CCoinsStats &stats) const { return base->GetStats(stats); }
 bool CCoinsViewBacked::GetAddrCoins(const string &addr, CTxOutMap &mapTxOut, bool fLicense) const { return base->GetAddrCoins(addr, mapTxOut, fLicense); }
 
@@ -117,11 +161,31 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
     } else {
         cachedCoinUsage = memusage::DynamicUsage(ret.first->second.coins);
     }
+    // A clean entry still holds the base's record, which is about to be replaced.
+    if (!(ret.first->second.flags & (CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH)))
+        statsReplaced.AddCoins(txid, ret.first->second.coins);
     // Assume that whenever ModifyCoins is called, the entry will be modified.
     ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
     return CCoinsModifier(*this, ret.first, cachedCoinUsage);
 }
 
+bool CCoinsViewCache::HaveCoinsInCache(const uint256 &txid) const {
+    return cacheCoins.count(txid) != 0;
+}
+
+void CCoinsViewCache::AddFetchedCoins(const uint256 &txid, CCoins &coins) {
+    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
+    if (!ret.second)
+        return;
+    coins.swap(ret.first->second.coins);
+    if (ret.first->second.coins.IsPruned()) {
+        // The parent only has an empty entry for this txid; we can consider our
+        // version as fresh.
+        ret.first->second.flags = CCoinsCacheEntry::FRESH;
+    }
+    cachedCoinsUsage += memusage::DynamicUsage(ret.first->second.coins);
+}
+
 const CCoins* CCoinsViewCache::AccessCoins(const uint256 &txid) const {
     CCoinsMap::const_iterator it = FetchCoins(txid);
     if (it == cacheCoins.end()) {
@@ -150,7 +214,9 @@ void CCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
     hashBlock = hashBlockIn;
 }
 
-bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn) {
+bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn, const CCoinsStats &statsReplacedIn) {
+    // statsReplacedIn counts records as this cache holds them; only the
+    // records of our own base that get replaced matter, see below.
     assert(!hasModifier);
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) { // Ignore non-dirty entries (optimization).
@@ -176,6 +242,8 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                     cacheCoins.erase(itUs);
                 } else {
                     // A normal modification.
+                    if (!(itUs->second.flags & (CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH)))
+                        statsReplaced.AddCoins(it->first, itUs->second.coins);
                     cachedCoinsUsage -= memusage::DynamicUsage(itUs->second.coins);
                     itUs->second.coins.swap(it->second.coins);
                     cachedCoinsUsage += memusage::DynamicUsage(itUs->second.coins);
@@ -191,9 +259,10 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
 }
 
 bool CCoinsViewCache::Flush() {
-    bool fOk = base->BatchWrite(cacheCoins, hashBlock);
+    bool fOk = base->BatchWrite(cacheCoins, hashBlock, statsReplaced);
     cacheCoins.clear();
     cachedCoinsUsage = 0;
+    statsReplaced = CCoinsStats();
     return fOk;
 }
 
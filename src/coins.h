@@ -333,10 +333,28 @@ struct CCoinsStats
     uint64_t nTransactions;
     uint64_t nTransactionOutputs;
     uint64_t nSerializedSize;
+    //! Order-independent hash of the coin set: the sum (mod 2^256) of the hashes of all coin records
     uint256 hashSerialized;
     colorAmount_t mapTotalAmount;
 
     CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0) {}
+
+    //! Count the coin record stored under txid
+    void AddCoins(const uint256 &txid, const CCoins &coins);
+    //! Remove the records counted in other
+    void Subtract(const CCoinsStats &other);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(hashBlock);
+        READWRITE(nTransactions);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nSerializedSize);
+        READWRITE(hashSerialized);
+        READWRITE(mapTotalAmount);
+    }
 };
 
 
@@ -355,8 +373,9 @@ public:
     virtual uint256 GetBestBlock() const;
 
     //! Do a bulk modification (multiple CCoins changes + BestBlock change).
-    //! The passed mapCoins can be modified.
-    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    //! The passed mapCoins can be modified. statsReplaced counts the records
+    //! of this view that the dirty entries of mapCoins replace.
+    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsStats &statsReplaced);
 
     //! Calculate statistics about the unspent transaction output set
     virtual bool GetStats(CCoinsStats &stats) const;
@@ -381,7 +400,8 @@ public:
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
     void SetBackend(CCoinsView &viewIn);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    CCoinsView *GetBackend() const;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsStats &statsReplaced);
     bool GetStats(CCoinsStats &stats) const;
     bool GetAddrCoins(const std::string &addr, CTxOutMap &mapTxOut, bool fLicense) const;
 };
@@ -427,6 +447,13 @@ protected:
     /* Cached dynamic memory usage for the inner CCoins objects. */
     mutable size_t cachedCoinsUsage;
 
+    /**
+     * The base's records replaced by the dirty entries, counted when an entry
+     * first becomes dirty while its old value is still in memory, so the
+     * coin database can update its statistics without reading them back.
+     */
+    CCoinsStats statsReplaced;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
     ~CCoinsViewCache();
@@ -436,7 +463,7 @@ public:
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
     void SetBestBlock(const uint256 &hashBlock);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsStats &statsReplaced);
     bool GetAddrCoins(const std::string &addr, CTxOutMap &mapTxOut, bool fLicense) const;
 
     /**
@@ -453,6 +480,16 @@ public:
      */
     CCoinsModifier ModifyCoins(const uint256 &txid);
 
+    //! Check whether txid is loaded in this cache, without asking the base.
+    bool HaveCoinsInCache(const uint256 &txid) const;
+
+    /**
+     * Add coins read from the base beforehand, e.g. by a prefetch. Nothing
+     * changes if txid is already loaded in this cache, so the result is the
+     * same as fetching it on demand.
+     */
+    void AddFetchedCoins(const uint256 &txid, CCoins &coins);
+
     /**
      * Push the modifications applied to this cache to its base.
      * Failure to call this method before destruction will cause the changes to be forgotten.
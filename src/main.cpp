@@ -30,12 +30,14 @@
 #include "policy/licenseinfo.h"
 #include "wallet/wallet.h"
 
+#include <list>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/math/distributions/poisson.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 #include <vector>
 
@@ -46,6 +48,8 @@ using namespace std;
 using alliance_member::AllianceMember;
 string ConsensusAddressForLicense = "";
 string ConsensusAddressForMiner = "";
+CScriptID ConsensusScriptIDForLicense;
+CScriptID ConsensusScriptIDForMiner;
 
 #if defined(NDEBUG)
 # error "Gcoin cannot be compiled without assertions."
@@ -59,6 +63,7 @@ CCriticalSection cs_main;
 
 BlockMap mapBlockIndex;
 CChain chainActive;
+CCriticalSection cs_tipSnapshot;
 CBlockIndex *pindexBestHeader = NULL;
 int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
@@ -101,6 +106,8 @@ struct COrphanTx {
 };
 map<uint256, COrphanTx> mapOrphanTransactions;
 map<uint256, set<uint256> > mapOrphanTransactionsByPrev;
+/** Guards mapOrphanTransactions and mapOrphanTransactionsByPrev, which inv messages read without cs_main */
+CCriticalSection cs_orphans;
 void EraseOrphansFor(NodeId peer);
 
 /**
@@ -286,10 +293,10 @@ static bool TryDecryptTx(CTransaction& tx)
 {
     if (pwalletMain == NULL)
         return false;
-    // Scan the pubKey in tx.pubKeys one by one to see if we own any one of the keys
-    for (unsigned int i = 0; i < tx.pubKeys.size(); i++) {
+    // Scan the pubKey in tx.GetPubKeys() one by one to see if we own any one of the keys
+    for (unsigned int i = 0; i < tx.GetPubKeys().size(); i++) {
         CKey key;
-        if (!pwalletMain->GetKey(tx.pubKeys[i].GetID(), key))
+        if (!pwalletMain->GetKey(tx.GetPubKeys()[i].GetID(), key))
             continue;
         return tx.Decrypt(i, key);
     }
@@ -519,6 +526,31 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
 
 } // anon namespace
 
+namespace {
+    const CBlockIndex* pindexTipSnapshot = NULL;
+} // anon namespace
+
+/** Change the active tip and publish it for GetTipSnapshot. Requires cs_main. */
+static void SetActiveTip(CBlockIndex* pindex)
+{
+    chainActive.SetTip(pindex);
+    LOCK(cs_tipSnapshot);
+    pindexTipSnapshot = pindex;
+}
+
+const CBlockIndex* GetTipSnapshot()
+{
+    LOCK(cs_tipSnapshot);
+    return pindexTipSnapshot;
+}
+
+const CBlockIndex* LookupBlockIndex(const uint256& hash)
+{
+    LOCK(cs_tipSnapshot);
+    BlockMap::const_iterator mi = mapBlockIndex.find(hash);
+    return mi == mapBlockIndex.end() ? NULL : mi->second;
+}
+
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats)
 {
     LOCK(cs_main);
@@ -569,6 +601,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsView *pcoinsDBView = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -578,6 +611,7 @@ CBlockTreeDB *pblocktree = NULL;
 
 bool AddOrphanTx(const CTransaction& tx, NodeId peer)
 {
+    LOCK(cs_orphans);
     uint256 hash = tx.GetHash();
     if (mapOrphanTransactions.count(hash))
         return false;
@@ -608,6 +642,7 @@ bool AddOrphanTx(const CTransaction& tx, NodeId peer)
 
 void static EraseOrphanTx(uint256 hash)
 {
+    LOCK(cs_orphans);
     map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.find(hash);
     if (it == mapOrphanTransactions.end())
         return;
@@ -625,6 +660,7 @@ void static EraseOrphanTx(uint256 hash)
 
 void EraseOrphansFor(NodeId peer)
 {
+    LOCK(cs_orphans);
     int nErased = 0;
     map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
     while (iter != mapOrphanTransactions.end())
@@ -642,6 +678,7 @@ void EraseOrphansFor(NodeId peer)
 
 unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans)
 {
+    LOCK(cs_orphans);
     unsigned int nEvicted = 0;
     while (mapOrphanTransactions.size() > nMaxOrphans)
     {
@@ -1071,14 +1108,15 @@ public:
                     const CBlock *pblock)
     {
         // First check if minter is alliance or not. Alliance can MINT color 0 without License
-        string addr = GetTxOutputAddr(tx, 0);
         if (tx.vout[0].color != DEFAULT_ADMIN_COLOR) {
+            string addr = GetTxOutputAddr(tx, 0);
             if (!plicense->IsColorOwner(tx.vout[0].color, addr)) {
                 return RejectInvalidTypeTx(
                         strprintf("mint color=%u without license", tx.vout[0].color),
                         state, 100);
             }
-        } else if (addr != ConsensusAddressForLicense && addr != ConsensusAddressForMiner) {
+        } else if (!IsPayToScriptID(tx.vout[0].scriptPubKey, ConsensusScriptIDForLicense) &&
+                   !IsPayToScriptID(tx.vout[0].scriptPubKey, ConsensusScriptIDForMiner)) {
             return RejectInvalidTypeTx(
                     "Target of mint AdminColor must be consensus address", state, 100);
         }
@@ -1149,13 +1187,11 @@ class Handler_License_ : public HandlerInterface, public HandlerUtility_
 public:
     Handler_License_() : HandlerUtility_(LICENSE)
     {
-        pinfo = NULL;
     }
 
     bool CheckValid(const CTransaction &tx, CValidationState &state,
                     const CBlock *pblock)
     {
-        DetachInfo();
         // we check when reconstruct list at if VerifyDB
         if (!IsValidColor(tx.vout[0].color))
             return RejectInvalidTypeTx("color invalid", state, 100);
@@ -1171,11 +1207,11 @@ public:
         }
 
         type_Color color = txinfo.GetTxOutColorOfIndex(txin.prevout.n);
-        string addr = txinfo.GetTxOutAddressOfIndex(txin.prevout.n);
 
         // Requires the admin color coin as input to create a new license.
         if (color != tx.vout[0].color) {
-            if (!(txinfo.GetTxType() == MINT && color == DEFAULT_ADMIN_COLOR) || addr != ConsensusAddressForLicense) {
+            if (!(txinfo.GetTxType() == MINT && color == DEFAULT_ADMIN_COLOR) ||
+                !IsPayToScriptID(txinfo.GetTxOutScriptOfIndex(txin.prevout.n), ConsensusScriptIDForLicense)) {
                 return RejectInvalidTypeTx(
                         "change color invalid", state, 100);
             }
@@ -1186,6 +1222,7 @@ public:
             if (tx.vout.size() == 1) {
                 // license owner's address must equal to input address for license
                 // transfer case
+                string addr = txinfo.GetTxOutAddressOfIndex(txin.prevout.n);
                 if (!plicense->IsColorOwner(tx.vout[0].color, addr))
                     return RejectInvalidTypeTx(
                             "Transferring license from non-owner", state, 100);
@@ -1197,11 +1234,9 @@ public:
                         "Invalid output amount of LICENSE", state, 100);
         } else {
             // New license requires valid license information.
-            pinfo = new CLicenseInfo();
+            CLicenseInfo info;
             if (tx.vout.size() > 1) {
-                CScript scriptInfo = tx.vout[1].scriptPubKey;
-                vector<unsigned char> vch = ParseHex(scriptInfo.ToString().substr(10));
-                if (!pinfo->DecodeInfo(string(vch.begin(), vch.end())))
+                if (!DecodeLicenseInfo(tx.vout[1].scriptPubKey, info))
                     return RejectInvalidTypeTx(
                             "Decode license info failed when first create license", state, 100);
             } else
@@ -1232,24 +1267,18 @@ public:
 
     bool Apply(const CTransaction &tx, const CBlock *pblock)
     {
-        DetachInfo();
-        if (tx.vout.size() > 1 && !pinfo) {
-            pinfo = new CLicenseInfo();
-            CScript scriptInfo = tx.vout[1].scriptPubKey;
-            vector<unsigned char> vch = ParseHex(scriptInfo.ToString().substr(10));
-            if (!pinfo->DecodeInfo(string(vch.begin(), vch.end()))) {
-                LogPrintf("%s() : Decode license info failed when first create license", __func__);
-                return error("%s(): Handle License %s failed", __func__, tx.GetHash().ToString());
-            }
+        CLicenseInfo info;
+        if (tx.vout.size() > 1 && !DecodeLicenseInfo(tx.vout[1].scriptPubKey, info)) {
+            LogPrintf("%s() : Decode license info failed when first create license", __func__);
+            return error("%s(): Handle License %s failed", __func__, tx.GetHash().ToString());
         }
         string receiverAddr = GetTxOutputAddr(tx, 0);
 
-        return plicense->SetOwner(tx.vout[0].color, receiverAddr, pinfo);
+        return plicense->SetOwner(tx.vout[0].color, receiverAddr, tx.vout.size() > 1 ? &info : NULL);
     }
 
     bool Undo(const CTransaction &tx, const CBlock *pblock)
     {
-        DetachInfo();
         assert(tx.vin.size() > 0);
         // erase this license if input was sent by alliance (from mint type tx)
         if (!plicense->IsColorExist(tx.vout[0].color)) {
@@ -1286,21 +1315,6 @@ public:
                     state, 50);
         return true;
     }
-
-    void DetachInfo()
-    {
-        if (pinfo)
-            delete pinfo;
-        pinfo = NULL;
-    }
-
-    ~Handler_License_()
-    {
-        DetachInfo();
-    }
-
-private:
-    CLicenseInfo *pinfo;
 };
 
 
@@ -1363,21 +1377,7 @@ public:
             return error("%s() : Invalid script", __func__);
         }
         palliance->UpdateAllianceList(alliance);
-
-        vector<string> key;
-
-        for (AllianceMember::CIterator it = palliance->IteratorBegin(); it != palliance->IteratorEnd(); ++it) {
-            key.push_back((*it));
-        }
-        CScript licenseaddr = _createmultisig_redeemScript(ceil(palliance->NumOfMembers() * Params().LicenseThreshold()), key);
-        CScriptID licenseaddrID(licenseaddr);
-        CBitcoinAddress licenseaddress(licenseaddrID);
-        ConsensusAddressForLicense = licenseaddress.ToString();
-
-        CScript mineraddr = _createmultisig_redeemScript(ceil(palliance->NumOfMembers() * Params().MinerThreshold()), key);
-        CScriptID mineraddrID(mineraddr);
-        CBitcoinAddress mineraddress(mineraddrID);
-        ConsensusAddressForMiner = mineraddress.ToString();
+        UpdateConsensusAddresses();
 
         return true;
     }
@@ -1406,19 +1406,7 @@ public:
             return true;
         }
 
-        vector<string> key;
-        for (AllianceMember::CIterator it = palliance->IteratorBegin(); it != palliance->IteratorEnd(); ++it) {
-            key.push_back((*it));
-        }
-        CScript licenseaddr = _createmultisig_redeemScript(ceil(palliance->NumOfMembers() * Params().LicenseThreshold()), key);
-        CScriptID licenseaddrID(licenseaddr);
-        CBitcoinAddress licenseaddress(licenseaddrID);
-        ConsensusAddressForLicense = licenseaddress.ToString();
-
-        CScript mineraddr = _createmultisig_redeemScript(ceil(palliance->NumOfMembers() * Params().MinerThreshold()), key);
-        CScriptID mineraddrID(mineraddr);
-        CBitcoinAddress mineraddress(mineraddrID);
-        ConsensusAddressForMiner = mineraddress.ToString();
+        UpdateConsensusAddresses();
 
         return true;
 
@@ -1451,8 +1439,8 @@ public:
                         std::string(BAD_TXNS_TYPE_) + "not-exist");
             }
             type_Color color = txinfo.GetTxOutColorOfIndex(txin.prevout.n);
-            string addr = txinfo.GetTxOutAddressOfIndex(txin.prevout.n);
-            if (!(txinfo.GetTxType() == MINT && color == DEFAULT_ADMIN_COLOR) || addr != ConsensusAddressForMiner) {
+            if (!(txinfo.GetTxType() == MINT && color == DEFAULT_ADMIN_COLOR) ||
+                !IsPayToScriptID(txinfo.GetTxOutScriptOfIndex(txin.prevout.n), ConsensusScriptIDForMiner)) {
                 return RejectInvalidTypeTx(
                         "Set Miner fail", state, 100);
             }
@@ -1539,8 +1527,8 @@ public:
                         std::string(BAD_TXNS_TYPE_) + "not-exist");
             }
             type_Color color = txinfo.GetTxOutColorOfIndex(txin.prevout.n);
-            string addr = txinfo.GetTxOutAddressOfIndex(txin.prevout.n);
-            if (!(txinfo.GetTxType() == MINT && color == DEFAULT_ADMIN_COLOR) || addr != ConsensusAddressForMiner) {
+            if (!(txinfo.GetTxType() == MINT && color == DEFAULT_ADMIN_COLOR) ||
+                !IsPayToScriptID(txinfo.GetTxOutScriptOfIndex(txin.prevout.n), ConsensusScriptIDForMiner)) {
                 return RejectInvalidTypeTx(
                         "Deminer fail", state, 100);
             }
@@ -1696,28 +1684,82 @@ bool GeneralCheckValid(const CTransaction& tx, CValidationState &state,
 namespace
 {
 
-struct CCachedAddress
+struct CCachedOutputAddress
 {
     uint256 tx_hash;
+    size_t index;
     string address;
 
-    CCachedAddress(const arith_uint256& fake_hash_value)
+    CCachedOutputAddress(const arith_uint256& fake_hash_value)
     {
         tx_hash = ArithToUint256(fake_hash_value);
     }
 };
 
-struct CCachedOutputAddress : CCachedAddress
+/** An output spent by a transaction, with its address encoded once. */
+struct CPrevout
 {
-    size_t index;
-
-    CCachedOutputAddress(const arith_uint256& fake_hash_value) :
-            CCachedAddress(fake_hash_value) {}
+    CTxOut txout;
+    tx_type type;
+    string address;
 };
 
+typedef std::list<std::pair<COutPoint, CPrevout> > PrevoutList;
+
+/** Resolved prevouts of confirmed coins, most recently used first. */
+CCriticalSection cs_prevoutCache;
+PrevoutList listPrevout;
+std::map<COutPoint, PrevoutList::iterator> mapPrevout;
+
+bool GetCachedPrevout(const COutPoint& outpoint, CPrevout& prevout)
+{
+    LOCK(cs_prevoutCache);
+    std::map<COutPoint, PrevoutList::iterator>::iterator mi = mapPrevout.find(outpoint);
+    if (mi == mapPrevout.end())
+        return false;
+    listPrevout.splice(listPrevout.begin(), listPrevout, mi->second);
+    prevout = mi->second->second;
+    return true;
+}
+
+void ErasePrevout(const COutPoint& outpoint)
+{
+    std::map<COutPoint, PrevoutList::iterator>::iterator mi = mapPrevout.find(outpoint);
+    if (mi == mapPrevout.end())
+        return;
+    listPrevout.erase(mi->second);
+    mapPrevout.erase(mi);
+}
+
 }  // namespace
 
 
+void SetConsensusAddresses(const CScriptID& licenseID, const CScriptID& minerID)
+{
+    ConsensusScriptIDForLicense = licenseID;
+    ConsensusScriptIDForMiner = minerID;
+    ConsensusAddressForLicense = licenseID.IsNull() ? "" : CBitcoinAddress(licenseID).ToString();
+    ConsensusAddressForMiner = minerID.IsNull() ? "" : CBitcoinAddress(minerID).ToString();
+}
+
+void UpdateConsensusAddresses()
+{
+    vector<string> key;
+    for (AllianceMember::CIterator it = palliance->IteratorBegin(); it != palliance->IteratorEnd(); ++it) {
+        key.push_back((*it));
+    }
+    CScript licenseaddr = _createmultisig_redeemScript(ceil(palliance->NumOfMembers() * Params().LicenseThreshold()), key);
+    CScript mineraddr = _createmultisig_redeemScript(ceil(palliance->NumOfMembers() * Params().MinerThreshold()), key);
+    SetConsensusAddresses(CScriptID(licenseaddr), CScriptID(mineraddr));
+}
+
+bool IsPayToScriptID(const CScript& script, const CScriptID& id)
+{
+    // OP_HASH160 <20-byte script id> OP_EQUAL
+    return !id.IsNull() && script.IsPayToScriptHash() &&
+           memcmp(&script[2], id.begin(), id.size()) == 0;
+}
+
 string GetTxOutputAddr(const CTransaction& tx, size_t index)
 {
     static boost::thread_specific_ptr<CCachedOutputAddress> cache;
@@ -1737,37 +1779,77 @@ string GetTxOutputAddr(const CTransaction& tx, size_t index)
 
 string GetTxInputAddr(const CTransaction& tx, const CBlock *pblock, bool fUndo)
 {
-    static boost::thread_specific_ptr<CCachedAddress> cache;
     if (tx.vin.size() == 0)
         return "";
-    if (cache.get() == NULL) {
-        cache.reset(new CCachedAddress(~(UintToArith256(tx.GetHash()))));
+
+    if (fJustStart || fUndo) {
+        CTransaction preTx;
+        uint256 hashBlock;
+        hashBlock.SetNull();
+        if (!GetTransaction(tx.vin[0].prevout.hash, preTx, hashBlock, pblock))
+            return "";
+        return GetDestination(preTx.vout[tx.vin[0].prevout.n].scriptPubKey);
     }
 
-    if (cache.get()->tx_hash != tx.GetHash()) {
-        cache.get()->tx_hash = tx.GetHash();
+    // Resolved through the prevout cache
+    TxInfo txinfo;
+    if (!txinfo.init(tx.vin[0].prevout, pblock))
+        return "";
+    return txinfo.GetTxOutAddressOfIndex(tx.vin[0].prevout.n);
+}
 
-        if (fJustStart || fUndo) {
-            CTransaction preTx;
-            uint256 hashBlock;
-            hashBlock.SetNull();
-            if (!GetTransaction(tx.vin[0].prevout.hash, preTx, hashBlock, pblock)) {
-                cache.get()->address = "";
-            } else {
-                cache.get()->address = GetDestination(
-                        preTx.vout[tx.vin[0].prevout.n].scriptPubKey);
-            }
-        } else {
-            TxInfo txinfo;
-            if (!txinfo.init(tx.vin[0].prevout, pblock)) {
-                cache.get()->address = "";
-            } else {
-                cache.get()->address = txinfo.GetTxOutAddressOfIndex(tx.vin[0].prevout.n);
-            }
+
+void AddPrevoutsToCache(const CTransaction& tx, const CCoinsViewCache& view, int nHeight)
+{
+    if (tx.IsCoinBase())
+        return;
+    BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+        const CCoins* coins = view.AccessCoins(txin.prevout.hash);
+        if (!coins || !coins->IsAvailable(txin.prevout.n) || coins->nHeight >= nHeight)
+            continue;
+        {
+            LOCK(cs_prevoutCache);
+            if (mapPrevout.count(txin.prevout))
+                continue;
+        }
+        CPrevout prevout;
+        prevout.txout = coins->vout[txin.prevout.n];
+        prevout.type = coins->type;
+        prevout.address = GetDestination(prevout.txout.scriptPubKey);
+
+        LOCK(cs_prevoutCache);
+        if (mapPrevout.count(txin.prevout))
+            continue;
+        listPrevout.push_front(std::make_pair(txin.prevout, prevout));
+        mapPrevout[txin.prevout] = listPrevout.begin();
+        while (listPrevout.size() > MAX_PREVOUT_CACHE_SIZE) {
+            mapPrevout.erase(listPrevout.back().first);
+            listPrevout.pop_back();
         }
     }
+}
 
-    return cache.get()->address;
+void ErasePrevoutsFromCache(const CTransaction& tx)
+{
+    if (tx.IsCoinBase())
+        return;
+    LOCK(cs_prevoutCache);
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        ErasePrevout(txin.prevout);
+}
+
+void EraseOutputsFromCache(const CTransaction& tx)
+{
+    LOCK(cs_prevoutCache);
+    for (unsigned int i = 0; i < tx.vout.size(); i++)
+        ErasePrevout(COutPoint(tx.GetHash(), i));
+}
+
+void ClearPrevoutCache()
+{
+    LOCK(cs_prevoutCache);
+    mapPrevout.clear();
+    listPrevout.clear();
 }
 
 
@@ -1801,13 +1883,12 @@ bool CheckTransactionType(const CTransaction& tx, CValidationState &state,
 bool CheckRepeatedTypeTransactionInPool(
         CTxMemPool& pool, CValidationState &state, const CTransaction &tx)
 {
-    typedef map<uint256, CTxMemPoolEntry>::value_type CMapTxIter;
-    BOOST_FOREACH(CMapTxIter it, pool.mapTx) {
-        if (tx.type != it.second.GetTx().type) {
-            continue;
-        }
+    // Only pool entries of the same type can repeat tx.
+    std::pair<CTxMemPool::typeiter, CTxMemPool::typeiter> range =
+        pool.mapTx.get<tx_type_index>().equal_range(tx.type);
+    for (CTxMemPool::typeiter it = range.first; it != range.second; it++) {
         if (!type_transaction_handler::GetHandler(tx.type)->CheckNotRepeated(
-                tx, it.second.GetTx(), state)) {
+                tx, it->GetTx(), state)) {
             return false;
         }
     }
@@ -1888,6 +1969,7 @@ bool IsValidColor(const type_Color &color) {
 
 // Use to initial Tx via COutPoint
 bool TxInfo::init(const COutPoint &outpoint, const CBlock *pblock, bool fUndo) {
+    SetNull();
     hash = outpoint.hash;
     if (fJustStart || fUndo) {
         CTransaction preTx;
@@ -1900,8 +1982,14 @@ bool TxInfo::init(const COutPoint &outpoint, const CBlock *pblock, bool fUndo) {
         vout = preTx.vout;
         type = preTx.type;
     } else {
+        CPrevout prevout;
         CCoins coins;
-        if (GetCoinsFromCache(outpoint, coins, pblock == NULL)) {
+        if (AlternateFunc_GetCoinsFromCache == NULL && GetCachedPrevout(outpoint, prevout)) {
+            vout.assign(1, prevout.txout);
+            type = prevout.type;
+            strAddr = prevout.address;
+            nAddrIndex = outpoint.n;
+        } else if (GetCoinsFromCache(outpoint, coins, pblock == NULL)) {
             vout = coins.vout;
             type = coins.type;
         } else if (pblock) {
@@ -1925,28 +2013,34 @@ bool TxInfo::init(const COutPoint &outpoint, const CBlock *pblock, bool fUndo) {
     return true;
 }
 
-string TxInfo::GetTxOutAddressOfIndex(unsigned int index) const {
+const CTxOut& TxInfo::GetTxOut(unsigned int index, const char *pszCaller) const {
+    if (nAddrIndex >= 0) {
+        if ((int)index != nAddrIndex)
+            throw runtime_error(strprintf("%s : only output %d is known.", pszCaller, nAddrIndex));
+        return vout[0];
+    }
     if (index >= vout.size())
-        throw runtime_error("GetTxOutAddressOfIndex : invalid index.");
-    return GetDestination(vout[index].scriptPubKey);
+        throw runtime_error(strprintf("%s : invalid index.", pszCaller));
+    return vout[index];
+}
+
+string TxInfo::GetTxOutAddressOfIndex(unsigned int index) const {
+    const CTxOut& txout = GetTxOut(index, __func__);
+    if ((int)index == nAddrIndex)
+        return strAddr;
+    return GetDestination(txout.scriptPubKey);
 }
 
 CScript TxInfo::GetTxOutScriptOfIndex(unsigned int index) const {
-    if (index >= vout.size())
-        throw runtime_error("GetTxOutAddressOfIndex : invalid index.");
-    return vout[index].scriptPubKey;
+    return GetTxOut(index, __func__).scriptPubKey;
 }
 
 type_Color TxInfo::GetTxOutColorOfIndex(unsigned int index) const {
-    if (index >= vout.size())
-        throw runtime_error("GetTxOutColorOfIndex : invalid index.");
-    return vout[index].color;
+    return GetTxOut(index, __func__).color;
 }
 
 int64_t TxInfo::GetTxOutValueOfIndex(unsigned int index) const {
-    if (index >= vout.size())
-        throw runtime_error("GetTxOutValueOfIndex : invalid index.");
-    return vout[index].nValue;
+    return GetTxOut(index, __func__).nValue;
 }
 
 tx_type TxInfo::GetTxType() const {
@@ -1958,9 +2052,21 @@ uint256 TxInfo::GetTxHash() const {
 }
 
 size_t TxInfo::GetTxOutSize() const {
+    if (nAddrIndex >= 0)
+        throw runtime_error("GetTxOutSize : only one output is known.");
     return vout.size();
 }
 
+/** Expire old transactions, then evict until the pool fits in -maxmempool. */
+static void LimitMempoolSize(CTxMemPool& pool)
+{
+    int nExpired = pool.Expire(GetTime() - GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+    if (nExpired != 0)
+        LogPrint("mempool", "Expired %i transactions from the memory pool\n", nExpired);
+
+    pool.TrimToSize(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
+}
+
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fRejectAbsurdFee, bool fDisconnect)
 {
@@ -2069,6 +2175,8 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
             return state.Invalid(error("AcceptToMemoryPool: inputs already spent"),
                                  REJECT_DUPLICATE, "bad-txns-inputs-spent");
 
+        AddPrevoutsToCache(tx, view, MEMPOOL_HEIGHT);
+
         if (!CheckTransactionType(tx, state))
             return error("%s: CheckTransactionType failed, txid : %s", __func__, tx.GetHash().ToString());
 
@@ -2115,6 +2223,22 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                                             hash.ToString(), nFees, txMinFee),
                                             REJECT_INSUFFICIENTFEE, "insufficient fee");
         }
+        // Once the pool has been full, evicted transactions and their like
+        // have to outbid what was evicted before they are validated again.
+        // Only the types that are evicted first are held to it, and
+        // transactions resurrected from disconnected blocks are not. Rates
+        // are compared as the eviction order does, as GetFee() charges nothing.
+        if (!tx.IsCoinBase() && !fDisconnect && (tx.type == NORMAL || tx.type == MINT)) {
+            CAmount nModifiedFees = nFees;
+            double dPriorityDelta = 0;
+            pool.ApplyDeltas(hash, dPriorityDelta, nModifiedFees);
+            CFeeRate mempoolRejectRate = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
+            CFeeRate txRate(std::max(nModifiedFees, (CAmount)0), nSize);
+            if (mempoolRejectRate > CFeeRate(0) && txRate < mempoolRejectRate)
+                return state.DoS(0, error("AcceptToMemoryPool: mempool min fee not met %s, %s < %s",
+                                            hash.ToString(), txRate.ToString(), mempoolRejectRate.ToString()),
+                                            REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+        }
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true))
@@ -2138,6 +2262,15 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
 
         // Store transaction in memory
         pool.addUnchecked(hash, entry);
+
+        // Transactions resurrected from disconnected blocks are only
+        // trimmed once the reorganization is done.
+        if (!fDisconnect) {
+            LimitMempoolSize(pool);
+            if (!pool.exists(hash))
+                return state.DoS(0, error("AcceptToMemoryPool: mempool full"),
+                                 REJECT_INSUFFICIENTFEE, "mempool full");
+        }
     }
 
     SyncWithWallets(tx, NULL);
@@ -2181,6 +2314,36 @@ bool GetCoinsFromCache(const COutPoint &outpoint, CCoins &coins, bool fUseMempoo
 }
 
 /** Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock */
+static bool ReadTxIndexTransaction(const uint256 &hash, const CDiskTxPos &postx, CTransaction &txOut, uint256 &hashBlock)
+{
+    CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        return error("%s: OpenBlockFile failed", __func__);
+    CBlockHeader header;
+    try {
+        file >> header;
+        fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+        file >> txOut;
+        if (txOut.IsEncrypted() && txOut.IsNull())
+            if (!TryDecryptTx(txOut))
+                return error("%s: Decryption of encrypted tx failed", __func__);
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+    hashBlock = header.GetHash();
+    if (txOut.GetHash() != hash)
+        return error("%s: txid mismatch", __func__);
+    return true;
+}
+
+bool GetTransactionFromTxIndex(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock)
+{
+    CDiskTxPos postx;
+    if (!fTxIndex || !pblocktree->ReadTxIndex(hash, postx))
+        return false;
+    return ReadTxIndexTransaction(hash, postx, txOut, hashBlock);
+}
+
 bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock, const CBlock *pblock, bool fAllowSlow)
 {
     if (AlternateFunc_GetTransaction != NULL) {
@@ -2209,26 +2372,8 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
         }
         if (fTxIndex) {
             CDiskTxPos postx;
-            if (pblocktree->ReadTxIndex(hash, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-                if (file.IsNull())
-                    return error("%s: OpenBlockFile failed", __func__);
-                CBlockHeader header;
-                try {
-                    file >> header;
-                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                    file >> txOut;
-                    if (txOut.IsEncrypted() && txOut.IsNull())
-                        if (!TryDecryptTx(txOut))
-                            return error("%s: Decryption of encrypted tx failed", __func__);
-                } catch (const std::exception& e) {
-                    return error("%s: Deserialize or I/O error - %s", __func__, e.what());
-                }
-                hashBlock = header.GetHash();
-                if (txOut.GetHash() != hash)
-                    return error("%s: txid mismatch", __func__);
-                return true;
-            }
+            if (pblocktree->ReadTxIndex(hash, postx))
+                return ReadTxIndexTransaction(hash, postx, txOut, hashBlock);
         }
 
         if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
@@ -2319,10 +2464,139 @@ bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos, const CMessageHeader::M
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+namespace {
+/** A read-only mapping of the first nSize bytes of a block file */
+class CMappedBlockFile
+{
+public:
+    const unsigned char* pbegin;
+    size_t nSize;
+
+    CMappedBlockFile(const unsigned char* pbeginIn, size_t nSizeIn) : pbegin(pbeginIn), nSize(nSizeIn) {}
+    ~CMappedBlockFile()
+    {
+#ifndef WIN32
+        munmap((void*)pbegin, nSize);
+#endif
+    }
+};
+typedef boost::shared_ptr<const CMappedBlockFile> MappedBlockFileRef;
+typedef std::list<std::pair<int, MappedBlockFileRef> > MappedBlockFileList;
+
+/** Recently read block files mapped into memory, most recently used first.
+ *  Readers hold a reference, so an evicted mapping stays valid until they are done. */
+CCriticalSection cs_blockFileMaps;
+MappedBlockFileList listBlockFileMaps;
+std::map<int, MappedBlockFileList::iterator> mapBlockFileMaps;
+
+/** Drop the mapping of a block file, e.g. because it is about to be deleted. */
+void UnmapBlockFile(int nFile)
+{
+    LOCK(cs_blockFileMaps);
+    std::map<int, MappedBlockFileList::iterator>::iterator mi = mapBlockFileMaps.find(nFile);
+    if (mi != mapBlockFileMaps.end()) {
+        listBlockFileMaps.erase(mi->second);
+        mapBlockFileMaps.erase(mi);
+    }
+}
+
+/**
+ * Return a mapping of block file nFile that covers at least its first nEnd
+ * bytes. The file being appended to is mapped again once reads go past the
+ * end of the existing mapping. Returns NULL if -blockmmapfiles is 0 or the
+ * file cannot be mapped, in which case the caller reads it with stdio.
+ */
+MappedBlockFileRef MapBlockFile(int nFile, size_t nEnd)
+{
+#ifdef WIN32
+    return MappedBlockFileRef();
+#else
+    size_t nMaxFiles = GetArg("-blockmmapfiles", DEFAULT_BLOCK_MMAP_FILES);
+    if (nMaxFiles == 0)
+        return MappedBlockFileRef();
+
+    LOCK(cs_blockFileMaps);
+    std::map<int, MappedBlockFileList::iterator>::iterator mi = mapBlockFileMaps.find(nFile);
+    if (mi != mapBlockFileMaps.end()) {
+        listBlockFileMaps.splice(listBlockFileMaps.begin(), listBlockFileMaps, mi->second);
+        if (mi->second->second->nSize >= nEnd)
+            return mi->second->second;
+        listBlockFileMaps.erase(mi->second);
+        mapBlockFileMaps.erase(mi);
+    }
+
+    boost::filesystem::path path = GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk");
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1)
+        return MappedBlockFileRef();
+    off_t nFileSize = lseek(fd, 0, SEEK_END);
+    void* pbegin = MAP_FAILED;
+    if (nFileSize > 0 && (size_t)nFileSize >= nEnd)
+        pbegin = mmap(NULL, nFileSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (pbegin == MAP_FAILED)
+        return MappedBlockFileRef();
+
+    MappedBlockFileRef mapping(new CMappedBlockFile((const unsigned char*)pbegin, nFileSize));
+    listBlockFileMaps.push_front(std::make_pair(nFile, mapping));
+    mapBlockFileMaps[nFile] = listBlockFileMaps.begin();
+    while (listBlockFileMaps.size() > nMaxFiles) {
+        mapBlockFileMaps.erase(listBlockFileMaps.back().first);
+        listBlockFileMaps.pop_back();
+    }
+    return mapping;
+#endif
+}
+
+/**
+ * Locate the serialized block at pos in a mapped block file, checking the
+ * network magic and size that precede it. On success pchBlock points into
+ * mapping, which the caller must keep while it reads.
+ */
+bool GetMappedBlock(const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart,
+                    MappedBlockFileRef& mapping, const unsigned char*& pchBlock, unsigned int& nSize)
+{
+    unsigned int nHeaderOffset = MESSAGE_START_SIZE + sizeof(unsigned int);
+    if (pos.IsNull() || pos.nPos < nHeaderOffset)
+        return false;
+    mapping = MapBlockFile(pos.nFile, pos.nPos);
+    if (!mapping)
+        return false;
+
+    const unsigned char* pchHeader = mapping->pbegin + pos.nPos - nHeaderOffset;
+    if (memcmp(pchHeader, messageStart, MESSAGE_START_SIZE) != 0)
+        return false;
+    nSize = ReadLE32(pchHeader + MESSAGE_START_SIZE);
+    if (nSize > MAX_BLOCK_SIZE)
+        return false;
+    if (mapping->nSize - pos.nPos < nSize) {
+        mapping = MapBlockFile(pos.nFile, (size_t)pos.nPos + nSize);
+        if (!mapping)
+            return false;
+    }
+    pchBlock = mapping->pbegin + pos.nPos;
+    return true;
+}
+
+/** Read a block without decrypting its transactions, from the mapped block file when possible. */
+bool ReadUndecryptedBlock(CBlock& block, const CDiskBlockPos& pos)
 {
     block.SetNull();
 
+    MappedBlockFileRef mapping;
+    const unsigned char* pchBlock;
+    unsigned int nSize;
+    if (GetMappedBlock(pos, Params().MessageStart(), mapping, pchBlock, nSize)) {
+        try {
+            CDataStream ssBlock((const char*)pchBlock, (const char*)pchBlock + nSize, SER_DISK, CLIENT_VERSION);
+            ssBlock >> block;
+            return true;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    }
+
     // Open history file to read
     CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
@@ -2331,31 +2605,189 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
     // Read block
     try {
         filein >> block;
-        for (unsigned int i = 0; i < block.vtx.size(); i++) {
-            if (block.vtx[i].IsEncrypted() && block.vtx[i].IsNull())
-                TryDecryptTx(block.vtx[i]);
-        }
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
     }
+    return true;
+}
+
+void DecryptBlock(CBlock& block)
+{
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        if (block.vtx[i].IsEncrypted() && block.vtx[i].IsNull())
+            TryDecryptTx(block.vtx[i]);
+    }
+}
+
+typedef boost::shared_ptr<const CBlock> BlockRef;
+typedef std::list<std::pair<uint256, BlockRef> > BlockList;
+
+/** Blocks recently read by hash, most recently used first. The chain
+ *  rules walk back over the same few recent blocks for every new block
+ *  (EnableMining, NumOfMined, the difficulty timespan), so they are kept
+ *  deserialized. Entries are stored before decryption, which is redone on
+ *  every read in case the wallet has learnt new keys. */
+CCriticalSection cs_blockReadCache;
+BlockList listReadBlocks;
+std::map<uint256, BlockList::iterator> mapReadBlocks;
+
+bool GetCachedBlock(const uint256& hash, CBlock& block)
+{
+    LOCK(cs_blockReadCache);
+    std::map<uint256, BlockList::iterator>::iterator mi = mapReadBlocks.find(hash);
+    if (mi == mapReadBlocks.end())
+        return false;
+    listReadBlocks.splice(listReadBlocks.begin(), listReadBlocks, mi->second);
+    block = *mi->second->second;
+    return true;
+}
 
-    // Check the header
+void CacheBlock(const uint256& hash, const CBlock& block)
+{
+    size_t nMaxBlocks = GetArg("-blockreadcache", DEFAULT_BLOCK_READ_CACHE);
+    if (nMaxBlocks == 0)
+        return;
 
+    LOCK(cs_blockReadCache);
+    if (mapReadBlocks.count(hash))
+        return;
+    listReadBlocks.push_front(std::make_pair(hash, BlockRef(new CBlock(block))));
+    mapReadBlocks[hash] = listReadBlocks.begin();
+    while (listReadBlocks.size() > nMaxBlocks) {
+        mapReadBlocks.erase(listReadBlocks.back().first);
+        listReadBlocks.pop_back();
+    }
+}
+} // anon namespace
 
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+{
+    if (!ReadUndecryptedBlock(block, pos))
+        return false;
+    DecryptBlock(block);
     return true;
 }
 
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos()))
+    const uint256 hash = pindex->GetBlockHash();
+    if (GetCachedBlock(hash, block)) {
+        DecryptBlock(block);
+        return true;
+    }
+
+    if (!ReadUndecryptedBlock(block, pindex->GetBlockPos()))
         return false;
-    if (block.GetHash() != pindex->GetBlockHash())
+    if (block.GetHash() != hash)
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
                 pindex->ToString(), pindex->GetBlockPos().ToString());
+    CacheBlock(hash, block);
+    DecryptBlock(block);
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    vchBlock.clear();
+
+    MappedBlockFileRef mapping;
+    const unsigned char* pchBlock;
+    unsigned int nMappedSize;
+    if (GetMappedBlock(pos, messageStart, mapping, pchBlock, nMappedSize)) {
+        vchBlock.assign(pchBlock, pchBlock + nMappedSize);
+        return true;
+    }
+
+    // The block is preceded by the network magic and its serialized size
+    unsigned int nHeaderOffset = MESSAGE_START_SIZE + sizeof(unsigned int);
+    if (pos.nPos < nHeaderOffset)
+        return error("%s: invalid block position %s", __func__, pos.ToString());
+    CDiskBlockPos posHeader(pos.nFile, pos.nPos - nHeaderOffset);
+
+    CAutoFile filein(OpenBlockFile(posHeader, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+
+    try {
+        CMessageHeader::MessageStartChars blockStart;
+        unsigned int nSize;
+        filein >> FLATDATA(blockStart) >> nSize;
+        if (memcmp(blockStart, messageStart, MESSAGE_START_SIZE) != 0)
+            return error("%s: block magic mismatch at %s", __func__, pos.ToString());
+        if (nSize > MAX_BLOCK_SIZE)
+            return error("%s: block size %u too large at %s", __func__, nSize, pos.ToString());
+        vchBlock.resize(nSize);
+        filein.read((char*)begin_ptr(vchBlock), nSize);
+    }
+    catch (const std::exception& e) {
+        vchBlock.clear();
+        return error("%s: I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart)
+{
+    if (!ReadRawBlockFromDisk(vchBlock, pindex->GetBlockPos(), messageStart))
+        return false;
+    // The block hash only covers the serialized header at the front
+    static const unsigned int nHeaderSize = ::GetSerializeSize(CBlockHeader(), SER_NETWORK, PROTOCOL_VERSION);
+    if (vchBlock.size() < nHeaderSize ||
+        Hash(vchBlock.begin(), vchBlock.begin() + nHeaderSize) != pindex->GetBlockHash())
+        return error("%s: hash doesn't match index for %s at %s", __func__,
+                pindex->ToString(), pindex->GetBlockPos().ToString());
+    return true;
+}
+
+namespace {
+typedef boost::shared_ptr<const std::vector<unsigned char> > RawBlockRef;
+typedef std::list<std::pair<uint256, RawBlockRef> > RawBlockList;
+
+/** Serialized blocks recently sent to peers, most recently used first.
+ *  Lets several syncing peers be served the same block from memory. */
+CCriticalSection cs_rawBlockCache;
+RawBlockList listRawBlocks;
+std::map<uint256, RawBlockList::iterator> mapRawBlocks;
+size_t nRawBlockCacheUsage = 0;
+
+/** Return the serialized block for pindex from the LRU, reading it from disk on a miss. */
+RawBlockRef GetRawBlockForPeer(const CBlockIndex* pindex)
+{
+    const uint256 hash = pindex->GetBlockHash();
+    {
+        LOCK(cs_rawBlockCache);
+        std::map<uint256, RawBlockList::iterator>::iterator mi = mapRawBlocks.find(hash);
+        if (mi != mapRawBlocks.end()) {
+            listRawBlocks.splice(listRawBlocks.begin(), listRawBlocks, mi->second);
+            return mi->second->second;
+        }
+    }
+
+    boost::shared_ptr<std::vector<unsigned char> > pvchBlock(new std::vector<unsigned char>());
+    if (!ReadRawBlockFromDisk(*pvchBlock, pindex, Params().MessageStart()))
+        return RawBlockRef();
+
+    size_t nMaxUsage = GetArg("-blockservecache", DEFAULT_BLOCK_SERVE_CACHE) << 20;
+    if (pvchBlock->size() > nMaxUsage)
+        return pvchBlock;
+
+    LOCK(cs_rawBlockCache);
+    if (mapRawBlocks.count(hash))
+        return mapRawBlocks[hash]->second;
+    listRawBlocks.push_front(std::make_pair(hash, RawBlockRef(pvchBlock)));
+    mapRawBlocks[hash] = listRawBlocks.begin();
+    nRawBlockCacheUsage += pvchBlock->size();
+    while (nRawBlockCacheUsage > nMaxUsage) {
+        nRawBlockCacheUsage -= listRawBlocks.back().second->size();
+        mapRawBlocks.erase(listRawBlocks.back().first);
+        listRawBlocks.pop_back();
+    }
+    return pvchBlock;
+}
+} // anon namespace
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     /**
@@ -2469,12 +2901,13 @@ void CheckForkWarningConditionsOnNewFork(CBlockIndex* pindexNewForkTip)
     CheckForkWarningConditions();
 }
 
-// Requires cs_main.
+// Takes cs_main, so the message handler workers can call it without holding it.
 void Misbehaving(NodeId pnode, int howmuch)
 {
     if (howmuch == 0)
         return;
 
+    LOCK(cs_main);
     CNodeState *state = State(pnode);
     if (state == NULL)
         return;
@@ -2842,6 +3275,7 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
     if (blockUndo.vtxundo.size() + CoinBaseCount != block.vtx.size())
         return error("%s() : block and undo data inconsistent", __func__);
 
+    CacheApplyLock lock(cs_cacheApply);
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = block.vtx[i];
@@ -2860,6 +3294,7 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         if (!type_transaction_handler::GetHandler(tx.type)->Undo(tx, &block)) {
             return false;
         }
+        EraseOutputsFromCache(tx);
 
         CCoins outsBlock(tx, pindex->nHeight);
         // The CCoins serialization does not serialize negative numbers.
@@ -2934,6 +3369,101 @@ void ThreadScriptCheck()
     scriptcheckqueue.Thread();
 }
 
+namespace {
+
+/** Coins of one transaction read ahead of ConnectBlock */
+struct CPrefetchedCoins
+{
+    uint256 txid;
+    CCoins coins;
+    bool fFound;
+
+    CPrefetchedCoins() : fFound(false) {}
+};
+
+/** Reads one CPrefetchedCoins from the coins database on a prefetch thread */
+class CCoinsPrefetch
+{
+private:
+    const CCoinsView *pdb;
+    CPrefetchedCoins *pslot;
+
+public:
+    CCoinsPrefetch() : pdb(NULL), pslot(NULL) {}
+    CCoinsPrefetch(const CCoinsView *pdbIn, CPrefetchedCoins *pslotIn) : pdb(pdbIn), pslot(pslotIn) {}
+
+    bool operator()()
+    {
+        pslot->fFound = pdb->GetCoins(pslot->txid, pslot->coins);
+        return true;
+    }
+
+    void swap(CCoinsPrefetch &prefetch)
+    {
+        std::swap(pdb, prefetch.pdb);
+        std::swap(pslot, prefetch.pslot);
+    }
+};
+
+CCheckQueue<CCoinsPrefetch> prefetchqueue(128);
+
+/**
+ * Queue database reads for the inputs of block that pcoinsTip has not loaded
+ * yet. Inputs created within the block itself are skipped. The reads only
+ * touch the database, so the caller can go on with other work until
+ * prefetch.Wait(), after which vPrefetched is to be handed to pcoinsTip.
+ */
+void PrefetchInputs(const CBlock& block, CCheckQueueControl<CCoinsPrefetch>& prefetch, std::vector<CPrefetchedCoins>& vPrefetched)
+{
+    // Only read ahead when pcoinsTip sits directly on the database view
+    const CCoinsView *pdb = pcoinsDBView;
+    if (pdb == NULL || pcoinsTip->GetBackend() != pdb)
+        return;
+
+    std::set<uint256> setTxid;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        setTxid.insert(tx.GetHash());
+    std::set<uint256> setFetch;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        if (tx.IsCoinBase())
+            continue;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            if (!setTxid.count(txin.prevout.hash) && !pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
+                setFetch.insert(txin.prevout.hash);
+        }
+    }
+    if (setFetch.empty())
+        return;
+
+    // Slots must not move once the reads are queued.
+    vPrefetched.resize(setFetch.size());
+    std::vector<CCoinsPrefetch> vPrefetch;
+    vPrefetch.reserve(setFetch.size());
+    unsigned int i = 0;
+    BOOST_FOREACH(const uint256& txid, setFetch) {
+        vPrefetched[i].txid = txid;
+        vPrefetch.push_back(CCoinsPrefetch(pdb, &vPrefetched[i]));
+        i++;
+    }
+    prefetch.Add(vPrefetch);
+}
+
+} // anon namespace
+
+void ThreadCoinsPrefetch()
+{
+    RenameThread("gcoin-prefetch");
+    prefetchqueue.Thread();
+}
+
+static uint64_t nPrefetchedCoins = 0;
+
+uint64_t GetPrefetchedCoinsCount()
+{
+    LOCK(cs_main);
+    return nPrefetchedCoins;
+}
+
 //
 // Called periodically asynchronously; alerts if it smells like
 // we're being fed a bad chain (blocks being generated much
@@ -3010,11 +3540,26 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     const CChainParams& chainparams = Params();
     AssertLockHeld(cs_main);
 
+    // Read the inputs missing from pcoinsTip in parallel, while the block is
+    // checked again below.
+    std::vector<CPrefetchedCoins> vPrefetched;
+    CCheckQueueControl<CCoinsPrefetch> prefetch(nScriptCheckThreads ? &prefetchqueue : NULL);
+    if (nScriptCheckThreads)
+        PrefetchInputs(block, prefetch, vPrefetched);
+
     // Check it again in case a previous version let a bad block in
     // dont check genesis block
     if (!CheckBlock(block, state, !fJustCheck, !fJustCheck))
         return false;
 
+    prefetch.Wait();
+    BOOST_FOREACH(CPrefetchedCoins& prefetched, vPrefetched) {
+        if (prefetched.fFound) {
+            pcoinsTip->AddFetchedCoins(prefetched.txid, prefetched.coins);
+            nPrefetchedCoins++;
+        }
+    }
+
     // verify that the view's current state corresponds to the previous block
     uint256 hashPrevBlock = pindex->pprev == NULL ? uint256() : pindex->pprev->GetBlockHash();
     assert(hashPrevBlock == view.GetBestBlock());
@@ -3061,23 +3606,35 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     int64_t nTimeStart = GetTimeMicros();
     int nInputs = 0;
-    unsigned int nSigOps = 0;
+    // A block that passed the full CheckBlock above already had its legacy
+    // sigops counted (and bounded), so only the P2SH sigops are added below.
+    bool fLegacySigOpsCounted = !fJustCheck && block.fChecked;
+    unsigned int nSigOps = fLegacySigOpsCounted ? block.nCheckedSigOps : 0;
     CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
     vector<pair<uint256, CDiskTxPos> > vPos;
     vPos.reserve(block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
+    // Fee paid by each tx, taken from the view while its inputs are resolved
+    // here and used for the coinbase check below.
+    std::vector<CAmount> vTxFees(block.vtx.size(), 0);
+    bool fEncrypted = false;
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const CTransaction &tx = block.vtx[i];
         // Skip the transaction if it is encrypted and unable to be decrypted
-        if (tx.IsEncrypted() && tx.IsNull())
+        if (tx.IsEncrypted() && tx.IsNull()) {
+            if (tx.type == NORMAL)
+                fEncrypted = true;
             continue;
+        }
 
         nInputs += tx.vin.size();
-        nSigOps += GetLegacySigOpCount(tx);
-        if (nSigOps > MAX_BLOCK_SIGOPS)
-            return state.DoS(100, error("ConnectBlock(): too many sigops"),
-                             REJECT_INVALID, "bad-blk-sigops");
+        if (!fLegacySigOpsCounted) {
+            nSigOps += GetLegacySigOpCount(tx);
+            if (nSigOps > MAX_BLOCK_SIGOPS)
+                return state.DoS(100, error("ConnectBlock(): too many sigops"),
+                                 REJECT_INVALID, "bad-blk-sigops");
+        }
 
         std::vector<CScriptCheck> vChecks;
 
@@ -3100,11 +3657,17 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             if (!ExistInPool(tx) && !CheckInputs(tx, state, view, fScriptChecks, flags, false, nScriptCheckThreads ? &vChecks : NULL))
                 return false;
             control.Add(vChecks);
+
+            vTxFees[i] = TxFee.GetTxFee(tx, view);
+            AddPrevoutsToCache(tx, view, pindex->nHeight);
         } else if (!ExistInPool(tx) && !CheckInputs(tx, state, view, fScriptChecks, flags, false, nScriptCheckThreads ? &vChecks : NULL))
             return false;
 
         if (i != 0 && !CheckTransactionType(tx, state, &block, false))
-            return error("%s() : CheckTransactionType failed", __func__, tx.GetHash().ToString());
+            return error("%s() : CheckTransactionType failed, txid : %s", __func__, tx.GetHash().ToString());
+
+        if (!fJustCheck)
+            ErasePrevoutsFromCache(tx);
 
         CTxUndo undoDummy;
         if (!tx.IsCoinBase()) {
@@ -3124,7 +3687,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime1 - nTimeStart), 0.001 * (nTime1 - nTimeStart) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime1 - nTimeStart) / (nInputs-1), nTimeConnect * 0.000001);
 
     // Check if coin base transaction meet the transaction fees of each color
-    if (!TxFee.CheckFirstCoinBaseTransactions(block))
+    if (!TxFee.CheckFirstCoinBaseTransactions(block, vTxFees, fEncrypted))
         return state.DoS(100, error("%s() : CheckCoinBaseTransactions", __func__));
 
     if (!control.Wait())
@@ -3299,7 +3862,7 @@ void PruneAndFlush() {
 void static UpdateTip(CBlockIndex *pindexNew) {
     const CChainParams& chainParams = Params();
     LOCK(cs_main);
-    chainActive.SetTip(pindexNew);
+    SetActiveTip(pindexNew);
 
     // New best block
     nTimeBestReceived = GetTime();
@@ -3419,6 +3982,7 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
             return error("ConnectTip(): ConnectBlock %s failed", pindexNew->GetBlockHash().ToString());
         }
         else {
+            CacheApplyLock lock(cs_cacheApply);
             pblkminer->Add(GetTxOutputAddr(pblock->vtx[0], 0));
             BOOST_FOREACH(const CTransaction &tx, pblock->vtx) {
                 if (!type_transaction_handler::GetHandler(tx.type)->Apply(
@@ -3547,9 +4111,11 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
     const CBlockIndex *pindexFork = chainActive.FindFork(pindexMostWork);
 
     // Disconnect active blocks which are no longer in the best chain.
+    bool fBlocksDisconnected = false;
     while (chainActive.Tip() && chainActive.Tip() != pindexFork) {
         if (!DisconnectTip(state))
             return false;
+        fBlocksDisconnected = true;
     }
 
     // Build list of new blocks to connect.
@@ -3595,6 +4161,9 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
     }
     }
 
+    if (fBlocksDisconnected)
+        LimitMempoolSize(mempool);
+
     // Callbacks/notifications for a new best chain.
     if (fInvalidFound)
         CheckForkWarningConditionsOnNewFork(vpindexToConnect.back());
@@ -3743,8 +4312,6 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
     pindexNew->nSequenceId = 0;
-    BlockMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
-    pindexNew->phashBlock = &((*mi).first);
     BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
     if (miPrev != mapBlockIndex.end())
     {
@@ -3752,6 +4319,12 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
         pindexNew->nHeight = pindexNew->pprev->nHeight + 1;
         pindexNew->BuildSkip();
     }
+    {
+        // Publish the entry only once its position in the tree is set up
+        LOCK(cs_tipSnapshot);
+        BlockMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
+        pindexNew->phashBlock = &((*mi).first);
+    }
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
     pindexNew->RaiseValidity(BLOCK_VALID_TREE);
     if (pindexBestHeader == NULL || pindexBestHeader->nChainWork < pindexNew->nChainWork)
@@ -3897,7 +4470,8 @@ bool CheckBlockHeaderSignature(const CBlock& block, CValidationState& state)
             return state.DoS(50, error("%s() : no block vtx[0] or no block vtx[0] vout[0]", __func__),
                              REJECT_INVALID, "high-hash");
 
-        if (!VerifyScript(block.scriptSig, block.vtx[0].vout[0].scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, BlockHeaderSignatureChecker(&block))) {
+        if (!block.fPreChecked &&
+            !VerifyScript(block.scriptSig, block.vtx[0].vout[0].scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, BlockHeaderSignatureChecker(&block))) {
             return state.DoS(50, error("%s() : verify blockheader signature error", __func__),
                              REJECT_INVALID, "high-hash");
         }
@@ -4008,9 +4582,9 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     }
 
     // Check the merkle root.
-    if (fCheckMerkleRoot) {
+    if (fCheckMerkleRoot && !block.fPreChecked) {
         bool mutated;
-        uint256 hashMerkleRoot2 = block.BuildMerkleTree(&mutated);
+        uint256 hashMerkleRoot2 = block.GetMerkleRoot(&mutated);
         if (block.hashMerkleRoot != hashMerkleRoot2)
             return state.DoS(100, error("CheckBlock(): hashMerkleRoot mismatch"),
                              REJECT_INVALID, "bad-txnmrklroot", true);
@@ -4027,8 +4601,15 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     // transaction validation, as otherwise we may mark the header as invalid
     // because we receive the wrong transactions for it.
 
+    // The PoW and merkle root checks above bind this header to exactly the
+    // transactions that passed the checks below before, so skip repeating them.
+    bool fCacheable = fCheckPOW && fCheckMerkleRoot;
+    if (fCacheable && block.fChecked)
+        return true;
+
     // Size limits
-    if (block.vtx.empty() || block.vtx.size() > MAX_BLOCK_SIZE || ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION) > MAX_BLOCK_SIZE)
+    unsigned int nSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    if (block.vtx.empty() || block.vtx.size() > MAX_BLOCK_SIZE || nSize > MAX_BLOCK_SIZE)
         return state.DoS(100, error("CheckBlock(): size limits failed"),
                          REJECT_INVALID, "bad-blk-length");
 
@@ -4038,10 +4619,12 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
                          REJECT_INVALID, "bad-cb-missing");
 
     // Check transactions
-    BOOST_FOREACH(const CTransaction& tx, block.vtx)
-    {
-        if (!ExistInPool(tx) && !tx.IsEncrypted() && !CheckTransaction(tx, state))
-            return error("%s() : CheckTransaction failed", __func__);
+    if (!block.fPreChecked) {
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        {
+            if (!ExistInPool(tx) && !tx.IsEncrypted() && !CheckTransaction(tx, state))
+                return error("%s() : CheckTransaction failed", __func__);
+        }
     }
 
     unsigned int nSigOps = 0;
@@ -4053,9 +4636,96 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         return state.DoS(100, error("CheckBlock(): out-of-bounds SigOpCount"),
                          REJECT_INVALID, "bad-blk-sigops", true);
 
+    // Transactions we cannot decrypt yet may be decrypted in place later and
+    // must then go through CheckTransaction, so don't remember such blocks.
+    bool fUndecrypted = false;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        fUndecrypted |= (tx.IsEncrypted() && tx.IsNull());
+    if (fCacheable && !fUndecrypted) {
+        block.nCheckedSize = nSize;
+        block.nCheckedSigOps = nSigOps;
+        block.fChecked = true;
+    }
+
     return true;
 }
 
+namespace {
+
+/** One context-free check of a block, run on a pre-check thread */
+class CBlockPreCheck
+{
+private:
+    const CBlock *pblock;
+    int nIndex; // transaction to check, or -1 for the header signature
+
+public:
+    CBlockPreCheck() : pblock(NULL), nIndex(-1) {}
+    CBlockPreCheck(const CBlock *pblockIn, int nIndexIn) : pblock(pblockIn), nIndex(nIndexIn) {}
+
+    bool operator()()
+    {
+        if (nIndex < 0)
+            return VerifyScript(pblock->scriptSig, pblock->vtx[0].vout[0].scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, BlockHeaderSignatureChecker(pblock));
+        const CTransaction& tx = pblock->vtx[nIndex];
+        CValidationState state;
+        return tx.IsEncrypted() || CheckTransaction(tx, state);
+    }
+
+    void swap(CBlockPreCheck &check)
+    {
+        std::swap(pblock, check.pblock);
+        std::swap(nIndex, check.nIndex);
+    }
+};
+
+CCheckQueue<CBlockPreCheck> precheckqueue(128);
+
+// Blocks arrive on the message handler and the import thread, but a check
+// queue serves one CCheckQueueControl at a time.
+CCriticalSection cs_precheckqueue;
+
+} // anon namespace
+
+void ThreadBlockPreCheck()
+{
+    RenameThread("gcoin-precheck");
+    precheckqueue.Thread();
+}
+
+void PreCheckBlock(const CBlock& block)
+{
+    if (block.fPreChecked || block.vtx.empty() || block.vtx[0].vout.empty())
+        return;
+    // Transactions we cannot decrypt yet may be decrypted in place later.
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        if (tx.IsEncrypted() && tx.IsNull())
+            return;
+    }
+
+    bool mutated;
+    if (block.GetMerkleRoot(&mutated) != block.hashMerkleRoot || mutated)
+        return;
+
+    std::vector<CBlockPreCheck> vChecks;
+    vChecks.reserve(block.vtx.size() + 1);
+    vChecks.push_back(CBlockPreCheck(&block, -1));
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+        vChecks.push_back(CBlockPreCheck(&block, i));
+
+    bool fValid = true;
+    if (nScriptCheckThreads) {
+        LOCK(cs_precheckqueue);
+        CCheckQueueControl<CBlockPreCheck> control(&precheckqueue);
+        control.Add(vChecks);
+        fValid = control.Wait();
+    } else {
+        for (unsigned int i = 0; i < vChecks.size() && fValid; i++)
+            fValid = vChecks[i]();
+    }
+    block.fPreChecked = fValid;
+}
+
 bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex * const pindexPrev)
 {
     const CChainParams& chainParams = Params();
@@ -4197,7 +4867,7 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
 
     // Write block to history file
     try {
-        unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+        unsigned int nBlockSize = block.fChecked ? block.nCheckedSize : ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
         CDiskBlockPos blockPos;
         if (dbp != NULL)
             blockPos = *dbp;
@@ -4446,6 +5116,7 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 {
     for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        UnmapBlockFile(*it);
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -4549,6 +5220,35 @@ boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char
     return GetDataDir() / "blocks" / strprintf("%s%05u.dat", prefix, pos.nFile);
 }
 
+namespace {
+/** Contiguous storage for the block index entries read at startup */
+CBlockIndex* pBlockIndexArena = NULL;
+size_t nBlockIndexArenaSize = 0;
+
+void FreeBlockIndex(CBlockIndex* pindex)
+{
+    std::less<CBlockIndex*> lt;
+    if (pBlockIndexArena && !lt(pindex, pBlockIndexArena) && lt(pindex, pBlockIndexArena + nBlockIndexArenaSize))
+        return;
+    delete pindex;
+}
+
+void FreeBlockIndexArena()
+{
+    delete[] pBlockIndexArena;
+    pBlockIndexArena = NULL;
+    nBlockIndexArenaSize = 0;
+}
+} // anon namespace
+
+CBlockIndex* AllocateBlockIndexArena(size_t nSize)
+{
+    assert(pBlockIndexArena == NULL);
+    pBlockIndexArena = new CBlockIndex[nSize];
+    nBlockIndexArenaSize = nSize;
+    return pBlockIndexArena;
+}
+
 CBlockIndex * InsertBlockIndex(uint256 hash)
 {
     if (hash.IsNull())
@@ -4572,23 +5272,28 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
 bool static LoadBlockIndexDB()
 {
     const CChainParams& chainparams = Params();
+    int64_t nTimeStart = GetTimeMillis();
     if (!pblocktree->LoadBlockIndexGuts())
         return false;
+    int64_t nTimeGuts = GetTimeMillis();
 
     boost::this_thread::interruption_point();
 
-    // Calculate nChainWork
-    vector<pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
+    // Calculate nChainWork, visiting parents before children. Heights are
+    // dense, so bucket the entries by height instead of sorting them.
+    int nMaxHeight = 0;
     BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        nMaxHeight = std::max(nMaxHeight, item.second->nHeight);
+    vector<size_t> vHeightOffset(nMaxHeight + 2, 0);
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        vHeightOffset[item.second->nHeight + 1]++;
+    for (int nHeight = 1; nHeight <= nMaxHeight + 1; nHeight++)
+        vHeightOffset[nHeight] += vHeightOffset[nHeight - 1];
+    vector<CBlockIndex*> vSortedByHeight(mapBlockIndex.size());
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        vSortedByHeight[vHeightOffset[item.second->nHeight]++] = item.second;
+    BOOST_FOREACH(CBlockIndex* pindex, vSortedByHeight)
     {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
-    }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
-    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
-    {
-        CBlockIndex* pindex = item.second;
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
         // We can link the chain of blocks for which we've received transactions at some point.
         // Pruned nodes may have deleted the block.
@@ -4614,6 +5319,9 @@ bool static LoadBlockIndexDB()
             pindexBestHeader = pindex;
     }
 
+    int64_t nTimeChainWork = GetTimeMillis();
+    LogPrintf("%s: %u entries, load %dms, chain work %dms\n", __func__, mapBlockIndex.size(), nTimeGuts - nTimeStart, nTimeChainWork - nTimeGuts);
+
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
     vinfoBlockFile.resize(nLastBlockFile + 1);
@@ -4667,7 +5375,7 @@ bool static LoadBlockIndexDB()
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
         return true;
-    chainActive.SetTip(it->second);
+    SetActiveTip(it->second);
 
     PruneBlockIndexCandidates();
 
@@ -4690,6 +5398,7 @@ bool UpdateList(const CBlockIndex *pindex)
     // Now: ignore ReadFail Block and continue checking.
     if (!ReadBlockFromDisk(block, pindex))
         return true;
+    CacheApplyLock lock(cs_cacheApply);
     // record the miner
     pblkminer->Add(GetTxOutputAddr(block.vtx[0], 0));
     // scan all transaction (no need to check vtx[0])
@@ -4807,12 +5516,16 @@ void UnloadBlockIndex()
 {
     LOCK(cs_main);
     setBlockIndexCandidates.clear();
-    chainActive.SetTip(NULL);
+    SetActiveTip(NULL);
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
     mempool.clear();
-    mapOrphanTransactions.clear();
-    mapOrphanTransactionsByPrev.clear();
+    ClearPrevoutCache();
+    {
+        LOCK(cs_orphans);
+        mapOrphanTransactions.clear();
+        mapOrphanTransactionsByPrev.clear();
+    }
     nSyncStarted = 0;
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
@@ -4826,10 +5539,14 @@ void UnloadBlockIndex()
     setDirtyFileInfo.clear();
     mapNodeState.clear();
 
-    BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex) {
-        delete entry.second;
+    {
+        LOCK(cs_tipSnapshot);
+        BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex) {
+            FreeBlockIndex(entry.second);
+        }
+        mapBlockIndex.clear();
     }
-    mapBlockIndex.clear();
+    FreeBlockIndexArena();
     fHavePruned = false;
 }
 
@@ -4945,6 +5662,7 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
 
                 // process in case the block isn't known yet
                 if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+                    PreCheckBlock(block);
                     CValidationState state;
                     if (ProcessNewBlock(state, NULL, &block, true, dbp))
                         nLoaded++;
@@ -5239,6 +5957,23 @@ string GetWarnings(string strFor)
 //
 
 
+/**
+ * Whether we already have a transaction, without cs_main. Its coins are looked
+ * up in pcoinsDBView, so a transaction confirmed since the last flush may be
+ * requested once more and is then rejected by AcceptToMemoryPool.
+ */
+bool static AlreadyHaveTx(const uint256& hash)
+{
+    if (mempool.exists(hash))
+        return true;
+    {
+        LOCK(cs_orphans);
+        if (mapOrphanTransactions.count(hash))
+            return true;
+    }
+    return pcoinsDBView != NULL && pcoinsDBView->HaveCoins(hash);
+}
+
 bool static AlreadyHave(const CInv& inv)
 {
     switch (inv.type)
@@ -5247,8 +5982,14 @@ bool static AlreadyHave(const CInv& inv)
         {
             bool txInMap = false;
             txInMap = mempool.exists(inv.hash);
-            return txInMap || mapOrphanTransactions.count(inv.hash) ||
-                pcoinsTip->HaveCoins(inv.hash);
+            if (txInMap)
+                return true;
+            {
+                LOCK(cs_orphans);
+                if (mapOrphanTransactions.count(inv.hash))
+                    return true;
+            }
+            return pcoinsTip->HaveCoins(inv.hash);
         }
     case MSG_BLOCK:
         return mapBlockIndex.count(inv.hash);
@@ -5299,15 +6040,20 @@ void static ProcessGetData(CNode* pfrom)
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
+                    // Send block from disk. The stored bytes are pushed as they
+                    // are, without deserializing the block or decrypting its
+                    // transactions.
+                    RawBlockRef pvchBlock = GetRawBlockForPeer((*mi).second);
+                    if (!pvchBlock)
                         assert(!"cannot load block from disk");
                     if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
+                        pfrom->PushMessage("block", CFlatData((void*)begin_ptr(*pvchBlock), (void*)end_ptr(*pvchBlock)));
                     else { // MSG_FILTERED_BLOCK)
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter) {
+                            CBlock block;
+                            CDataStream ssBlock(*pvchBlock, SER_DISK, CLIENT_VERSION);
+                            ssBlock >> block;
                             CMerkleBlock merkleBlock(block, *pfrom->pfilter);
                             pfrom->PushMessage("merkleblock", merkleBlock);
                             // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
@@ -5461,7 +6207,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         pfrom->fClient = !(pfrom->nServices & NODE_NETWORK);
 
         // Potentially mark this peer as a preferred download peer.
-        UpdatePreferredDownload(pfrom, State(pfrom->GetId()));
+        {
+            LOCK(cs_main);
+            UpdatePreferredDownload(pfrom, State(pfrom->GetId()));
+        }
 
         // Change version
         pfrom->PushMessage("verack");
@@ -5618,10 +6367,9 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             return error("message inv size() = %u", vInv.size());
         }
 
-        LOCK(cs_main);
-
-        std::vector<CInv> vToFetch;
-
+        // Transactions only need the mempool, the orphans and the coins database,
+        // so cs_main is taken for the block announcements alone.
+        std::vector<CInv> vBlockInv;
         for (unsigned int nInv = 0; nInv < vInv.size(); nInv++)
         {
             const CInv &inv = vInv[nInv];
@@ -5629,34 +6377,61 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             boost::this_thread::interruption_point();
             pfrom->AddInventoryKnown(inv);
 
-            bool fAlreadyHave = AlreadyHave(inv);
+            if (inv.type == MSG_BLOCK) {
+                vBlockInv.push_back(inv);
+                continue;
+            }
+
+            bool fAlreadyHave = inv.type == MSG_TX ? AlreadyHaveTx(inv.hash) : AlreadyHave(inv);
             LogPrint("net", "got inv: %s  %s peer=%d\n", inv.ToString(), fAlreadyHave ? "have" : "new", pfrom->id);
 
-            if (!fAlreadyHave && !fImporting && !fReindex && inv.type != MSG_BLOCK)
+            if (!fAlreadyHave && !fImporting && !fReindex)
                 pfrom->AskFor(inv);
 
-            if (inv.type == MSG_BLOCK) {
-                UpdateBlockAvailability(pfrom->GetId(), inv.hash);
-                if (!fAlreadyHave && !fImporting && !fReindex && !mapBlocksInFlight.count(inv.hash)) {
-                    // First request the headers preceding the announced block. In the normal fully-synced
-                    // case where a new block is announced that succeeds the current tip (no reorganization),
-                    // there are no such headers.
-                    // Secondly, and only when we are close to being synced, we request the announced block directly,
-                    // to avoid an extra round-trip. Note that we must *first* ask for the headers, so by the
-                    // time the block arrives, the header chain leading up to it is already validated. Not
-                    // doing this will result in the received block being rejected as an orphan in case it is
-                    // not a direct successor.
-                    pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), inv.hash);
-                    CNodeState *nodestate = State(pfrom->GetId());
-                    if (chainActive.Tip()->GetBlockTime() > GetAdjustedTime() - chainparams.GetConsensus().nPowTargetSpacing * 20 &&
-                        nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
-                        vToFetch.push_back(inv);
-                        // Mark block as in flight already, even though the actual "getdata" message only goes out
-                        // later (within the same cs_main lock, though).
-                        MarkBlockAsInFlight(pfrom->GetId(), inv.hash, chainparams.GetConsensus());
-                    }
-                    LogPrint("net", "getheaders (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+            // Track requests for our stuff
+            GetMainSignals().Inventory(inv.hash);
+
+            if (pfrom->nSendSize > (SendBufferSize() * 2)) {
+                LOCK(cs_main);
+                Misbehaving(pfrom->GetId(), 50);
+                return error("send buffer size() = %u", pfrom->nSendSize);
+            }
+        }
+
+        if (vBlockInv.empty())
+            return true;
+
+        LOCK(cs_main);
+
+        std::vector<CInv> vToFetch;
+
+        BOOST_FOREACH(const CInv& inv, vBlockInv)
+        {
+            boost::this_thread::interruption_point();
+
+            bool fAlreadyHave = AlreadyHave(inv);
+            LogPrint("net", "got inv: %s  %s peer=%d\n", inv.ToString(), fAlreadyHave ? "have" : "new", pfrom->id);
+
+            UpdateBlockAvailability(pfrom->GetId(), inv.hash);
+            if (!fAlreadyHave && !fImporting && !fReindex && !mapBlocksInFlight.count(inv.hash)) {
+                // First request the headers preceding the announced block. In the normal fully-synced
+                // case where a new block is announced that succeeds the current tip (no reorganization),
+                // there are no such headers.
+                // Secondly, and only when we are close to being synced, we request the announced block directly,
+                // to avoid an extra round-trip. Note that we must *first* ask for the headers, so by the
+                // time the block arrives, the header chain leading up to it is already validated. Not
+                // doing this will result in the received block being rejected as an orphan in case it is
+                // not a direct successor.
+                pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), inv.hash);
+                CNodeState *nodestate = State(pfrom->GetId());
+                if (chainActive.Tip()->GetBlockTime() > GetAdjustedTime() - chainparams.GetConsensus().nPowTargetSpacing * 20 &&
+                    nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+                    vToFetch.push_back(inv);
+                    // Mark block as in flight already, even though the actual "getdata" message only goes out
+                    // later (within the same cs_main lock, though).
+                    MarkBlockAsInFlight(pfrom->GetId(), inv.hash, chainparams.GetConsensus());
                 }
+                LogPrint("net", "getheaders (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
             }
 
             // Track requests for our stuff
@@ -5787,7 +6562,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         bool fMissingInputs = false;
         CValidationState state;
 
-        mapAlreadyAskedFor.erase(inv);
+        {
+            LOCK(cs_mapAlreadyAskedFor);
+            mapAlreadyAskedFor.erase(inv);
+        }
         if (tx.IsEncrypted() && tx.IsNull()) {
             if (!TryDecryptTx(tx)) {
                 LogPrint("mempool", "Unverifiable confidential tx %s received\n",
@@ -5808,6 +6586,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 mempool.mapTx.size());
 
             // Recursively process any orphan transactions that depended on this one
+            LOCK(cs_orphans);
             set<NodeId> setMisbehaving;
             for (unsigned int i = 0; i < vWorkQueue.size(); i++)
             {
@@ -5957,6 +6736,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         pfrom->AddInventoryKnown(inv);
 
+        // The context-free checks don't need cs_main, get them out of the way
+        // before ProcessNewBlock takes it.
+        PreCheckBlock(block);
+
         CValidationState state;
         // Process all blocks from whitelisted peers, even if not requested.
         ProcessNewBlock(state, pfrom, &block, pfrom->fWhitelisted, NULL);
@@ -5980,7 +6763,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     // the getaddr message mitigates the attack.
     else if ((strCommand == "getaddr") && (pfrom->fInbound))
     {
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_addrSend);
+            pfrom->vAddrToSend.clear();
+        }
         vector<CAddress> vAddr = addrman.GetAddr();
         BOOST_FOREACH(const CAddress &addr, vAddr)
             pfrom->PushAddress(addr);
@@ -6331,6 +7117,10 @@ bool ProcessMessages(CNode* pfrom)
 }
 
 
+/** Time of the last address rebroadcast, shared by all message handler threads */
+static int64_t nLastRebroadcast = 0;
+static CCriticalSection cs_rebroadcast;
+
 bool SendMessages(CNode* pto, bool fSendTrickle)
 {
     const Consensus::Params& consensusParams = Params().GetConsensus();
@@ -6373,21 +7163,25 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             return true;
 
         // Address refresh broadcast
-        static int64_t nLastRebroadcast;
-        if (!IsInitialBlockDownload() && (GetTime() - nLastRebroadcast > 24 * 60 * 60))
         {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodes)
+            LOCK(cs_rebroadcast);
+            if (!IsInitialBlockDownload() && (GetTime() - nLastRebroadcast > 24 * 60 * 60))
             {
-                // Periodically clear addrKnown to allow refresh broadcasts
-                if (nLastRebroadcast)
-                    pnode->addrKnown.clear();
+                LOCK(cs_vNodes);
+                BOOST_FOREACH(CNode* pnode, vNodes)
+                {
+                    // Periodically clear addrKnown to allow refresh broadcasts
+                    if (nLastRebroadcast) {
+                        LOCK(pnode->cs_addrSend);
+                        pnode->addrKnown.clear();
+                    }
 
-                // Rebroadcast our address
-                AdvertizeLocal(pnode);
+                    // Rebroadcast our address
+                    AdvertizeLocal(pnode);
+                }
+                if (!vNodes.empty())
+                    nLastRebroadcast = GetTime();
             }
-            if (!vNodes.empty())
-                nLastRebroadcast = GetTime();
         }
 
         //
@@ -6395,6 +7189,7 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         //
         if (fSendTrickle)
         {
+            LOCK(pto->cs_addrSend);
             vector<CAddress> vAddr;
             vAddr.reserve(pto->vAddrToSend.size());
             BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
@@ -6607,8 +7402,9 @@ public:
         // block headers
         BlockMap::iterator it1 = mapBlockIndex.begin();
         for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
+            FreeBlockIndex((*it1).second);
         mapBlockIndex.clear();
+        FreeBlockIndexArena();
 
         // orphan transactions
         mapOrphanTransactions.clear();
@@ -6620,34 +7416,28 @@ bool Fee::CheckFee(const type_Color& Color, const int64_t& Value) const {
     return Color == color && Value >= value;
 }
 
-bool Fee::CheckFirstCoinBaseTransactions(const CBlock& block) const {
-    CAmount totalfee = 0;
-    bool fEncrypted = false;
-    for (unsigned int i = 1; i < block.vtx.size(); i++) {
-        const CTransaction& tx = block.vtx[i];
-        if (tx.type == NORMAL) {
-            if (tx.IsEncrypted() && tx.IsNull()) {
-                fEncrypted = true;
-                continue;
-            }
-            // Fee needed.
-            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
-                TxInfo txinfo;
-                if (!txinfo.init(txin.prevout, &block)) {
-                    LogPrintf("%s : fetch input failed\n", __func__);
-                    return false;
-                }
-
-                if (txinfo.GetTxOutColorOfIndex(txin.prevout.n) == color)
-                    totalfee += txinfo.GetTxOutValueOfIndex(txin.prevout.n);
-            }
-
-            BOOST_FOREACH(const CTxOut& txout, tx.vout) {
-                if (txout.color == TxFee.GetColor())
-                    totalfee -= txout.nValue;
-            }
-        }
+CAmount Fee::GetTxFee(const CTransaction& tx, const CCoinsViewCache& view) const {
+    CAmount fee = 0;
+    if (tx.type != NORMAL)
+        return fee;
+    BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+        const CTxOut& prevout = view.GetOutputFor(txin);
+        if (prevout.color == color)
+            fee += prevout.nValue;
     }
+    BOOST_FOREACH(const CTxOut& txout, tx.vout) {
+        if (txout.color == color)
+            fee -= txout.nValue;
+    }
+    return fee;
+}
+
+bool Fee::CheckFirstCoinBaseTransactions(const CBlock& block, const std::vector<CAmount>& vTxFees, bool fEncrypted) const {
+    if (vTxFees.size() != block.vtx.size())
+        return false;
+    CAmount totalfee = 0;
+    for (unsigned int i = 1; i < vTxFees.size(); i++)
+        totalfee += vTxFees[i];
 
     const CTransaction& tx = block.vtx[0];
     if (!tx.IsCoinBase())
@@ -93,6 +93,16 @@ static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 static const unsigned int DATABASE_FLUSH_INTERVAL = 24 * 60 * 60;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
+/** -blockservecache default (MiB of recently served raw blocks kept in memory) */
+static const unsigned int DEFAULT_BLOCK_SERVE_CACHE = 32;
+/** -blockmmapfiles default (block files kept memory-mapped for reading, 0 to read with stdio) */
+static const unsigned int DEFAULT_BLOCK_MMAP_FILES = 8;
+/** -blockreadcache default (recently read blocks kept deserialized in memory) */
+static const unsigned int DEFAULT_BLOCK_READ_CACHE = 32;
+/** Default for -maxmempool, maximum megabytes of mempool memory usage */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
+static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
 /** Default control color */
 static const type_Color DEFAULT_ADMIN_COLOR = 0x0000;
 
@@ -106,6 +116,16 @@ extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
 typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
 extern BlockMap mapBlockIndex;
+/**
+ * Taken after cs_main whenever the active tip changes or mapBlockIndex
+ * grows at runtime, so the two functions below can be used without cs_main.
+ * Entries loaded at startup are inserted before RPC leaves warmup.
+ */
+extern CCriticalSection cs_tipSnapshot;
+/** The active chain tip as of the last tip change. Does not require cs_main. */
+const CBlockIndex* GetTipSnapshot();
+/** Find a block index entry by hash. Does not require cs_main. */
+const CBlockIndex* LookupBlockIndex(const uint256& hash);
 extern uint64_t nLastBlockTx;
 extern uint64_t nLastBlockSize;
 extern const std::string strMessageMagic;
@@ -195,6 +215,12 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the thread reading block inputs ahead of ConnectBlock */
+void ThreadCoinsPrefetch();
+/** Number of input coins the prefetch threads have handed to pcoinsTip so far */
+uint64_t GetPrefetchedCoinsCount();
+/** Run an instance of the block pre-check thread */
+void ThreadBlockPreCheck();
 /** Try to detect Partition (network isolation) attacks against us */
 void PartitionCheck(bool (*initialDownloadCheck)(), CCriticalSection& cs, const CBlockIndex *const &bestHeader, int64_t nPowTargetSpacing);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -206,6 +232,8 @@ bool GetCoinsFromCache(const COutPoint &outpoint, CCoins &coins, bool fUseMempoo
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
 
 bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock, const CBlock *pblock = NULL, bool fAllowSlow = false);
+/** Retrieve a transaction from the transaction index only. Does not require cs_main. */
+bool GetTransactionFromTxIndex(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock);
 
 /** Find the best known block, and make it the tip of the block chain */
 bool ActivateBestChain(CValidationState &state, CBlock *pblock = NULL);
@@ -235,6 +263,9 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune);
 
 /** Create a new block index entry for a given block hash */
 CBlockIndex * InsertBlockIndex(uint256 hash);
+/** Allocate nSize contiguous block index entries for loading the index at startup.
+ *  They are released together with mapBlockIndex and must not be deleted individually. */
+CBlockIndex* AllocateBlockIndexArena(size_t nSize);
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 /** Increase a node's misbehavior score. */
@@ -375,6 +406,29 @@ bool GeneralCheckValid(const CTransaction& tx, CValidationState &state,
 
 }  // namespace type_transaction_handler
 
+/** Maximum number of entries in the prevout cache */
+static const unsigned int MAX_PREVOUT_CACHE_SIZE = 100000;
+
+/*!
+ * @brief   Remember the outputs spent by tx, as resolved from view, in the
+ *          prevout cache.
+ * @param   nHeight Only outputs confirmed below this height are cached, which
+ *          leaves out the mempool and the block being connected.
+ */
+void AddPrevoutsToCache(const CTransaction& tx, const CCoinsViewCache& view, int nHeight);
+
+/*!
+ * @brief   Drop the outputs spent by tx from the prevout cache.
+ */
+void ErasePrevoutsFromCache(const CTransaction& tx);
+
+/*!
+ * @brief   Drop the outputs created by tx from the prevout cache.
+ */
+void EraseOutputsFromCache(const CTransaction& tx);
+
+void ClearPrevoutCache();
+
 // An interface to fetch transaction
 class TxInfo
 {
@@ -382,7 +436,7 @@ public:
     TxInfo() {
         SetNull();
     }
-    TxInfo(const CTransaction& tx) : hash(tx.GetHash()), vout(tx.vout), type(tx.type) {}
+    TxInfo(const CTransaction& tx) : hash(tx.GetHash()), vout(tx.vout), type(tx.type), nAddrIndex(-1) {}
     bool init(const COutPoint &outpoint, const CBlock *block = NULL, bool fUndo = false);
     std::string GetTxOutAddressOfIndex(unsigned int index) const;
     CScript GetTxOutScriptOfIndex(unsigned int index) const;
@@ -395,10 +449,17 @@ private:
     uint256 hash;
     std::vector<CTxOut> vout;
     tx_type type;
+    //! Address of output nAddrIndex, when resolved through the prevout cache.
+    //! vout then holds only that output and every other index is rejected.
+    std::string strAddr;
+    int nAddrIndex;
+    const CTxOut& GetTxOut(unsigned int index, const char *pszCaller) const;
     void SetNull() {
         hash.SetNull();
         vout.clear();
         type = 0;
+        strAddr.clear();
+        nAddrIndex = -1;
     }
 };
 
@@ -552,6 +613,10 @@ bool WriteCacheToDisk(const int nHeight);
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/** Read the serialized bytes of a block without deserializing them. The
+ *  magic bytes and length stored in front of the block are checked. */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -571,6 +636,15 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = t
 
 bool CheckBlockHeaderSignature(const CBlock& block, CValidationState& state);
 
+/**
+ * Verify the merkle root, the header signature and CheckTransaction of every
+ * transaction of a block on the pre-check threads, without holding cs_main.
+ * When everything passes block.fPreChecked is set and CheckBlock and
+ * CheckBlockHeaderSignature skip that work later; otherwise nothing is
+ * recorded and the failure is reported by the regular checks.
+ */
+void PreCheckBlock(const CBlock& block);
+
 /** Context-dependent validity checks */
 bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex *pindexPrev);
 bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIndex *pindexPrev);
@@ -668,6 +742,13 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/**
+ * The coins database below pcoinsTip, read through the same error handling.
+ * It may be read from any thread without cs_main, but lacks whatever pcoinsTip
+ * has not flushed yet.
+ */
+extern CCoinsView *pcoinsDBView;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
@@ -683,7 +764,13 @@ private:
 public:
     inline Fee(type_Color Color, int64_t Value) : color(Color), value(Value) { }
     bool CheckFee(const type_Color& color, const int64_t& Value) const;
-    bool CheckFirstCoinBaseTransactions(const CBlock& block) const;
+    /** Fee color paid by a NORMAL tx (inputs minus outputs), 0 for other types. Inputs must be in view. */
+    CAmount GetTxFee(const CTransaction& tx, const CCoinsViewCache& view) const;
+    /**
+     * Check the coinbase collects exactly the fees of the block. vTxFees holds GetTxFee of each
+     * tx of the block; fEncrypted is set if the block has encrypted txs we were unable to decrypt.
+     */
+    bool CheckFirstCoinBaseTransactions(const CBlock& block, const std::vector<CAmount>& vTxFees, bool fEncrypted) const;
     void SetOutputForFee(CTxOut &txout, const CScript& scriptPubKeyIn, unsigned int cnt);
     type_Color GetColor() const { return color; }
     int64_t GetFee() const { return value;}
@@ -693,5 +780,25 @@ public:
 extern Fee TxFee;
 extern std::string ConsensusAddressForLicense;
 extern std::string ConsensusAddressForMiner;
+extern CScriptID ConsensusScriptIDForLicense;
+extern CScriptID ConsensusScriptIDForMiner;
+
+/*!
+ * @brief   Set the license and miner consensus addresses. A null id clears
+ *          the address.
+ */
+void SetConsensusAddresses(const CScriptID& licenseID, const CScriptID& minerID);
+
+/*!
+ * @brief   Derive the license and miner consensus addresses from the
+ *          multisig redeem scripts of the current alliance.
+ */
+void UpdateConsensusAddresses();
+
+/*!
+ * @brief   Checks whether a script pays to the given script id, comparing the
+ *          hash in place. A null id matches nothing.
+ */
+bool IsPayToScriptID(const CScript& script, const CScriptID& id);
 
 #endif // BITCOIN_MAIN_H
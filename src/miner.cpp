@@ -156,12 +156,15 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet *pwallet,
         map<uint256, vector<COrphan*> > mapDependers;
         bool fPrintPriority = GetBoolArg("-printpriority", false);
 
-        // This vector will be sorted into a priority queue:
+        // This vector will be sorted into a priority queue. Walking the fee rate
+        // index from the top fills it in fee order, so make_heap has little left
+        // to do when sorting by fee.
         vector<TxPriority> vecPriority;
         vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi) {
-            const CTransaction& tx = mi->second.GetTx();
+        typedef CTxMemPool::indexed_transaction_set::index<fee_rate>::type::reverse_iterator feeriter;
+        for (feeriter mi = mempool.mapTx.get<fee_rate>().rbegin();
+             mi != mempool.mapTx.get<fee_rate>().rend(); ++mi) {
+            const CTransaction& tx = mi->GetTx();
             if (!IsFinalTx(tx, nHeight, pblock->nTime))
                 continue;
 
@@ -180,7 +183,8 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet *pwallet,
                         // This should never happen; all transactions in the memory
                         // pool should connect to either transactions in the chain
                         // or other transactions in the memory pool.
-                        if (!mempool.mapTx.count(txin.prevout.hash))
+                        CTxMemPool::txiter itParent = mempool.mapTx.find(txin.prevout.hash);
+                        if (itParent == mempool.mapTx.end())
                         {
                             LogPrintf("ERROR: mempool transaction missing input\n");
                             if (fDebug) assert("mempool transaction missing input" == 0);
@@ -199,7 +203,7 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet *pwallet,
                         }
                         mapDependers[txin.prevout.hash].push_back(porphan);
                         porphan->setDependsOn.insert(txin.prevout.hash);
-                        nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
+                        nTotalIn += itParent->GetTx().vout[txin.prevout.n].nValue;
                         continue;
                     }
 
@@ -231,7 +235,7 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet *pwallet,
                 porphan->feeRate = feeRate;
             }
             else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
+                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->GetTx()));
         }
 
         // Collect transactions into block
@@ -288,32 +292,19 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet *pwallet,
             if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
                 continue;
 
+            // Fee has to be taken before UpdateCoins spends the inputs
+            CAmount nTxFees = TxFee.GetTxFee(tx, view);
+
             UpdateCoins(tx, state, view, nHeight);
 
             // Added
             pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(0);
+            pblocktemplate->vTxFees.push_back(nTxFees);
             pblocktemplate->vTxSigOps.push_back(nTxSigOps);
             nBlockSize += nTxSize;
             ++nBlockTx;
             nBlockSigOps += nTxSigOps;
-
-            if (tx.type == NORMAL) {
-                BOOST_FOREACH(const CTxIn& txin, tx.vin) {
-                    TxInfo txinfo;
-                    if (!txinfo.init(txin.prevout)) {
-                        throw std::runtime_error("CreateNewBlock() : fetch input failed");
-                    }
-
-                    if (txinfo.GetTxOutColorOfIndex(txin.prevout.n) == TxFee.GetColor())
-                        totalfee += txinfo.GetTxOutValueOfIndex(txin.prevout.n);
-                }
-
-                BOOST_FOREACH(const CTxOut& txout, tx.vout) {
-                    if (txout.color == TxFee.GetColor())
-                        totalfee -= txout.nValue;
-                }
-            }
+            totalfee += nTxFees;
 
             if (fPrintPriority)
             {
@@ -356,7 +347,7 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet *pwallet,
         }
 
         pblock->vtx[0] = txNew;
-        pblocktemplate->vTxFees[0] = -txNew.vout[0].nValue;
+        pblocktemplate->vTxFees[0] = -totalfee;
 
         nLastBlockTx = nBlockTx;
         nLastBlockSize = nBlockSize;
@@ -400,23 +391,18 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int&
     assert(txCoinbase.vin[0].scriptSig.size() <= 100);
 
     pblock->vtx[0] = txCoinbase;
-    pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+    // Only the coinbase changed, so rehash just its branch of the tree.
+    pblock->hashMerkleRoot = pblock->UpdateMerkleLeaf(0);
 }
 
 
-#ifdef ENABLE_WALLET
-//////////////////////////////////////////////////////////////////////////////
-//
-// Internal miner
-//
-
 //
 // ScanHash scans nonces looking for a hash with at least some zero bits.
 // The nonce is usually preserved between calls, but periodically or if the
 // nonce is 0xffff0000 or above, the block is rebuilt and nNonce starts over at
 // zero.
 //
-bool static ScanHash(const CBlockHeader *pblock, uint32_t& nNonce, uint256 *phash)
+bool ScanHash(const CBlockHeader *pblock, uint32_t& nNonce, uint256 *phash)
 {
     // Write the first 76 bytes of the block header to a double-SHA256 state.
     CHash256 hasher;
@@ -443,6 +429,12 @@ bool static ScanHash(const CBlockHeader *pblock, uint32_t& nNonce, uint256 *phas
     }
 }
 
+#ifdef ENABLE_WALLET
+//////////////////////////////////////////////////////////////////////////////
+//
+// Internal miner
+//
+
 CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey)
 {
     CPubKey pubkey;
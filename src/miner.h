@@ -32,6 +32,9 @@ CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey);
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 
+/** Scan nonces of the block header for a hash with at least 16 leading zero bits */
+bool ScanHash(const CBlockHeader *pblock, uint32_t& nNonce, uint256 *phash);
+
 void UpdateTime(CBlock* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
 
 #endif // BITCOIN_MINER_H
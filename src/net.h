@@ -60,6 +60,16 @@ static const bool DEFAULT_UPNP = USE_UPNP;
 #else
 static const bool DEFAULT_UPNP = false;
 #endif
+/** -msghandthreads default: number of message handler worker threads */
+static const int DEFAULT_MSGHAND_THREADS = 4;
+/** Maximum number of message handler worker threads */
+static const int MAX_MSGHAND_THREADS = 16;
+/** -socketevents default */
+#ifdef HAVE_SYS_EPOLL_H
+static const char DEFAULT_SOCKETEVENTS[] = "epoll";
+#else
+static const char DEFAULT_SOCKETEVENTS[] = "select";
+#endif
 /** The maximum number of entries in mapAskFor */
 static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
 
@@ -78,6 +88,8 @@ unsigned short GetListenPort();
 bool BindListenPort(const CService &bindAddr, std::string& strError, bool fWhitelisted = false);
 void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
 bool StopNode();
+/** Whether -socketevents asks for epoll, which is not limited to FD_SETSIZE descriptors like select() */
+bool SocketEventsUseEpoll();
 void SocketSendData(CNode *pnode);
 
 typedef int NodeId;
@@ -149,6 +161,7 @@ extern std::map<CInv, CDataStream> mapRelay;
 extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
 extern limitedmap<CInv, int64_t> mapAlreadyAskedFor;
+extern CCriticalSection cs_mapAlreadyAskedFor;
 
 extern std::vector<std::string> vAddedNodes;
 extern CCriticalSection cs_vAddedNodes;
@@ -282,6 +295,11 @@ public:
     CBloomFilter* pfilter;
     int nRefCount;
     NodeId id;
+
+    // Socket readiness as reported by the edge-triggered epoll loop and not
+    // yet acted on. Only touched by the socket handler thread.
+    bool fSocketRecvReady;
+    bool fSocketSendReady;
 protected:
 
     // Denial-of-service detection/prevention
@@ -305,6 +323,9 @@ public:
     // flood relay
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
+    // Guards vAddrToSend and addrKnown, which other peers' message handler
+    // workers touch when relaying addresses
+    CCriticalSection cs_addrSend;
     bool fGetAddr;
     std::set<uint256> setKnown;
 
@@ -385,6 +406,7 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
+        LOCK(cs_addrSend);
         addrKnown.insert(addr.GetKey());
     }
 
@@ -393,6 +415,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_addrSend);
         if (addr.IsValid() && !addrKnown.contains(addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand() % vAddrToSend.size()] = addr;
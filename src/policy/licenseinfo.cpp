@@ -4,6 +4,53 @@
 
 #include "licenseinfo.h"
 
+#include "hash.h"
+#include "sync.h"
+
+#include <list>
+#include <map>
+
+namespace {
+
+typedef std::list<std::pair<uint256, CLicenseInfo> > LicenseInfoList;
+
+/** Decoded license information by hash of the encoded info, most recently
+ *  used first. */
+CCriticalSection cs_licenseInfoCache;
+LicenseInfoList listLicenseInfo;
+std::map<uint256, LicenseInfoList::iterator> mapLicenseInfo;
+
+bool GetCachedLicenseInfo(const std::string& hexStr, CLicenseInfo& info)
+{
+    const uint256 hash = Hash(hexStr.begin(), hexStr.end());
+    {
+        LOCK(cs_licenseInfoCache);
+        std::map<uint256, LicenseInfoList::iterator>::iterator mi = mapLicenseInfo.find(hash);
+        if (mi != mapLicenseInfo.end()) {
+            listLicenseInfo.splice(listLicenseInfo.begin(), listLicenseInfo, mi->second);
+            info = mi->second->second;
+            return true;
+        }
+    }
+
+    // Only valid info is cached, a tx carrying invalid info gets rejected.
+    if (!info.DecodeInfo(hexStr))
+        return false;
+
+    LOCK(cs_licenseInfoCache);
+    if (mapLicenseInfo.count(hash))
+        return true;
+    listLicenseInfo.push_front(std::make_pair(hash, info));
+    mapLicenseInfo[hash] = listLicenseInfo.begin();
+    while (listLicenseInfo.size() > MAX_LICENSE_INFO_CACHE_SIZE) {
+        mapLicenseInfo.erase(listLicenseInfo.back().first);
+        listLicenseInfo.pop_back();
+    }
+    return true;
+}
+
+} // anon namespace
+
 
 CLicenseInfo::CLicenseInfo() : nVersion(1), name(""), description(""), issuer(""), fDivisibility(true),
     feeType(FIXED), nFeeRate(0), feeCollectorAddr(""), nLimit(0), mintSchedule(FREE), fMemberControl(false),
@@ -49,3 +96,33 @@ bool CLicenseInfo::IsValid()
     else
         return true;
 }
+
+bool DecodeLicenseInfo(const CScript& scriptInfo, CLicenseInfo& info)
+{
+    // Which info a LICENSE carries is consensus critical and has always been
+    // ParseHex(scriptInfo.ToString().substr(10)). For OP_RETURN followed only by
+    // pushes of more than 4 bytes that is the concatenated push data. Any other
+    // script (short pushes shown as numbers, trailing opcodes, no OP_RETURN...)
+    // goes through the original expression to keep the verdict it always had.
+    CScript::const_iterator pc = scriptInfo.begin();
+    opcodetype opcode;
+    std::vector<unsigned char> vch;
+    std::string hexStr;
+    bool fPushesOnly = scriptInfo.GetOp(pc, opcode) && opcode == OP_RETURN && pc < scriptInfo.end();
+    while (fPushesOnly && pc < scriptInfo.end()) {
+        if (!scriptInfo.GetOp(pc, opcode, vch) || opcode > OP_PUSHDATA4 || vch.size() <= 4)
+            fPushesOnly = false;
+        else
+            hexStr.append(vch.begin(), vch.end());
+    }
+    if (!fPushesOnly) {
+        std::vector<unsigned char> vchInfo = ParseHex(scriptInfo.ToString().substr(10));
+        hexStr.assign(vchInfo.begin(), vchInfo.end());
+    }
+    return GetCachedLicenseInfo(hexStr, info);
+}
+
+bool DecodeLicenseInfo(const std::string& hexStr, CLicenseInfo& info)
+{
+    return GetCachedLicenseInfo(hexStr, info);
+}
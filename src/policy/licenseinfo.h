@@ -117,25 +117,30 @@ public:
      * @return  True if license information is valid.
      */
     bool IsValid();
-
-    inline CLicenseInfo& operator=(const CLicenseInfo& rhs)
-    {
-        nVersion = rhs.nVersion;
-        name = rhs.name;
-        description = rhs.description;
-        issuer = rhs.issuer;
-        fDivisibility = rhs.fDivisibility;
-        feeType = rhs.feeType;
-        nFeeRate = rhs.nFeeRate;
-        feeCollectorAddr = rhs.feeCollectorAddr;
-        nLimit = rhs.nLimit;
-        mintSchedule = rhs.mintSchedule;
-        fMemberControl = rhs.fMemberControl;
-        metadataLink = rhs.metadataLink;
-        metadataHash = rhs.metadataHash;
-
-        return *this;
-    }
 };
 
+/** Number of decoded license information kept by DecodeLicenseInfo */
+static const unsigned int MAX_LICENSE_INFO_CACHE_SIZE = 1000;
+
+/*!
+ * @brief   Decode the license information carried by a LICENSE transaction
+ *          output ("OP_RETURN <encoded info>"). The info is what
+ *          ParseHex(scriptInfo.ToString().substr(10)) yields, as it always was;
+ *          the common form is read straight from the pushed bytes. Decoded
+ *          results are kept in a bounded cache, so mempool acceptance and block
+ *          validation decode it only once.
+ * @param   scriptInfo  The script of the output carrying the info.
+ * @param   info        The decoded license information.
+ * @return  True if the script carries valid license information.
+ */
+bool DecodeLicenseInfo(const CScript& scriptInfo, CLicenseInfo& info);
+
+/*!
+ * @brief   Decode the given hex string through the same cache as above.
+ * @param   hexStr  The hex string to be decoded.
+ * @param   info    The decoded license information.
+ * @return  True if the decoding process is successful.
+ */
+bool DecodeLicenseInfo(const string& hexStr, CLicenseInfo& info);
+
 #endif
@@ -10,12 +10,22 @@
 #include "tinyformat.h"
 #include "utilstrencodings.h"
 #include "crypto/common.h"
+#include "crypto/sha256.h"
 
 uint256 CBlockHeader::GetHash() const
 {
     return SerializeHash(*this);
 }
 
+/** Number of nodes in the merkle tree of a block with nLeaves transactions. */
+static size_t MerkleTreeSize(size_t nLeaves)
+{
+    size_t nNodes = 0;
+    for (size_t nSize = nLeaves; nSize > 1; nSize = (nSize + 1) / 2)
+        nNodes += nSize;
+    return nLeaves ? nNodes + 1 : 0;
+}
+
 uint256 CBlock::BuildMerkleTree(bool* fMutated) const
 {
     /* WARNING! If you're reading this because you're learning about crypto
@@ -61,24 +71,67 @@ uint256 CBlock::BuildMerkleTree(bool* fMutated) const
     bool mutated = false;
     for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
     {
-        for (int i = 0; i < nSize; i += 2)
-        {
-            int i2 = std::min(i+1, nSize-1);
-            if (i2 == i + 1 && i2 + 1 == nSize && vMerkleTree[j+i] == vMerkleTree[j+i2]) {
-                // Two identical hashes at the end of the list at a particular level.
-                mutated = true;
-            }
-            vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                       BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
+        if (nSize % 2 == 0 && vMerkleTree[j+nSize-2] == vMerkleTree[j+nSize-1]) {
+            // Two identical hashes at the end of the list at a particular level.
+            mutated = true;
+        }
+        // Sibling hashes are adjacent in vMerkleTree, so every complete pair
+        // of a level is one contiguous 64-byte input and the whole level can
+        // be hashed in a single batch.
+        int nPairs = nSize / 2;
+        vMerkleTree.resize(j + nSize + (nSize + 1) / 2);
+        SHA256D64(vMerkleTree[j+nSize].begin(), vMerkleTree[j].begin(), nPairs);
+        if (nSize % 2) {
+            // An odd last hash is paired with itself.
+            const uint256& last = vMerkleTree[j+nSize-1];
+            vMerkleTree[j+nSize+nPairs] = Hash(BEGIN(last), END(last), BEGIN(last), END(last));
         }
         j += nSize;
     }
+    fMerkleMutated = mutated;
     if (fMutated) {
         *fMutated = mutated;
     }
     return (vMerkleTree.empty() ? uint256() : vMerkleTree.back());
 }
 
+uint256 CBlock::GetMerkleRoot(bool* fMutated) const
+{
+    // Comparing the cached txids is far cheaper than rehashing the tree.
+    bool fCurrent = !vtx.empty() && vMerkleTree.size() == MerkleTreeSize(vtx.size());
+    for (unsigned int i = 0; fCurrent && i < vtx.size(); i++)
+        fCurrent = (vMerkleTree[i] == vtx[i].GetHash());
+    if (!fCurrent)
+        return BuildMerkleTree(fMutated);
+    if (fMutated) {
+        *fMutated = fMerkleMutated;
+    }
+    return vMerkleTree.back();
+}
+
+uint256 CBlock::UpdateMerkleLeaf(unsigned int nIndex) const
+{
+    ClearCheckCache();
+    if (nIndex >= vtx.size() || vMerkleTree.size() != MerkleTreeSize(vtx.size()))
+        return BuildMerkleTree();
+    vMerkleTree[nIndex] = vtx[nIndex].GetHash();
+    int j = 0;
+    bool mutated = false;
+    for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
+    {
+        if (nSize % 2 == 0 && vMerkleTree[j+nSize-2] == vMerkleTree[j+nSize-1])
+            mutated = true;
+        int i = nIndex & ~1u;
+        int i2 = std::min(i+1, nSize-1);
+        vMerkleTree[j+nSize+nIndex/2] = Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
+                                             BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2]));
+        nIndex >>= 1;
+        j += nSize;
+    }
+    fMerkleMutated = mutated;
+    return vMerkleTree.back();
+}
+
 std::vector<uint256> CBlock::GetMerkleBranch(int nIndex) const
 {
     if (vMerkleTree.empty())
@@ -81,6 +81,15 @@ public:
 
     // memory only
     mutable std::vector<uint256> vMerkleTree;
+    mutable bool fMerkleMutated;
+    // Results of the context-free checks in CheckBlock, valid once fChecked
+    // is set (by a CheckBlock pass that verified both PoW and merkle root).
+    mutable bool fChecked;
+    mutable unsigned int nCheckedSize;
+    mutable unsigned int nCheckedSigOps;
+    // Set by PreCheckBlock once the merkle root, the header signature and
+    // CheckTransaction of every transaction have been verified.
+    mutable bool fPreChecked;
 
     // sign blockheader
     CScript scriptSig;
@@ -103,14 +112,32 @@ public:
         READWRITE(*(CBlockHeader*)this);
         READWRITE(vtx);
         READWRITE(scriptSig);
+        if (ser_action.ForRead())
+            ClearCache();
+    }
+
+    void ClearCache() const
+    {
+        vMerkleTree.clear();
+        fMerkleMutated = false;
+        ClearCheckCache();
+    }
+
+    // Forget the CheckBlock and PreCheckBlock results after vtx changed.
+    void ClearCheckCache() const
+    {
+        fChecked = false;
+        nCheckedSize = 0;
+        nCheckedSigOps = 0;
+        fPreChecked = false;
     }
 
     void SetNull()
     {
         CBlockHeader::SetNull();
         vtx.clear();
-        vMerkleTree.clear();
         scriptSig.clear();
+        ClearCache();
     }
 
     CBlockHeader GetBlockHeader() const
@@ -131,6 +158,16 @@ public:
     // merkle root).
     uint256 BuildMerkleTree(bool* mutated = NULL) const;
 
+    // Like BuildMerkleTree, but reuses the in-memory merkle tree when its
+    // leaves still match the transactions of this block.
+    uint256 GetMerkleRoot(bool* mutated = NULL) const;
+
+    // Recompute only the path from leaf nIndex to the root after vtx[nIndex]
+    // was replaced, e.g. the coinbase on an extra-nonce bump. Falls back to
+    // BuildMerkleTree when no tree of the right shape has been built yet.
+    // The check results cached by CheckBlock are dropped.
+    uint256 UpdateMerkleLeaf(unsigned int nIndex) const;
+
     std::vector<uint256> GetMerkleBranch(int nIndex) const;
     static uint256 CheckMerkleBranch(uint256 hash, const std::vector<uint256>& vMerkleBranch, int nIndex);
     std::string ToString() const;
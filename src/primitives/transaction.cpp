@@ -8,6 +8,7 @@
 
 #include "wallet/crypter.h"
 #include "hash.h"
+#include "memusage.h"
 #include "random.h"
 #include "streams.h"
 #include "tinyformat.h"
@@ -64,7 +65,7 @@ std::string CTxOut::ToString() const
 }
 
 CMutableTransaction::CMutableTransaction() : nVersion(CTransaction::CURRENT_VERSION), nLockTime(0), type(NORMAL) {}
-CMutableTransaction::CMutableTransaction(const CTransaction& tx) : nVersion(tx.nVersion), pubKeys(tx.pubKeys), encryptedKeys(tx.encryptedKeys), vin(tx.vin), vout(tx.vout), nLockTime(tx.nLockTime), type(tx.type), chex(tx.chex) {}
+CMutableTransaction::CMutableTransaction(const CTransaction& tx) : nVersion(tx.nVersion), pubKeys(tx.GetPubKeys()), encryptedKeys(tx.GetEncryptedKeys()), vin(tx.vin), vout(tx.vout), nLockTime(tx.nLockTime), type(tx.type), chex(tx.GetCryptedHex()) {}
 
 uint256 CMutableTransaction::GetHash() const
 {
@@ -78,25 +79,89 @@ void CTransaction::UpdateHash() const
 
 void CTransaction::UpdateHex(const std::string& hex) const
 {
-    *const_cast<std::string*>(&phex) = hex;
+    SetConfidential(GetPubKeys(), GetEncryptedKeys(), GetCryptedHex(), hex);
 }
 
-CTransaction::CTransaction() : nVersion(CTransaction::CURRENT_VERSION), pubKeys(), encryptedKeys(), vin(), vout(), nLockTime(0), type(NORMAL) {}
-CTransaction::CTransaction(const CMutableTransaction &tx) : nVersion(tx.nVersion), pubKeys(tx.pubKeys), encryptedKeys(tx.encryptedKeys), vin(tx.vin), vout(tx.vout), nLockTime(tx.nLockTime), type(tx.type), chex(tx.chex)
+void CTransaction::SetConfidential(const std::vector<CPubKey>& pubKeys, const std::vector<std::string>& encryptedKeys,
+                                   const std::string& chex, const std::string& phex) const
 {
+    boost::shared_ptr<const CTxConfidential>& p = const_cast<CTransaction*>(this)->pconfidential;
+    if (pubKeys.empty() && encryptedKeys.empty() && chex.empty() && phex.empty()) {
+        p.reset();
+        return;
+    }
+    // Build the new block before releasing the old one, the arguments may point into it
+    CTxConfidential* pnew = new CTxConfidential();
+    pnew->pubKeys = pubKeys;
+    pnew->encryptedKeys = encryptedKeys;
+    pnew->chex = chex;
+    pnew->phex = phex;
+    p.reset(pnew);
+}
+
+static const CTxConfidential confidentialEmpty;
+
+const std::vector<CPubKey>& CTransaction::GetPubKeys() const
+{
+    return pconfidential ? pconfidential->pubKeys : confidentialEmpty.pubKeys;
+}
+
+const std::vector<std::string>& CTransaction::GetEncryptedKeys() const
+{
+    return pconfidential ? pconfidential->encryptedKeys : confidentialEmpty.encryptedKeys;
+}
+
+const std::string& CTransaction::GetCryptedHex() const
+{
+    return pconfidential ? pconfidential->chex : confidentialEmpty.chex;
+}
+
+const std::string& CTransaction::GetPlainHex() const
+{
+    return pconfidential ? pconfidential->phex : confidentialEmpty.phex;
+}
+
+size_t CTransaction::DynamicMemoryUsage() const
+{
+    size_t ret = memusage::DynamicUsage(vin) + memusage::DynamicUsage(vout);
+    for (std::vector<CTxIn>::const_iterator it(vin.begin()); it != vin.end(); ++it) {
+        const std::vector<unsigned char> *script = &it->scriptSig;
+        ret += memusage::DynamicUsage(*script);
+    }
+    for (std::vector<CTxOut>::const_iterator it(vout.begin()); it != vout.end(); ++it) {
+        const std::vector<unsigned char> *script = &it->scriptPubKey;
+        ret += memusage::DynamicUsage(*script);
+    }
+    if (pconfidential) {
+        // The shared block and its control block, plus the contents
+        ret += memusage::MallocUsage(sizeof(CTxConfidential)) + memusage::MallocUsage(2 * sizeof(void*) + 2 * sizeof(int));
+        ret += memusage::DynamicUsage(pconfidential->pubKeys) + memusage::DynamicUsage(pconfidential->encryptedKeys);
+        for (std::vector<std::string>::const_iterator it(pconfidential->encryptedKeys.begin()); it != pconfidential->encryptedKeys.end(); ++it)
+            ret += it->capacity() ? memusage::MallocUsage(it->capacity() + 1) : 0;
+        ret += pconfidential->chex.capacity() ? memusage::MallocUsage(pconfidential->chex.capacity() + 1) : 0;
+    }
+    return ret;
+}
+
+CTransaction::CTransaction() : nVersion(CTransaction::CURRENT_VERSION), vin(), vout(), nLockTime(0), type(NORMAL) {}
+CTransaction::CTransaction(const CMutableTransaction &tx) : nVersion(tx.nVersion), vin(tx.vin), vout(tx.vout), nLockTime(tx.nLockTime), type(tx.type)
+{
+    SetConfidential(tx.pubKeys, tx.encryptedKeys, tx.chex, "");
     UpdateHash();
 }
 
 CTransaction& CTransaction::operator=(const CTransaction &tx) {
     *const_cast<int*>(&nVersion) = tx.nVersion;
-    *const_cast<std::vector<CPubKey>*>(&pubKeys) = tx.pubKeys;
-    *const_cast<std::vector<std::string>*>(&encryptedKeys) = tx.encryptedKeys;
     *const_cast<std::vector<CTxIn>*>(&vin) = tx.vin;
     *const_cast<std::vector<CTxOut>*>(&vout) = tx.vout;
     *const_cast<unsigned int*>(&nLockTime) = tx.nLockTime;
     *const_cast<uint256*>(&hash) = tx.hash;
     *const_cast<tx_type*>(&type) = tx.type;
-    *const_cast<std::string*>(&chex) = tx.chex;
+    // Memory-only plain hex is not copied, as before
+    if (tx.GetPlainHex().empty())
+        pconfidential = tx.pconfidential;
+    else
+        SetConfidential(tx.GetPubKeys(), tx.GetEncryptedKeys(), tx.GetCryptedHex(), "");
     return *this;
 }
 
@@ -148,7 +213,7 @@ std::string CTransaction::EncodeHexCryptedTx() const
 {
     CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
     ssTx << *this;
-    unsigned nSize = NONCRYPTED_TX_FIELD_SIZE;
+    unsigned nSize = NONCRYPTED_TX_FIELD_SIZE(nVersion, GetPubKeys(), GetEncryptedKeys());
     // Skip the part that does not require enryption
     ssTx.ignore(nSize);
     return HexStr(ssTx.begin(), ssTx.end());
@@ -158,22 +223,22 @@ bool CTransaction::Decrypt(const unsigned int& index, const CKey& vchPrivKey)
 {
     // Decrypt the key with given secp256k1 privkey
     std::string strKey;
-    vchPrivKey.Decrypt(encryptedKeys[index], strKey);
+    vchPrivKey.Decrypt(GetEncryptedKeys()[index], strKey);
     CKeyingMaterial vchKey(strKey.begin(), strKey.begin() + WALLET_CRYPTO_KEY_SIZE);
     std::vector<unsigned char> vchIV(strKey.begin() + WALLET_CRYPTO_KEY_SIZE, strKey.end());
     // Decrypt the chex with the AES key and IV
     CCrypter cKeyCrypter;
     if (!cKeyCrypter.SetKey(vchKey, vchIV))
         return false;
-    std::vector<unsigned char> vchCryptData(chex.begin(), chex.end());
+    std::vector<unsigned char> vchCryptData(GetCryptedHex().begin(), GetCryptedHex().end());
     CKeyingMaterial vchPlainData;
     if (!cKeyCrypter.Decrypt(vchCryptData, vchPlainData))
         return false;
     std::string hex(vchPlainData.begin(), vchPlainData.end());
-    *const_cast<std::string*>(&phex) = hex;
+    UpdateHex(hex);
     // Decode the transaction with the decrypted hex
     DecodeHexCryptedTx();
-    *const_cast<std::string*>(&phex) = "";
+    UpdateHex("");
     UpdateHash();
 
     return true;
@@ -181,14 +246,14 @@ bool CTransaction::Decrypt(const unsigned int& index, const CKey& vchPrivKey)
 
 bool CTransaction::DecodeHexCryptedTx()
 {
-    if (!IsHex(phex))
+    if (!IsHex(GetPlainHex()))
         return false;
 
     // Recover the stream by replacing the encrypted part with the decrypted part
-    std::vector<unsigned char> txData(ParseHex(phex));
+    std::vector<unsigned char> txData(ParseHex(GetPlainHex()));
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
     ss << *this;
-    unsigned nSize = NONCRYPTED_TX_FIELD_SIZE;
+    unsigned nSize = NONCRYPTED_TX_FIELD_SIZE(nVersion, GetPubKeys(), GetEncryptedKeys());
     ss.erase(ss.begin() + nSize, ss.end());
     CDataStream ssData(txData, SER_NETWORK, PROTOCOL_VERSION);
     ss += ssData;
@@ -208,7 +273,7 @@ std::string CTransaction::ToString() const
     str += strprintf("CTransaction(hash=%s, ver=%d, encrypted=%s, vin.size=%u, vout.size=%u, nLockTime=%u, type=%s)\n",
         GetHash().ToString().substr(0,10),
         nVersion,
-        encryptedKeys.size() > 0? "true": "false",
+        IsEncrypted() ? "true": "false",
         vin.size(),
         vout.size(),
         nLockTime,
@@ -217,8 +282,8 @@ std::string CTransaction::ToString() const
         str += "    " + vin[i].ToString() + "\n";
     for (unsigned int i = 0; i < vout.size(); i++)
         str += "    " + vout[i].ToString() + "\n";
-    for (unsigned int i = 0; i < encryptedKeys.size(); i++)
-        str += "    " + HexStr(encryptedKeys[i]) + "\n";
+    for (unsigned int i = 0; i < GetEncryptedKeys().size(); i++)
+        str += "    " + HexStr(GetEncryptedKeys()[i]) + "\n";
     return str;
 }
 
@@ -287,7 +352,7 @@ std::string CMutableTransaction::EncodeHexCryptedTx()
 {
     CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
     ssTx << *this;
-    unsigned nSize = NONCRYPTED_TX_FIELD_SIZE;
+    unsigned nSize = NONCRYPTED_TX_FIELD_SIZE(nVersion, pubKeys, encryptedKeys);
     // Ignore the part that does not requires encryption
     ssTx.ignore(nSize);
     return HexStr(ssTx.str());
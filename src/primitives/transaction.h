@@ -14,11 +14,13 @@
 #include "serialize.h"
 #include "uint256.h"
 
+#include <boost/shared_ptr.hpp>
+
 // Define the part that does not require encryption of a confidential transaction
-#define NONCRYPTED_TX_FIELD_SIZE                                                    \
-              ::GetSerializeSize(this->nVersion     , SER_NETWORK, PROTOCOL_VERSION)\
-            + ::GetSerializeSize(this->pubKeys      , SER_NETWORK, PROTOCOL_VERSION)\
-            + ::GetSerializeSize(this->encryptedKeys, SER_NETWORK, PROTOCOL_VERSION)
+#define NONCRYPTED_TX_FIELD_SIZE(nVersion, pubKeys, encryptedKeys)                  \
+              ::GetSerializeSize(nVersion     , SER_NETWORK, PROTOCOL_VERSION)      \
+            + ::GetSerializeSize(pubKeys      , SER_NETWORK, PROTOCOL_VERSION)      \
+            + ::GetSerializeSize(encryptedKeys, SER_NETWORK, PROTOCOL_VERSION)
 
 
 /** An outpoint - a combination of a transaction hash and an index n into its vout */
@@ -205,6 +207,22 @@ enum TransactionType
 
 std::string GetTypeName(tx_type type);
 
+/** The fields only confidential transactions have. They are kept out of line
+ * and shared between copies of a CTransaction, so a plain transaction pays a
+ * single null pointer for them.
+ */
+struct CTxConfidential
+{
+    // The pubkeys that are used in encrypting the AES key
+    std::vector<CPubKey> pubKeys;
+    // The encrypted AES key
+    std::vector<std::string> encryptedKeys;
+    // The encrypted transaction data
+    std::string chex;
+    // Memory only: the decrypted transaction data while it is being decoded
+    std::string phex;
+};
+
 /** The basic transaction that is broadcasted on the network and contained in
  * blocks.  A transaction can contain multiple inputs and outputs.
  */
@@ -214,8 +232,12 @@ private:
     /** Memory only. */
     const uint256 hash;
     void UpdateHash() const;
-    const std::string phex;
     void UpdateHex(const std::string& hex) const;
+    /** Never modified in place; replaced as a whole. NULL when all fields are empty. */
+    boost::shared_ptr<const CTxConfidential> pconfidential;
+    void SetConfidential(const std::vector<CPubKey>& pubKeys, const std::vector<std::string>& encryptedKeys,
+                         const std::string& chex, const std::string& phex) const;
+    const std::string& GetPlainHex() const;
 
 public:
     static const int32_t CURRENT_VERSION=1;
@@ -226,15 +248,10 @@ public:
     // and bypass the constness. This is safe, as they update the entire
     // structure, including the hash.
     const int32_t nVersion;
-    // The pubkeys that are used in encrypting the AES key
-    const std::vector<CPubKey> pubKeys;
-    // The encrypted AES key
-    const std::vector<std::string> encryptedKeys;
     const std::vector<CTxIn> vin;
     const std::vector<CTxOut> vout;
     const uint32_t nLockTime;
     const tx_type type;
-    const std::string chex;
 
     /** Construct a CTransaction that qualifies as IsNull() */
     CTransaction();
@@ -244,23 +261,41 @@ public:
 
     CTransaction& operator=(const CTransaction& tx);
 
+    // The pubkeys that are used in encrypting the AES key
+    const std::vector<CPubKey>& GetPubKeys() const;
+    // The encrypted AES key
+    const std::vector<std::string>& GetEncryptedKeys() const;
+    const std::string& GetCryptedHex() const;
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
         READWRITE(*const_cast<int32_t*>(&this->nVersion));
         nVersion = this->nVersion;
-        READWRITE(*const_cast<std::vector<CPubKey>*>(&this->pubKeys));
-        READWRITE(*const_cast<std::vector<std::string>*>(&this->encryptedKeys));
+        if (ser_action.ForRead()) {
+            std::vector<CPubKey> pubKeys;
+            std::vector<std::string> encryptedKeys;
+            READWRITE(pubKeys);
+            READWRITE(encryptedKeys);
+            SetConfidential(pubKeys, encryptedKeys, GetCryptedHex(), GetPlainHex());
+        } else {
+            READWRITE(*const_cast<std::vector<CPubKey>*>(&GetPubKeys()));
+            READWRITE(*const_cast<std::vector<std::string>*>(&GetEncryptedKeys()));
+        }
         // Serialization follow the original process if the transaction is not encrypted
         // or plain hex is available
-        if (!IsEncrypted() || !phex.empty()) {
+        if (!IsEncrypted() || !GetPlainHex().empty()) {
             READWRITE(*const_cast<std::vector<CTxIn>*>(&this->vin));
             READWRITE(*const_cast<std::vector<CTxOut>*>(&this->vout));
             READWRITE(*const_cast<uint32_t*>(&this->nLockTime));
             READWRITE(*const_cast<tx_type*>(&this->type));
+        } else if (ser_action.ForRead()) {
+            std::string chex;
+            READWRITE(chex);
+            SetConfidential(GetPubKeys(), GetEncryptedKeys(), chex, GetPlainHex());
         } else {
-            READWRITE(*const_cast<std::string*>(&this->chex));
+            READWRITE(*const_cast<std::string*>(&GetCryptedHex()));
         }
         if (ser_action.ForRead())
             UpdateHash();
@@ -275,7 +310,7 @@ public:
     }
 
     bool IsEncrypted() const {
-        return encryptedKeys.size() > 0;
+        return pconfidential && pconfidential->encryptedKeys.size() > 0;
     }
 
     bool Decrypt(const unsigned int& index, const CKey& vchPrivKey);
@@ -283,6 +318,9 @@ public:
     // Encode the part of transaction to be encrypted into hex
     std::string EncodeHexCryptedTx() const;
 
+    //! Heap memory owned by this transaction (the object itself excluded)
+    size_t DynamicMemoryUsage() const;
+
     bool DecodeHexCryptedTx();
 
     // Return sum of txouts.
@@ -3,9 +3,11 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "cache.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "main.h"
+#include "policy/licenseinfo.h"
 #include "rpcserver.h"
 #include "streams.h"
 #include "sync.h"
@@ -21,6 +23,9 @@ using namespace json_spirit;
 
 static const int MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
 
+// Held during an addrutxos scan, so only one runs at a time
+static CCriticalSection cs_addrUTXOsScan;
+
 enum RetFormat {
     RF_UNDEF,
     RF_BINARY,
@@ -64,6 +69,8 @@ public:
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry);
 extern Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
 extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, Object& out, bool fIncludeHex);
+extern void LicenseInfoToJSON(const CLicenseInfo& info, Object& entry);
+extern Object txOutAddressToJSON(const COutPoint& outpoint, const CTxOut& out);
 
 static RestErr RESTERR(enum HTTPStatusCode status, string message)
 {
@@ -110,6 +117,47 @@ static bool ParseHashStr(const string& strReq, uint256& v)
     return true;
 }
 
+static bool ParseColorStr(const string& strReq, type_Color& color)
+{
+    if (strReq.empty() || strReq.size() > 10 || strReq.find_first_not_of("0123456789") != string::npos)
+        return false;
+
+    uint64_t n = strtoull(strReq.c_str(), NULL, 10);
+    if (n > std::numeric_limits<type_Color>::max())
+        return false;
+    color = (type_Color)n;
+    return true;
+}
+
+/** Reply with ssData for the .bin and .hex formats */
+static bool RestReplyData(AcceptedConnection* conn, enum RetFormat rf, const CDataStream& ssData, bool fRun)
+{
+    switch (rf) {
+    case RF_BINARY: {
+        string binaryData = ssData.str();
+        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, binaryData.size(), "application/octet-stream") << binaryData << std::flush;
+        return true;
+    }
+
+    case RF_HEX: {
+        string strHex = HexStr(ssData.begin(), ssData.end()) + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+}
+
+static bool RestReplyJSON(AcceptedConnection* conn, const Value& valJSON, bool fRun)
+{
+    string strJSON = write_string(valJSON, false) + "\n";
+    conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+    return true;
+}
+
 static bool rest_headers(AcceptedConnection* conn,
                          const std::string& strURIPart,
                          const std::string& strRequest,
@@ -529,6 +577,203 @@ static bool rest_getutxos(AcceptedConnection* conn,
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static Object LicenseToJSON(const color_license::Owner_& owner)
+{
+    Object obj;
+    obj.push_back(Pair("Owner", owner.address_));
+    obj.push_back(Pair("Total amount", owner.num_of_coins_ / COIN));
+    LicenseInfoToJSON(owner.info_, obj);
+    return obj;
+}
+
+static bool rest_license(AcceptedConnection* conn,
+                         const std::string& strURIPart,
+                         const std::string& strRequest,
+                         const std::map<std::string, std::string>& mapHeaders,
+                         bool fRun)
+{
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+
+    type_Color color;
+    if (!ParseColorStr(params[0], color))
+        throw RESTERR(HTTP_BAD_REQUEST, "Invalid color: " + params[0]);
+
+    // Copy the entry out of the cache; serialization happens without the lock
+    color_license::Owner_ owner;
+    {
+        CacheReadLock lock(cs_cacheApply);
+        if (!plicense->GetEntry(color, owner))
+            throw RESTERR(HTTP_NOT_FOUND, params[0] + " not found");
+    }
+
+    if (rf == RF_JSON)
+        return RestReplyJSON(conn, LicenseToJSON(owner), fRun);
+
+    CDataStream ssLicense(SER_NETWORK, PROTOCOL_VERSION);
+    ssLicense << owner;
+    return RestReplyData(conn, rf, ssLicense, fRun);
+}
+
+static bool rest_licenses(AcceptedConnection* conn,
+                          const std::string& strURIPart,
+                          const std::string& strRequest,
+                          const std::map<std::string, std::string>& mapHeaders,
+                          bool fRun)
+{
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+
+    // Sorted by color, serialized the same way as a map.
+    std::vector<std::pair<type_Color, color_license::Owner_> > vLicense;
+    {
+        CacheReadLock lock(cs_cacheApply);
+        vLicense = plicense->Snapshot();
+    }
+
+    if (rf == RF_JSON) {
+        Object objLicenses;
+        for (std::vector<std::pair<type_Color, color_license::Owner_> >::const_iterator it = vLicense.begin(); it != vLicense.end(); ++it)
+            objLicenses.push_back(Pair(strprintf("%u", it->first), LicenseToJSON(it->second)));
+        return RestReplyJSON(conn, objLicenses, fRun);
+    }
+
+    CDataStream ssLicenses(SER_NETWORK, PROTOCOL_VERSION);
+    ssLicenses << vLicense;
+    return RestReplyData(conn, rf, ssLicenses, fRun);
+}
+
+static bool rest_alliance(AcceptedConnection* conn,
+                          const std::string& strURIPart,
+                          const std::string& strRequest,
+                          const std::map<std::string, std::string>& mapHeaders,
+                          bool fRun)
+{
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+
+    std::set<std::string> setMembers;
+    std::string strLicenseAddress, strMinerAddress;
+    {
+        CacheReadLock lock(cs_cacheApply);
+        setMembers = palliance->Snapshot();
+        strLicenseAddress = ConsensusAddressForLicense;
+        strMinerAddress = ConsensusAddressForMiner;
+    }
+    std::vector<std::string> vMembers(setMembers.begin(), setMembers.end());
+
+    if (rf == RF_JSON) {
+        Array members;
+        BOOST_FOREACH(const std::string& member, vMembers)
+            members.push_back(member);
+        Object obj;
+        obj.push_back(Pair("member_list", members));
+        obj.push_back(Pair("Consensus address for license", strLicenseAddress));
+        obj.push_back(Pair("Consensus address for miner", strMinerAddress));
+        return RestReplyJSON(conn, obj, fRun);
+    }
+
+    CDataStream ssMembers(SER_NETWORK, PROTOCOL_VERSION);
+    ssMembers << vMembers;
+    return RestReplyData(conn, rf, ssMembers, fRun);
+}
+
+static bool rest_miners(AcceptedConnection* conn,
+                        const std::string& strURIPart,
+                        const std::string& strRequest,
+                        const std::map<std::string, std::string>& mapHeaders,
+                        bool fRun)
+{
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+
+    std::set<std::string> setMiners;
+    {
+        CacheReadLock lock(cs_cacheApply);
+        setMiners = pminer->Snapshot();
+    }
+    std::vector<std::string> vMiners(setMiners.begin(), setMiners.end());
+
+    if (rf == RF_JSON) {
+        Array miners;
+        BOOST_FOREACH(const std::string& miner, vMiners)
+            miners.push_back(miner);
+        Object obj;
+        obj.push_back(Pair("miner_list", miners));
+        return RestReplyJSON(conn, obj, fRun);
+    }
+
+    CDataStream ssMiners(SER_NETWORK, PROTOCOL_VERSION);
+    ssMiners << vMiners;
+    return RestReplyData(conn, rf, ssMiners, fRun);
+}
+
+static bool rest_addrutxos(AcceptedConnection* conn,
+                           const std::string& strURIPart,
+                           const std::string& strRequest,
+                           const std::map<std::string, std::string>& mapHeaders,
+                           bool fRun)
+{
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+
+    // The scanned database lags the tip by up to a flush interval, so the
+    // mempool cannot be laid over it: outputs confirmed since the flush have
+    // left the mempool without reaching the database.
+    if (path.size() == 2 && path[0] == "checkmempool")
+        throw RESTERR(HTTP_BAD_REQUEST, "checkmempool is not supported by addrutxos, use gettxoutaddress instead");
+    if (path.size() != 1 || path[0].empty())
+        throw RESTERR(HTTP_BAD_REQUEST, "No address specified. Use /rest/addrutxos/<address>.<ext>.");
+    if (rf == RF_UNDEF)
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+
+    // Every request reads the whole coins database, so serving it to the
+    // public is opt-in, and requests never scan more than once or in parallel.
+    if (!GetBoolArg("-restaddrutxos", false))
+        throw RESTERR(HTTP_FORBIDDEN, "addrutxos is disabled, start with -restaddrutxos to enable it");
+    TRY_LOCK(cs_addrUTXOsScan, lockScan);
+    if (!lockScan)
+        throw RESTERR(HTTP_SERVICE_UNAVAILABLE, "Another address scan is running, try again");
+
+    // Scan the coins database directly, without cs_main and without flushing
+    // pcoinsTip first, so polling this endpoint never holds up block
+    // connection. The result is as of the last flush; the reported tip is the
+    // block the database was flushed at. If a flush lands during the scan the
+    // result may mix both states and is refused.
+    if (pcoinsDBView == NULL)
+        throw RESTERR(HTTP_SERVICE_UNAVAILABLE, "Coins database not loaded");
+    CTxOutMap mapTxOut;
+    uint256 hashTip = pcoinsDBView->GetBestBlock();
+    if (!pcoinsDBView->GetAddrCoins(path[0], mapTxOut, false))
+        throw RESTERR(HTTP_INTERNAL_SERVER_ERROR, "Unable to read the coins database");
+    if (pcoinsDBView->GetBestBlock() != hashTip)
+        throw RESTERR(HTTP_SERVICE_UNAVAILABLE, "Coins database was flushed during the scan, try again");
+    int nHeight = -1;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator mi = mapBlockIndex.find(hashTip);
+        if (mi != mapBlockIndex.end())
+            nHeight = mi->second->nHeight;
+    }
+
+    if (rf == RF_JSON) {
+        Object objAddrUTXOs;
+        objAddrUTXOs.push_back(Pair("chainHeight", nHeight));
+        objAddrUTXOs.push_back(Pair("chaintipHash", hashTip.GetHex()));
+        Array utxos;
+        for (CTxOutMap::const_iterator it = mapTxOut.begin(); it != mapTxOut.end(); ++it)
+            utxos.push_back(txOutAddressToJSON(it->first, it->second));
+        objAddrUTXOs.push_back(Pair("utxos", utxos));
+        return RestReplyJSON(conn, objAddrUTXOs, fRun);
+    }
+
+    CDataStream ssAddrUTXOs(SER_NETWORK, PROTOCOL_VERSION);
+    ssAddrUTXOs << nHeight << hashTip << mapTxOut;
+    return RestReplyData(conn, rf, ssAddrUTXOs, fRun);
+}
+
 static const struct {
     const char* prefix;
     bool (*handler)(AcceptedConnection* conn,
@@ -543,6 +788,11 @@ static const struct {
       {"/rest/chaininfo", rest_chaininfo},
       {"/rest/headers/", rest_headers},
       {"/rest/getutxos", rest_getutxos},
+      {"/rest/license/", rest_license},
+      {"/rest/licenses", rest_licenses},
+      {"/rest/alliance", rest_alliance},
+      {"/rest/miners", rest_miners},
+      {"/rest/addrutxos/", rest_addrutxos},
 };
 
 bool HTTPReq_REST(AcceptedConnection* conn,
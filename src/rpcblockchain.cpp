@@ -7,6 +7,7 @@
 #include "checkpoints.h"
 #include "consensus/validation.h"
 #include "main.h"
+#include "policy/licenseinfo.h"
 #include "primitives/transaction.h"
 #include "rpcserver.h"
 #include "sync.h"
@@ -55,9 +56,8 @@ double GetDifficulty(const CBlockIndex* blockindex)
 }
 
 
-Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+static void blockToJSONHeader(const CBlock& block, const CBlockIndex* blockindex, Object& result)
 {
-    Object result;
     result.push_back(Pair("hash", block.GetHash().GetHex()));
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
@@ -68,6 +68,28 @@ Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDe
     result.push_back(Pair("height", blockindex->nHeight));
     result.push_back(Pair("version", block.nVersion));
     result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
+}
+
+static void blockToJSONTrailer(const CBlock& block, const CBlockIndex* blockindex, Object& result)
+{
+    result.push_back(Pair("time", block.GetBlockTime()));
+    result.push_back(Pair("starttime", block.GetBlockStartTime()));
+    result.push_back(Pair("nonce", (uint64_t)block.nNonce));
+    result.push_back(Pair("bits", strprintf("%08x", block.nBits)));
+    result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
+    result.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
+
+    if (blockindex->pprev)
+        result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
+    CBlockIndex *pnext = chainActive.Next(blockindex);
+    if (pnext)
+        result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
+}
+
+Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+{
+    Object result;
+    blockToJSONHeader(block, blockindex, result);
     Array txs;
     BOOST_FOREACH(const CTransaction&tx, block.vtx)
     {
@@ -81,18 +103,7 @@ Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDe
             txs.push_back(tx.GetHash().GetHex());
     }
     result.push_back(Pair("tx", txs));
-    result.push_back(Pair("time", block.GetBlockTime()));
-    result.push_back(Pair("starttime", block.GetBlockStartTime()));
-    result.push_back(Pair("nonce", (uint64_t)block.nNonce));
-    result.push_back(Pair("bits", strprintf("%08x", block.nBits)));
-    result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
-    result.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
-
-    if (blockindex->pprev)
-        result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    CBlockIndex *pnext = chainActive.Next(blockindex);
-    if (pnext)
-        result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
+    blockToJSONTrailer(block, blockindex, result);
     return result;
 }
 
@@ -110,8 +121,8 @@ Value getblockcount(const Array& params, bool fHelp)
             + HelpExampleRpc("getblockcount", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Height();
+    const CBlockIndex* pindexTip = GetTipSnapshot();
+    return pindexTip ? pindexTip->nHeight : -1;
 }
 
 Value getbestblockhash(const Array& params, bool fHelp)
@@ -148,6 +159,26 @@ Value getdifficulty(const Array& params, bool fHelp)
     return GetDifficulty();
 }
 
+/** Requires cs_main and mempool.cs. */
+static Object mempoolEntryToJSON(const CTxMemPoolEntry& e)
+{
+    Object info;
+    info.push_back(Pair("size", (int)e.GetTxSize()));
+    info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
+    info.push_back(Pair("time", e.GetTime()));
+    info.push_back(Pair("height", (int)e.GetHeight()));
+    info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
+    info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
+    const CTransaction& tx = e.GetTx();
+    std::set<std::string> setDepends;
+    BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+        if (mempool.exists(txin.prevout.hash))
+            setDepends.insert(txin.prevout.hash.ToString());
+    }
+    Array depends(setDepends.begin(), setDepends.end());
+    info.push_back(Pair("depends", depends));
+    return info;
+}
 
 Value getrawmempool(const Array& params, bool fHelp)
 {
@@ -190,26 +221,8 @@ Value getrawmempool(const Array& params, bool fHelp)
     if (fVerbose) {
         LOCK(mempool.cs);
         Object o;
-        BOOST_FOREACH(const PAIRTYPE(uint256, CTxMemPoolEntry)& entry, mempool.mapTx) {
-            const uint256& hash = entry.first;
-            const CTxMemPoolEntry& e = entry.second;
-            Object info;
-            info.push_back(Pair("size", (int)e.GetTxSize()));
-            info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
-            info.push_back(Pair("time", e.GetTime()));
-            info.push_back(Pair("height", (int)e.GetHeight()));
-            info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
-            info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
-            const CTransaction& tx = e.GetTx();
-            std::set<std::string> setDepends;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
-                if (mempool.exists(txin.prevout.hash))
-                    setDepends.insert(txin.prevout.hash.ToString());
-            }
-            Array depends(setDepends.begin(), setDepends.end());
-            info.push_back(Pair("depends", depends));
-            o.push_back(Pair(hash.ToString(), info));
-        }
+        BOOST_FOREACH(const CTxMemPoolEntry& entry, mempool.mapTx)
+            o.push_back(Pair(entry.GetTx().GetHash().ToString(), mempoolEntryToJSON(entry)));
         return o;
     } else {
         std::vector<uint256> vtxid;
@@ -223,6 +236,42 @@ Value getrawmempool(const Array& params, bool fHelp)
     }
 }
 
+void getrawmempool_stream(const Array& params, CJSONStreamWriter& writer)
+{
+    if (params.size() > 1)
+        getrawmempool(params, true); // throws the usage text
+
+    bool fVerbose = false;
+    if (params.size() > 0)
+        fVerbose = params[0].get_bool();
+
+    // Only the txids are copied; each entry is looked up again while it is
+    // written so the locks are not held while the client reads.
+    std::vector<uint256> vtxid;
+    mempool.queryHashes(vtxid);
+
+    if (fVerbose) {
+        writer.BeginObject();
+        BOOST_FOREACH(const uint256& hash, vtxid) {
+            Object info;
+            {
+                LOCK2(cs_main, mempool.cs);
+                CTxMemPool::txiter it = mempool.mapTx.find(hash);
+                if (it == mempool.mapTx.end())
+                    continue;
+                info = mempoolEntryToJSON(*it);
+            }
+            writer.Write(hash.ToString(), info);
+        }
+        writer.EndObject();
+    } else {
+        writer.BeginArray();
+        BOOST_FOREACH(const uint256& hash, vtxid)
+            writer.Write(hash.ToString());
+        writer.EndArray();
+    }
+}
+
 
 Value getaddrmempool(const Array& params, bool fHelp)
 {
@@ -266,12 +315,10 @@ Value getaddrmempool(const Array& params, bool fHelp)
 
     Object o;
     Array a;
-    typedef std::pair<const uint256, const CTxMemPoolEntry> mapit_t;
-    BOOST_FOREACH(const mapit_t &it, mempool.mapTx)
+    LOCK(mempool.cs);
+    BOOST_FOREACH(const CTxMemPoolEntry& e, mempool.mapTx.get<entry_time>())
     {
-        LOCK(mempool.cs);
-        const uint256& hash = it.first;
-        const CTxMemPoolEntry& e = it.second;
+        const uint256& hash = e.GetTx().GetHash();
         const CTransaction& tx = e.GetTx();
         bool fAddr = false;
         TxInfo txinfo(tx);
@@ -331,16 +378,40 @@ Value getblockhash(const Array& params, bool fHelp)
             + HelpExampleRpc("getblockhash", "1000")
         );
 
-    LOCK(cs_main);
+    const CBlockIndex* pindexTip = GetTipSnapshot();
 
     int nHeight = params[0].get_int();
-    if (nHeight < 0 || nHeight > chainActive.Height())
+    if (pindexTip == NULL || nHeight < 0 || nHeight > pindexTip->nHeight)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
 
-    CBlockIndex* pblockindex = chainActive[nHeight];
+    const CBlockIndex* pblockindex = pindexTip->GetAncestor(nHeight);
     return pblockindex->GetBlockHash().GetHex();
 }
 
+/** Look up and read the block named by getblock's parameters. Requires cs_main. */
+static CBlockIndex* readBlockForRPC(const Array& params, CBlock& block, bool& fVerbose)
+{
+    std::string strHash = params[0].get_str();
+    uint256 hash(uint256S(strHash));
+
+    fVerbose = true;
+    if (params.size() > 1)
+        fVerbose = params[1].get_bool();
+
+    if (mapBlockIndex.count(hash) == 0)
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+
+    CBlockIndex* pblockindex = mapBlockIndex[hash];
+
+    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+
+    if(!ReadBlockFromDisk(block, pblockindex))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+
+    return pblockindex;
+}
+
 Value getblock(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -379,24 +450,9 @@ Value getblock(const Array& params, bool fHelp)
 
     LOCK(cs_main);
 
-    std::string strHash = params[0].get_str();
-    uint256 hash(uint256S(strHash));
-
-    bool fVerbose = true;
-    if (params.size() > 1)
-        fVerbose = params[1].get_bool();
-
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
-
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-
-    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
-
-    if(!ReadBlockFromDisk(block, pblockindex))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    bool fVerbose;
+    CBlockIndex* pblockindex = readBlockForRPC(params, block, fVerbose);
 
     if (!fVerbose) {
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
@@ -408,13 +464,49 @@ Value getblock(const Array& params, bool fHelp)
     return blockToJSON(block, pblockindex);
 }
 
+void getblock_stream(const Array& params, CJSONStreamWriter& writer)
+{
+    if (params.size() < 1 || params.size() > 2)
+        getblock(params, true); // throws the usage text
+
+    CBlock block;
+    bool fVerbose;
+    Object header, trailer;
+    {
+        LOCK(cs_main);
+        CBlockIndex* pblockindex = readBlockForRPC(params, block, fVerbose);
+        if (fVerbose) {
+            blockToJSONHeader(block, pblockindex, header);
+            blockToJSONTrailer(block, pblockindex, trailer);
+        }
+    }
+
+    if (!fVerbose) {
+        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+        ssBlock << block;
+        const unsigned char* begin = (const unsigned char*)&ssBlock[0];
+        writer.WriteHex(begin, begin + ssBlock.size());
+        return;
+    }
+
+    writer.BeginObject();
+    writer.WriteMembers(header);
+    writer.Key("tx");
+    writer.BeginArray();
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        writer.Write(tx.GetHash().GetHex());
+    writer.EndArray();
+    writer.WriteMembers(trailer);
+    writer.EndObject();
+}
+
 Value gettxoutsetinfo(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
         throw std::runtime_error(
             "gettxoutsetinfo\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "The statistics are maintained as blocks are connected, so only pending coin changes are flushed.\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
@@ -422,7 +514,7 @@ Value gettxoutsetinfo(const Array& params, bool fHelp)
             "  \"transactions\": n,      (numeric) The number of transactions\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"hash_serialized\": \"hash\",   (string) Order-independent hash of the unspent output set\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
@@ -534,6 +626,74 @@ Value gettxout(const Array& params, bool fHelp)
     return ret;
 }
 
+// Create JSON object from given license information.
+void LicenseInfoToJSON(const CLicenseInfo& info, Object& entry)
+{
+    entry.push_back(Pair("version", info.nVersion));
+    entry.push_back(Pair("name", info.name));
+    entry.push_back(Pair("description", info.description));
+    entry.push_back(Pair("issuer", info.issuer));
+    entry.push_back(Pair("divisibility", info.fDivisibility));
+    if (info.feeType == FIXED)
+        entry.push_back(Pair("fee_type", "fixed"));
+    else if (info.feeType == BYSIZE)
+        entry.push_back(Pair("fee_type", "by_size"));
+    else if (info.feeType == BYAMOUNT)
+        entry.push_back(Pair("fee_type", "by_amount"));
+    entry.push_back(Pair("fee_rate", info.nFeeRate));
+    entry.push_back(Pair("fee_collector", info.feeCollectorAddr));
+    entry.push_back(Pair("upper_limit", info.nLimit));
+    if (info.mintSchedule == FREE)
+        entry.push_back(Pair("mint_schedule", "free"));
+    else if (info.mintSchedule == ONCE)
+        entry.push_back(Pair("mint_schedule", "once"));
+    else if (info.mintSchedule == LINEAR)
+        entry.push_back(Pair("mint_schedule", "linear"));
+    else if (info.mintSchedule == HALFLIFE)
+        entry.push_back(Pair("mint_schedule", "half_life"));
+    entry.push_back(Pair("member_control", info.fMemberControl));
+    entry.push_back(Pair("metadata_link", info.metadataLink));
+    entry.push_back(Pair("metadata_hash", info.metadataHash.ToString()));
+}
+
+/** Collect the outputs reported by gettxoutaddress. Returns false if there are none. */
+static bool getTxOutAddressOutputs(const Array& params, CTxOutMap& mapTxOut)
+{
+    LOCK(cs_main);
+
+    std::string address = params[0].get_str();
+    bool fMempool = true;
+    if (params.size() > 1)
+        fMempool = params[1].get_bool();
+
+    bool fLicense = false;
+    if (params.size() > 2)
+        fLicense = (params[2].get_int() != 0);
+
+    FlushStateToDisk();
+    if (fMempool) {
+        LOCK(mempool.cs);
+        CCoinsViewMemPool view(pcoinsTip, mempool);
+        if (!view.GetAddrCoins(address, mapTxOut, fLicense))
+            return false;
+    } else {
+        if (!pcoinsTip->GetAddrCoins(address, mapTxOut, fLicense))
+            return false;
+    }
+    return mapTxOut.size() != 0;
+}
+
+Object txOutAddressToJSON(const COutPoint& outpoint, const CTxOut& out)
+{
+    Object info;
+    info.push_back(Pair("txid", outpoint.hash.GetHex()));
+    info.push_back(Pair("vout", (uint64_t)outpoint.n));
+    info.push_back(Pair("color", (uint64_t)out.color));
+    info.push_back(Pair("value", ValueFromAmount(out.nValue)));
+    info.push_back(Pair("scriptPubKey", HexStr(out.scriptPubKey.begin(), out.scriptPubKey.end())));
+    return info;
+}
+
 Value gettxoutaddress(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 3)
@@ -559,48 +719,34 @@ Value gettxoutaddress(const Array& params, bool fHelp)
             + HelpExampleRpc("gettxoutaddress", "\"address\"")
         );
 
-    LOCK(cs_main);
-
-    std::string address = params[0].get_str();
-    bool fMempool = true;
-    if (params.size() > 1)
-        fMempool = params[1].get_bool();
-
-    bool fLicense = false;
-    if (params.size() > 2)
-        fLicense = (params[2].get_int() != 0);
-
     CTxOutMap mapTxOut;
-    FlushStateToDisk();
-    if (fMempool) {
-        LOCK(mempool.cs);
-        CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetAddrCoins(address, mapTxOut, fLicense))
-            return Value::null;
-    } else {
-        if (!pcoinsTip->GetAddrCoins(address, mapTxOut, fLicense))
-            return Value::null;
-    }
-    if (mapTxOut.size() == 0)
+    if (!getTxOutAddressOutputs(params, mapTxOut))
         return Value::null;
 
     Array ret;
-    for (CTxOutMap::iterator it = mapTxOut.begin(); it != mapTxOut.end(); it++) {
-        Object info;
-        uint256 hash = it->first.hash;
-        unsigned int index = it->first.n;
-        CTxOut out = it->second;
-        info.push_back(Pair("txid", hash.GetHex()));
-        info.push_back(Pair("vout", (uint64_t)index));
-        info.push_back(Pair("color", (uint64_t)out.color));
-        info.push_back(Pair("value", ValueFromAmount(out.nValue)));
-        info.push_back(Pair("scriptPubKey", HexStr(out.scriptPubKey.begin(), out.scriptPubKey.end())));
-        ret.push_back(info);
-    }
+    for (CTxOutMap::iterator it = mapTxOut.begin(); it != mapTxOut.end(); it++)
+        ret.push_back(txOutAddressToJSON(it->first, it->second));
 
     return ret;
 }
 
+void gettxoutaddress_stream(const Array& params, CJSONStreamWriter& writer)
+{
+    if (params.size() < 1 || params.size() > 3)
+        gettxoutaddress(params, true); // throws the usage text
+
+    CTxOutMap mapTxOut;
+    if (!getTxOutAddressOutputs(params, mapTxOut)) {
+        writer.Write(Value::null);
+        return;
+    }
+
+    writer.BeginArray();
+    for (CTxOutMap::iterator it = mapTxOut.begin(); it != mapTxOut.end(); it++)
+        writer.Write(txOutAddressToJSON(it->first, it->second));
+    writer.EndArray();
+}
+
 Value verifychain(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 2)
@@ -783,6 +929,8 @@ Value getmempoolinfo(const Array& params, bool fHelp)
             "{\n"
             "  \"size\": xxxxx                (numeric) Current tx count\n"
             "  \"bytes\": xxxxx               (numeric) Sum of all tx sizes\n"
+            "  \"usage\": xxxxx               (numeric) Total memory usage for the mempool\n"
+            "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee per kB for a transaction to be accepted\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmempoolinfo", "")
@@ -792,6 +940,9 @@ Value getmempoolinfo(const Array& params, bool fHelp)
     Object ret;
     ret.push_back(Pair("size", (int64_t) mempool.size()));
     ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
+    ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
+    size_t nMaxMempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+    ret.push_back(Pair("mempoolminfee", ValueFromAmount(mempool.GetMinFee(nMaxMempool).GetSatoshisPerK())));
 
     return ret;
 }
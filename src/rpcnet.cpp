@@ -439,16 +439,24 @@ Value getmemberlist(const Array& params, bool fHelp)
             + HelpExampleRpc("getmemberlist", "")
        );
 
-    LOCK(cs_main);
+    // The consensus addresses are derived from the members, so read them
+    // under the same lock to get all three as of the same block.
+    std::set<std::string> setMembers;
+    std::string strLicenseAddress, strMinerAddress;
+    {
+        CacheReadLock lock(cs_cacheApply);
+        setMembers = palliance->Snapshot();
+        strLicenseAddress = ConsensusAddressForLicense;
+        strMinerAddress = ConsensusAddressForMiner;
+    }
 
     Object obj;
     Array a;
-    for (AllianceMember::CIterator it = palliance->IteratorBegin();
-         it != palliance->IteratorEnd(); ++it)
+    for (std::set<std::string>::const_iterator it = setMembers.begin(); it != setMembers.end(); ++it)
         a.push_back((*it));
     obj.push_back(Pair("member_list", a));
-    obj.push_back(Pair("Consensus address for license", ConsensusAddressForLicense));
-    obj.push_back(Pair("Consensus address for miner", ConsensusAddressForMiner));
+    obj.push_back(Pair("Consensus address for license", strLicenseAddress));
+    obj.push_back(Pair("Consensus address for miner", strMinerAddress));
     return obj;
 }
 
@@ -472,12 +480,15 @@ Value getminerlist(const Array& params, bool fHelp)
             + HelpExampleRpc("getminerlist", "")
        );
 
-    LOCK(cs_main);
+    std::set<std::string> setMiners;
+    {
+        CacheReadLock lock(cs_cacheApply);
+        setMiners = pminer->Snapshot();
+    }
 
     Object obj;
     Array a;
-    for (Miner::CIterator it = pminer->IteratorBegin();
-         it != pminer->IteratorEnd(); ++it)
+    for (std::set<std::string>::const_iterator it = setMiners.begin(); it != setMiners.end(); ++it)
         a.push_back((*it));
     obj.push_back(Pair("miner_list", a));
     return obj;
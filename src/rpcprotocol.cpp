@@ -134,6 +134,24 @@ std::string HTTPReply(int nStatus, const std::string& strMsg, bool keepalive,
         return HTTPReplyHeader(nStatus, keepalive, strMsg.size(), contentType) + strMsg;
 }
 
+std::string HTTPReplyHeaderChunked(int nStatus, bool keepalive, const char *contentType)
+{
+    return strprintf(
+            "HTTP/1.1 %d %s\r\n"
+            "Date: %s\r\n"
+            "Connection: %s\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "Content-Type: %s\r\n"
+            "Server: gcoin-json-rpc/%s\r\n"
+            "\r\n",
+        nStatus,
+        httpStatusDescription(nStatus),
+        rfc1123Time(),
+        keepalive ? "keep-alive" : "close",
+        contentType,
+        FormatFullVersion());
+}
+
 bool ReadHTTPRequestLine(std::basic_istream<char>& stream, int &proto,
                          std::string& http_method, std::string& http_uri)
 {
@@ -210,6 +228,45 @@ int ReadHTTPHeaders(std::basic_istream<char>& stream, std::map<std::string, std:
 }
 
 
+static bool ReadHTTPChunkedBody(std::basic_istream<char>& stream, std::vector<char>& vch, size_t max_size)
+{
+    while (true) {
+        std::string str;
+        std::getline(stream, str);
+        if (!stream || str.empty() || HexDigit(str[0]) < 0)
+            return false;
+        // Chunk extensions after ';' are ignored
+        size_t nChunk = strtoul(str.c_str(), NULL, 16);
+        if (nChunk == 0)
+            break;
+        if (nChunk > max_size - vch.size())
+            return false;
+        size_t ptr = vch.size();
+        size_t end = ptr + nChunk;
+        while (ptr < end) {
+            size_t bytes_to_read = std::min(end - ptr, POST_READ_SIZE);
+            vch.resize(ptr + bytes_to_read);
+            stream.read(&vch[ptr], bytes_to_read);
+            if (!stream)
+                return false;
+            ptr += bytes_to_read;
+        }
+        // CRLF terminating the chunk data
+        std::getline(stream, str);
+    }
+
+    // Skip trailer headers up to the empty line ending the message
+    while (true) {
+        std::string str;
+        std::getline(stream, str);
+        if (!stream)
+            return false;
+        if (str.empty() || str == "\r")
+            break;
+    }
+    return true;
+}
+
 int ReadHTTPMessage(std::basic_istream<char>& stream, std::map<std::string,
                     std::string>& mapHeadersRet, std::string& strMessageRet,
                     int nProto, size_t max_size)
@@ -223,7 +280,12 @@ int ReadHTTPMessage(std::basic_istream<char>& stream, std::map<std::string,
         return HTTP_INTERNAL_SERVER_ERROR;
 
     // Read message
-    if (nLen > 0) {
+    if (boost::iequals(mapHeadersRet["transfer-encoding"], "chunked")) {
+        std::vector<char> vch;
+        if (!ReadHTTPChunkedBody(stream, vch, max_size))
+            return HTTP_INTERNAL_SERVER_ERROR;
+        strMessageRet = std::string(vch.begin(), vch.end());
+    } else if (nLen > 0) {
         std::vector<char> vch;
         size_t ptr = 0;
         while (ptr < (size_t)nLen) {
@@ -293,3 +355,140 @@ Object JSONRPCError(int code, const std::string& message)
     error.push_back(Pair("message", message));
     return error;
 }
+
+CHTTPChunkedStreamBuf::CHTTPChunkedStreamBuf(std::ostream& outIn, const std::string& strHeaderIn, size_t nChunkSize) :
+    out(outIn), strHeader(strHeaderIn), vBuffer(std::max(nChunkSize, (size_t)1)), fStarted(false)
+{
+    setp(&vBuffer[0], &vBuffer[0] + vBuffer.size());
+}
+
+bool CHTTPChunkedStreamBuf::FlushChunk()
+{
+    size_t nSize = pptr() - pbase();
+    if (nSize == 0)
+        return out.good();
+    if (!fStarted) {
+        out << strHeader;
+        fStarted = true;
+    }
+    out << strprintf("%x\r\n", nSize);
+    out.write(pbase(), nSize);
+    out << "\r\n";
+    setp(&vBuffer[0], &vBuffer[0] + vBuffer.size());
+    return out.good();
+}
+
+CHTTPChunkedStreamBuf::int_type CHTTPChunkedStreamBuf::overflow(int_type ch)
+{
+    if (!FlushChunk())
+        return traits_type::eof();
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+int CHTTPChunkedStreamBuf::sync()
+{
+    // Data only leaves in full chunks until Finish(); see Started()
+    return 0;
+}
+
+bool CHTTPChunkedStreamBuf::Finish()
+{
+    if (!FlushChunk())
+        return false;
+    if (!fStarted) {
+        out << strHeader;
+        fStarted = true;
+    }
+    out << "0\r\n\r\n" << std::flush;
+    return out.good();
+}
+
+void CJSONStreamWriter::Separate()
+{
+    if (fAfterKey) {
+        fAfterKey = false;
+        return;
+    }
+    if (!vFirst.empty()) {
+        if (!vFirst.back())
+            os << ',';
+        vFirst.back() = false;
+    }
+}
+
+void CJSONStreamWriter::Check()
+{
+    if (!os)
+        throw std::runtime_error("JSON output stream failed");
+}
+
+void CJSONStreamWriter::BeginObject()
+{
+    Separate();
+    os << '{';
+    vFirst.push_back(true);
+}
+
+void CJSONStreamWriter::EndObject()
+{
+    assert(!vFirst.empty() && !fAfterKey);
+    vFirst.pop_back();
+    os << '}';
+    Check();
+}
+
+void CJSONStreamWriter::BeginArray()
+{
+    Separate();
+    os << '[';
+    vFirst.push_back(true);
+}
+
+void CJSONStreamWriter::EndArray()
+{
+    assert(!vFirst.empty() && !fAfterKey);
+    vFirst.pop_back();
+    os << ']';
+    Check();
+}
+
+void CJSONStreamWriter::Key(const std::string& name)
+{
+    assert(!fAfterKey);
+    Separate();
+    write_stream(Value(name), os, false);
+    os << ':';
+    fAfterKey = true;
+}
+
+void CJSONStreamWriter::Write(const Value& value)
+{
+    Separate();
+    write_stream(value, os, false);
+    Check();
+}
+
+void CJSONStreamWriter::WriteMembers(const Object& obj)
+{
+    BOOST_FOREACH(const Pair& pair, obj)
+        Write(pair.name_, pair.value_);
+}
+
+void CJSONStreamWriter::WriteHex(const unsigned char* begin, const unsigned char* end)
+{
+    static const size_t nStep = 4096;
+    Separate();
+    os << '"';
+    while (begin < end) {
+        const unsigned char* next = begin + std::min((size_t)(end - begin), nStep);
+        os << HexStr(begin, next);
+        begin = next;
+        Check();
+    }
+    os << '"';
+    Check();
+}
@@ -11,7 +11,10 @@
 #include <ios>
 #include <istream>
 #include <map>
+#include <ostream>
+#include <streambuf>
 #include <string>
+#include <vector>
 
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
@@ -157,6 +160,8 @@ std::string HTTPReplyHeader(int nStatus, bool keepalive, size_t contentLength,
 std::string HTTPReply(int nStatus, const std::string& strMsg, bool keepalive,
                       bool headerOnly = false,
                       const char *contentType = "application/json");
+std::string HTTPReplyHeaderChunked(int nStatus, bool keepalive,
+                                   const char *contentType = "application/json");
 bool ReadHTTPRequestLine(std::basic_istream<char>& stream, int &proto,
                          std::string& http_method, std::string& http_uri);
 int ReadHTTPStatus(std::basic_istream<char>& stream, int &proto);
@@ -168,4 +173,68 @@ json_spirit::Object JSONRPCReplyObj(const json_spirit::Value& result, const json
 std::string JSONRPCReply(const json_spirit::Value& result, const json_spirit::Value& error, const json_spirit::Value& id);
 json_spirit::Object JSONRPCError(int code, const std::string& message);
 
+/**
+ * Stream buffer that sends everything written through it as an HTTP/1.1
+ * chunked reply body. The reply header is held back until the first chunk
+ * is full, so a handler that fails early can still be answered with an
+ * ordinary error reply as long as Started() is false.
+ */
+class CHTTPChunkedStreamBuf : public std::streambuf
+{
+public:
+    CHTTPChunkedStreamBuf(std::ostream& outIn, const std::string& strHeaderIn, size_t nChunkSize = 64 * 1024);
+
+    //! True once any part of the reply has been handed to the connection
+    bool Started() const { return fStarted; }
+    //! Send the buffered data and the terminating zero-length chunk
+    bool Finish();
+
+protected:
+    int_type overflow(int_type ch);
+    int sync();
+
+private:
+    std::ostream& out;
+    std::string strHeader;
+    std::vector<char> vBuffer;
+    bool fStarted;
+
+    bool FlushChunk();
+};
+
+/**
+ * Writes a JSON document piece by piece. The output is byte-identical to
+ * json_spirit::write_string(value, false) for the equivalent Value tree,
+ * but only the value passed to each Write call has to exist in memory.
+ * Throws std::runtime_error once the underlying stream has failed, so
+ * callers stop producing output for a client that went away.
+ */
+class CJSONStreamWriter
+{
+public:
+    explicit CJSONStreamWriter(std::ostream& osIn) : os(osIn), fAfterKey(false) {}
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    //! Write the name of the next member of the current object
+    void Key(const std::string& name);
+    //! Write the next array element, the value of the last key, or the whole document
+    void Write(const json_spirit::Value& value);
+    void Write(const std::string& name, const json_spirit::Value& value) { Key(name); Write(value); }
+    //! Write all members of obj into the current object
+    void WriteMembers(const json_spirit::Object& obj);
+    //! Write a string holding the hex encoding of [begin, end) without building it in memory
+    void WriteHex(const unsigned char* begin, const unsigned char* end);
+
+private:
+    std::ostream& os;
+    std::vector<bool> vFirst; //! per open container: no element written yet
+    bool fAfterKey;
+
+    void Separate();
+    void Check();
+};
+
 #endif // BITCOIN_RPCPROTOCOL_H
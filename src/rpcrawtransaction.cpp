@@ -56,7 +56,8 @@ void ScriptPubKeyToJSON(const CScript& scriptPubKey, Object& out, bool fIncludeH
     out.push_back(Pair("addresses", a));
 }
 
-void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry)
+/** Confirmations are counted against pindexTip, which need not be chainActive's tip. */
+static void TxToJSON(const CTransaction& tx, const uint256 hashBlock, const CBlockIndex* pindexTip, Object& entry)
 {
     entry.push_back(Pair("txid", tx.GetHash().GetHex()));
     entry.push_back(Pair("version", tx.nVersion));
@@ -102,11 +103,10 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry)
 
     if (!hashBlock.IsNull()) {
         entry.push_back(Pair("blockhash", hashBlock.GetHex()));
-        BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
-        if (mi != mapBlockIndex.end() && (*mi).second) {
-            CBlockIndex* pindex = (*mi).second;
-            if (chainActive.Contains(pindex)) {
-                entry.push_back(Pair("confirmations", 1 + chainActive.Height() - pindex->nHeight));
+        const CBlockIndex* pindex = LookupBlockIndex(hashBlock);
+        if (pindex) {
+            if (pindexTip && pindexTip->GetAncestor(pindex->nHeight) == pindex) {
+                entry.push_back(Pair("confirmations", 1 + pindexTip->nHeight - pindex->nHeight));
                 entry.push_back(Pair("time", pindex->GetBlockTime()));
                 entry.push_back(Pair("blocktime", pindex->GetBlockTime()));
             }
@@ -116,6 +116,11 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry)
     }
 }
 
+void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry)
+{
+    TxToJSON(tx, hashBlock, chainActive.Tip(), entry);
+}
+
 Value getrawtransaction(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -183,18 +188,23 @@ Value getrawtransaction(const Array& params, bool fHelp)
             + HelpExampleRpc(__func__, "\"mytxid\", 1")
         );
 
-    LOCK(cs_main);
-
     uint256 hash = ParseHashV(params[0], "parameter 1");
 
     bool fVerbose = false;
     if (params.size() > 1)
         fVerbose = (params[1].get_int() != 0);
 
+    // With -txindex the mempool and the index answer without cs_main; the
+    // tip snapshot is taken first so the confirmations never run ahead of it.
+    const CBlockIndex* pindexTip = GetTipSnapshot();
     CTransaction tx;
     uint256 hashBlock;
-    if (!GetTransaction(hash, tx, hashBlock, NULL, true))
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available about transaction");
+    if (!mempool.lookup(hash, tx) && !GetTransactionFromTxIndex(hash, tx, hashBlock)) {
+        LOCK(cs_main);
+        pindexTip = chainActive.Tip();
+        if (!GetTransaction(hash, tx, hashBlock, NULL, true))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available about transaction");
+    }
     std::string strHex = EncodeHexTx(tx);
 
     if (!fVerbose)
@@ -202,50 +212,13 @@ Value getrawtransaction(const Array& params, bool fHelp)
 
     Object result;
     result.push_back(Pair("hex", strHex));
-    TxToJSON(tx, hashBlock, result);
+    TxToJSON(tx, hashBlock, pindexTip, result);
     return result;
 }
 
-Value listunspent(const Array& params, bool fHelp)
+/** Collect the wallet outputs selected by listunspent's parameters. */
+static void listUnspentOutputs(const Array& params, std::vector<COutput>& vResults)
 {
-    if (fHelp || params.size() > 4)
-        throw std::runtime_error(
-        _(__func__) + " ( minconf maxconf  [\"address\",...] )\n"
-        "\nReturns array of unspent transaction outputs\n"
-        "with between minconf and maxconf (inclusive) confirmations.\n"
-        "Optionally filter to only include txouts paid to specified addresses.\n"
-        "Results are an array of Objects, each of which has:\n"
-        "{txid, vout, scriptPubKey, amount, confirmations}\n"
-        "\nArguments:\n"
-        "1. minconf          (numeric, optional, default=1) The minimum confirmationsi to filter\n"                "2. maxconf          (numeric, optional, default=9999999) The maximum confirmations to filter\n"
-        "3. \"addresses\"    (string) A json array of gcoin addresses to filter\n"
-        "    [\n"
-        "      \"address\"   (string) gcoin address\n"
-        "      ,...\n"
-        "    ]\n"
-        "4. color          (numeric, optional) If specified, looks for UTXOs with this color\n"
-        "\nResult\n"
-        "[                   (array of json object)\n"
-        "  {\n"
-        "    \"txid\" : \"txid\",        (string) the transaction id \n"
-        "    \"vout\" : n,               (numeric) the vout value\n"
-        "    \"address\" : \"address\",  (string) the gcoin address\n"
-        "    \"account\" : \"account\",  (string) The associated account, or \"\" for the default account\n"
-        "    \"scriptPubKey\" : \"key\", (string) the script key\n"
-        "    \"amount\" : x.xxx,         (numeric) the transaction amount in btc\n"
-        "    \"color\" : color_type      (numeric) The currency type (color) of the transaction\n"
-        "    \"confirmations\" : n       (numeric) The number of confirmations\n"
-        "  }\n"
-        "  ,...\n"
-        "]\n"
-
-        "\nExamples\n"
-        + HelpExampleCli(__func__, "")
-        + HelpExampleCli(__func__, "6 9999999 \"[\\\"1PGFqEzfmQch1gKD3ra4k18PNj3tTUUSqg\\\",\\\"1LtvqCaApEdUGFkpKMM4MstjcaL4dKg8SP\\\"]\"")
-        + HelpExampleRpc(__func__, "6, 9999999 \"[\\\"1PGFqEzfmQch1gKD3ra4k18PNj3tTUUSqg\\\",\\\"1LtvqCaApEdUGFkpKMM4MstjcaL4dKg8SP\\\"]\"")
-        + HelpExampleRpc(__func__, "6, 9999999 \"[\\\"1PGFqEzfmQch1gKD3ra4k18PNj3tTUUSqg\\\",\\\"1LtvqCaApEdUGFkpKMM4MstjcaL4dKg8SP\\\"]\" 1")
-        );
-
     RPCTypeCheck(params, boost::assign::list_of(int_type)(int_type)(array_type));
 
     int nMinDepth = 1;
@@ -276,7 +249,6 @@ Value listunspent(const Array& params, bool fHelp)
         color_filter = ColorFromValue(params[3]);
     }
 
-    Array results;
     std::vector<COutput> vecOutputs;
     assert(pwalletMain != NULL);
 
@@ -302,38 +274,133 @@ Value listunspent(const Array& params, bool fHelp)
                 if (!setAddress.count(address))
                     continue;
             }
+            vResults.push_back(out);
+        }
+    }
+}
 
-            int64_t nValue = out.tx->vout[out.i].nValue;
-            const CScript& pk = out.tx->vout[out.i].scriptPubKey;
-            Object entry;
-            entry.push_back(Pair("txid", out.tx->GetHash().GetHex()));
-            entry.push_back(Pair("vout", out.i));
-            CTxDestination address;
-            if (ExtractDestination(out.tx->vout[out.i].scriptPubKey, address)) {
-                entry.push_back(Pair("address", CBitcoinAddress(address).ToString()));
-                if (pwalletMain->mapAddressBook.count(address))
-                    entry.push_back(Pair("account", pwalletMain->mapAddressBook[address].name));
-            }
-            entry.push_back(Pair("scriptPubKey", HexStr(pk.begin(), pk.end())));
-            if (pk.IsPayToScriptHash()) {
-                CTxDestination address;
-                if (ExtractDestination(pk, address)) {
-                    const CScriptID& hash = boost::get<CScriptID>(address);
-                    CScript redeemScript;
-                    if (pwalletMain->GetCScript(hash, redeemScript))
-                        entry.push_back(Pair("redeemScript", HexStr(redeemScript.begin(), redeemScript.end())));
-                }
-            }
-            entry.push_back(Pair("amount", ValueFromAmount(nValue)));
-            entry.push_back(Pair("color", (int64_t)out.tx->vout[out.i].color));
-            entry.push_back(Pair("confirmations", out.nDepth));
-            entry.push_back(Pair("spendable", out.fSpendable));
-            results.push_back(entry);
+static Object unspentToJSON(const COutput& out)
+{
+    int64_t nValue = out.tx->vout[out.i].nValue;
+    const CScript& pk = out.tx->vout[out.i].scriptPubKey;
+    Object entry;
+    entry.push_back(Pair("txid", out.tx->GetHash().GetHex()));
+    entry.push_back(Pair("vout", out.i));
+    CTxDestination address;
+    if (ExtractDestination(out.tx->vout[out.i].scriptPubKey, address)) {
+        entry.push_back(Pair("address", CBitcoinAddress(address).ToString()));
+        if (pwalletMain->mapAddressBook.count(address))
+            entry.push_back(Pair("account", pwalletMain->mapAddressBook[address].name));
+    }
+    entry.push_back(Pair("scriptPubKey", HexStr(pk.begin(), pk.end())));
+    if (pk.IsPayToScriptHash()) {
+        CTxDestination address;
+        if (ExtractDestination(pk, address)) {
+            const CScriptID& hash = boost::get<CScriptID>(address);
+            CScript redeemScript;
+            if (pwalletMain->GetCScript(hash, redeemScript))
+                entry.push_back(Pair("redeemScript", HexStr(redeemScript.begin(), redeemScript.end())));
         }
     }
+    entry.push_back(Pair("amount", ValueFromAmount(nValue)));
+    entry.push_back(Pair("color", (int64_t)out.tx->vout[out.i].color));
+    entry.push_back(Pair("confirmations", out.nDepth));
+    entry.push_back(Pair("spendable", out.fSpendable));
+    return entry;
+}
+
+Value listunspent(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 4)
+        throw std::runtime_error(
+        _(__func__) + " ( minconf maxconf  [\"address\",...] )\n"
+        "\nReturns array of unspent transaction outputs\n"
+        "with between minconf and maxconf (inclusive) confirmations.\n"
+        "Optionally filter to only include txouts paid to specified addresses.\n"
+        "Results are an array of Objects, each of which has:\n"
+        "{txid, vout, scriptPubKey, amount, confirmations}\n"
+        "\nArguments:\n"
+        "1. minconf          (numeric, optional, default=1) The minimum confirmationsi to filter\n"                "2. maxconf          (numeric, optional, default=9999999) The maximum confirmations to filter\n"
+        "3. \"addresses\"    (string) A json array of gcoin addresses to filter\n"
+        "    [\n"
+        "      \"address\"   (string) gcoin address\n"
+        "      ,...\n"
+        "    ]\n"
+        "4. color          (numeric, optional) If specified, looks for UTXOs with this color\n"
+        "\nResult\n"
+        "[                   (array of json object)\n"
+        "  {\n"
+        "    \"txid\" : \"txid\",        (string) the transaction id \n"
+        "    \"vout\" : n,               (numeric) the vout value\n"
+        "    \"address\" : \"address\",  (string) the gcoin address\n"
+        "    \"account\" : \"account\",  (string) The associated account, or \"\" for the default account\n"
+        "    \"scriptPubKey\" : \"key\", (string) the script key\n"
+        "    \"amount\" : x.xxx,         (numeric) the transaction amount in btc\n"
+        "    \"color\" : color_type      (numeric) The currency type (color) of the transaction\n"
+        "    \"confirmations\" : n       (numeric) The number of confirmations\n"
+        "  }\n"
+        "  ,...\n"
+        "]\n"
+
+        "\nExamples\n"
+        + HelpExampleCli(__func__, "")
+        + HelpExampleCli(__func__, "6 9999999 \"[\\\"1PGFqEzfmQch1gKD3ra4k18PNj3tTUUSqg\\\",\\\"1LtvqCaApEdUGFkpKMM4MstjcaL4dKg8SP\\\"]\"")
+        + HelpExampleRpc(__func__, "6, 9999999 \"[\\\"1PGFqEzfmQch1gKD3ra4k18PNj3tTUUSqg\\\",\\\"1LtvqCaApEdUGFkpKMM4MstjcaL4dKg8SP\\\"]\"")
+        + HelpExampleRpc(__func__, "6, 9999999 \"[\\\"1PGFqEzfmQch1gKD3ra4k18PNj3tTUUSqg\\\",\\\"1LtvqCaApEdUGFkpKMM4MstjcaL4dKg8SP\\\"]\" 1")
+        );
+
+    Array results;
+    std::vector<COutput> vecOutputs;
+    listUnspentOutputs(params, vecOutputs);
+    BOOST_FOREACH(const COutput& out, vecOutputs)
+        results.push_back(unspentToJSON(out));
     return results;
 }
 
+void listunspent_stream(const Array& params, CJSONStreamWriter& writer)
+{
+    if (pwalletMain == NULL)
+        throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found (disabled)");
+
+    if (params.size() > 4)
+        listunspent(params, true); // throws the usage text
+
+    // Only the outputs are collected under the locks. They are converted in
+    // batches, each under the locks again with the transaction looked up
+    // anew, and written after releasing them, so neither the whole JSON
+    // result is held in memory nor can a slow client stall block connection
+    // or the wallet.
+    std::vector<std::pair<uint256, COutput> > vOutputs;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
+        std::vector<COutput> vecOutputs;
+        listUnspentOutputs(params, vecOutputs);
+        vOutputs.reserve(vecOutputs.size());
+        BOOST_FOREACH(const COutput& out, vecOutputs)
+            vOutputs.push_back(std::make_pair(out.tx->GetHash(), out));
+    }
+
+    static const size_t nBatchSize = 100;
+    writer.BeginArray();
+    for (size_t nStart = 0; nStart < vOutputs.size(); nStart += nBatchSize) {
+        std::vector<Object> vEntries;
+        {
+            LOCK2(cs_main, pwalletMain->cs_wallet);
+            for (size_t n = nStart; n < vOutputs.size() && n < nStart + nBatchSize; n++) {
+                std::map<uint256, CWalletTx>::const_iterator it = pwalletMain->mapWallet.find(vOutputs[n].first);
+                if (it == pwalletMain->mapWallet.end())
+                    continue;
+                const COutput& out = vOutputs[n].second;
+                vEntries.push_back(unspentToJSON(COutput(&it->second, out.i, out.nDepth, out.fSpendable)));
+            }
+        }
+        BOOST_FOREACH(const Object& entry, vEntries)
+            writer.Write(entry);
+    }
+    writer.EndArray();
+}
+
 Value verifytxoutproof(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
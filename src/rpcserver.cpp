@@ -8,6 +8,7 @@
 
 #include "base58.h"
 #include "init.h"
+#include "main.h"
 #include "random.h"
 #include "sync.h"
 #include "ui_interface.h"
@@ -289,19 +290,121 @@ Value stop(const Array& params, bool fHelp)
     return "Gcoin server stopping";
 }
 
+/** Upper bounds of the RPC latency histogram buckets, in microseconds; the last bucket is open */
+static const int64_t RPC_LATENCY_BUCKETS[] = { 100, 1000, 10000, 100000, 1000000, 10000000 };
+static const char* const RPC_LATENCY_BUCKET_NAMES[] = { "0.1ms", "1ms", "10ms", "100ms", "1s", "10s", "inf" };
+static const unsigned int RPC_LATENCY_BUCKET_COUNT = sizeof(RPC_LATENCY_BUCKETS) / sizeof(RPC_LATENCY_BUCKETS[0]) + 1;
+
+struct CRPCMethodStats
+{
+    uint64_t nCalls;
+    uint64_t nErrors;
+    int64_t nTotalMicros;
+    int64_t nMaxMicros;
+    uint64_t vBuckets[RPC_LATENCY_BUCKET_COUNT];
+
+    CRPCMethodStats() : nCalls(0), nErrors(0), nTotalMicros(0), nMaxMicros(0)
+    {
+        for (unsigned int i = 0; i < RPC_LATENCY_BUCKET_COUNT; i++)
+            vBuckets[i] = 0;
+    }
+};
+
+static CCriticalSection cs_rpcStats;
+static std::map<std::string, CRPCMethodStats> mapRPCStats;
+
+/**
+ * Times one command handler and records it in mapRPCStats when it goes out
+ * of scope. Calls that leave without Success() count as errors.
+ */
+class CRPCCallTimer
+{
+private:
+    const std::string& strMethod;
+    int64_t nStart;
+    bool fSuccess;
+
+public:
+    explicit CRPCCallTimer(const std::string& strMethodIn) : strMethod(strMethodIn), nStart(GetTimeMicros()), fSuccess(false) {}
+
+    void Success() { fSuccess = true; }
+
+    ~CRPCCallTimer()
+    {
+        int64_t nMicros = GetTimeMicros() - nStart;
+        unsigned int nBucket = 0;
+        while (nBucket + 1 < RPC_LATENCY_BUCKET_COUNT && nMicros > RPC_LATENCY_BUCKETS[nBucket])
+            nBucket++;
+
+        LOCK(cs_rpcStats);
+        CRPCMethodStats& stats = mapRPCStats[strMethod];
+        stats.nCalls++;
+        if (!fSuccess)
+            stats.nErrors++;
+        stats.nTotalMicros += nMicros;
+        stats.nMaxMicros = std::max(stats.nMaxMicros, nMicros);
+        stats.vBuckets[nBucket]++;
+    }
+};
+
+Value getrpcstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrpcstats\n"
+            "\nReturns call counts and handler latencies of the RPC methods called since startup.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"method\" : {                (object) One entry per method called so far\n"
+            "    \"calls\" : n,              (numeric) Number of calls\n"
+            "    \"errors\" : n,             (numeric) Number of calls that returned an error\n"
+            "    \"totalms\" : x.xxx,        (numeric) Total time spent in the handler in milliseconds\n"
+            "    \"avgms\" : x.xxx,          (numeric) Average time per call in milliseconds\n"
+            "    \"maxms\" : x.xxx,          (numeric) Slowest call in milliseconds\n"
+            "    \"histogram\" : {           (object) Number of calls that took at most the given time\n"
+            "      \"0.1ms\" : n, \"1ms\" : n, \"10ms\" : n, \"100ms\" : n, \"1s\" : n, \"10s\" : n, \"inf\" : n\n"
+            "    }\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrpcstats", "")
+            + HelpExampleRpc("getrpcstats", "")
+        );
+
+    Object ret;
+    LOCK(cs_rpcStats);
+    for (std::map<std::string, CRPCMethodStats>::const_iterator it = mapRPCStats.begin(); it != mapRPCStats.end(); ++it) {
+        const CRPCMethodStats& stats = it->second;
+        Object obj;
+        obj.push_back(Pair("calls", (uint64_t)stats.nCalls));
+        obj.push_back(Pair("errors", (uint64_t)stats.nErrors));
+        obj.push_back(Pair("totalms", stats.nTotalMicros / 1000.0));
+        obj.push_back(Pair("avgms", stats.nCalls ? stats.nTotalMicros / 1000.0 / stats.nCalls : 0.0));
+        obj.push_back(Pair("maxms", stats.nMaxMicros / 1000.0));
+        Object histogram;
+        for (unsigned int i = 0; i < RPC_LATENCY_BUCKET_COUNT; i++)
+            histogram.push_back(Pair(RPC_LATENCY_BUCKET_NAMES[i], (uint64_t)stats.vBuckets[i]));
+        obj.push_back(Pair("histogram", histogram));
+        ret.push_back(Pair(it->first, obj));
+    }
+    return ret;
+}
+
 
 /**
  * Call Table
  */
 static const CRPCCommand vRPCCommands[] =
 {
-  //  category              name                           actor (function)              okSafeMode threadSafe  reqWallet
-  //  --------------------- -----------------------------  ----------------------------  ---------- ----------- ---------
+  //  category              name                           actor (function)              okSafeMode threadSafe  reqWallet   streamActor (optional)  snapshotSafe (optional)
+  //  --------------------- -----------------------------  ----------------------------  ---------- ----------- ----------- ----------------------  -----------------------
     /* Overall control/query calls */
     { "control",            "getinfo",                     &getinfo,                     true,      false,      false }, /* uses wallet if enabled */
     { "control",            "resetwarning",                &resetwarning,                true,      false,      false },
     { "control",            "help",                        &help,                        true,      true,       false },
     { "control",            "stop",                        &stop,                        true,      true,       false },
+    { "control",            "getrpcstats",                 &getrpcstats,                 true,      true,       false,      NULL,                   true },
 
     /* P2P networking */
     { "network",            "getnetworkinfo",              &getnetworkinfo,              true,      false,      false },
@@ -325,16 +428,16 @@ static const CRPCCommand vRPCCommands[] =
     /* Block chain and UTXO */
     { "blockchain",         "getblockchaininfo",           &getblockchaininfo,           true,      false,      false },
     { "blockchain",         "getbestblockhash",            &getbestblockhash,            true,      false,      false },
-    { "blockchain",         "getblockcount",               &getblockcount,               true,      false,      false },
-    { "blockchain",         "getblock",                    &getblock,                    true,      false,      false },
-    { "blockchain",         "getblockhash",                &getblockhash,                true,      false,      false },
+    { "blockchain",         "getblockcount",               &getblockcount,               true,      false,      false,      NULL,                   true },
+    { "blockchain",         "getblock",                    &getblock,                    true,      false,      false,      &getblock_stream },
+    { "blockchain",         "getblockhash",                &getblockhash,                true,      false,      false,      NULL,                   true },
     { "blockchain",         "getchaintips",                &getchaintips,                true,      false,      false },
     { "blockchain",         "getdifficulty",               &getdifficulty,               true,      false,      false },
     { "blockchain",         "getmempoolinfo",              &getmempoolinfo,              true,      true,       false },
-    { "blockchain",         "getrawmempool",               &getrawmempool,               true,      false,      false },
+    { "blockchain",         "getrawmempool",               &getrawmempool,               true,      false,      false,      &getrawmempool_stream },
     { "blockchain",         "getaddrmempool",              &getaddrmempool,              true,      false,      false },
     { "blockchain",         "gettxout",                    &gettxout,                    true,      false,      false },
-    { "blockchain",         "gettxoutaddress",             &gettxoutaddress,             true,      false,      false },
+    { "blockchain",         "gettxoutaddress",             &gettxoutaddress,             true,      false,      false,      &gettxoutaddress_stream },
     { "blockchain",         "verifytxoutproof",            &verifytxoutproof,            true,      false,      false },
     { "blockchain",         "gettxoutsetinfo",             &gettxoutsetinfo,             true,      false,      false },
     { "blockchain",         "verifychain",                 &verifychain,                 true,      false,      false },
@@ -356,7 +459,7 @@ static const CRPCCommand vRPCCommands[] =
     { "rawtransactions",    "createrawtransaction",        &createrawtransaction,        true,      false,      false },
     { "rawtransactions",    "decoderawtransaction",        &decoderawtransaction,        true,      false,      false },
     { "rawtransactions",    "decodescript",                &decodescript,                true,      false,      false },
-    { "rawtransactions",    "getrawtransaction",           &getrawtransaction,           true,      false,      false },
+    { "rawtransactions",    "getrawtransaction",           &getrawtransaction,           true,      false,      false,      NULL,                   true },
     { "rawtransactions",    "sendrawtransaction",          &sendrawtransaction,          false,     false,      false },
     { "rawtransactions",    "signrawtransaction",          &signrawtransaction,          false,     false,      false }, /* uses wallet if enabled */
 
@@ -394,7 +497,7 @@ static const CRPCCommand vRPCCommands[] =
     { "wallet",             "mintforlicense",              &mintforlicense,              false,     false,      true },
     { "wallet",             "mintforminer",                &mintforminer,                false,     false,      true },
     { "wallet",             "getlicenselist",              &getlicenselist,              false,     false,      true },
-    { "wallet",             "getlicenseinfo",              &getlicenseinfo,              false,     false,      true },
+    { "wallet",             "getlicenseinfo",              &getlicenseinfo,              false,     false,      true,       NULL,                   true },
 
     { "wallet",             "addmultisigaddress",          &addmultisigaddress,          true,      false,      true },
     { "wallet",             "backupwallet",                &backupwallet,                true,      false,      true },
@@ -424,8 +527,8 @@ static const CRPCCommand vRPCCommands[] =
     { "wallet",             "listreceivedbyaccount",       &listreceivedbyaccount,       false,     false,      true },
     { "wallet",             "listreceivedbyaddress",       &listreceivedbyaddress,       false,     false,      true },
     { "wallet",             "listsinceblock",              &listsinceblock,              false,     false,      true },
-    { "wallet",             "listtransactions",            &listtransactions,            false,     false,      true },
-    { "wallet",             "listunspent",                 &listunspent,                 false,     false,      true },
+    { "wallet",             "listtransactions",            &listtransactions,            false,     false,      true,       &listtransactions_stream },
+    { "wallet",             "listunspent",                 &listunspent,                 false,     false,      true,       &listunspent_stream },
     { "wallet",             "lockunspent",                 &lockunspent,                 true,      false,      true },
     { "wallet",             "move",                        &movecmd,                     false,     false,      true },
     { "wallet",             "sendfrom",                    &sendfrom,                    false,     false,      true },
@@ -464,6 +567,16 @@ const CRPCCommand *CRPCTable::operator[](string name) const
     return (*it).second;
 }
 
+bool CRPCTable::IsSnapshotCall(const string &method) const
+{
+    const CRPCCommand *pcmd = (*this)[method];
+    if (pcmd == NULL || !pcmd->snapshotSafe)
+        return false;
+    if (pcmd->actor == &getrawtransaction)
+        return fTxIndex;
+    return true;
+}
+
 
 bool HTTPAuthorized(map<string, string>& mapHeaders)
 {
@@ -546,6 +659,14 @@ public:
         _stream.close();
     }
 
+    virtual bool DataAvailable()
+    {
+        if (_stream.rdbuf()->in_avail() > 0)
+            return true;
+        boost::system::error_code ec;
+        return sslStream.lowest_layer().available(ec) > 0 && !ec;
+    }
+
     typename Protocol::endpoint peer;
     boost::asio::ssl::stream<typename Protocol::socket> sslStream;
 
@@ -555,6 +676,8 @@ private:
 };
 
 void ServiceConnection(AcceptedConnection *conn);
+static void StartRPCCallWorkers();
+static void StopRPCCallWorkers();
 
 //! Forward declaration required for RPCListen
 template <typename Protocol, typename SocketAcceptorService>
@@ -785,6 +908,7 @@ void StartRPCThreads()
         return;
     }
 
+    StartRPCCallWorkers();
     rpc_worker_group = new boost::thread_group();
     for (int i = 0; i < GetArg("-rpcthreads", 4); i++)
         rpc_worker_group->create_thread(boost::bind(&boost::asio::io_service::run, rpc_io_service));
@@ -835,6 +959,7 @@ void StopRPCThreads()
     g_rpcSignals.Stopped();
     if (rpc_worker_group != NULL)
         rpc_worker_group->join_all();
+    StopRPCCallWorkers();
     delete rpc_dummy_work; rpc_dummy_work = NULL;
     delete rpc_worker_group; rpc_worker_group = NULL;
     delete rpc_ssl_context; rpc_ssl_context = NULL;
@@ -928,44 +1053,362 @@ void JSONRequest::parse(const Value& valRequest)
 }
 
 
-static Object JSONRPCExecOne(const Value& req)
-{
-    Object rpc_result;
+static bool HTTPReq_JSONRPCStream(AcceptedConnection *conn, const JSONRequest& jreq, bool fRun);
 
+/**
+ * One JSON-RPC call, executed by the RPC worker pool. The connection
+ * thread that owns the request waits for the result, or, for a streamed
+ * call, for the worker to finish writing the reply to the connection.
+ */
+class CRPCCall
+{
+public:
     JSONRequest jreq;
-    try {
-        jreq.parse(req);
+    //! The method is marked snapshotSafe in the dispatch table
+    bool fSnapshot;
+    //! Handed to QueueRPCCall already; only touched by the connection thread
+    bool fQueued;
+
+    explicit CRPCCall(const Value& valRequest) : fSnapshot(false), fQueued(false), connStream(NULL), fStreamRun(false), fStreamOk(false), fError(false), fDone(false)
+    {
+        try {
+            jreq.parse(valRequest);
+            fSnapshot = tableRPC.IsSnapshotCall(jreq.strMethod);
+        } catch (const Object& objErrorIn) {
+            SetError(objErrorIn);
+        }
+    }
 
-        Value result = tableRPC.execute(jreq.strMethod, jreq.params);
-        rpc_result = JSONRPCReplyObj(result, Value::null, jreq.id);
+    void Run()
+    {
+        {
+            // Requests that failed to parse have their error already
+            boost::unique_lock<boost::mutex> lock(cs);
+            if (fDone)
+                return;
+        }
+        try {
+            if (connStream) {
+                bool fOk = HTTPReq_JSONRPCStream(connStream, jreq, fStreamRun);
+                boost::unique_lock<boost::mutex> lock(cs);
+                fStreamOk = fOk;
+                fDone = true;
+            } else {
+                Value resultIn = tableRPC.execute(jreq.strMethod, jreq.params);
+                boost::unique_lock<boost::mutex> lock(cs);
+                result = resultIn;
+                fDone = true;
+            }
+        } catch (const Object& objErrorIn) {
+            SetError(objErrorIn);
+        } catch (const std::exception& e) {
+            SetError(JSONRPCError(RPC_PARSE_ERROR, e.what()));
+        } catch (...) {
+            SetError(JSONRPCError(RPC_MISC_ERROR, "unknown error"));
+        }
+        cond.notify_all();
     }
-    catch (const Object& objError)
+
+    /** Wait for the call and return its result, or throw its error object */
+    Value Result()
     {
-        rpc_result = JSONRPCReplyObj(Value::null, objError, jreq.id);
+        Wait();
+        if (fError)
+            throw objError;
+        return result;
     }
-    catch (const std::exception& e)
+
+    /**
+     * Have the worker stream the reply to conn itself. It holds its worker
+     * until the client has read the whole reply, so it is never run as a
+     * snapshot call and counts against the method's worker limit.
+     */
+    void SetStream(AcceptedConnection *conn, bool fRun)
+    {
+        connStream = conn;
+        fStreamRun = fRun;
+        fSnapshot = false;
+    }
+
+    /**
+     * Wait for a streamed call and return whether the connection can be
+     * kept. Errors raised before the reply was started are thrown as their
+     * error object, for the caller to reply with.
+     */
+    bool StreamResult()
+    {
+        Wait();
+        if (fError)
+            throw objError;
+        return fStreamOk;
+    }
+
+    /** Wait for the call and return its reply as an element of a batch */
+    Object ReplyObj()
     {
-        rpc_result = JSONRPCReplyObj(Value::null,
-                                     JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
+        Wait();
+        if (fError)
+            return JSONRPCReplyObj(Value::null, objError, jreq.id);
+        return JSONRPCReplyObj(result, Value::null, jreq.id);
     }
 
-    return rpc_result;
+private:
+    AcceptedConnection *connStream;
+    bool fStreamRun;
+    bool fStreamOk;
+    Value result;
+    Object objError;
+    bool fError;
+    bool fDone;
+    boost::mutex cs;
+    boost::condition_variable cond;
+
+    void SetError(const Object& objErrorIn)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        objError = objErrorIn;
+        fError = true;
+        fDone = true;
+    }
+
+    void Wait()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (!fDone)
+            cond.wait(lock);
+    }
+};
+
+typedef boost::shared_ptr<CRPCCall> CRPCCallRef;
+
+/**
+ * RPC worker pool. Calls are taken in arrival order, except that snapshot
+ * calls go first and one worker is kept free for them so that cheap reads
+ * are never stuck behind slow ones. No method may occupy more than
+ * nRPCMethodThreads workers at a time.
+ */
+static boost::mutex cs_rpcCallQueue;
+static boost::condition_variable condRPCCallQueue;
+static std::deque<CRPCCallRef> vRPCCallQueue;
+static std::map<std::string, int> mapRPCCallsRunning;
+static int nRPCCallsRunning = 0; //!< Running calls that are not snapshot calls
+static int nRPCCallThreads = 0;
+static int nRPCMethodThreads = DEFAULT_RPC_METHOD_THREADS;
+static bool fRPCCallQueueRunning = false;
+static boost::thread_group* rpc_call_group = NULL;
+
+//! Requires cs_rpcCallQueue
+static CRPCCallRef PopRPCCall()
+{
+    for (std::deque<CRPCCallRef>::iterator it = vRPCCallQueue.begin(); it != vRPCCallQueue.end(); ++it) {
+        if ((*it)->fSnapshot) {
+            CRPCCallRef call = *it;
+            vRPCCallQueue.erase(it);
+            return call;
+        }
+    }
+    if (nRPCCallThreads > 1 && nRPCCallsRunning >= nRPCCallThreads - 1)
+        return CRPCCallRef();
+    for (std::deque<CRPCCallRef>::iterator it = vRPCCallQueue.begin(); it != vRPCCallQueue.end(); ++it) {
+        std::map<std::string, int>::const_iterator mi = mapRPCCallsRunning.find((*it)->jreq.strMethod);
+        if (mi == mapRPCCallsRunning.end() || mi->second < nRPCMethodThreads) {
+            CRPCCallRef call = *it;
+            vRPCCallQueue.erase(it);
+            return call;
+        }
+    }
+    return CRPCCallRef();
 }
 
-static string JSONRPCExecBatch(const Array& vReq)
+static void ThreadRPCCallWorker()
 {
+    RenameThread("gcoin-rpcworker");
+    boost::unique_lock<boost::mutex> lock(cs_rpcCallQueue);
+    while (true) {
+        CRPCCallRef call = PopRPCCall();
+        if (!call) {
+            // Drain the queue before exiting so that no connection waits forever
+            if (!fRPCCallQueueRunning && vRPCCallQueue.empty())
+                return;
+            condRPCCallQueue.wait(lock);
+            continue;
+        }
+        if (!call->fSnapshot) {
+            nRPCCallsRunning++;
+            mapRPCCallsRunning[call->jreq.strMethod]++;
+        }
+        lock.unlock();
+        call->Run();
+        lock.lock();
+        if (!call->fSnapshot) {
+            nRPCCallsRunning--;
+            if (--mapRPCCallsRunning[call->jreq.strMethod] == 0)
+                mapRPCCallsRunning.erase(call->jreq.strMethod);
+        }
+        // A worker or method slot has become free
+        condRPCCallQueue.notify_all();
+    }
+}
+
+static void QueueRPCCall(const CRPCCallRef& call)
+{
+    if (call->fQueued)
+        return;
+    call->fQueued = true;
+    {
+        boost::unique_lock<boost::mutex> lock(cs_rpcCallQueue);
+        if (fRPCCallQueueRunning) {
+            vRPCCallQueue.push_back(call);
+            condRPCCallQueue.notify_all();
+            return;
+        }
+    }
+    call->Run();
+}
+
+static void StartRPCCallWorkers()
+{
+    nRPCCallThreads = std::max((int)GetArg("-rpcworkers", DEFAULT_RPC_WORKER_THREADS), 1);
+    nRPCMethodThreads = std::max((int)GetArg("-rpcmethodthreads", DEFAULT_RPC_METHOD_THREADS), 1);
+    {
+        boost::unique_lock<boost::mutex> lock(cs_rpcCallQueue);
+        fRPCCallQueueRunning = true;
+    }
+    rpc_call_group = new boost::thread_group();
+    for (int i = 0; i < nRPCCallThreads; i++)
+        rpc_call_group->create_thread(&ThreadRPCCallWorker);
+}
+
+static void StopRPCCallWorkers()
+{
+    if (rpc_call_group == NULL)
+        return;
+    {
+        boost::unique_lock<boost::mutex> lock(cs_rpcCallQueue);
+        fRPCCallQueueRunning = false;
+        condRPCCallQueue.notify_all();
+    }
+    rpc_call_group->join_all();
+    delete rpc_call_group; rpc_call_group = NULL;
+}
+
+/** Maximum number of requests read ahead on one keep-alive connection */
+static const unsigned int MAX_RPC_PIPELINE_DEPTH = 16;
+
+/** A request read off a keep-alive connection but not answered yet */
+class CPipelinedRequest
+{
+public:
+    int nProto;
+    map<string, string> mapHeaders;
+    string strRequest, strMethod, strURI;
+    //! The reply keeps the connection open
+    bool fRun;
+    //! The body has been parsed into valRequest
+    bool fParsed;
+    Value valRequest;
+    //! Calls queued ahead of time, by position in the batch (0 for a singleton)
+    std::vector<CRPCCallRef> vCalls;
+
+    CPipelinedRequest() : nProto(0), fRun(true), fParsed(false) {}
+};
+
+/** Return the call for entry n of req, creating it if it was not queued ahead */
+static CRPCCallRef PipelinedCall(CPipelinedRequest& req, unsigned int n, const Value& valRequest)
+{
+    if (n < req.vCalls.size() && req.vCalls[n])
+        return req.vCalls[n];
+    return CRPCCallRef(new CRPCCall(valRequest));
+}
+
+/**
+ * Queue the snapshot calls of the waiting requests so that they run while
+ * the requests ahead of them are answered. The first call that is not a
+ * snapshot call is a barrier: nothing after it is queued early, so a read
+ * never observes the state from before an earlier write on the connection.
+ */
+static void QueuePipelinedCalls(std::deque<CPipelinedRequest>& vPipeline)
+{
+    if (RPCIsInWarmup(NULL))
+        return;
+    BOOST_FOREACH(CPipelinedRequest& req, vPipeline) {
+        // REST requests only read, and are answered in order regardless
+        if (req.strURI != "/")
+            continue;
+        if (req.mapHeaders.count("authorization") == 0 || !HTTPAuthorized(req.mapHeaders))
+            return;
+        if (!req.fParsed) {
+            if (!read_string(req.strRequest, req.valRequest))
+                return;
+            req.fParsed = true;
+        }
+
+        std::vector<Value> vReq;
+        if (req.valRequest.type() == obj_type)
+            vReq.push_back(req.valRequest);
+        else if (req.valRequest.type() == array_type)
+            vReq.assign(req.valRequest.get_array().begin(), req.valRequest.get_array().end());
+        else
+            return;
+
+        req.vCalls.resize(vReq.size());
+        for (unsigned int i = 0; i < vReq.size(); i++) {
+            if (!req.vCalls[i])
+                req.vCalls[i] = CRPCCallRef(new CRPCCall(vReq[i]));
+            if (!req.vCalls[i]->fSnapshot)
+                return;
+            QueueRPCCall(req.vCalls[i]);
+        }
+    }
+}
+
+static string JSONRPCExecBatch(CPipelinedRequest& req, const Array& vReq)
+{
+    // Entries run one after the other; snapshot calls may have been queued ahead
     Array ret;
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++) {
+        CRPCCallRef call = PipelinedCall(req, reqIdx, vReq[reqIdx]);
+        QueueRPCCall(call);
+        ret.push_back(call->ReplyObj());
+    }
 
     return write_string(Value(ret), false) + "\n";
 }
 
-static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
-                            string& strRequest,
-                            map<string, string>& mapHeaders,
-                            bool fRun)
+/**
+ * Answer a singleton request whose command has a streaming implementation.
+ * The reply is sent with chunked transfer encoding so that the result never
+ * has to be held in memory as a whole. Errors raised before the first chunk
+ * went out propagate to the caller, which replies as usual; after that the
+ * only option left is to drop the connection.
+ */
+static bool HTTPReq_JSONRPCStream(AcceptedConnection *conn, const JSONRequest& jreq, bool fRun)
 {
+    CHTTPChunkedStreamBuf buf(conn->stream(), HTTPReplyHeaderChunked(HTTP_OK, fRun));
+    std::ostream os(&buf);
+    try {
+        CJSONStreamWriter writer(os);
+        writer.BeginObject();
+        writer.Key("result");
+        tableRPC.executeStream(jreq.strMethod, jreq.params, writer);
+        writer.Write("error", Value::null);
+        writer.Write("id", jreq.id);
+        writer.EndObject();
+        os << "\n";
+    } catch (...) {
+        if (!buf.Started())
+            throw;
+        LogPrintf("ThreadRPCServer %s failed after the reply was started, dropping connection\n", SanitizeString(jreq.strMethod));
+        return false;
+    }
+    return buf.Finish();
+}
+
+static bool HTTPReq_JSONRPC(AcceptedConnection *conn, CPipelinedRequest& req)
+{
+    map<string, string>& mapHeaders = req.mapHeaders;
+    bool fRun = req.fRun;
+
     // Check authorization
     if (mapHeaders.count("authorization") == 0)
     {
@@ -989,9 +1432,12 @@ static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
     try
     {
         // Parse request
-        Value valRequest;
-        if (!read_string(strRequest, valRequest))
-            throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
+        if (!req.fParsed) {
+            if (!read_string(req.strRequest, req.valRequest))
+                throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
+            req.fParsed = true;
+        }
+        const Value& valRequest = req.valRequest;
 
         // Return immediately if in warmup
         {
@@ -1004,16 +1450,27 @@ static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
 
         // singleton request
         if (valRequest.type() == obj_type) {
-            jreq.parse(valRequest);
+            CRPCCallRef call = PipelinedCall(req, 0, valRequest);
+            jreq = call->jreq;
+
+            // Large results are streamed to HTTP/1.1 clients, by the worker
+            // that runs the call
+            const CRPCCommand *pcmd = tableRPC[jreq.strMethod];
+            if (!call->fQueued && req.nProto >= 1 && pcmd && pcmd->streamActor) {
+                call->SetStream(conn, fRun);
+                QueueRPCCall(call);
+                return call->StreamResult();
+            }
 
-            Value result = tableRPC.execute(jreq.strMethod, jreq.params);
+            QueueRPCCall(call);
+            Value result = call->Result();
 
             // Send reply
             strReply = JSONRPCReply(result, Value::null, jreq.id);
 
         // array of requests
         } else if (valRequest.type() == array_type)
-            strReply = JSONRPCExecBatch(valRequest.get_array());
+            strReply = JSONRPCExecBatch(req, valRequest.get_array());
         else
             throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
 
@@ -1034,39 +1491,68 @@ static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
 
 void ServiceConnection(AcceptedConnection *conn)
 {
-    bool fRun = true;
-    while (fRun && !ShutdownRequested())
+    // Requests that arrive back to back on a keep-alive connection are read
+    // ahead, so that their snapshot calls run in parallel; the replies still
+    // go out in request order.
+    std::deque<CPipelinedRequest> vPipeline;
+    bool fReading = true;
+    while (!ShutdownRequested())
     {
-        int nProto = 0;
-        map<string, string> mapHeaders;
-        string strRequest, strMethod, strURI;
+        while (fReading && (vPipeline.empty() ||
+                            (vPipeline.size() < MAX_RPC_PIPELINE_DEPTH && conn->DataAvailable())))
+        {
+            CPipelinedRequest req;
 
-        // Read HTTP request line
-        if (!ReadHTTPRequestLine(conn->stream(), nProto, strMethod, strURI))
-            break;
+            // Read HTTP request line
+            if (!ReadHTTPRequestLine(conn->stream(), req.nProto, req.strMethod, req.strURI)) {
+                fReading = false;
+                break;
+            }
 
-        // Read HTTP message headers and body
-        ReadHTTPMessage(conn->stream(), mapHeaders, strRequest, nProto, MAX_SIZE);
+            // Read HTTP message headers and body
+            ReadHTTPMessage(conn->stream(), req.mapHeaders, req.strRequest, req.nProto, MAX_SIZE);
 
-        // HTTP Keep-Alive is false; close connection immediately
-        if ((mapHeaders["connection"] == "close") || (!GetBoolArg("-rpckeepalive", true)))
-            fRun = false;
+            // HTTP Keep-Alive is false; close connection after this request
+            if ((req.mapHeaders["connection"] == "close") || (!GetBoolArg("-rpckeepalive", true))) {
+                req.fRun = false;
+                fReading = false;
+            }
+            vPipeline.push_back(req);
+        }
+        if (vPipeline.empty())
+            break;
+        if (vPipeline.size() > 1)
+            QueuePipelinedCalls(vPipeline);
+
+        CPipelinedRequest& req = vPipeline.front();
+        bool fRun = req.fRun;
 
         // Process via JSON-RPC API
-        if (strURI == "/") {
-            if (!HTTPReq_JSONRPC(conn, strRequest, mapHeaders, fRun))
+        if (req.strURI == "/") {
+            if (!HTTPReq_JSONRPC(conn, req))
                 break;
 
         // Process via HTTP REST API
-        } else if (strURI.substr(0, 6) == "/rest/" && GetBoolArg("-rest", false)) {
-            if (!HTTPReq_REST(conn, strURI, strRequest, mapHeaders, fRun))
+        } else if (req.strURI.substr(0, 6) == "/rest/" && GetBoolArg("-rest", false)) {
+            if (!HTTPReq_REST(conn, req.strURI, req.strRequest, req.mapHeaders, fRun))
                 break;
 
         } else {
             conn->stream() << HTTPError(HTTP_NOT_FOUND, false) << std::flush;
             break;
         }
+
+        vPipeline.pop_front();
+        if (!fRun)
+            break;
     }
+
+    // Calls queued ahead for requests that will not be answered still hold
+    // a worker; let them finish before the connection goes away
+    BOOST_FOREACH(CPipelinedRequest& req, vPipeline)
+        BOOST_FOREACH(const CRPCCallRef& call, req.vCalls)
+            if (call && call->fQueued)
+                call->ReplyObj();
 }
 
 json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
@@ -1081,7 +1567,38 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
     try
     {
         // Execute
-        return pcmd->actor(params, false);
+        CRPCCallTimer timer(pcmd->name);
+        Value result = pcmd->actor(params, false);
+        timer.Success();
+        return result;
+    }
+    catch (const std::exception& e)
+    {
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+
+    g_rpcSignals.PostCommand(*pcmd);
+}
+
+void CRPCTable::executeStream(const std::string &strMethod, const json_spirit::Array &params, CJSONStreamWriter& writer) const
+{
+    // Find method
+    const CRPCCommand *pcmd = tableRPC[strMethod];
+    if (!pcmd || !pcmd->streamActor)
+        throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found");
+#ifdef ENABLE_WALLET
+    if (pcmd->reqWallet && !pwalletMain)
+        throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found (disabled)");
+#endif
+
+    g_rpcSignals.PreCommand(*pcmd);
+
+    try
+    {
+        // Execute
+        CRPCCallTimer timer(pcmd->name);
+        pcmd->streamActor(params, writer);
+        timer.Success();
     }
     catch (const std::exception& e)
     {
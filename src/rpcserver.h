@@ -43,8 +43,15 @@ public:
     virtual std::iostream& stream() = 0;
     virtual std::string peer_address_to_string() const = 0;
     virtual void close() = 0;
+    /** Whether more request bytes can be read without blocking */
+    virtual bool DataAvailable() = 0;
 };
 
+/** Default number of threads executing JSON-RPC calls (-rpcworkers) */
+static const int DEFAULT_RPC_WORKER_THREADS = 4;
+/** Default number of RPC workers a single method may occupy (-rpcmethodthreads) */
+static const int DEFAULT_RPC_METHOD_THREADS = 2;
+
 /** Start RPC threads */
 void StartRPCThreads();
 /**
@@ -94,6 +101,14 @@ extern CNetAddr BoostAsioToCNetAddr(boost::asio::ip::address address);
 
 typedef json_spirit::Value(*rpcfn_type)(const json_spirit::Array& params, bool fHelp);
 
+/**
+ * Optional second implementation of a command that writes its result
+ * straight to the reply instead of returning it. It must produce the same
+ * JSON as the regular actor and should throw before writing anything on
+ * bad parameters.
+ */
+typedef void(*rpcstreamfn_type)(const json_spirit::Array& params, CJSONStreamWriter& writer);
+
 class CRPCCommand
 {
 public:
@@ -103,6 +118,13 @@ public:
     bool okSafeMode;
     bool threadSafe;
     bool reqWallet;
+    rpcstreamfn_type streamActor;
+    /**
+     * The command only reads the tip snapshot (see GetTipSnapshot), never
+     * takes cs_main and changes no state, so it may run ahead of earlier
+     * requests on a pipelined connection.
+     */
+    bool snapshotSafe;
 };
 
 /**
@@ -117,6 +139,12 @@ public:
     const CRPCCommand* operator[](std::string name) const;
     std::string help(std::string name) const;
 
+    /**
+     * Whether a call of method may run on the tip snapshot right now.
+     * getrawtransaction only avoids cs_main with -txindex.
+     */
+    bool IsSnapshotCall(const std::string &method) const;
+
     /**
      * Execute a method.
      * @param method   Method to execute
@@ -125,6 +153,13 @@ public:
      * @throws an exception (json_spirit::Value) when an error happens.
      */
     json_spirit::Value execute(const std::string &method, const json_spirit::Array &params) const;
+
+    /**
+     * Execute a method that has a streaming implementation, writing the
+     * result to writer.
+     * @throws an exception (json_spirit::Value) when an error happens.
+     */
+    void executeStream(const std::string &method, const json_spirit::Array &params, CJSONStreamWriter& writer) const;
 };
 
 extern const CRPCTable tableRPC;
@@ -209,6 +244,7 @@ extern json_spirit::Value createmultisig(const json_spirit::Array& params, bool
 extern json_spirit::Value listreceivedbyaddress(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listreceivedbyaccount(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listtransactions(const json_spirit::Array& params, bool fHelp);
+extern void listtransactions_stream(const json_spirit::Array& params, CJSONStreamWriter& writer);
 extern json_spirit::Value listwalletaddress(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listonewalletaddress(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listaddressgroupings(const json_spirit::Array& params, bool fHelp);
@@ -259,6 +295,7 @@ extern json_spirit::Value getlicenseinfo(const json_spirit::Array& params, bool
 
 extern json_spirit::Value getrawtransaction(const json_spirit::Array& params, bool fHelp); // in rcprawtransaction.cpp
 extern json_spirit::Value listunspent(const json_spirit::Array& params, bool fHelp);
+extern void listunspent_stream(const json_spirit::Array& params, CJSONStreamWriter& writer);
 extern json_spirit::Value lockunspent(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listlockunspent(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value createrawtransaction(const json_spirit::Array& params, bool fHelp);
@@ -275,12 +312,15 @@ extern json_spirit::Value getdifficulty(const json_spirit::Array& params, bool f
 extern json_spirit::Value settxfee(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getmempoolinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getrawmempool(const json_spirit::Array& params, bool fHelp);
+extern void getrawmempool_stream(const json_spirit::Array& params, CJSONStreamWriter& writer);
 extern json_spirit::Value getaddrmempool(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblockhash(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblock(const json_spirit::Array& params, bool fHelp);
+extern void getblock_stream(const json_spirit::Array& params, CJSONStreamWriter& writer);
 extern json_spirit::Value gettxoutsetinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value gettxout(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value gettxoutaddress(const json_spirit::Array& params, bool fHelp);
+extern void gettxoutaddress_stream(const json_spirit::Array& params, CJSONStreamWriter& writer);
 extern json_spirit::Value verifychain(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getchaintips(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value invalidateblock(const json_spirit::Array& params, bool fHelp);
@@ -24,6 +24,7 @@
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 // Tests this internal-to-main.cpp method:
 extern bool AddOrphanTx(const CTransaction& tx, NodeId peer);
@@ -108,6 +109,36 @@ BOOST_AUTO_TEST_CASE(DoS_bantime)
     BOOST_CHECK(!CNode::IsBanned(addr));
 }
 
+// Mimics a message handler worker punishing a peer while other peers come and go
+static void MisbehaveConcurrently(NodeId id, uint32_t nOtherIp, int nTimes)
+{
+    for (int i = 0; i < nTimes; i++) {
+        CNode dummyOther(INVALID_SOCKET, CAddress(ip(nOtherIp)), "", true);
+        Misbehaving(id, 1);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(DoS_misbehaving_workers)
+{
+    CNode::ClearBanned();
+    mapArgs["-banscore"] = "1000";
+    CAddress addr(ip(0xa0b0c001));
+    CNode dummyNode(INVALID_SOCKET, addr, "", true);
+    dummyNode.nVersion = 1;
+
+    boost::thread worker1(boost::bind(&MisbehaveConcurrently, dummyNode.GetId(), 0xa0b0c101, 500));
+    boost::thread worker2(boost::bind(&MisbehaveConcurrently, dummyNode.GetId(), 0xa0b0c201, 500));
+    worker1.join();
+    worker2.join();
+
+    CNodeStateStats stats;
+    BOOST_CHECK(GetNodeStateStats(dummyNode.GetId(), stats));
+    BOOST_CHECK_EQUAL(stats.nMisbehavior, 1000);
+    SendMessages(&dummyNode, false);
+    BOOST_CHECK(CNode::IsBanned(addr));
+    mapArgs.erase("-banscore");
+}
+
 CTransaction RandomOrphan()
 {
     std::map<uint256, COrphanTx>::iterator it;
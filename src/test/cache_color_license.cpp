@@ -8,6 +8,9 @@
 
 #include <map>
 #include <string>
+#include <vector>
+
+#include <boost/thread.hpp>
 
 #include "test_gcoin.h"
 #include "policy/licenseinfo.h"
@@ -61,4 +64,125 @@ BOOST_FIXTURE_TEST_CASE(CacheTestColorLicense, CacheTestFixture)
     BOOST_CHECK(plicense->IsColorExist(4) == false);
 }
 
+BOOST_FIXTURE_TEST_CASE(CacheTestLookupUnknownColor, CacheTestFixture)
+{
+    // Queries about a color without a license don't add it.
+    BOOST_CHECK_EQUAL(plicense->GetOwner(5), "");
+    BOOST_CHECK_EQUAL(plicense->GetUpperLimit(5), 0);
+    BOOST_CHECK_EQUAL(plicense->NumOfCoins(5), 0);
+    BOOST_CHECK(!plicense->HasColorOwner(5));
+    BOOST_CHECK(plicense->IsColorExist(5) == false);
+    BOOST_CHECK(plicense->ListLicense().empty());
+
+    // Licenses added out of order are found.
+    CLicenseInfo info;
+    info.nLimit = 1000;
+    plicense->SetOwner(9, "issuer9", &info);
+    plicense->SetOwner(3, "issuer3", &info);
+    plicense->SetOwner(6, "issuer6", &info);
+    BOOST_CHECK_EQUAL(plicense->GetOwner(3), "issuer3");
+    BOOST_CHECK_EQUAL(plicense->GetOwner(6), "issuer6");
+    BOOST_CHECK_EQUAL(plicense->GetOwner(9), "issuer9");
+    BOOST_CHECK_EQUAL(plicense->GetUpperLimit(6), 1000);
+    BOOST_CHECK_EQUAL(plicense->GetOwner(5), "");
+    BOOST_CHECK_EQUAL(plicense->ListLicense().size(), 3U);
+    plicense->RemoveOwner(5);
+    BOOST_CHECK(plicense->IsColorExist(5) == false);
+    plicense->RemoveAll();
+}
+
+BOOST_FIXTURE_TEST_CASE(CacheTestManyUnorderedColors, CacheTestFixture)
+{
+    // Enough colors added out of order to be merged several times stay
+    // sorted and can be removed wherever they are kept.
+    const type_Color nColors = 3000;
+    CLicenseInfo info;
+    for (type_Color i = 0; i < nColors; i++) {
+        type_Color color = 1 + (i * 7919) % nColors;
+        BOOST_REQUIRE(plicense->SetOwner(color, "issuer", &info));
+        plicense->AddNumOfCoins(color, color);
+        if (color % 3 == 0)
+            plicense->RemoveColor(color);
+    }
+    std::vector<std::pair<type_Color, color_license::Owner_> > vLicense = plicense->Snapshot();
+    BOOST_CHECK_EQUAL(vLicense.size(), nColors - nColors / 3);
+    for (size_t i = 1; i < vLicense.size(); i++)
+        BOOST_REQUIRE(vLicense[i - 1].first < vLicense[i].first);
+    for (type_Color color = 1; color <= nColors; color++) {
+        BOOST_CHECK_EQUAL(plicense->IsColorExist(color), color % 3 != 0);
+        BOOST_CHECK_EQUAL(plicense->NumOfCoins(color), color % 3 ? (int64_t)color : 0);
+    }
+    BOOST_CHECK_EQUAL(plicense->ListLicense().size(), vLicense.size());
+    plicense->RemoveAll();
+    BOOST_CHECK(plicense->Snapshot().empty());
+}
+
+static void AddColors(type_Color nColors)
+{
+    CLicenseInfo info;
+    for (type_Color color = 1; color <= nColors; color++)
+        plicense->SetOwner(color, "issuer", &info);
+}
+
+BOOST_FIXTURE_TEST_CASE(CacheTestSnapshot, CacheTestFixture)
+{
+    // Snapshots taken while another thread adds colors in order always hold
+    // colors 1 to n.
+    const type_Color nColors = 2000;
+    boost::thread writer(boost::bind(&AddColors, nColors));
+    size_t nLast = 0;
+    while (nLast < nColors) {
+        std::vector<std::pair<type_Color, color_license::Owner_> > vLicense = plicense->Snapshot();
+        BOOST_REQUIRE(vLicense.size() >= nLast);
+        if (!vLicense.empty()) {
+            BOOST_REQUIRE_EQUAL(vLicense.front().first, 1U);
+            BOOST_REQUIRE_EQUAL(vLicense.back().first, vLicense.size());
+        }
+        nLast = vLicense.size();
+    }
+    writer.join();
+    BOOST_CHECK_EQUAL(plicense->ListLicense().size(), nColors);
+    plicense->RemoveAll();
+}
+
+static void ApplyColorPairs(type_Color nPairs)
+{
+    CLicenseInfo info;
+    for (type_Color color = 1; color <= 2 * nPairs; color += 2) {
+        CacheApplyLock lock(cs_cacheApply);
+        plicense->SetOwner(color, "issuer", &info);
+        plicense->SetOwner(color + 1, "issuer", &info);
+        plicense->AddNumOfCoins(color + 1, COIN);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(CacheTestApplyLock, CacheTestFixture)
+{
+    // Readers holding cs_cacheApply never see half of what was applied
+    // under it: the colors come in pairs, and the second of each pair is
+    // already minted.
+    const type_Color nPairs = 1000;
+    boost::thread writer(boost::bind(&ApplyColorPairs, nPairs));
+    size_t nLast = 0;
+    while (nLast < 2 * nPairs) {
+        CacheReadLock lock(cs_cacheApply);
+        std::vector<std::pair<type_Color, color_license::Owner_> > vLicense = plicense->Snapshot();
+        BOOST_REQUIRE_EQUAL(vLicense.size() % 2, 0U);
+        if (!vLicense.empty()) {
+            color_license::Owner_ owner;
+            BOOST_REQUIRE(plicense->GetEntry(vLicense.back().first, owner));
+            BOOST_REQUIRE_EQUAL(owner.num_of_coins_, COIN);
+        }
+        nLast = vLicense.size();
+    }
+    writer.join();
+
+    color_license::Owner_ owner;
+    BOOST_CHECK(!plicense->GetEntry(2 * nPairs + 1, owner));
+    BOOST_CHECK(plicense->GetEntry(1, owner));
+    BOOST_CHECK_EQUAL(owner.address_, "issuer");
+    BOOST_CHECK_EQUAL(owner.num_of_coins_, 0);
+    plicense->RemoveAll();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,8 @@
 
 #include "coins.h"
 #include "random.h"
+#include "script/script.h"
+#include "txdb.h"
 #include "uint256.h"
 #include "test/test_gcoin.h"
 
@@ -42,7 +44,7 @@ public:
 
     uint256 GetBestBlock() const { return hashBestBlock_; }
 
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, const CCoinsStats& statsReplaced)
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             map_[it->first] = it->second.coins;
@@ -197,4 +199,90 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(missed_an_entry);
 }
 
+
+// Create new coin records and spend outputs of earlier ones
+static void ModifyRandomCoins(CCoinsViewCache& cache, std::vector<uint256>& txids, int nHeight)
+{
+    for (unsigned int i = 0; i < 20; i++) {
+        if (!txids.empty() && insecure_rand() % 3 == 0) {
+            // Spend an output of an existing record, erasing it once empty
+            CCoinsModifier coins = cache.ModifyCoins(txids[insecure_rand() % txids.size()]);
+            if (!coins->vout.empty())
+                coins->Spend(insecure_rand() % coins->vout.size());
+        } else {
+            uint256 txid = GetRandHash();
+            CCoinsModifier coins = cache.ModifyCoins(txid);
+            coins->nHeight = nHeight;
+            coins->vout.resize(1 + insecure_rand() % 3);
+            for (unsigned int n = 0; n < coins->vout.size(); n++)
+                coins->vout[n] = CTxOut(1 + insecure_rand() % 1000, CScript() << OP_TRUE, 1 + insecure_rand() % 4);
+            txids.push_back(txid);
+        }
+    }
+}
+
+// The statistics kept by CCoinsViewDB must match a full scan after every flush,
+// including changes that reach the database through a chain of caches.
+BOOST_AUTO_TEST_CASE(coins_db_stats_test)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    std::vector<uint256> txids;
+
+    for (unsigned int round = 0; round < 20; round++) {
+        CCoinsViewCache cache(&db);
+        ModifyRandomCoins(cache, txids, round);
+        if (round % 2) {
+            CCoinsViewCache child(&cache);
+            ModifyRandomCoins(child, txids, round);
+            BOOST_CHECK(child.Flush());
+            ModifyRandomCoins(cache, txids, round);
+        }
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+
+        CCoinsStats stats, statsScan;
+        BOOST_CHECK(db.GetStats(stats));
+        BOOST_CHECK(db.ComputeStats(statsScan));
+        BOOST_CHECK(stats.hashBlock == db.GetBestBlock());
+        BOOST_CHECK(stats.hashBlock == statsScan.hashBlock);
+        BOOST_CHECK_EQUAL(stats.nTransactions, statsScan.nTransactions);
+        BOOST_CHECK_EQUAL(stats.nTransactionOutputs, statsScan.nTransactionOutputs);
+        BOOST_CHECK_EQUAL(stats.nSerializedSize, statsScan.nSerializedSize);
+        BOOST_CHECK(stats.hashSerialized == statsScan.hashSerialized);
+        BOOST_CHECK(stats.mapTotalAmount == statsScan.mapTotalAmount);
+    }
+}
+
+// Coins handed to a cache ahead of time must read the same as coins fetched
+// on demand, and never replace what the cache already holds.
+BOOST_AUTO_TEST_CASE(coins_fetched_ahead_test)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    uint256 txidA = GetRandHash(), txidB = GetRandHash();
+    {
+        CCoinsViewCache cache(&db);
+        cache.ModifyCoins(txidA)->vout.push_back(CTxOut(10, CScript() << OP_TRUE, 1));
+        cache.ModifyCoins(txidB)->vout.push_back(CTxOut(20, CScript() << OP_TRUE, 1));
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+    }
+
+    CCoinsViewCache cache(&db);
+    BOOST_CHECK(!cache.HaveCoinsInCache(txidA));
+    cache.ModifyCoins(txidB)->Spend(0);
+    BOOST_CHECK(cache.HaveCoinsInCache(txidB));
+
+    CCoins coinsA, coinsB;
+    BOOST_CHECK(db.GetCoins(txidA, coinsA));
+    BOOST_CHECK(db.GetCoins(txidB, coinsB));
+    cache.AddFetchedCoins(txidA, coinsA);
+    cache.AddFetchedCoins(txidB, coinsB);
+    BOOST_CHECK(cache.HaveCoinsInCache(txidA));
+    BOOST_CHECK(cache.AccessCoins(txidA)->IsAvailable(0));
+    BOOST_CHECK_EQUAL(cache.AccessCoins(txidA)->vout[0].nValue, 10);
+    // The spend in the cache wins over the stale read.
+    BOOST_CHECK(!cache.AccessCoins(txidB)->IsAvailable(0));
+    BOOST_CHECK(cache.DynamicMemoryUsage() > 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
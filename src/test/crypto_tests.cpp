@@ -8,6 +8,7 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "hash.h"
 #include "random.h"
 #include "utilstrencodings.h"
 #include "test/test_gcoin.h"
@@ -131,6 +132,23 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    // Batch sizes cover every combination of the 8-way, 4-way and single-lane paths.
+    for (int blocks = 0; blocks <= 32; blocks++) {
+        std::vector<unsigned char> in(64 * blocks);
+        std::vector<unsigned char> out(32 * blocks);
+        for (size_t i = 0; i < in.size(); i++)
+            in[i] = insecure_rand() & 0xff;
+        if (blocks)
+            SHA256D64(&out[0], &in[0], blocks);
+        for (int i = 0; i < blocks; i++) {
+            uint256 expected = Hash(in.begin() + 64 * i, in.begin() + 64 * (i + 1));
+            BOOST_CHECK(std::equal(out.begin() + 32 * i, out.begin() + 32 * (i + 1), expected.begin()));
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
@@ -2,6 +2,7 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
 
 #include <stdint.h>
@@ -44,9 +45,7 @@ struct CreateLicenseHandlerCheckValidFixture : public LicenseHandlerFixture
         vector<string> key;
         key.push_back(member);
         CScript licenseaddr = _createmultisig_redeemScript(1, key);
-        CScriptID licenseaddrID(licenseaddr);
-        CBitcoinAddress licenseaddress(licenseaddrID);
-        ConsensusAddressForLicense = licenseaddress.ToString();
+        SetConsensusAddresses(CScriptID(licenseaddr), CScriptID());
         issuer = CreateAddress();
 
         palliance->Add(member);
@@ -92,7 +91,7 @@ BOOST_FIXTURE_TEST_CASE(CreateLicenseHandlerCheckValidPass, CreateLicenseHandler
 
 BOOST_FIXTURE_TEST_CASE(CreateLicenseHandlerCheckValidNotConsensusAddress, CreateLicenseHandlerCheckValidFixture)
 {
-    ConsensusAddressForLicense = CreateAddress();
+    SetConsensusAddresses(CScriptID(CScript() << OP_TRUE), CScriptID());
     CheckFalse(100, __func__);
 }
 
@@ -112,6 +111,90 @@ BOOST_FIXTURE_TEST_CASE(CreateLicenseHandlerCheckValidInvalidInfo, CreateLicense
     CheckFalse(100, __func__);
 }
 
+BOOST_FIXTURE_TEST_CASE(CreateLicenseHandlerApplyInfo, CreateLicenseHandlerCheckValidFixture)
+{
+    info.name = "gcoin";
+    info.issuer = "issuer";
+    string hexStr = info.EncodeInfo();
+    transactions[license_hash].vout[1].scriptPubKey = CScript() << OP_RETURN << vector<unsigned char>(hexStr.begin(), hexStr.end());
+    BOOST_CHECK(handler->Apply(CTransaction(transactions[license_hash]), NULL));
+
+    CLicenseInfo applied;
+    BOOST_CHECK(plicense->GetLicenseInfo(color, applied));
+    BOOST_CHECK_EQUAL(applied.name, "gcoin");
+    BOOST_CHECK_EQUAL(applied.issuer, "issuer");
+}
+
+BOOST_AUTO_TEST_CASE(DecodeLicenseInfoFromScript)
+{
+    CLicenseInfo info;
+    info.name = "gcoin";
+    info.description = "license";
+    string hexStr = info.EncodeInfo();
+    vector<unsigned char> vch(hexStr.begin(), hexStr.end());
+
+    CLicenseInfo decoded;
+    BOOST_CHECK(DecodeLicenseInfo(CScript() << OP_RETURN << vch, decoded));
+    BOOST_CHECK_EQUAL(decoded.name, "gcoin");
+    BOOST_CHECK_EQUAL(decoded.description, "license");
+
+    // The hex string shares the cache entry with the script.
+    CLicenseInfo cached;
+    BOOST_CHECK(DecodeLicenseInfo(hexStr, cached));
+    BOOST_CHECK_EQUAL(cached.name, "gcoin");
+
+    BOOST_CHECK(!DecodeLicenseInfo(CScript() << vch, decoded));
+    BOOST_CHECK(!DecodeLicenseInfo(CScript() << OP_RETURN << OP_DUP, decoded));
+    BOOST_CHECK(!DecodeLicenseInfo(CScript() << OP_RETURN << ParseHex("0102"), decoded));
+    BOOST_CHECK(!DecodeLicenseInfo("fake_info", decoded));
+}
+
+// The way LICENSE transactions have always been read
+static bool DecodeLicenseInfoFromScriptString(const CScript& scriptInfo, CLicenseInfo& info)
+{
+    vector<unsigned char> vch = ParseHex(scriptInfo.ToString().substr(10));
+    return info.DecodeInfo(string(vch.begin(), vch.end()));
+}
+
+BOOST_AUTO_TEST_CASE(DecodeLicenseInfoMatchesScriptString)
+{
+    CLicenseInfo info;
+    info.name = "gcoin";
+    string hexStr = info.EncodeInfo();
+    vector<unsigned char> vch(hexStr.begin(), hexStr.end());
+    vector<unsigned char> vchHead(vch.begin(), vch.end() - 4);
+    vector<unsigned char> vchTail(vch.end() - 4, vch.end());
+    vector<unsigned char> vchFirst(vch.begin(), vch.begin() + vch.size() / 2);
+    vector<unsigned char> vchSecond(vch.begin() + vch.size() / 2, vch.end());
+
+    vector<CScript> scripts;
+    scripts.push_back(CScript() << OP_RETURN << vch);
+    scripts.push_back(CScript() << OP_RETURN << vchFirst << vchSecond);
+    // Trailing opcodes end the hex string, the info in front of them is accepted
+    scripts.push_back(CScript() << OP_RETURN << vch << OP_DROP);
+    scripts.push_back(CScript() << OP_RETURN << vch << OP_16);
+    scripts.push_back(CScript() << OP_RETURN << vch << OP_0);
+    // Pushes of up to 4 bytes are shown as numbers
+    scripts.push_back(CScript() << OP_RETURN << vchHead << vchTail);
+    scripts.push_back(CScript() << OP_RETURN << vchHead << ParseHex("00"));
+    scripts.push_back(CScript() << OP_RETURN << ParseHex("0102"));
+    scripts.push_back(CScript() << OP_RETURN << OP_DUP << vch);
+    scripts.push_back(CScript() << OP_DUP << OP_RETURN << vch);
+    scripts.push_back(CScript() << vch);
+
+    BOOST_FOREACH(const CScript& script, scripts) {
+        CLicenseInfo expected, decoded;
+        bool fExpected = DecodeLicenseInfoFromScriptString(script, expected);
+        BOOST_CHECK_EQUAL(DecodeLicenseInfo(script, decoded), fExpected);
+        if (fExpected)
+            BOOST_CHECK_EQUAL(decoded.name, expected.name);
+    }
+    BOOST_CHECK(DecodeLicenseInfo(CScript() << OP_RETURN << vch << OP_DROP, info));
+
+    // Too short to hold "OP_RETURN " and anything after it, as before
+    BOOST_CHECK_THROW(DecodeLicenseInfo(CScript() << OP_RETURN, info), std::out_of_range);
+}
+
 struct TransferLicenseHandlerCheckValidFixture : public LicenseHandlerFixture
 {
     TransferLicenseHandlerCheckValidFixture()
@@ -2,11 +2,14 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "base58.h"
 #include "chainparams.h"
 #include "main.h"
+#include "util.h"
 
 #include "test/test_gcoin.h"
 
+#include <boost/filesystem.hpp>
 #include <boost/signals2/signal.hpp>
 #include <boost/test/unit_test.hpp>
 
@@ -36,6 +39,35 @@ static void TestBlockSubsidyHalvings(int nSubsidyHalvingInterval)
     TestBlockSubsidyHalvings(consensusParams);
 }
 
+BOOST_AUTO_TEST_CASE(read_block_mapped)
+{
+    const CBlockIndex* pindex = chainActive.Genesis();
+    BOOST_REQUIRE(pindex != NULL);
+    const CMessageHeader::MessageStartChars& messageStart = Params().MessageStart();
+
+    std::vector<unsigned char> vchMapped, vchRead;
+    CBlock blockMapped, blockRead;
+    mapArgs["-blockmmapfiles"] = "8";
+    BOOST_CHECK(ReadRawBlockFromDisk(vchMapped, pindex, messageStart));
+    BOOST_CHECK(ReadBlockFromDisk(blockMapped, pindex->GetBlockPos()));
+    mapArgs["-blockmmapfiles"] = "0";
+    BOOST_CHECK(ReadRawBlockFromDisk(vchRead, pindex, messageStart));
+    BOOST_CHECK(ReadBlockFromDisk(blockRead, pindex->GetBlockPos()));
+    BOOST_CHECK(vchMapped == vchRead);
+    BOOST_CHECK(blockMapped.GetHash() == pindex->GetBlockHash());
+    BOOST_CHECK(blockRead.GetHash() == pindex->GetBlockHash());
+
+    // A block appended past the end of the existing mapping is still found
+    mapArgs["-blockmmapfiles"] = "8";
+    CBlock block = blockRead;
+    block.nNonce++;
+    CDiskBlockPos pos(pindex->GetBlockPos().nFile, boost::filesystem::file_size(GetBlockPosFilename(pindex->GetBlockPos(), "blk")));
+    BOOST_REQUIRE(WriteBlockToDisk(block, pos, messageStart));
+    BOOST_CHECK(ReadBlockFromDisk(blockMapped, pos));
+    BOOST_CHECK(blockMapped.GetHash() == block.GetHash());
+    mapArgs.erase("-blockmmapfiles");
+}
+
 BOOST_AUTO_TEST_CASE(block_subsidy_test)
 {
     TestBlockSubsidyHalvings(Params(CBaseChainParams::MAIN).GetConsensus()); // As in main
@@ -56,6 +88,218 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     BOOST_CHECK_EQUAL(nSum, 2099999997690000ULL);
 }
 */
+BOOST_AUTO_TEST_CASE(tx_fee_from_view)
+{
+    CCoinsView dummy;
+    CCoinsViewCache view(&dummy);
+
+    CMutableTransaction prev;
+    prev.vout.push_back(CTxOut(10 * COIN, CScript(), TxFee.GetColor()));
+    prev.vout.push_back(CTxOut(3 * COIN, CScript(), 5));
+    view.ModifyCoins(prev.GetHash())->FromTx(prev, 0);
+
+    CMutableTransaction tx;
+    tx.vin.push_back(CTxIn(COutPoint(prev.GetHash(), 0)));
+    tx.vin.push_back(CTxIn(COutPoint(prev.GetHash(), 1)));
+    tx.vout.push_back(CTxOut(9 * COIN, CScript(), TxFee.GetColor()));
+    tx.vout.push_back(CTxOut(3 * COIN, CScript(), 5));
+    BOOST_CHECK_EQUAL(TxFee.GetTxFee(tx, view), COIN);
+    tx.type = MINT;
+    BOOST_CHECK_EQUAL(TxFee.GetTxFee(tx, view), 0);
+
+    // The coinbase has to collect exactly the fees of the block.
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.push_back(CTxOut(0, CScript(), DEFAULT_ADMIN_COLOR));
+    coinbase.vout.push_back(CTxOut(COIN, CScript(), TxFee.GetColor()));
+    CBlock block;
+    block.vtx.push_back(coinbase);
+    block.vtx.push_back(tx);
+    std::vector<CAmount> vTxFees(2, 0);
+    vTxFees[1] = COIN;
+    BOOST_CHECK(TxFee.CheckFirstCoinBaseTransactions(block, vTxFees, false));
+    vTxFees[1] = 2 * COIN;
+    BOOST_CHECK(!TxFee.CheckFirstCoinBaseTransactions(block, vTxFees, false));
+    vTxFees[1] = COIN / 2;
+    BOOST_CHECK(!TxFee.CheckFirstCoinBaseTransactions(block, vTxFees, false));
+    BOOST_CHECK(TxFee.CheckFirstCoinBaseTransactions(block, vTxFees, true));
+    vTxFees.pop_back();
+    BOOST_CHECK(!TxFee.CheckFirstCoinBaseTransactions(block, vTxFees, false));
+}
+
+BOOST_AUTO_TEST_CASE(prevout_cache)
+{
+    // The prevout cache is bypassed while coins lookups are stubbed.
+    bool (*GetCoinsFromCacheSaved)(const COutPoint&, CCoins&, bool) = AlternateFunc_GetCoinsFromCache;
+    AlternateFunc_GetCoinsFromCache = NULL;
+
+    CCoinsView dummy;
+    CCoinsViewCache view(&dummy);
+
+    CScript scriptPubKey = GetScriptForDestination(CScriptID(CScript() << OP_TRUE));
+    CMutableTransaction prev;
+    prev.type = MINT;
+    prev.vout.push_back(CTxOut(COIN, CScript(), 5));
+    prev.vout.push_back(CTxOut(2 * COIN, scriptPubKey, 6));
+    view.ModifyCoins(prev.GetHash())->FromTx(prev, 10);
+    CMutableTransaction pooled;
+    pooled.vout.push_back(CTxOut(COIN, scriptPubKey, 5));
+    view.ModifyCoins(pooled.GetHash())->FromTx(pooled, MEMPOOL_HEIGHT);
+
+    CMutableTransaction tx;
+    tx.vin.push_back(CTxIn(COutPoint(prev.GetHash(), 1)));
+    tx.vin.push_back(CTxIn(COutPoint(pooled.GetHash(), 0)));
+
+    // The outputs are only in view, not in the chain.
+    TxInfo txinfo;
+    BOOST_CHECK(!txinfo.init(tx.vin[0].prevout, NULL));
+
+    // Coins at or above the given height are not cached.
+    AddPrevoutsToCache(tx, view, 10);
+    BOOST_CHECK(!txinfo.init(tx.vin[0].prevout, NULL));
+
+    AddPrevoutsToCache(tx, view, MEMPOOL_HEIGHT);
+    BOOST_CHECK(txinfo.init(tx.vin[0].prevout, NULL));
+    BOOST_CHECK_EQUAL(txinfo.GetTxType(), MINT);
+    BOOST_CHECK_EQUAL(txinfo.GetTxOutColorOfIndex(1), 6);
+    BOOST_CHECK_EQUAL(txinfo.GetTxOutValueOfIndex(1), 2 * COIN);
+    BOOST_CHECK(txinfo.GetTxOutScriptOfIndex(1) == scriptPubKey);
+    BOOST_CHECK_EQUAL(txinfo.GetTxOutAddressOfIndex(1), GetDestination(scriptPubKey));
+    BOOST_CHECK_EQUAL(GetTxInputAddr(tx, NULL), GetDestination(scriptPubKey));
+    // Only the spent output is known from the cache.
+    BOOST_CHECK_THROW(txinfo.GetTxOutValueOfIndex(0), std::runtime_error);
+    BOOST_CHECK_THROW(txinfo.GetTxOutAddressOfIndex(0), std::runtime_error);
+    BOOST_CHECK_THROW(txinfo.GetTxOutSize(), std::runtime_error);
+    BOOST_CHECK(!txinfo.init(tx.vin[1].prevout, NULL));
+
+    // Spending the input or disconnecting its transaction drops it.
+    ErasePrevoutsFromCache(tx);
+    BOOST_CHECK(!txinfo.init(tx.vin[0].prevout, NULL));
+    AddPrevoutsToCache(tx, view, MEMPOOL_HEIGHT);
+    EraseOutputsFromCache(prev);
+    BOOST_CHECK(!txinfo.init(tx.vin[0].prevout, NULL));
+
+    AlternateFunc_GetCoinsFromCache = GetCoinsFromCacheSaved;
+}
+
+BOOST_AUTO_TEST_CASE(consensus_address_scriptid)
+{
+    CScript redeemScript = CScript() << OP_TRUE;
+    CScriptID id(redeemScript);
+    SetConsensusAddresses(id, CScriptID());
+    BOOST_CHECK_EQUAL(ConsensusAddressForLicense, CBitcoinAddress(id).ToString());
+    BOOST_CHECK_EQUAL(ConsensusAddressForMiner, "");
+
+    BOOST_CHECK(IsPayToScriptID(GetScriptForDestination(id), ConsensusScriptIDForLicense));
+    // Same hash behind a pay to pubkey hash script is not the consensus address.
+    BOOST_CHECK(!IsPayToScriptID(GetScriptForDestination(CKeyID(id)), ConsensusScriptIDForLicense));
+    BOOST_CHECK(!IsPayToScriptID(GetScriptForDestination(CScriptID(CScript() << OP_FALSE)), ConsensusScriptIDForLicense));
+    // An unset consensus address matches nothing.
+    BOOST_CHECK(!IsPayToScriptID(GetScriptForDestination(CScriptID()), ConsensusScriptIDForMiner));
+
+    SetConsensusAddresses(CScriptID(), CScriptID());
+    BOOST_CHECK_EQUAL(ConsensusAddressForLicense, "");
+}
+
+BOOST_AUTO_TEST_CASE(precheck_block)
+{
+    // The header signature is checked against the coinbase output, so an
+    // OP_TRUE output accepts the empty scriptSig.
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << 1 << OP_0;
+    coinbase.vout.push_back(CTxOut(0, CScript() << OP_TRUE, DEFAULT_ADMIN_COLOR));
+    CMutableTransaction mtx;
+    mtx.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+    mtx.vout.push_back(CTxOut(COIN, CScript() << OP_TRUE, 2));
+
+    CBlock block;
+    block.vtx.push_back(coinbase);
+    for (unsigned int i = 0; i < 100; i++) {
+        mtx.vin[0].prevout.n = i;
+        block.vtx.push_back(mtx);
+    }
+    block.hashMerkleRoot = block.GetMerkleRoot();
+    PreCheckBlock(block);
+    BOOST_CHECK(block.fPreChecked);
+    block.ClearCache();
+    BOOST_CHECK(!block.fPreChecked);
+
+    // Merkle root mismatch
+    block.hashMerkleRoot = uint256();
+    PreCheckBlock(block);
+    BOOST_CHECK(!block.fPreChecked);
+    block.hashMerkleRoot = block.GetMerkleRoot();
+
+    // Header signature rejected
+    CMutableTransaction coinbaseBad(coinbase);
+    coinbaseBad.vout[0].scriptPubKey = CScript() << OP_FALSE;
+    block.vtx[0] = coinbaseBad;
+    block.ClearCache();
+    block.hashMerkleRoot = block.GetMerkleRoot();
+    PreCheckBlock(block);
+    BOOST_CHECK(!block.fPreChecked);
+
+    // One transaction failing CheckTransaction
+    block.vtx[0] = coinbase;
+    mtx.vout[0].nValue = -1;
+    block.vtx[50] = mtx;
+    block.ClearCache();
+    block.hashMerkleRoot = block.GetMerkleRoot();
+    PreCheckBlock(block);
+    BOOST_CHECK(!block.fPreChecked);
+}
+
+BOOST_AUTO_TEST_CASE(prefetch_inputs)
+{
+    LOCK(cs_main);
+
+    // Put the coins database behind an error catcher, as the node does.
+    CCoinsViewErrorCatcher catcher(pcoinsdbview);
+    pcoinsTip->SetBackend(catcher);
+    pcoinsDBView = &catcher;
+
+    CMutableTransaction prev;
+    prev.vout.push_back(CTxOut(COIN, CScript() << OP_TRUE, 2));
+    pcoinsTip->ModifyCoins(prev.GetHash())->FromTx(prev, 1);
+    BOOST_CHECK(pcoinsTip->Flush());
+    BOOST_CHECK(!pcoinsTip->HaveCoinsInCache(prev.GetHash()));
+
+    CKey key;
+    key.MakeNewKey(true);
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << 1 << OP_0;
+    coinbase.vout.push_back(CTxOut(0, GetScriptForDestination(key.GetPubKey().GetID()), DEFAULT_ADMIN_COLOR));
+    pminer->Add(GetDestination(coinbase.vout[0].scriptPubKey));
+    CMutableTransaction spend;
+    spend.vin.push_back(CTxIn(COutPoint(prev.GetHash(), 0)));
+    spend.vout.push_back(CTxOut(COIN, CScript() << OP_TRUE, 2));
+
+    CBlock block;
+    block.hashPrevBlock = chainActive.Tip()->GetBlockHash();
+    block.nTime = chainActive.Tip()->GetBlockTime() + 1;
+    block.vtx.push_back(coinbase);
+    block.vtx.push_back(spend);
+    block.hashMerkleRoot = block.GetMerkleRoot();
+    uint256 hash = block.GetHash();
+    CBlockIndex index(block);
+    index.phashBlock = &hash;
+    index.pprev = chainActive.Tip();
+    index.nHeight = chainActive.Height() + 1;
+
+    // Whether the block connects does not matter, its input is read ahead either way.
+    uint64_t nPrefetched = GetPrefetchedCoinsCount();
+    CCoinsViewCache view(pcoinsTip);
+    CValidationState state;
+    ConnectBlock(block, state, &index, view, true);
+    BOOST_CHECK_EQUAL(GetPrefetchedCoinsCount(), nPrefetched + 1);
+    BOOST_CHECK(pcoinsTip->HaveCoinsInCache(prev.GetHash()));
+
+    pcoinsTip->SetBackend(*pcoinsdbview);
+    pcoinsDBView = pcoinsdbview;
+}
+
 bool ReturnFalse() { return false; }
 bool ReturnTrue() { return true; }
 
@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "arith_uint256.h"
 #include "main.h"
 #include "txmempool.h"
 #include "util.h"
@@ -101,4 +102,139 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+static CMutableTransaction PoolTx(tx_type type, const uint256& hashPrev, unsigned int n)
+{
+    CMutableTransaction tx;
+    tx.type = type;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_11;
+    tx.vin[0].prevout = COutPoint(hashPrev, n);
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx.vout[0].nValue = 10 * COIN;
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    uint256 hashFunding = ArithToUint256(arith_uint256(1));
+
+    // Three same-sized transfers paying increasing fees, a child of the
+    // cheapest one and a license without fee.
+    CMutableTransaction txLow = PoolTx(NORMAL, hashFunding, 0);
+    CMutableTransaction txMid = PoolTx(NORMAL, hashFunding, 1);
+    CMutableTransaction txHigh = PoolTx(NORMAL, hashFunding, 2);
+    CMutableTransaction txChild = PoolTx(NORMAL, txLow.GetHash(), 0);
+    CMutableTransaction txLicense = PoolTx(LICENSE, hashFunding, 3);
+    pool.addUnchecked(txLow.GetHash(), CTxMemPoolEntry(txLow, 1000, 0, 0.0, 1));
+    pool.addUnchecked(txMid.GetHash(), CTxMemPoolEntry(txMid, 2000, 0, 0.0, 1));
+    pool.addUnchecked(txHigh.GetHash(), CTxMemPoolEntry(txHigh, 3000, 0, 0.0, 1));
+    pool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 10000, 0, 0.0, 1));
+    pool.addUnchecked(txLicense.GetHash(), CTxMemPoolEntry(txLicense, 0, 0, 0.0, 1));
+    BOOST_CHECK_EQUAL(pool.size(), 5);
+
+    // Nothing to do under the limit.
+    pool.TrimToSize(pool.DynamicMemoryUsage());
+    BOOST_CHECK_EQUAL(pool.size(), 5);
+
+    // The lowest fee rate goes first, together with its child.
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(txLow.GetHash()));
+    BOOST_CHECK(!pool.exists(txChild.GetHash()));
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+
+    // The license outlives every transfer.
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(txMid.GetHash()));
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(txHigh.GetHash()));
+    BOOST_CHECK(pool.exists(txLicense.GetHash()));
+    pool.TrimToSize(0);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitNegativeFeeTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    uint256 hashFunding = ArithToUint256(arith_uint256(1));
+
+    // A mint paying a negative color fee counts as paying none, so it ties
+    // with a free transfer of the same size and the lower txid, here the
+    // transfer's, goes first.
+    CMutableTransaction txFree = PoolTx(NORMAL, hashFunding, 0);
+    CMutableTransaction txPaying = PoolTx(NORMAL, hashFunding, 1);
+    CMutableTransaction txMint = PoolTx(MINT, hashFunding, 4);
+    BOOST_REQUIRE(txFree.GetHash() < txMint.GetHash());
+    pool.addUnchecked(txFree.GetHash(), CTxMemPoolEntry(txFree, 0, 0, 0.0, 1));
+    pool.addUnchecked(txPaying.GetHash(), CTxMemPoolEntry(txPaying, 1000, 0, 0.0, 1));
+    pool.addUnchecked(txMint.GetHash(), CTxMemPoolEntry(txMint, -5000, 0, 0.0, 1));
+
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(txFree.GetHash()));
+    BOOST_CHECK(pool.exists(txMint.GetHash()));
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(txMint.GetHash()));
+    BOOST_CHECK(pool.exists(txPaying.GetHash()));
+}
+
+BOOST_AUTO_TEST_CASE(MempoolMinFeeTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    uint256 hashFunding = ArithToUint256(arith_uint256(1));
+    std::vector<CTransaction> vtxNone;
+    std::list<CTransaction> conflicts;
+    SetMockTime(42);
+
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetSatoshisPerK(), 0);
+
+    CMutableTransaction txLow = PoolTx(NORMAL, hashFunding, 0);
+    CMutableTransaction txHigh = PoolTx(NORMAL, hashFunding, 1);
+    pool.addUnchecked(txLow.GetHash(), CTxMemPoolEntry(txLow, 5000, 0, 0.0, 1));
+    pool.addUnchecked(txHigh.GetHash(), CTxMemPoolEntry(txHigh, 20000, 0, 0.0, 1));
+    CFeeRate rateLow(5000, ::GetSerializeSize(txLow, SER_NETWORK, PROTOCOL_VERSION));
+
+    // Evicting raises the floor above the evicted rate by the relay fee
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(txLow.GetHash()));
+    const CAmount nFloor = rateLow.GetSatoshisPerK() + 1000;
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetSatoshisPerK(), nFloor);
+
+    // ... and it stays there until a block comes in
+    SetMockTime(42 + CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetSatoshisPerK(), nFloor);
+    pool.removeForBlock(vtxNone, 2, conflicts);
+
+    // Then it halves every half-life, faster while the pool is far below its limit
+    SetMockTime(42 + 2 * CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetSatoshisPerK(), nFloor / 2);
+    SetMockTime(42 + 2 * CTxMemPool::ROLLING_FEE_HALFLIFE + CTxMemPool::ROLLING_FEE_HALFLIFE / 2);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(pool.DynamicMemoryUsage() * 5 / 2).GetSatoshisPerK(), nFloor / 4);
+
+    // Never below the relay fee, until it drops under half of it
+    SetMockTime(42 + 2 * CTxMemPool::ROLLING_FEE_HALFLIFE + CTxMemPool::ROLLING_FEE_HALFLIFE / 2 + CTxMemPool::ROLLING_FEE_HALFLIFE * 8);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetSatoshisPerK(), 0);
+
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolExpireTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    uint256 hashFunding = ArithToUint256(arith_uint256(1));
+
+    CMutableTransaction txOld = PoolTx(NORMAL, hashFunding, 0);
+    CMutableTransaction txChild = PoolTx(NORMAL, txOld.GetHash(), 0);
+    CMutableTransaction txNew = PoolTx(NORMAL, hashFunding, 1);
+    pool.addUnchecked(txOld.GetHash(), CTxMemPoolEntry(txOld, 0, 100, 0.0, 1));
+    pool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 0, 300, 0.0, 1));
+    pool.addUnchecked(txNew.GetHash(), CTxMemPoolEntry(txNew, 0, 300, 0.0, 1));
+
+    BOOST_CHECK_EQUAL(pool.Expire(100), 0);
+    // Expiring a transaction takes its descendants along.
+    BOOST_CHECK_EQUAL(pool.Expire(200), 2);
+    BOOST_CHECK(pool.exists(txNew.GetHash()));
+    BOOST_CHECK_EQUAL(pool.size(), 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
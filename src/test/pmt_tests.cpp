@@ -124,4 +124,71 @@ BOOST_AUTO_TEST_CASE(pmt_malleability)
     BOOST_CHECK(tree.ExtractMatches(vTxid).IsNull());
 }
 
+BOOST_AUTO_TEST_CASE(merkle_tree_cache)
+{
+    static const unsigned int nTxCounts[] = {1, 2, 3, 7, 8, 17, 100};
+
+    for (int n = 0; n < 7; n++) {
+        unsigned int nTx = nTxCounts[n];
+        CBlock block;
+        for (unsigned int j=0; j<nTx; j++) {
+            CMutableTransaction tx;
+            tx.nLockTime = j;
+            block.vtx.push_back(CTransaction(tx));
+        }
+        uint256 root = block.BuildMerkleTree();
+        BOOST_CHECK(block.GetMerkleRoot() == root);
+
+        // replace the first transaction the way IncrementExtraNonce does
+        CMutableTransaction txFirst(block.vtx[0]);
+        txFirst.nLockTime = 1000 + n;
+        block.vtx[0] = CTransaction(txFirst);
+        uint256 rootUpdated = block.UpdateMerkleLeaf(0);
+        BOOST_CHECK(rootUpdated != root);
+
+        CBlock blockCopy;
+        blockCopy.vtx = block.vtx;
+        BOOST_CHECK(blockCopy.BuildMerkleTree() == rootUpdated);
+        BOOST_CHECK(block.vMerkleTree == blockCopy.vMerkleTree);
+
+        // a changed transaction invalidates the cached tree
+        CMutableTransaction txLast(block.vtx[nTx-1]);
+        txLast.nLockTime = 2000 + n;
+        block.vtx[nTx-1] = CTransaction(txLast);
+        blockCopy.vtx = block.vtx;
+        BOOST_CHECK(block.GetMerkleRoot() == blockCopy.BuildMerkleTree());
+    }
+
+    // the mutation flag survives a cached lookup and follows leaf updates
+    CBlock block;
+    for (unsigned int j=0; j<4; j++) {
+        CMutableTransaction tx;
+        tx.nLockTime = j < 2 ? j : 2;
+        block.vtx.push_back(CTransaction(tx));
+    }
+    bool mutated = false;
+    block.BuildMerkleTree(&mutated);
+    BOOST_CHECK(mutated);
+    mutated = false;
+    block.GetMerkleRoot(&mutated);
+    BOOST_CHECK(mutated);
+    CMutableTransaction txLast(block.vtx[3]);
+    txLast.nLockTime = 3;
+    block.vtx[3] = CTransaction(txLast);
+    block.UpdateMerkleLeaf(3);
+    block.GetMerkleRoot(&mutated);
+    BOOST_CHECK(!mutated);
+
+    // a leaf update drops the cached check results
+    block.fChecked = true;
+    block.nCheckedSize = 100;
+    block.nCheckedSigOps = 10;
+    block.fPreChecked = true;
+    block.UpdateMerkleLeaf(0);
+    BOOST_CHECK(!block.fChecked);
+    BOOST_CHECK_EQUAL(block.nCheckedSize, 0U);
+    BOOST_CHECK_EQUAL(block.nCheckedSigOps, 0U);
+    BOOST_CHECK(!block.fPreChecked);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
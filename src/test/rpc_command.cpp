@@ -179,10 +179,7 @@ BOOST_FIXTURE_TEST_CASE(rpc_sendlicensetoaddress_test, RPCTestWalletFixture)
     key.push_back(member);
     CScript licenseaddr = _createmultisig_redeemScript(1, key);
 
-    CScriptID licenseaddrID(licenseaddr);
-    CBitcoinAddress licenseaddress(licenseaddrID);
-
-    ConsensusAddressForLicense = licenseaddress.ToString();
+    SetConsensusAddresses(CScriptID(licenseaddr), CScriptID());
     CTxDestination address = CBitcoinAddress(pubkey.GetID()).Get();
 
     string err_msg = "some error";
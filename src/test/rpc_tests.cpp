@@ -142,4 +142,105 @@ BOOST_AUTO_TEST_CASE(rpc_boostasiotocnetaddr)
     BOOST_CHECK_EQUAL(BoostAsioToCNetAddr(boost::asio::ip::address::from_string("::ffff:127.0.0.1")).ToString(), "127.0.0.1");
 }
 
+BOOST_AUTO_TEST_CASE(rpc_json_stream_writer)
+{
+    Object inner;
+    inner.push_back(Pair("amount", 1.5));
+    inner.push_back(Pair("escaped", "quote\" backslash\\ tab\t"));
+    inner.push_back(Pair("empty", Array()));
+    Array arr;
+    arr.push_back(inner);
+    arr.push_back((int64_t)-7);
+    arr.push_back((uint64_t)18446744073709551615ULL);
+    arr.push_back(Value::null);
+
+    Object expected;
+    expected.push_back(Pair("result", arr));
+    expected.push_back(Pair("flag", true));
+    expected.push_back(Pair("hex", "00ff10"));
+    expected.push_back(Pair("obj", Object()));
+
+    std::ostringstream os;
+    CJSONStreamWriter writer(os);
+    writer.BeginObject();
+    writer.Key("result");
+    writer.BeginArray();
+    writer.Write(inner);
+    writer.Write((int64_t)-7);
+    writer.Write((uint64_t)18446744073709551615ULL);
+    writer.Write(Value::null);
+    writer.EndArray();
+    writer.Write("flag", true);
+    const unsigned char data[] = {0x00, 0xff, 0x10};
+    writer.Key("hex");
+    writer.WriteHex(data, data + sizeof(data));
+    writer.Key("obj");
+    writer.BeginObject();
+    writer.EndObject();
+    writer.EndObject();
+
+    BOOST_CHECK_EQUAL(os.str(), write_string(Value(expected), false));
+}
+
+BOOST_AUTO_TEST_CASE(rpc_http_chunked_reply)
+{
+    std::string strBody(100000, 'x');
+    std::stringstream ss;
+    {
+        CHTTPChunkedStreamBuf buf(ss, HTTPReplyHeaderChunked(HTTP_OK, true), 4096);
+        std::ostream os(&buf);
+        os << strBody.substr(0, 10);
+        BOOST_CHECK(!buf.Started());
+        os << strBody.substr(10);
+        BOOST_CHECK(buf.Started());
+        BOOST_CHECK(buf.Finish());
+    }
+
+    int nProto = 0;
+    BOOST_CHECK_EQUAL(ReadHTTPStatus(ss, nProto), HTTP_OK);
+    std::map<std::string, std::string> mapHeaders;
+    std::string strReply;
+    BOOST_CHECK_EQUAL(ReadHTTPMessage(ss, mapHeaders, strReply, nProto, strBody.size()), HTTP_OK);
+    BOOST_CHECK(strReply == strBody);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_getrpcstats)
+{
+    // Stats are recorded by CRPCTable::execute, which CallRPC bypasses.
+    tableRPC.execute("getblockcount", Array());
+    tableRPC.execute("getblockcount", Array());
+    Array params;
+    params.push_back("DEADBEEF");
+    BOOST_CHECK_THROW(tableRPC.execute("decoderawtransaction", params), Object);
+
+    Value r;
+    BOOST_CHECK_NO_THROW(r = CallRPC("getrpcstats"));
+    const Object& count = find_value(r.get_obj(), "getblockcount").get_obj();
+    BOOST_CHECK(find_value(count, "calls").get_int64() >= 2);
+    BOOST_CHECK(find_value(count, "maxms").get_real() <= find_value(count, "totalms").get_real());
+
+    int64_t nHistogram = 0;
+    BOOST_FOREACH(const Pair& bucket, find_value(count, "histogram").get_obj())
+        nHistogram += bucket.value_.get_int64();
+    BOOST_CHECK_EQUAL(nHistogram, find_value(count, "calls").get_int64());
+
+    const Object& decode = find_value(r.get_obj(), "decoderawtransaction").get_obj();
+    BOOST_CHECK(find_value(decode, "errors").get_int64() >= 1);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_snapshot_calls)
+{
+    BOOST_CHECK(tableRPC.IsSnapshotCall("getblockcount"));
+    BOOST_CHECK(!tableRPC.IsSnapshotCall("getblock"));
+    BOOST_CHECK(!tableRPC.IsSnapshotCall("nosuchmethod"));
+
+    // Without the transaction index getrawtransaction falls back to cs_main.
+    bool fTxIndexSaved = fTxIndex;
+    fTxIndex = false;
+    BOOST_CHECK(!tableRPC.IsSnapshotCall("getrawtransaction"));
+    fTxIndex = true;
+    BOOST_CHECK(tableRPC.IsSnapshotCall("getrawtransaction"));
+    fTxIndex = fTxIndexSaved;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
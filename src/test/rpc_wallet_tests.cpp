@@ -226,4 +226,16 @@ BOOST_AUTO_TEST_CASE(rpc_wallet)
     BOOST_CHECK(CBitcoinAddress(arr[0].get_str()).Get() == demoAddress.Get());
 }
 
+BOOST_AUTO_TEST_CASE(rpc_wallet_stream_disabled)
+{
+    // Streamed wallet commands must fail cleanly under -disablewallet
+    CWallet* pwalletSaved = pwalletMain;
+    pwalletMain = NULL;
+    std::ostringstream os;
+    CJSONStreamWriter writer(os);
+    BOOST_CHECK_THROW(tableRPC.executeStream("listunspent", Array(), writer), Object);
+    BOOST_CHECK_THROW(tableRPC.executeStream("listtransactions", Array(), writer), Object);
+    pwalletMain = pwalletSaved;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
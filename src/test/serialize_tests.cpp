@@ -5,6 +5,9 @@
 #include "serialize.h"
 #include "streams.h"
 #include "hash.h"
+#include "key.h"
+#include "primitives/transaction.h"
+#include "script/script.h"
 #include "test/test_gcoin.h"
 
 #include <stdint.h>
@@ -276,4 +279,79 @@ BOOST_AUTO_TEST_CASE(insert_delete)
     BOOST_CHECK_EQUAL(ss.size(), 0);
 }
 
+// Serialize tx, read it back and check that nothing was lost
+static CTransaction CheckTransactionRoundTrip(const CTransaction& tx)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << tx;
+    std::string strSerialized = ss.str();
+    CTransaction txRead;
+    ss >> txRead;
+    BOOST_CHECK(ss.empty());
+
+    BOOST_CHECK(txRead.GetHash() == tx.GetHash());
+    BOOST_CHECK_EQUAL(txRead.GetSerializeSize(SER_NETWORK, PROTOCOL_VERSION), tx.GetSerializeSize(SER_NETWORK, PROTOCOL_VERSION));
+    BOOST_CHECK_EQUAL(txRead.IsEncrypted(), tx.IsEncrypted());
+    CDataStream ssRead(SER_NETWORK, PROTOCOL_VERSION);
+    ssRead << txRead;
+    BOOST_CHECK(ssRead.str() == strSerialized);
+    return txRead;
+}
+
+BOOST_AUTO_TEST_CASE(transaction_roundtrip)
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(GetRandHash(), 1);
+    mtx.vin[0].scriptSig = CScript() << OP_1 << OP_2;
+    mtx.vout.resize(2);
+    mtx.vout[0] = CTxOut(1000, CScript() << OP_TRUE, 1);
+    mtx.vout[1] = CTxOut(2000, CScript() << OP_2 << OP_DROP, 7);
+
+    // Plain transactions carry no confidential fields
+    const CTransaction txPlain(mtx);
+    CTransaction txPlainRead = CheckTransactionRoundTrip(txPlain);
+    BOOST_CHECK(!txPlainRead.IsEncrypted());
+    BOOST_CHECK(txPlainRead.GetPubKeys().empty() && txPlainRead.GetEncryptedKeys().empty() && txPlainRead.GetCryptedHex().empty());
+    BOOST_CHECK(txPlainRead.vin == txPlain.vin);
+    BOOST_CHECK(txPlainRead.vout == txPlain.vout);
+    BOOST_CHECK_EQUAL(txPlainRead.DynamicMemoryUsage(), txPlain.DynamicMemoryUsage());
+
+    CKey key1, key2;
+    key1.MakeNewKey(true);
+    key2.MakeNewKey(true);
+    std::vector<CPubKey> vPubKeys;
+    vPubKeys.push_back(key1.GetPubKey());
+    vPubKeys.push_back(key2.GetPubKey());
+
+    // Encrypted transactions only carry the keys and the encrypted data
+    CMutableTransaction mtxEncrypted(txPlain);
+    BOOST_CHECK(mtxEncrypted.Encrypt(vPubKeys));
+    const CTransaction txEncrypted(mtxEncrypted);
+    BOOST_CHECK(txEncrypted.IsEncrypted());
+    BOOST_CHECK(txEncrypted.GetHash() == mtxEncrypted.GetHash());
+    CTransaction txEncryptedRead = CheckTransactionRoundTrip(txEncrypted);
+    BOOST_CHECK(txEncryptedRead.GetPubKeys() == vPubKeys);
+    BOOST_CHECK(txEncryptedRead.GetEncryptedKeys() == txEncrypted.GetEncryptedKeys());
+    BOOST_CHECK(txEncryptedRead.GetCryptedHex() == txEncrypted.GetCryptedHex());
+    BOOST_CHECK(txEncryptedRead.vin.empty() && txEncryptedRead.vout.empty());
+
+    // Decrypting a copy recovers the transfer and leaves the original alone
+    CTransaction txDecrypted;
+    txDecrypted = txEncryptedRead;
+    BOOST_CHECK(txDecrypted.Decrypt(1, key2));
+    BOOST_CHECK(txDecrypted.vin == txPlain.vin);
+    BOOST_CHECK(txDecrypted.vout == txPlain.vout);
+    BOOST_CHECK(txDecrypted.type == txPlain.type);
+    BOOST_CHECK(txDecrypted.GetHash() == txEncrypted.GetHash());
+    BOOST_CHECK(txEncryptedRead.vin.empty() && txEncryptedRead.vout.empty());
+    BOOST_CHECK(txEncryptedRead.GetCryptedHex() == txEncrypted.GetCryptedHex());
+    CTransaction txDecryptedRead = CheckTransactionRoundTrip(txDecrypted);
+    BOOST_CHECK(txDecryptedRead.GetCryptedHex() == txEncrypted.GetCryptedHex());
+
+    // A decrypted transaction converts back to the same encrypted one
+    CMutableTransaction mtxDecrypted(txDecrypted);
+    BOOST_CHECK(mtxDecrypted.GetHash() == txEncrypted.GetHash());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -9,11 +9,16 @@
 #include "hash.h"
 #include "main.h"
 #include "pow.h"
+#include "ui_interface.h"
 #include "uint256.h"
+#include "util.h"
 
+#include <cmath>
 #include <stdint.h>
 
 
+#include <boost/bind.hpp>
+#include <boost/scoped_array.hpp>
 #include <boost/thread.hpp>
 #include "utilerror.h"
 
@@ -26,6 +31,7 @@ static const char DB_TXINDEX = 't';
 static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
+static const char DB_COINS_STATS = 'S';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
@@ -44,6 +50,49 @@ void static BatchWriteHashBestChain(CLevelDBBatch &batch, const uint256 &hash) {
 
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe)
 {
+    LoadStats();
+}
+
+void CCoinsViewDB::LoadStats()
+{
+    uint256 hashBestChain = GetBestBlock();
+    if (db.Read(DB_COINS_STATS, stats) && stats.hashBlock == hashBestChain)
+        return;
+
+    // Databases written before the statistics were kept need one full scan
+    LogPrintf("Computing coin database statistics...\n");
+    stats = CCoinsStats();
+    if (!ComputeStats(stats) || !db.Write(DB_COINS_STATS, stats))
+        throw runtime_error("CCoinsViewDB::LoadStats(): cannot compute coin database statistics");
+    LogPrintf("Coin database statistics: %u transactions, %u outputs\n", stats.nTransactions, stats.nTransactionOutputs);
+}
+
+static void ReportReadError(const std::runtime_error& e)
+{
+    uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
+    LogPrintf("Error reading from database: %s\n", e.what());
+}
+
+bool CCoinsViewErrorCatcher::GetCoins(const uint256 &txid, CCoins &coins) const {
+    try {
+        return CCoinsViewBacked::GetCoins(txid, coins);
+    } catch(const std::runtime_error& e) {
+        ReportReadError(e);
+        // Starting the shutdown sequence and returning false to the caller would be
+        // interpreted as 'entry not found' (as opposed to unable to read data), and
+        // could lead to invalid interpretation. Just exit immediately, as we can't
+        // continue anyway, and all writes should be atomic.
+        abort();
+    }
+}
+
+bool CCoinsViewErrorCatcher::HaveCoins(const uint256 &txid) const {
+    try {
+        return CCoinsViewBacked::HaveCoins(txid);
+    } catch(const std::runtime_error& e) {
+        ReportReadError(e);
+        abort();
+    }
 }
 
 bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
@@ -62,12 +111,14 @@ uint256 CCoinsViewDB::GetBestBlock() const
     return hashBestChain;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsStats &statsReplaced) {
     CLevelDBBatch batch;
     size_t count = 0;
     size_t changed = 0;
+    CCoinsStats statsNew = stats;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            statsNew.AddCoins(it->first, it->second.coins);
             BatchWriteCoins(batch, it->first, it->second.coins);
             changed++;
         }
@@ -75,11 +126,19 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
         CCoinsMap::iterator itOld = it++;
         mapCoins.erase(itOld);
     }
-    if (!hashBlock.IsNull())
+    // The stored records the dirty entries replace were counted by the cache
+    statsNew.Subtract(statsReplaced);
+    if (!hashBlock.IsNull()) {
         BatchWriteHashBestChain(batch, hashBlock);
+        statsNew.hashBlock = hashBlock;
+    }
+    batch.Write(DB_COINS_STATS, statsNew);
 
     LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
-    return db.WriteBatch(batch);
+    if (!db.WriteBatch(batch))
+        return false;
+    stats = statsNew;
+    return true;
 }
 
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe)
@@ -107,7 +166,15 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read(DB_LAST_BLOCK, nFile);
 }
 
-bool CCoinsViewDB::GetStats(CCoinsStats &stats) const
+bool CCoinsViewDB::GetStats(CCoinsStats &statsOut) const
+{
+    statsOut = stats;
+    BlockMap::const_iterator mi = mapBlockIndex.find(stats.hashBlock);
+    statsOut.nHeight = mi != mapBlockIndex.end() ? mi->second->nHeight : 0;
+    return true;
+}
+
+bool CCoinsViewDB::ComputeStats(CCoinsStats &statsOut) const
 {
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
@@ -115,10 +182,8 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const
     boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
     pcursor->SeekToFirst();
 
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = GetBestBlock();
-    ss << stats.hashBlock;
-    colorAmount_t mapTotalAmount;
+    statsOut = CCoinsStats();
+    statsOut.hashBlock = GetBestBlock();
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         try {
@@ -133,34 +198,13 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const
                 ssValue >> coins;
                 uint256 txhash;
                 ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        if (mapTotalAmount.find(out.color) == mapTotalAmount.end())
-                            mapTotalAmount[out.color] = out.nValue;
-                        else
-                            mapTotalAmount[out.color] += out.nValue;
-                    }
-                }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
+                statsOut.AddCoins(txhash, coins);
             }
             pcursor->Next();
         } catch (const std::exception& e) {
             return error("%s: Deserialize or I/O error - %s", __func__, e.what());
         }
     }
-    stats.nHeight = mapBlockIndex.find(GetBestBlock())->second->nHeight;
-    stats.hashSerialized = ss.GetHash();
-    stats.mapTotalAmount = mapTotalAmount;
     return true;
 }
 
@@ -241,56 +285,107 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue)
     return true;
 }
 
-bool CBlockTreeDB::LoadBlockIndexGuts()
+/** Decode the block index entries whose hash starts with a byte in [nBegin, nEnd). */
+static void DecodeBlockIndexRange(CBlockTreeDB* pdb, unsigned int nBegin, unsigned int nEnd,
+                                  std::vector<std::pair<uint256, CDiskBlockIndex> >* pvEntries, bool* pfOk)
 {
-    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    *pfOk = true;
+    try {
+        boost::scoped_ptr<leveldb::Iterator> pcursor(pdb->NewIterator());
 
-    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
-    ssKeySet << make_pair(DB_BLOCK_INDEX, uint256());
-    pcursor->Seek(ssKeySet.str());
+        uint256 hashStart;
+        *hashStart.begin() = (unsigned char)nBegin;
+        CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+        ssKeySet << make_pair(DB_BLOCK_INDEX, hashStart);
+        pcursor->Seek(ssKeySet.str());
 
-    // Load mapBlockIndex
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        try {
+        while (pcursor->Valid()) {
             leveldb::Slice slKey = pcursor->key();
             CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
             char chType;
             ssKey >> chType;
-            if (chType == DB_BLOCK_INDEX) {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
-                CDiskBlockIndex diskindex;
-                ssValue >> diskindex;
-
-                // Construct block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
-                pindexNew->nHeight        = diskindex.nHeight;
-                pindexNew->nFile          = diskindex.nFile;
-                pindexNew->nDataPos       = diskindex.nDataPos;
-                pindexNew->nUndoPos       = diskindex.nUndoPos;
-                pindexNew->nVersion       = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->nTime          = diskindex.nTime;
-                pindexNew->nBits          = diskindex.nBits;
-                pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nStatus        = diskindex.nStatus;
-                pindexNew->nTx            = diskindex.nTx;
-
-                /*
-                if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits))
-                    return error("%s() : CheckProofOfWork failed: %s", __func__, pindexNew->ToString());
-                */
-
-                pcursor->Next();
-            } else {
-                break; // if shutdown requested or finished loading block index
-            }
-        } catch (const std::exception& e) {
-            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+            if (chType != DB_BLOCK_INDEX)
+                break;
+            uint256 hash;
+            ssKey >> hash;
+            if (*hash.begin() >= nEnd)
+                break;
+
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            CDiskBlockIndex diskindex;
+            ssValue >> diskindex;
+            pvEntries->push_back(make_pair(diskindex.GetBlockHash(), diskindex));
+
+            pcursor->Next();
         }
+    } catch (const std::exception& e) {
+        *pfOk = error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+}
+
+bool CBlockTreeDB::LoadBlockIndexGuts()
+{
+    // Decode the entries (including the header hash of each) on several
+    // threads, each covering a range of the first byte of the block hash
+    int64_t nTimeStart = GetTimeMillis();
+    int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), 8));
+    std::vector<std::vector<std::pair<uint256, CDiskBlockIndex> > > vRanges(nThreads);
+    boost::scoped_array<bool> pfOk(new bool[nThreads]);
+    {
+        boost::thread_group threads;
+        for (int i = 0; i < nThreads; i++)
+            threads.create_thread(boost::bind(&DecodeBlockIndexRange, this, 256 * i / nThreads, 256 * (i + 1) / nThreads, &vRanges[i], &pfOk[i]));
+        threads.join_all();
+    }
+    boost::this_thread::interruption_point();
+    size_t nEntries = 0;
+    for (int i = 0; i < nThreads; i++) {
+        if (!pfOk[i])
+            return false;
+        nEntries += vRanges[i].size();
+    }
+    int64_t nTimeDecode = GetTimeMillis();
+
+    // Construct block index objects in one contiguous allocation
+    CBlockIndex* pindexArena = AllocateBlockIndexArena(nEntries);
+    mapBlockIndex.rehash(std::ceil(nEntries / mapBlockIndex.max_load_factor()));
+    size_t nPos = 0;
+    for (int i = 0; i < nThreads; i++) {
+        for (size_t j = 0; j < vRanges[i].size(); j++) {
+            const CDiskBlockIndex& diskindex = vRanges[i][j].second;
+            CBlockIndex* pindexNew = &pindexArena[nPos++];
+            BlockMap::iterator mi = mapBlockIndex.insert(make_pair(vRanges[i][j].first, pindexNew)).first;
+            pindexNew->phashBlock     = &((*mi).first);
+            pindexNew->nHeight        = diskindex.nHeight;
+            pindexNew->nFile          = diskindex.nFile;
+            pindexNew->nDataPos       = diskindex.nDataPos;
+            pindexNew->nUndoPos       = diskindex.nUndoPos;
+            pindexNew->nVersion       = diskindex.nVersion;
+            pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+            pindexNew->nTime          = diskindex.nTime;
+            pindexNew->nBits          = diskindex.nBits;
+            pindexNew->nNonce         = diskindex.nNonce;
+            pindexNew->nStatus        = diskindex.nStatus;
+            pindexNew->nTx            = diskindex.nTx;
+
+            /*
+            if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits))
+                return error("%s() : CheckProofOfWork failed: %s", __func__, pindexNew->ToString());
+            */
+        }
+    }
+
+    // Link every entry to its parent. Parents missing from the database
+    // still get a placeholder entry, as before.
+    nPos = 0;
+    for (int i = 0; i < nThreads; i++) {
+        for (size_t j = 0; j < vRanges[i].size(); j++)
+            pindexArena[nPos++].pprev = InsertBlockIndex(vRanges[i][j].second.hashPrev);
     }
+    int64_t nTimeLink = GetTimeMillis();
 
+    LogPrintf("%s: %u entries, decode %dms (%d threads), link %dms\n", __func__,
+              nEntries, nTimeDecode - nTimeStart, nThreads, nTimeLink - nTimeDecode);
     return true;
 }
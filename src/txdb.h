@@ -31,17 +31,36 @@ class CCoinsViewDB : public CCoinsView
 {
 protected:
     CLevelDBWrapper db;
+    //! Running statistics of the coin set, written in the same batch as every change
+    CCoinsStats stats;
+
+    void LoadStats();
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
     bool GetCoins(const uint256 &txid, CCoins &coins) const;
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsStats &statsReplaced);
     bool GetStats(CCoinsStats &stats) const;
+    //! Recompute the statistics by scanning the whole database
+    bool ComputeStats(CCoinsStats &stats) const;
     bool GetAddrCoins(const std::string &addr, CTxOutMap &mapTxOut, bool fLicense) const;
 };
 
+/**
+ * Reads the coins database and stops the node on a read error, which callers
+ * would otherwise take for a missing entry.
+ */
+class CCoinsViewErrorCatcher : public CCoinsViewBacked
+{
+public:
+    CCoinsViewErrorCatcher(CCoinsView* view) : CCoinsViewBacked(view) {}
+    bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    bool HaveCoins(const uint256 &txid) const;
+    // Writes do not need similar protection, as failure to write is handled by the caller.
+};
+
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CLevelDBWrapper
 {
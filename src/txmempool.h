@@ -7,6 +7,7 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <algorithm>
 #include <list>
 
 #include "amount.h"
@@ -14,6 +15,12 @@
 #include "primitives/transaction.h"
 #include "sync.h"
 
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/identity.hpp>
+#include <boost/multi_index/mem_fun.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+
 class CAutoFile;
 
 inline double AllowFreeThreshold()
@@ -39,8 +46,10 @@ class CTxMemPoolEntry
 private:
     CTransaction tx;
     CAmount nFee; //! Cached to avoid expensive parent-transaction lookups
+    CAmount feeDelta; //! Fee delta from PrioritiseTransaction
     size_t nTxSize; //! ... and avoid recomputing tx size
     size_t nModSize; //! ... and modified size for priority
+    size_t nUsageSize; //! ... and total memory usage
     int64_t nTime; //! Local time when entering the mempool
     double dPriority; //! Priority when entering the mempool
     unsigned int nHeight; //! Chain height when entering the mempool
@@ -55,12 +64,92 @@ public:
     const CTransaction& GetTx() const { return this->tx; }
     double GetPriority(unsigned int currentHeight) const;
     CAmount GetFee() const { return nFee; }
+    CAmount GetModifiedFee() const { return nFee + feeDelta; }
+    tx_type GetType() const { return tx.type; }
     size_t GetTxSize() const { return nTxSize; }
+    size_t DynamicMemoryUsage() const { return nUsageSize; }
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return nHeight; }
     bool WasClearAtEntry() const { return hadNoDependencies; }
+
+    void UpdateFeeDelta(CAmount newFeeDelta) { feeDelta = newFeeDelta; }
+};
+
+struct update_fee_delta
+{
+    update_fee_delta(CAmount _feeDelta) : feeDelta(_feeDelta) { }
+
+    void operator() (CTxMemPoolEntry &e) { e.UpdateFeeDelta(feeDelta); }
+
+private:
+    CAmount feeDelta;
+};
+
+// extracts a transaction hash from CTxMemPoolEntry
+struct mempoolentry_txid
+{
+    typedef uint256 result_type;
+    result_type operator() (const CTxMemPoolEntry &entry) const
+    {
+        return entry.GetTx().GetHash();
+    }
 };
 
+struct mempoolentry_txid_hasher
+{
+    size_t operator()(const uint256& hash) const { return hash.GetCheapHash(); }
+};
+
+/** Lowest modified fee per byte first. */
+class CompareTxMemPoolEntryByFeeRate
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        double f1 = (double)a.GetModifiedFee() * b.GetTxSize();
+        double f2 = (double)b.GetModifiedFee() * a.GetTxSize();
+        if (f1 == f2)
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        return f1 < f2;
+    }
+};
+
+/**
+ * Eviction order: NORMAL and MINT transactions before the special types, then
+ * lowest modified fee per byte first, counting negative fees as zero.
+ */
+class CompareTxMemPoolEntryByEviction
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        bool fSpecialA = a.GetType() != NORMAL && a.GetType() != MINT;
+        bool fSpecialB = b.GetType() != NORMAL && b.GetType() != MINT;
+        if (fSpecialA != fSpecialB)
+            return fSpecialB;
+        double f1 = (double)std::max(a.GetModifiedFee(), (CAmount)0) * b.GetTxSize();
+        double f2 = (double)std::max(b.GetModifiedFee(), (CAmount)0) * a.GetTxSize();
+        if (f1 == f2)
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        return f1 < f2;
+    }
+};
+
+class CompareTxMemPoolEntryByEntryTime
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        return a.GetTime() < b.GetTime();
+    }
+};
+
+// Multi_index tag names
+struct fee_rate {};
+struct eviction {};
+struct entry_time {};
+struct tx_type_index {};
+
 class CBlockPolicyEstimator;
 
 /** An inpoint - a combination of a transaction and an index n into its vin */
@@ -88,16 +177,68 @@ public:
  */
 class CTxMemPool
 {
+public:
+    /**
+     * The pool entries, each stored once in a multi_index node that links it
+     * into every index:
+     * - by txid (hashed)
+     * - by modified fee per byte, lowest first (fee_rate)
+     * - by the order TrimToSize evicts them in (eviction)
+     * - by time of entry, oldest first (entry_time)
+     * - by transaction type (tx_type_index)
+     */
+    typedef boost::multi_index_container<
+        CTxMemPoolEntry,
+        boost::multi_index::indexed_by<
+            boost::multi_index::hashed_unique<mempoolentry_txid, mempoolentry_txid_hasher>,
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<fee_rate>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByFeeRate
+            >,
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<eviction>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByEviction
+            >,
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<entry_time>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByEntryTime
+            >,
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<tx_type_index>,
+                boost::multi_index::const_mem_fun<CTxMemPoolEntry, tx_type, &CTxMemPoolEntry::GetType>
+            >
+        >
+    > indexed_transaction_set;
+
+    typedef indexed_transaction_set::nth_index<0>::type::iterator txiter;
+    typedef indexed_transaction_set::index<fee_rate>::type::iterator feeiter;
+    typedef indexed_transaction_set::index<entry_time>::type::iterator timeiter;
+    typedef indexed_transaction_set::index<tx_type_index>::type::iterator typeiter;
+
 private:
     bool fSanityCheck; //! Normally false, true if -checkmempool or -regtest
     unsigned int nTransactionsUpdated;
     CBlockPolicyEstimator* minerPolicyEstimator;
 
     uint64_t totalTxSize; //! sum of all mempool tx' byte sizes
+    uint64_t cachedInnerUsage; //! sum of dynamic memory usage of all the map elements (NOT the maps themselves)
+
+    CFeeRate minReasonableRelayFee;
+
+    mutable int64_t lastRollingFeeUpdate;
+    mutable bool blockSinceLastRollingFeeBump;
+    mutable double rollingMinimumFeeRate; //! minimum fee to get into the pool, decreases exponentially
+
+    void trackPackageRemoved(const CFeeRate& rate);
 
 public:
+    static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12; // public only for testing
+
     mutable CCriticalSection cs;
-    std::map<uint256, CTxMemPoolEntry> mapTx;
+    indexed_transaction_set mapTx;
     std::map<COutPoint, CInPoint> mapNextTx;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
 
@@ -121,6 +262,24 @@ public:
     void removeForBlock(const std::vector<CTransaction>& vtx, unsigned int nBlockHeight,
                         std::list<CTransaction>& conflicts, bool fCurrentEstimate = true);
     void clear();
+    /**
+     * Remove transactions, with their descendants, until the dynamic memory
+     * usage of the pool is at most sizelimit. NORMAL and MINT transactions
+     * go first, lowest fee per byte first with negative fees counted as zero;
+     * LICENSE, VOTE, MINER and DEMINER transactions are only evicted once no
+     * ordinary ones are left.
+     */
+    void TrimToSize(size_t sizelimit);
+    /**
+     * The minimum fee rate to get into the pool. TrimToSize raises it above
+     * the rate of each transaction it evicts, so evicted transactions cannot
+     * come straight back. Once a block has come in it halves every
+     * ROLLING_FEE_HALFLIFE, faster while the pool is well below sizelimit,
+     * and drops to zero when below half the minimum relay fee.
+     */
+    CFeeRate GetMinFee(size_t sizelimit) const;
+    /** Remove transactions, with their descendants, that entered the pool before time. Returns the number removed. */
+    int Expire(int64_t time);
     void queryHashes(std::vector<uint256>& vtxid);
     void pruneSpent(const uint256& hash, CCoins &coins);
     unsigned int GetTransactionsUpdated() const;
@@ -147,6 +306,9 @@ public:
         return totalTxSize;
     }
 
+    /** Approximate number of heap bytes held by the pool, its indexes and its transactions. */
+    size_t DynamicMemoryUsage() const;
+
     bool exists(uint256 hash) const
     {
         LOCK(cs);
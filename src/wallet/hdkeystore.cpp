@@ -242,21 +242,38 @@ bool CHDKeyStore::DeriveHDPubKeyAtIndex(const HDChainID chainId, CHDPubKey& hdPu
 
 unsigned int CHDKeyStore::GetNextChildIndex(const HDChainID& chainId, bool internal)
 {
-    std::vector<unsigned int> vIndices;
+    std::vector<unsigned int> vIndices = GetNextChildIndexes(chainId, internal, 1, std::set<unsigned int>());
+    if (vIndices.empty())
+        return 0;
+
+    return vIndices[0];
+}
+
+std::vector<unsigned int> CHDKeyStore::GetNextChildIndexes(const HDChainID& chainId, bool internal, unsigned int nCount, const std::set<unsigned int>& setSkip)
+{
+    std::set<unsigned int> setUsed(setSkip);
 
     {
         LOCK(cs_KeyStore);
-        //get next unused child index
+        //collect used child indices
         for (std::map<CKeyID, CHDPubKey>::iterator it = mapHDPubKeys.begin(); it != mapHDPubKeys.end(); ++it)
             if (it->second.chainHash == chainId && it->second.internal == internal)
-                vIndices.push_back(it->second.nChild);
+                setUsed.insert(it->second.nChild);
     }
 
-    for (unsigned int i=0;i<0x80000000;i++)
-        if (std::find(vIndices.begin(), vIndices.end(), i) == vIndices.end())
-            return i;
+    //walk the sorted indices once and fill the gaps
+    std::vector<unsigned int> vIndices;
+    vIndices.reserve(nCount);
+    std::set<unsigned int>::const_iterator it = setUsed.begin();
+    for (unsigned int i = 0; i < 0x80000000 && vIndices.size() < nCount; i++) {
+        if (it != setUsed.end() && *it == i) {
+            ++it;
+            continue;
+        }
+        vIndices.push_back(i);
+    }
 
-    return 0;
+    return vIndices;
 }
 
 bool CHDKeyStore::AddChain(const CHDChain& chain)
@@ -164,6 +164,13 @@ public:
      */
     unsigned int GetNextChildIndex(const HDChainID& chainId, bool internal);
 
+    /**
+     * Get the next nCount available indices for child keys in chain defined by given chain id
+     * @param setSkip indices that are taken although no key has been stored for them yet
+     * @return available indices in ascending order, gaps are filled first
+     */
+    std::vector<unsigned int> GetNextChildIndexes(const HDChainID& chainId, bool internal, unsigned int nCount, const std::set<unsigned int>& setSkip);
+
     //!check if a wallet has a certain key
     bool HaveKey(const CKeyID &address) const;
 
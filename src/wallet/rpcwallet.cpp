@@ -85,35 +85,7 @@ void WalletTxToJSON(const CWalletTx& wtx, Object& entry)
         entry.push_back(Pair(item.first, item.second));
 }
 
-// Create JSON object from given license information.
-void LicenseInfoToJSON(const CLicenseInfo& info, Object& entry)
-{
-    entry.push_back(Pair("version", info.nVersion));
-    entry.push_back(Pair("name", info.name));
-    entry.push_back(Pair("description", info.description));
-    entry.push_back(Pair("issuer", info.issuer));
-    entry.push_back(Pair("divisibility", info.fDivisibility));
-    if (info.feeType == FIXED)
-        entry.push_back(Pair("fee_type", "fixed"));
-    else if (info.feeType == BYSIZE)
-        entry.push_back(Pair("fee_type", "by_size"));
-    else if (info.feeType == BYAMOUNT)
-        entry.push_back(Pair("fee_type", "by_amount"));
-    entry.push_back(Pair("fee_rate", info.nFeeRate));
-    entry.push_back(Pair("fee_collector", info.feeCollectorAddr));
-    entry.push_back(Pair("upper_limit", info.nLimit));
-    if (info.mintSchedule == FREE)
-        entry.push_back(Pair("mint_schedule", "free"));
-    else if (info.mintSchedule == ONCE)
-        entry.push_back(Pair("mint_schedule", "once"));
-    else if (info.mintSchedule == LINEAR)
-        entry.push_back(Pair("mint_schedule", "linear"));
-    else if (info.mintSchedule == HALFLIFE)
-        entry.push_back(Pair("mint_schedule", "half_life"));
-    entry.push_back(Pair("member_control", info.fMemberControl));
-    entry.push_back(Pair("metadata_link", info.metadataLink));
-    entry.push_back(Pair("metadata_hash", info.metadataHash.ToString()));
-}
+extern void LicenseInfoToJSON(const CLicenseInfo& info, Object& entry);
 
 string AccountFromValue(const Value& value)
 {
@@ -762,7 +734,7 @@ Value decodelicenseinfo(const Array& params, bool fHelp)
 
     CLicenseInfo info;
 
-    if (!info.DecodeInfo(params[0].get_str()))
+    if (!DecodeLicenseInfo(params[0].get_str(), info))
         throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "LicenseInfo decode failed");
 
     Object result;
@@ -1601,13 +1573,17 @@ Value getlicenselist(const Array& params, bool fHelp)
             + HelpExampleRpc("getlicenselist", "")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
     bool fVerbose = false;
     if (params.size() > 0)
         fVerbose = (params[0].get_int() != 0);
 
-    map<type_Color, pair<string, CAmount> > color_amount = plicense->ListLicense();
+    map<type_Color, pair<string, CAmount> > color_amount;
+    {
+        CacheReadLock lock(cs_cacheApply);
+        color_amount = plicense->ListLicense();
+    }
+
+    LOCK(pwalletMain->cs_wallet);
 
     Object ret;
     char r1[21];
@@ -1662,14 +1638,17 @@ Value getlicenseinfo(const Array& params, bool fHelp)
 
     const type_Color color = ColorFromValue(params[0]);
 
-    CLicenseInfo info;
-    if (!plicense->GetLicenseInfo(color, info))
-        throw JSONRPCError(RPC_INVALID_PARAMETER, "License color not exist.");
+    color_license::Owner_ owner;
+    {
+        CacheReadLock lock(cs_cacheApply);
+        if (!plicense->GetEntry(color, owner))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "License color not exist.");
+    }
 
     Object result;
-    result.push_back(Pair("Owner", plicense->GetOwner(color)));
-    result.push_back(Pair("Total amount", plicense->NumOfCoins(color)/COIN));
-    LicenseInfoToJSON(info, result);
+    result.push_back(Pair("Owner", owner.address_));
+    result.push_back(Pair("Total amount", owner.num_of_coins_/COIN));
+    LicenseInfoToJSON(owner.info_, result);
 
     return result;
 }
@@ -2461,6 +2440,62 @@ Value listtransactions(const Array& params, bool fHelp)
     return ret;
 }
 
+void listtransactions_stream(const Array& params, CJSONStreamWriter& writer)
+{
+    EnsureWalletIsAvailable(false);
+
+    if (params.size() > 4)
+        listtransactions(params, true); // throws the usage text
+
+    string strAccount = "*";
+    if (params.size() > 0)
+        strAccount = params[0].get_str();
+    int nCount = 10;
+    if (params.size() > 1)
+        nCount = params[1].get_int();
+    int nFrom = 0;
+    if (params.size() > 2)
+        nFrom = params[2].get_int();
+    isminefilter filter = ISMINE_SPENDABLE;
+    if (params.size() > 3)
+        if (params[3].get_bool())
+            filter = filter | ISMINE_WATCH_ONLY;
+
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+    if (nFrom < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative from");
+
+    // Walk newest to oldest like listtransactions, building each item once and
+    // keeping only the entries of the requested window, then write them oldest
+    // first once the locks are released, so a slow client cannot stall the node.
+    std::vector<Value> vWindow;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
+        list<CAccountingEntry> acentries;
+        CWallet::TxItems txOrdered = pwalletMain->OrderedTxItems(acentries, strAccount);
+
+        int nPos = 0;
+        for (CWallet::TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend() && nPos < nFrom + nCount; ++it) {
+            Array entries;
+            if ((*it).second.first != 0)
+                ListTransactions(*(*it).second.first, strAccount, 0, true, entries, filter);
+            if ((*it).second.second != 0)
+                AcentryToJSON(*(*it).second.second, strAccount, entries);
+            for (unsigned int j = 0; j < entries.size() && nPos < nFrom + nCount; j++, nPos++) {
+                if (nPos >= nFrom)
+                    vWindow.push_back(entries[j]);
+            }
+        }
+    }
+
+    writer.BeginArray();
+    for (std::vector<Value>::reverse_iterator it = vWindow.rbegin(); it != vWindow.rend(); ++it)
+        writer.Write(*it);
+    writer.EndArray();
+}
+
 Value listwalletaddress(const Array& params, bool fHelp)
 {
     if (!EnsureWalletIsAvailable(fHelp))
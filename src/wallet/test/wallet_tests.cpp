@@ -4,6 +4,11 @@
 
 #include "wallet/wallet.h"
 
+#include "arith_uint256.h"
+#include "main.h"
+#include "script/standard.h"
+#include "txmempool.h"
+
 #include <set>
 #include <stdint.h>
 #include <utility>
@@ -13,6 +18,7 @@
 
 #include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 // how many times to run all the tests to have a chance to catch errors that only show up with particular random shuffles
 #define RUN_TESTS 100
@@ -52,6 +58,19 @@ static void add_coin(const CAmount& nValue, int nAge = 6*24, bool fIsFromMe = fa
     vCoins.push_back(output);
 }
 
+// Add a mature coin of the given color to vCoins and to its color bucket in mapCoins.
+static void add_colored_coin(map<type_Color, vector<COutput> >& mapCoins, const type_Color& color, const CAmount& nValue)
+{
+    static unsigned int nextLockTime = 1000000;
+    CMutableTransaction tx;
+    tx.nLockTime = nextLockTime++;
+    tx.vout.push_back(CTxOut(nValue, CScript(), color));
+    CWalletTx* wtx = new CWalletTx(&wallet, tx);
+    COutput output(wtx, 0, 6*24, true);
+    vCoins.push_back(output);
+    mapCoins[color].push_back(output);
+}
+
 static void empty_wallet(void)
 {
     BOOST_FOREACH(COutput output, vCoins)
@@ -307,4 +326,295 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+BOOST_AUTO_TEST_CASE(coin_selection_exact_match)
+{
+    CoinSet setCoinsRet;
+    CAmount nValueRet;
+
+    // 5+4 and 7+2 both hit 9 cents exactly, branch and bound must find one of them every time
+    for (int i = 0; i < RUN_TESTS; i++) {
+        empty_wallet();
+        add_coin(7*CENT);
+        add_coin(5*CENT);
+        add_coin(4*CENT);
+        add_coin(3*CENT);
+        add_coin(2*CENT);
+        add_coin(1111*CENT);
+        BOOST_CHECK(wallet.SelectCoinsMinConf(9*CENT, 1, 6, vCoins, setCoinsRet, nValueRet));
+        BOOST_CHECK_EQUAL(nValueRet, 9*CENT);
+        BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
+    }
+    empty_wallet();
+}
+
+BOOST_AUTO_TEST_CASE(coin_selection_knapsack_fallback)
+{
+    CoinSet setCoinsRet;
+    CAmount nValueRet;
+
+    // no subset of 3, 5 and 7 cents adds up to 9 cents, the knapsack settles on 3+7
+    for (int i = 0; i < RUN_TESTS; i++) {
+        empty_wallet();
+        add_coin(3*CENT);
+        add_coin(5*CENT);
+        add_coin(7*CENT);
+        BOOST_CHECK(wallet.SelectCoinsMinConf(9*CENT, 1, 6, vCoins, setCoinsRet, nValueRet));
+        BOOST_CHECK_EQUAL(nValueRet, 10*CENT);
+        BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
+    }
+    empty_wallet();
+}
+
+BOOST_AUTO_TEST_CASE(coin_selection_by_color)
+{
+    const type_Color colorA = 1, colorB = 2, colorC = 3;
+    map<type_Color, vector<COutput> > mapCoins;
+    map<type_Color, CoinSet> mapCoinsRet;
+    colorAmount_t mapTargetValue, mapValueRet;
+
+    empty_wallet();
+    add_colored_coin(mapCoins, colorA, 2*CENT);
+    add_colored_coin(mapCoins, colorA, 3*CENT);
+    add_colored_coin(mapCoins, colorB, 5*CENT);
+    add_colored_coin(mapCoins, colorB, 20*CENT);
+
+    mapTargetValue[colorA] = 5*CENT;
+    mapTargetValue[colorB] = 5*CENT;
+    BOOST_CHECK(wallet.SelectCoinsByColor(mapTargetValue, mapCoins, mapCoinsRet, mapValueRet));
+    BOOST_CHECK_EQUAL(mapValueRet[colorA], 5*CENT);
+    BOOST_CHECK_EQUAL(mapCoinsRet[colorA].size(), 2U);
+    BOOST_CHECK_EQUAL(mapValueRet[colorB], 5*CENT);
+    BOOST_CHECK_EQUAL(mapCoinsRet[colorB].size(), 1U);
+    for (map<type_Color, CoinSet>::const_iterator it = mapCoinsRet.begin(); it != mapCoinsRet.end(); ++it)
+        BOOST_FOREACH(const PAIRTYPE(const CWalletTx*, unsigned int)& coin, it->second)
+            BOOST_CHECK_EQUAL(coin.first->vout[coin.second].color, it->first);
+
+    // a color without coins fails the selection, the other colors are still selected
+    mapTargetValue[colorC] = 1*CENT;
+    BOOST_CHECK(!wallet.SelectCoinsByColor(mapTargetValue, mapCoins, mapCoinsRet, mapValueRet));
+    BOOST_CHECK_EQUAL(mapValueRet[colorA], 5*CENT);
+    BOOST_CHECK_EQUAL(mapValueRet[colorB], 5*CENT);
+    BOOST_CHECK_EQUAL(mapValueRet[colorC], 0);
+
+    empty_wallet();
+}
+
+BOOST_AUTO_TEST_CASE(available_coins_by_color)
+{
+    CWallet colorWallet;
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_REQUIRE(colorWallet.AddKeyPubKey(key, key.GetPubKey()));
+    CScript scriptMine = GetScriptForDestination(key.GetPubKey().GetID());
+    const type_Color colorA = 1, colorB = 2, colorC = 3;
+
+    // Two unconfirmed transactions paying the wallet, in the pool so they count
+    CMutableTransaction tx1, tx2;
+    tx1.vin.resize(1);
+    tx1.vin[0].prevout = COutPoint(ArithToUint256(arith_uint256(1)), 0);
+    tx1.vout.push_back(CTxOut(3*CENT, scriptMine, colorA));
+    tx1.vout.push_back(CTxOut(5*CENT, scriptMine, colorB));
+    tx1.vout.push_back(CTxOut(1*CENT, scriptMine, colorA));
+    tx2.vin.resize(1);
+    tx2.vin[0].prevout = COutPoint(ArithToUint256(arith_uint256(1)), 1);
+    tx2.vout.push_back(CTxOut(2*CENT, scriptMine, colorA));
+    tx2.vout.push_back(CTxOut(7*CENT, scriptMine, colorC));
+    tx2.vout.push_back(CTxOut(4*CENT, CScript(), colorA));
+    const CTransaction vtx[] = {tx1, tx2};
+    for (unsigned int i = 0; i < 2; i++) {
+        mempool.addUnchecked(vtx[i].GetHash(), CTxMemPoolEntry(vtx[i], 0, 0, 0.0, 1));
+        BOOST_CHECK(colorWallet.AddToWallet(CWalletTx(&colorWallet, vtx[i]), true, NULL));
+    }
+    // As LoadWallet does once the keys are in
+    colorWallet.RebuildColorIndex();
+
+    // Only the wallet's outputs are indexed
+    BOOST_CHECK_EQUAL(colorWallet.mapWalletColor[colorA].size(), 3U);
+
+    // Only the requested colors and only the wallet's outputs, highest value first
+    map<type_Color, vector<COutput> > mapCoins;
+    set<type_Color> setColors;
+    setColors.insert(colorA);
+    setColors.insert(colorB);
+    colorWallet.AvailableCoinsByColor(mapCoins, setColors, false);
+    BOOST_CHECK(!mapCoins.count(colorC));
+    BOOST_REQUIRE_EQUAL(mapCoins[colorA].size(), 3U);
+    BOOST_CHECK_EQUAL(mapCoins[colorA][0].tx->vout[mapCoins[colorA][0].i].nValue, 3*CENT);
+    BOOST_CHECK_EQUAL(mapCoins[colorA][1].tx->vout[mapCoins[colorA][1].i].nValue, 2*CENT);
+    BOOST_CHECK_EQUAL(mapCoins[colorA][2].tx->vout[mapCoins[colorA][2].i].nValue, 1*CENT);
+    BOOST_REQUIRE_EQUAL(mapCoins[colorB].size(), 1U);
+    BOOST_CHECK_EQUAL(mapCoins[colorB][0].tx->vout[mapCoins[colorB][0].i].nValue, 5*CENT);
+
+    // Out of the pool the transactions are neither confirmed nor pending
+    mempool.clear();
+    colorWallet.AvailableCoinsByColor(mapCoins, setColors, false);
+    BOOST_CHECK(mapCoins.empty());
+}
+
+BOOST_AUTO_TEST_CASE(color_index_follows_spends)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_REQUIRE(pwalletMain->AddKeyPubKey(key, key.GetPubKey()));
+    CScript scriptMine = GetScriptForDestination(key.GetPubKey().GetID());
+    CScript scriptOther = CScript() << OP_TRUE;
+    const type_Color colorA = 1;
+
+    CMutableTransaction tx1;
+    tx1.vin.resize(1);
+    tx1.vin[0].prevout = COutPoint(ArithToUint256(arith_uint256(1)), 0);
+    tx1.vout.push_back(CTxOut(3*CENT, scriptMine, colorA));
+    tx1.vout.push_back(CTxOut(4*CENT, scriptOther, colorA));
+    mempool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 0, 0, 0.0, 1));
+    pwalletMain->SyncTransaction(tx1, NULL);
+    const COutPoint outMine(tx1.GetHash(), 0);
+    const pair<CAmount, COutPoint> entryMine(3*CENT, outMine);
+
+    // The output paying someone else is not indexed
+    BOOST_REQUIRE_EQUAL(pwalletMain->mapWalletColor[colorA].size(), 1U);
+    BOOST_CHECK(pwalletMain->mapWalletColor[colorA].count(entryMine));
+
+    // A pending spend keeps the output indexed, it is only skipped
+    CMutableTransaction tx2;
+    tx2.vin.resize(1);
+    tx2.vin[0].prevout = outMine;
+    tx2.vout.push_back(CTxOut(3*CENT, scriptOther, colorA));
+    mempool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 0, 0, 0.0, 1));
+    pwalletMain->SyncTransaction(tx2, NULL);
+    BOOST_CHECK(pwalletMain->mapWalletColor[colorA].count(entryMine));
+    map<type_Color, vector<COutput> > mapCoins;
+    set<type_Color> setColors;
+    setColors.insert(colorA);
+    pwalletMain->AvailableCoinsByColor(mapCoins, setColors, false);
+    BOOST_CHECK(mapCoins[colorA].empty());
+
+    // Confirmed in the active chain, the spend removes it
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        CWalletTx& wtx2 = pwalletMain->mapWallet[tx2.GetHash()];
+        wtx2.hashBlock = chainActive.Tip()->GetBlockHash();
+        wtx2.nIndex = 0;
+        wtx2.fMerkleVerified = true;
+    }
+    pwalletMain->SyncTransaction(tx2, NULL);
+    BOOST_CHECK(!pwalletMain->mapWalletColor.count(colorA));
+
+    // Disconnected and dropped from the pool, the output is spendable again
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        CWalletTx& wtx2 = pwalletMain->mapWallet[tx2.GetHash()];
+        wtx2.hashBlock = uint256();
+        wtx2.nIndex = -1;
+        list<CTransaction> removed;
+        mempool.remove(tx2, removed);
+    }
+    pwalletMain->SyncTransaction(tx2, NULL);
+    BOOST_CHECK(pwalletMain->mapWalletColor[colorA].count(entryMine));
+    pwalletMain->AvailableCoinsByColor(mapCoins, setColors, false);
+    BOOST_REQUIRE_EQUAL(mapCoins[colorA].size(), 1U);
+    BOOST_CHECK(mapCoins[colorA][0].tx->GetHash() == tx1.GetHash());
+
+    mempool.clear();
+}
+
+// Make a memory only hd chain "m/c" the active chain of hdwallet.
+static HDChainID AddTestHDChain(CWallet& hdwallet)
+{
+    CKeyingMaterial vSeed(32, 0x5a);
+    CExtKey masterKey;
+    masterKey.SetMaster(&vSeed[0], vSeed.size());
+    CExtPubKey masterPubKey = masterKey.Neuter();
+
+    CHDChain chain(GetTime());
+    chain.chainPath = "m/c";
+    chain.chainHash = masterPubKey.pubkey.GetHash();
+    masterPubKey.Derive(chain.externalPubKey, 0);
+    masterPubKey.Derive(chain.internalPubKey, 1);
+    BOOST_REQUIRE(hdwallet.AddMasterSeed(chain.chainHash, vSeed));
+    BOOST_REQUIRE(hdwallet.AddChain(chain));
+    BOOST_REQUIRE(hdwallet.HDSetActiveChainID(chain.chainHash));
+    return chain.chainHash;
+}
+
+static unsigned int KeyPoolSize(CWallet& hdwallet)
+{
+    LOCK(hdwallet.cs_wallet);
+    return hdwallet.GetKeyPoolSize();
+}
+
+// Wait up to 20 seconds for the keypool to reach nSize. The worker also
+// wakes up every 10 seconds on its own.
+static bool WaitForKeyPoolSize(CWallet& hdwallet, unsigned int nSize)
+{
+    for (int i = 0; i < 2000 && KeyPoolSize(hdwallet) != nSize; i++)
+        MilliSleep(10);
+    return KeyPoolSize(hdwallet) == nSize;
+}
+
+BOOST_AUTO_TEST_CASE(hd_keypool_reserve_from_memory)
+{
+    CWallet hdwallet;
+    HDChainID chainID = AddTestHDChain(hdwallet);
+    BOOST_CHECK_EQUAL(hdwallet.HDExtendKeyPool(3), 3U);
+    BOOST_CHECK_EQUAL(KeyPoolSize(hdwallet), 3U);
+
+    // Keys come out in child index order and reserving only pops the pool.
+    for (unsigned int i = 0; i < 3; i++) {
+        CHDPubKey hdPubKey;
+        BOOST_REQUIRE(hdwallet.DeriveHDPubKeyAtIndex(chainID, hdPubKey, i, false));
+        int64_t nIndex;
+        CKeyPool keypool;
+        hdwallet.ReserveKeyFromKeyPool(nIndex, keypool);
+        BOOST_CHECK(nIndex != -1);
+        BOOST_CHECK(keypool.vchPubKey == hdPubKey.pubkey);
+        BOOST_CHECK_EQUAL(KeyPoolSize(hdwallet), 2U - i);
+        if (i == 0) {
+            hdwallet.ReturnKey(nIndex);
+            BOOST_CHECK_EQUAL(KeyPoolSize(hdwallet), 3U);
+            hdwallet.ReserveKeyFromKeyPool(nIndex, keypool);
+        }
+        hdwallet.KeepKey(nIndex);
+    }
+
+    // An empty pool is not refilled by the reservation itself.
+    int64_t nIndex;
+    CKeyPool keypool;
+    hdwallet.ReserveKeyFromKeyPool(nIndex, keypool);
+    BOOST_CHECK_EQUAL(nIndex, -1);
+    BOOST_CHECK_EQUAL(KeyPoolSize(hdwallet), 0U);
+
+    // The next batch continues after the keys already handed out.
+    BOOST_CHECK_EQUAL(hdwallet.HDExtendKeyPool(1), 1U);
+    CHDPubKey hdPubKey;
+    BOOST_REQUIRE(hdwallet.DeriveHDPubKeyAtIndex(chainID, hdPubKey, 3, false));
+    hdwallet.ReserveKeyFromKeyPool(nIndex, keypool);
+    BOOST_CHECK(keypool.vchPubKey == hdPubKey.pubkey);
+}
+
+BOOST_AUTO_TEST_CASE(hd_keypool_worker_refill)
+{
+    mapArgs["-hdkeypoolbuffer"] = "8";
+    mapArgs["-hdkeypoolbatch"] = "3";
+    CWallet hdwallet;
+    AddTestHDChain(hdwallet);
+
+    boost::thread worker(boost::bind(&ThreadHDKeyPoolWorker, &hdwallet));
+    BOOST_CHECK(WaitForKeyPoolSize(hdwallet, 8));
+
+    // Reservations wake the worker, which tops the buffer up again.
+    for (unsigned int i = 0; i < 5; i++) {
+        int64_t nIndex;
+        CKeyPool keypool;
+        hdwallet.ReserveKeyFromKeyPool(nIndex, keypool);
+        BOOST_CHECK(nIndex != -1);
+        hdwallet.KeepKey(nIndex);
+    }
+    BOOST_CHECK(WaitForKeyPoolSize(hdwallet, 8));
+
+    worker.interrupt();
+    worker.join();
+    mapArgs.erase("-hdkeypoolbuffer");
+    mapArgs.erase("-hdkeypoolbatch");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -61,6 +61,14 @@ struct CompareValueOnly
     }
 };
 
+struct CompareOutputValue
+{
+    bool operator()(const COutput& t1, const COutput& t2) const
+    {
+        return t1.tx->vout[t1.i].nValue < t2.tx->vout[t2.i].nValue;
+    }
+};
+
 string COutput::ToString() const
 {
     return strprintf("COutput(%s, %d, %d) [%s]", tx->GetHash().ToString(), i, nDepth, FormatMoney(tx->vout[i].nValue));
@@ -599,6 +607,47 @@ void CWallet::MarkDirty()
         item.second.MarkDirty();
 }
 
+void CWallet::SyncColorIndex(const COutPoint& outpoint)
+{
+    AssertLockHeld(cs_wallet); // mapWallet, mapTxSpends
+    map<uint256, CWalletTx>::const_iterator it = mapWallet.find(outpoint.hash);
+    if (it == mapWallet.end() || outpoint.n >= it->second.vout.size())
+        return;
+    const CWalletTx& wtx = it->second;
+    if (wtx.type != NORMAL && wtx.type != MINT)
+        return;
+    const CTxOut& txout = wtx.vout[outpoint.n];
+
+    // A spend that is only pending keeps the output: it may still be evicted
+    // or conflicted without the wallet being told.
+    bool fSpentInChain = false;
+    pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(outpoint);
+    for (TxSpends::const_iterator itspend = range.first; itspend != range.second && !fSpentInChain; ++itspend) {
+        map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(itspend->second);
+        fSpentInChain = mit != mapWallet.end() && mit->second.GetDepthInMainChain() > 0;
+    }
+
+    if (!fSpentInChain && IsMine(txout) != ISMINE_NO) {
+        mapWalletColor[txout.color].insert(make_pair(txout.nValue, outpoint));
+        return;
+    }
+    map<type_Color, set<pair<CAmount, COutPoint> > >::iterator itcolor = mapWalletColor.find(txout.color);
+    if (itcolor != mapWalletColor.end()) {
+        itcolor->second.erase(make_pair(txout.nValue, outpoint));
+        if (itcolor->second.empty())
+            mapWalletColor.erase(itcolor);
+    }
+}
+
+void CWallet::RebuildColorIndex()
+{
+    LOCK2(cs_main, cs_wallet);
+    mapWalletColor.clear();
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (unsigned int i = 0; i < it->second.vout.size(); i++)
+            SyncColorIndex(COutPoint(it->first, i));
+}
+
 bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb)
 {
     uint256 hash = wtxIn.GetHash();
@@ -683,6 +732,14 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
             }
         }
 
+        // Its outputs may be ours, and its inputs may have been confirmed as
+        // spent or, on a disconnect or conflict, become unspent again
+        for (unsigned int i = 0; i < wtx.vout.size(); i++)
+            SyncColorIndex(COutPoint(hash, i));
+        if (!wtx.IsCoinBase())
+            BOOST_FOREACH(const CTxIn& txin, wtx.vin)
+                SyncColorIndex(txin.prevout);
+
         //// debug print
         LogPrintf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
 
@@ -758,8 +815,18 @@ void CWallet::EraseFromWallet(const uint256 &hash)
     {
         LOCK(cs_wallet);
         map<uint256, CWalletTx>::iterator ittx = mapWallet.find(hash);
-        for (unsigned int i = 0; ittx != mapWallet.end() && i < ittx->second.vout.size(); i++) {
-            map<string, set<pair<uint256, unsigned int> > >::iterator itaddr = mapWalletAddr.find(GetDestination(ittx->second.vout[i].scriptPubKey));
+        if (ittx == mapWallet.end())
+            return;
+        // Copied, the transaction goes away with its first output
+        const vector<CTxOut> vout = ittx->second.vout;
+        for (unsigned int i = 0; i < vout.size(); i++) {
+            map<type_Color, set<pair<CAmount, COutPoint> > >::iterator itcolor = mapWalletColor.find(vout[i].color);
+            if (itcolor != mapWalletColor.end()) {
+                itcolor->second.erase(make_pair(vout[i].nValue, COutPoint(hash, i)));
+                if (itcolor->second.empty())
+                    mapWalletColor.erase(itcolor);
+            }
+            map<string, set<pair<uint256, unsigned int> > >::iterator itaddr = mapWalletAddr.find(GetDestination(vout[i].scriptPubKey));
             if (itaddr == mapWalletAddr.end()) return;
             if (itaddr->second.erase(make_pair(hash, i)) && mapWallet.erase(hash))
                 CWalletDB(strWalletFile).EraseTx(hash);
@@ -1721,7 +1788,16 @@ void CWallet::AvailableCoinsForLicense(vector<COutput>& vCoins, const type_Color
 void CWallet::AvailableCoins(vector<COutput>& vCoins, const type_Color& color, bool fOnlyConfirmed, const CCoinControl *coinControl,
                                 bool fIncludeZeroValue, const std::string& strFromAddress) const
 {
-    vCoins.clear();
+    map<type_Color, vector<COutput> > mapCoins;
+    AvailableCoinsByColor(mapCoins, set<type_Color>(&color, &color + 1), fOnlyConfirmed, coinControl, fIncludeZeroValue, strFromAddress, false);
+    vCoins.swap(mapCoins[color]);
+}
+
+// populate mapCoins with the available COutputs of each requested color.
+void CWallet::AvailableCoinsByColor(map<type_Color, vector<COutput> >& mapCoins, const set<type_Color>& setColors, bool fOnlyConfirmed,
+                                    const CCoinControl *coinControl, bool fIncludeZeroValue, const std::string& strFromAddress, bool fSortByValue) const
+{
+    mapCoins.clear();
     {
         LOCK2(cs_main, cs_wallet);
         if (!strFromAddress.empty()) {
@@ -1749,50 +1825,123 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, const type_Color& color, b
                 if (nDepth < 0)
                     continue;
 
-                if (pcoin->vout[index].color != color)
+                if (!setColors.count(pcoin->vout[index].color))
                     continue;
 
                 // FIXME: what if index >= pcoin->vout.size() ?
                 isminetype mine = IsMine(pcoin->vout[index]);
                 if (!(IsSpent(wtxid, index)) && mine != ISMINE_NO && !IsLockedCoin((*txit).first, index) && pcoin->vout[index].nValue > 0 &&
                         (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected((*txit).first, index)))
-                    vCoins.push_back(COutput(pcoin, index, nDepth, (mine & ISMINE_SPENDABLE) != ISMINE_NO));
+                    mapCoins[pcoin->vout[index].color].push_back(COutput(pcoin, index, nDepth, (mine & ISMINE_SPENDABLE) != ISMINE_NO));
             }
         } else {
-            for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-                const uint256& wtxid = it->first;
-                const CWalletTx* pcoin = &(*it).second;
-
-                if (!CheckFinalTx(*pcoin))
-                    continue;
-
-                if (fOnlyConfirmed && !pcoin->IsTrusted())
+            // Only the outputs of the requested colors, highest value first
+            for (set<type_Color>::const_iterator itcolor = setColors.begin(); itcolor != setColors.end(); ++itcolor) {
+                map<type_Color, set<pair<CAmount, COutPoint> > >::const_iterator itindex = mapWalletColor.find(*itcolor);
+                if (itindex == mapWalletColor.end())
                     continue;
+                for (set<pair<CAmount, COutPoint> >::const_reverse_iterator it = itindex->second.rbegin(); it != itindex->second.rend(); ++it) {
+                    const uint256& wtxid = it->second.hash;
+                    const unsigned int i = it->second.n;
+                    map<uint256, CWalletTx>::const_iterator txit = mapWallet.find(wtxid);
+                    if (txit == mapWallet.end())
+                        continue;
+                    const CWalletTx* pcoin = &txit->second;
 
-                if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
-                    continue;
+                    if (!CheckFinalTx(*pcoin))
+                        continue;
 
+                    if (fOnlyConfirmed && !pcoin->IsTrusted())
+                        continue;
 
-                if (!(pcoin->type == NORMAL || pcoin->type == MINT))
-                    continue;
+                    if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
+                        continue;
 
-                int nDepth = pcoin->GetDepthInMainChain();
-                if (nDepth < 0)
-                    continue;
-                for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
-                    if (pcoin->vout[i].color != color)
+                    int nDepth = pcoin->GetDepthInMainChain();
+                    if (nDepth < 0)
                         continue;
+
                     isminetype mine = IsMine(pcoin->vout[i]);
-                    if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO && !IsLockedCoin((*it).first, i) && (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
-                            (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected((*it).first, i)))
-                        vCoins.push_back(COutput(pcoin, i, nDepth, (mine & ISMINE_SPENDABLE) != ISMINE_NO));
+                    if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO && !IsLockedCoin(wtxid, i) && (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
+                            (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected(wtxid, i)))
+                        mapCoins[*itcolor].push_back(COutput(pcoin, i, nDepth, (mine & ISMINE_SPENDABLE) != ISMINE_NO));
                 }
             }
+            // Already in descending value
+            return;
+        }
+    }
+
+    // Outputs taken by address come in wallet order
+    if (fSortByValue)
+        for (map<type_Color, vector<COutput> >::iterator it = mapCoins.begin(); it != mapCoins.end(); ++it)
+            sort(it->second.rbegin(), it->second.rend(), CompareOutputValue());
+}
+
+/**
+ * Coins of the same value are interchangeable for the solvers below, so only
+ * their relative order is randomized. This keeps the choice between them
+ * unpredictable without shuffling the whole candidate list.
+ */
+static void ShuffleEqualValues(vector<pair<CAmount, pair<const CWalletTx*, unsigned int> > >& vValue)
+{
+    size_t nBegin = 0;
+    while (nBegin < vValue.size()) {
+        size_t nEnd = nBegin + 1;
+        while (nEnd < vValue.size() && vValue[nEnd].first == vValue[nBegin].first)
+            nEnd++;
+        for (size_t i = nEnd - 1; i > nBegin; i--)
+            swap(vValue[i], vValue[nBegin + insecure_rand() % (i - nBegin + 1)]);
+        nBegin = nEnd;
+    }
+}
+
+/**
+ * Branch and bound search for a subset of vValue (sorted by descending value)
+ * that adds up to exactly nTargetValue. The search walks the inclusion branch
+ * first and cuts a branch as soon as it overshoots the target or the remaining
+ * coins can no longer reach it.
+ */
+static bool SelectCoinsBnB(const vector<pair<CAmount, pair<const CWalletTx*, unsigned int> > >& vValue, const CAmount& nTargetValue,
+                           vector<char>& vfBest, int nMaxTries = 100000)
+{
+    // vRemaining[i] is the sum of vValue[i..end)
+    vector<CAmount> vRemaining(vValue.size() + 1, 0);
+    for (size_t i = vValue.size(); i > 0; i--)
+        vRemaining[i - 1] = vRemaining[i] + vValue[i - 1].first;
+
+    vector<size_t> vSelected;
+    CAmount nTotal = 0;
+    size_t i = 0;
+    for (int nTries = 0; nTries < nMaxTries; nTries++) {
+        if (nTotal == nTargetValue) {
+            vfBest.assign(vValue.size(), false);
+            BOOST_FOREACH(size_t n, vSelected)
+                vfBest[n] = true;
+            return true;
+        }
+
+        if (nTotal > nTargetValue || nTotal + vRemaining[i] < nTargetValue) {
+            // backtrack: drop the last included coin and continue with its omission branch
+            if (vSelected.empty())
+                return false;
+            i = vSelected.back();
+            vSelected.pop_back();
+            nTotal -= vValue[i].first;
+            i++;
+            // omitting a coin and then including an equal one gives the same sum
+            while (i < vValue.size() && vValue[i].first == vValue[i - 1].first)
+                i++;
+        } else {
+            vSelected.push_back(i);
+            nTotal += vValue[i].first;
+            i++;
         }
     }
+    return false;
 }
 
-static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*, unsigned int> > > vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
+static void ApproximateBestSubset(const vector<pair<CAmount, pair<const CWalletTx*, unsigned int> > >& vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
                                   vector<char>& vfBest, CAmount& nBest, int iterations = 1000)
 {
     vector<char> vfIncluded;
@@ -1832,21 +1981,22 @@ static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*, un
     }
 }
 
-bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, vector<COutput> vCoins,
+bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, const vector<COutput>& vCoins,
                                  set<pair<const CWalletTx*, unsigned int> >& setCoinsRet, CAmount& nValueRet) const
 {
     setCoinsRet.clear();
     nValueRet = 0;
 
+    seed_insecure_rand();
+
     // List of values less than target
     pair<CAmount, pair<const CWalletTx*, unsigned int> > coinLowestLarger;
     coinLowestLarger.first = std::numeric_limits<CAmount>::max();
     coinLowestLarger.second.first = NULL;
+    unsigned int nLowestLargerCount = 0;
     vector<pair<CAmount, pair<const CWalletTx*, unsigned int> > > vValue;
     CAmount nTotalLower = 0;
 
-    random_shuffle(vCoins.begin(), vCoins.end(), GetRandInt);
-
     BOOST_FOREACH(const COutput &output, vCoins) {
         if (!output.fSpendable)
             continue;
@@ -1861,15 +2011,15 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
 
         pair<CAmount,pair<const CWalletTx*, unsigned int> > coin = make_pair(n,make_pair(pcoin, i));
 
-        if (n == nTargetValue) {
-            setCoinsRet.insert(coin.second);
-            nValueRet += coin.first;
-            return true;
-        } else if (n < nTargetValue + CENT) {
+        if (n < nTargetValue + CENT) {
             vValue.push_back(coin);
             nTotalLower += n;
         } else if (n < coinLowestLarger.first) {
             coinLowestLarger = coin;
+            nLowestLargerCount = 1;
+        } else if (n == coinLowestLarger.first && insecure_rand() % ++nLowestLargerCount == 0) {
+            // pick uniformly among equally small larger coins
+            coinLowestLarger = coin;
         }
     }
 
@@ -1889,14 +2039,22 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
         return true;
     }
 
-    // Solve subset sum by stochastic approximation
-    sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
+    // Candidates from AvailableCoinsByColor are already sorted by value
+    if (!std::is_sorted(vValue.rbegin(), vValue.rend(), CompareValueOnly()))
+        sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
+    ShuffleEqualValues(vValue);
+
     vector<char> vfBest;
     CAmount nBest;
 
-    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, 1000);
-    if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
-        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, 1000);
+    // Look for an exact match first, then solve subset sum by stochastic approximation
+    if (SelectCoinsBnB(vValue, nTargetValue, vfBest)) {
+        nBest = nTargetValue;
+    } else {
+        ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, 1000);
+        if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
+            ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, 1000);
+    }
 
     // If we have a bigger coin and (either the stochastic approximation didn't find a good solution,
     //                                   or the next bigger coin is closer), return the bigger coin
@@ -1934,11 +2092,37 @@ bool CWallet::SelectCoinsForLicense(const CAmount& nTargetValue, const type_Colo
 bool CWallet::SelectCoins(const CAmount& nTargetValue, const type_Color& color, set<pair<const CWalletTx*, unsigned int> >& setCoinsRet,
                             CAmount& nValueRet, const CCoinControl* coinControl, const string& strFromAddress) const
 {
-    vector<COutput> vCoins;
-    AvailableCoins(vCoins, color, true, coinControl, false, strFromAddress);
+    map<type_Color, vector<COutput> > mapCoins;
+    AvailableCoinsByColor(mapCoins, set<type_Color>(&color, &color + 1), true, coinControl, false, strFromAddress);
+
+    return SelectCoinsFromAvailable(nTargetValue, mapCoins[color], setCoinsRet, nValueRet, coinControl);
+}
+
+bool CWallet::SelectCoinsByColor(const colorAmount_t& mapTargetValue, const map<type_Color, vector<COutput> >& mapCoins,
+                                 map<type_Color, set<pair<const CWalletTx*, unsigned int> > >& mapCoinsRet,
+                                 colorAmount_t& mapValueRet, const CCoinControl* coinControl) const
+{
+    mapCoinsRet.clear();
+    mapValueRet.clear();
+
+    static const vector<COutput> vNoCoins;
+    bool fSelected = true;
+    for (colorAmount_t::const_iterator it = mapTargetValue.begin(); it != mapTargetValue.end(); ++it) {
+        map<type_Color, vector<COutput> >::const_iterator itCoins = mapCoins.find(it->first);
+        const vector<COutput>& vCoins = itCoins == mapCoins.end() ? vNoCoins : itCoins->second;
+        if (!SelectCoinsFromAvailable(it->second, vCoins, mapCoinsRet[it->first], mapValueRet[it->first], coinControl))
+            fSelected = false;
+    }
+    return fSelected;
+}
 
+bool CWallet::SelectCoinsFromAvailable(const CAmount& nTargetValue, const vector<COutput>& vCoins, set<pair<const CWalletTx*, unsigned int> >& setCoinsRet,
+                                       CAmount& nValueRet, const CCoinControl* coinControl) const
+{
     // coin control -> return all selected outputs (we want all selected to go into the transaction for sure)
     if (coinControl && coinControl->HasSelected()) {
+        setCoinsRet.clear();
+        nValueRet = 0;
         BOOST_FOREACH(const COutput& out, vCoins) {
             if (!out.fSpendable)
                 continue;
@@ -2116,6 +2300,27 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, const type_Co
     {
         LOCK2(cs_main, cs_wallet);
         {
+            const type_Color feeColor = TxFee.GetColor();
+            bool fSameColor = send_color == feeColor;
+            string feeAddr;
+            if (feeFromAddress == "")
+                feeAddr = strFromAddress;
+            else
+                feeAddr = feeFromAddress;
+
+            // Collect the candidate coins of the send and fee colors once, the fee loop below only re-runs the selection
+            map<type_Color, vector<COutput> > mapCoins;
+            set<type_Color> setColors;
+            setColors.insert(send_color);
+            if (!fSameColor && feeAddr == strFromAddress)
+                setColors.insert(feeColor);
+            AvailableCoinsByColor(mapCoins, setColors, true, coinControl, false, strFromAddress);
+            if (!fSameColor && feeAddr != strFromAddress) {
+                map<type_Color, vector<COutput> > mapFeeCoins;
+                AvailableCoinsByColor(mapFeeCoins, set<type_Color>(&feeColor, &feeColor + 1), true, coinControl, false, feeAddr);
+                mapCoins[feeColor].swap(mapFeeCoins[feeColor]);
+            }
+
             nFeeRet = TxFee.GetFee();
             while (true) {
                 txNew.vin.clear();
@@ -2126,7 +2331,6 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, const type_Co
                 nChangePosRet = -1;
 
                 CAmount nTotalValue = nValue;
-                bool fSameColor = send_color == TxFee.GetColor();
                 if (fSameColor) {
                     nTotalValue += nFeeRet;
                 }
@@ -2142,14 +2346,22 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, const type_Co
                     txNew.vout.push_back(txout);
                 }
 
-                // Choose coins to use
-                set<pair<const CWalletTx*,unsigned int> > setCoins, setFeeCoins;
-                CAmount nValueIn = 0;
-                if (!SelectCoins(nTotalValue, send_color, setCoins, nValueIn, coinControl, strFromAddress))
-                {
-                    strFailReason = _("You can not spend the token from this address.");
+                // Choose coins to use, the send and fee colors in one selection pass
+                colorAmount_t mapTargetValue, mapValueIn;
+                map<type_Color, set<pair<const CWalletTx*,unsigned int> > > mapSelected;
+                mapTargetValue[send_color] = nTotalValue;
+                if (!fSameColor)
+                    mapTargetValue[feeColor] = nFeeRet;
+                if (!SelectCoinsByColor(mapTargetValue, mapCoins, mapSelected, mapValueIn, coinControl)) {
+                    if (mapValueIn[send_color] < nTotalValue)
+                        strFailReason = _("You can not spend the token from this address.");
+                    else
+                        strFailReason = _("Insufficient fee funds");
                     return false;
                 }
+                set<pair<const CWalletTx*,unsigned int> >& setCoins = mapSelected[send_color];
+                set<pair<const CWalletTx*,unsigned int> > setFeeCoins;
+                CAmount nValueIn = mapValueIn[send_color];
 
                 BOOST_FOREACH(PAIRTYPE(const CWalletTx*, unsigned int) pcoin, setCoins) {
                     CAmount nCredit = pcoin.first->vout[pcoin.second].nValue;
@@ -2169,16 +2381,8 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, const type_Co
                 if (fSameColor) {
                     nChange -= nFeeRet;
                 } else {
-                    string feeAddr;
-                    if (feeFromAddress == "")
-                        feeAddr = strFromAddress;
-                    else
-                        feeAddr = feeFromAddress;
-                    int64_t nFeeIn = 0;
-                    if (!SelectCoins(nFeeRet, TxFee.GetColor(), setFeeCoins, nFeeIn, coinControl, feeAddr)) {
-                        strFailReason = _("Insufficient fee funds");
-                        return false;
-                    }
+                    setFeeCoins.swap(mapSelected[feeColor]);
+                    CAmount nFeeIn = mapValueIn[feeColor];
                     scriptFeeChange = setFeeCoins.begin()->first->vout[setFeeCoins.begin()->second].scriptPubKey;
                     nFeeChange = nFeeIn - nFeeRet;
                 }
@@ -2401,6 +2605,7 @@ DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
         if (CDB::Rewrite(strWalletFile, "\x04pool")) {
             LOCK(cs_wallet);
             setKeyPool.clear();
+            mapKeyPool.clear();
             // Note: can't top-up keypool here, because wallet is locked.
             // User will be prompted to unlock wallet the next operation
             // that requires a new key.
@@ -2411,6 +2616,9 @@ DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
         return nLoadWalletRet;
     fFirstRunRet = !vchDefaultKey.IsValid();
 
+    // Transactions are read before the keys, so only now is known which outputs are ours
+    RebuildColorIndex();
+
     uiInterface.LoadWallet(this);
 
     return DB_LOAD_OK;
@@ -2426,6 +2634,7 @@ DBErrors CWallet::ZapWalletTx(vector<CWalletTx>& vWtx)
         if (CDB::Rewrite(strWalletFile, "\x04pool")) {
             LOCK(cs_wallet);
             setKeyPool.clear();
+            mapKeyPool.clear();
             // Note: can't top-up keypool here, because wallet is locked.
             // User will be prompted to unlock wallet the next operation
             // that requires a new key.
@@ -2496,8 +2705,10 @@ bool CWallet::NewKeyPool()
 {
     LOCK(cs_wallet);
     CWalletDB walletdb(strWalletFile);
-    BOOST_FOREACH(int64_t nIndex, setKeyPool)
+    BOOST_FOREACH(int64_t nIndex, setKeyPool) {
         walletdb.ErasePool(nIndex);
+        mapKeyPool.erase(nIndex);
+    }
     setKeyPool.clear();
 
     if (IsLocked())
@@ -2505,9 +2716,10 @@ bool CWallet::NewKeyPool()
 
     int64_t nKeys = std::max(GetArg("-keypool", 100), (int64_t)0);
     for (int i = 0; i < nKeys; i++) {
-        int64_t nIndex = i+1;
-        walletdb.WritePool(nIndex, CKeyPool(GenerateNewKey()));
-        setKeyPool.insert(nIndex);
+        int64_t nIndex = GetNextKeyPoolIndex();
+        CKeyPool keypool(GenerateNewKey());
+        walletdb.WritePool(nIndex, keypool);
+        LoadKeyPool(nIndex, keypool);
     }
     LogPrintf("CWallet::NewKeyPool wrote %d new keys\n", nKeys);
     return true;
@@ -2517,12 +2729,29 @@ bool CWallet::EraseKeyPool()
 {
     LOCK(cs_wallet);
     CWalletDB walletdb(strWalletFile);
-    BOOST_FOREACH(int64_t nIndex, setKeyPool)
+    BOOST_FOREACH(int64_t nIndex, setKeyPool) {
         walletdb.ErasePool(nIndex);
+        mapKeyPool.erase(nIndex);
+    }
     setKeyPool.clear();
     return true;
 }
 
+void CWallet::LoadKeyPool(int64_t nIndex, const CKeyPool &keypool)
+{
+    AssertLockHeld(cs_wallet); // setKeyPool, mapKeyPool
+    mapKeyPool[nIndex] = keypool;
+    setKeyPool.insert(nIndex);
+}
+
+int64_t CWallet::GetNextKeyPoolIndex() const
+{
+    AssertLockHeld(cs_wallet); // mapKeyPool
+    if (mapKeyPool.empty())
+        return 1;
+    return mapKeyPool.rbegin()->first + 1;
+}
+
 bool CWallet::TopUpKeyPool(unsigned int kpSize)
 {
     {
@@ -2540,12 +2769,11 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
         else
             nTargetSize = std::max(GetArg("-keypool", 100), (int64_t) 0);
         while (setKeyPool.size() < nTargetSize) {
-            int64_t nEnd = 1;
-            if (!setKeyPool.empty())
-                nEnd = *(--setKeyPool.end()) + 1;
-            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey())))
+            int64_t nEnd = GetNextKeyPoolIndex();
+            CKeyPool keypool(GenerateNewKey());
+            if (!walletdb.WritePool(nEnd, keypool))
                 throw runtime_error(_(__func__)+"() : writing generated key failed");
-            setKeyPool.insert(nEnd);
+            LoadKeyPool(nEnd, keypool);
             LogPrintf("keypool added key %d, size=%u\n", nEnd, setKeyPool.size());
         }
     }
@@ -2560,8 +2788,6 @@ bool CWallet::HDTopUpKeyPool(unsigned int kpSize)
         if (IsLocked())
             return false;
 
-        CWalletDB walletdb(strWalletFile);
-
         // Top up key pool
         unsigned int nTargetSize;
         if (kpSize > 0)
@@ -2569,25 +2795,126 @@ bool CWallet::HDTopUpKeyPool(unsigned int kpSize)
         else
             nTargetSize = std::max(GetArg("-keypool", 100), (int64_t) 0);
 
+        unsigned int nBatch = std::max(GetArg("-hdkeypoolbatch", DEFAULT_HDKEYPOOL_BATCH), (int64_t) 1);
         while (setKeyPool.size() < nTargetSize) {
-            int64_t nEnd = 1;
-            if (!setKeyPool.empty())
-                nEnd = *(--setKeyPool.end()) + 1;
-            // key here
-            HDChainID emptyId;
-            CPubKey newKey;
-            string keyChainPath;
-            if (!HDGetNextChildPubKey(emptyId, newKey, keyChainPath))
+            unsigned int nCount = std::min(nTargetSize - (unsigned int)setKeyPool.size(), nBatch);
+            if (HDExtendKeyPool(nCount) == 0)
                 throw runtime_error(_(__func__)+"can't generate HD child key");
-            if (!walletdb.WritePool(nEnd, CKeyPool(newKey)))
-                throw runtime_error(_(__func__)+"() : writing generated key failed");
-            setKeyPool.insert(nEnd);
-            LogPrintf("keypool added key %d, size=%u\n", nEnd, setKeyPool.size());
         }
     }
     return true;
 }
 
+unsigned int CWallet::HDExtendKeyPool(unsigned int nCount)
+{
+    HDChainID chainID;
+    std::vector<unsigned int> vIndices;
+    {
+        LOCK(cs_wallet);
+        CHDChain chain;
+        chainID = activeHDChain;
+        if (chainID.IsNull() || !GetChain(chainID, chain) || !chain.IsValid())
+            return 0;
+
+        // claim the indices so a concurrent caller derives different keys
+        vIndices = GetNextChildIndexes(chainID, false, nCount, setHDIndexInFlight);
+        setHDIndexInFlight.insert(vIndices.begin(), vIndices.end());
+    }
+
+    // the expensive part, public derivation only needs the chain's extended pubkey
+    std::vector<CHDPubKey> vHDPubKeys;
+    vHDPubKeys.reserve(vIndices.size());
+    try {
+        BOOST_FOREACH(unsigned int nIndex, vIndices) {
+            CHDPubKey hdPubKey;
+            if (!DeriveHDPubKeyAtIndex(chainID, hdPubKey, nIndex, false))
+                break;
+            vHDPubKeys.push_back(hdPubKey);
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+
+    LOCK(cs_wallet);
+    BOOST_FOREACH(unsigned int nIndex, vIndices)
+        setHDIndexInFlight.erase(nIndex);
+
+    if (vHDPubKeys.empty() || chainID != activeHDChain)
+        return 0;
+
+    int64_t nCreationTime = GetTime();
+    int64_t nEnd = GetNextKeyPoolIndex();
+    CKeyMetadata keyMeta(nCreationTime);
+
+    // one db transaction for the whole batch
+    if (fFileBacked) {
+        CWalletDB walletdb(strWalletFile);
+        walletdb.TxnBegin();
+        for (unsigned int i = 0; i < vHDPubKeys.size(); i++) {
+            if (!walletdb.WriteHDPubKey(vHDPubKeys[i], keyMeta) ||
+                !walletdb.WritePool(nEnd + i, CKeyPool(vHDPubKeys[i].pubkey))) {
+                walletdb.TxnAbort();
+                throw runtime_error(_(__func__)+"() : writing derived key failed");
+            }
+        }
+        if (!walletdb.TxnCommit())
+            throw runtime_error(_(__func__)+"() : committing derived keys failed");
+    }
+
+    if (!nTimeFirstKey || nCreationTime < nTimeFirstKey)
+        nTimeFirstKey = nCreationTime;
+    for (unsigned int i = 0; i < vHDPubKeys.size(); i++) {
+        mapKeyMetadata[vHDPubKeys[i].pubkey.GetID()] = keyMeta;
+        if (!LoadHDPubKey(vHDPubKeys[i]))
+            throw runtime_error(_(__func__)+"() : add key to keystore failed");
+        LoadKeyPool(nEnd + i, CKeyPool(vHDPubKeys[i].pubkey));
+    }
+    LogPrint("keypool", "keypool added hd keys %d..%d, size=%u\n", nEnd, nEnd + vHDPubKeys.size() - 1, setKeyPool.size());
+    return vHDPubKeys.size();
+}
+
+static boost::mutex csHDKeyPoolWorker;
+static boost::condition_variable condHDKeyPoolWorker;
+
+void CWallet::NotifyHDKeyPoolWorker()
+{
+    AssertLockHeld(cs_wallet); // setKeyPool
+    if (setKeyPool.size() < (uint64_t)std::max(GetArg("-hdkeypoolbuffer", DEFAULT_HDKEYPOOL_BUFFER), (int64_t) 0))
+        condHDKeyPoolWorker.notify_one();
+}
+
+void ThreadHDKeyPoolWorker(CWallet* pwallet)
+{
+    RenameThread("gcoin-hdkeypool");
+    const unsigned int nTarget = std::max(GetArg("-hdkeypoolbuffer", DEFAULT_HDKEYPOOL_BUFFER), (int64_t) 0);
+    const unsigned int nBatch = std::max(GetArg("-hdkeypoolbatch", DEFAULT_HDKEYPOOL_BATCH), (int64_t) 1);
+    if (nTarget == 0)
+        return;
+
+    LogPrintf("HD keypool worker started, buffer=%u batch=%u\n", nTarget, nBatch);
+    while (true) {
+        unsigned int nSize;
+        {
+            LOCK(pwallet->cs_wallet);
+            nSize = pwallet->GetKeyPoolSize();
+        }
+        unsigned int nAdded = 0;
+        if (nSize < nTarget) {
+            try {
+                nAdded = pwallet->HDExtendKeyPool(std::min(nTarget - nSize, nBatch));
+            } catch (const std::runtime_error& e) {
+                LogPrintf("ThreadHDKeyPoolWorker: %s\n", e.what());
+            }
+        }
+        if (nAdded == 0) {
+            // pool is full or there is no usable hd chain, sleep until a reservation drains it
+            boost::unique_lock<boost::mutex> lock(csHDKeyPoolWorker);
+            condHDKeyPoolWorker.timed_wait(lock, boost::posix_time::seconds(10));
+        }
+        boost::this_thread::interruption_point();
+    }
+}
+
 bool CWallet::AddKeyPool(CPubKey& key)
 {
     LOCK(cs_wallet);
@@ -2597,12 +2924,10 @@ bool CWallet::AddKeyPool(CPubKey& key)
 
     CWalletDB walletdb(strWalletFile);
 
-    int64_t nEnd = 1;
-    if (!setKeyPool.empty())
-        nEnd = *(--setKeyPool.end()) + 1;
+    int64_t nEnd = GetNextKeyPoolIndex();
     if (!walletdb.WritePool(nEnd, CKeyPool(key)))
         throw runtime_error(_(__func__)+"() : writing imported key failed");
-    setKeyPool.insert(nEnd);
+    LoadKeyPool(nEnd, CKeyPool(key));
     LogPrintf("keypool added key %d, size=%u\n", nEnd, setKeyPool.size());
     return true;
 }
@@ -2610,26 +2935,24 @@ bool CWallet::AddKeyPool(CPubKey& key)
 void CWallet::ViewKeyPool(std::vector<CPubKey>& keys)
 {
     LOCK(cs_wallet);
-    CWalletDB walletdb(strWalletFile);
 
     for (set<int64_t>::iterator it = setKeyPool.begin(); it != setKeyPool.end(); it++) {
-        CKeyPool keypool;
-        if (!walletdb.ReadPool(*it, keypool))
+        std::map<int64_t, CKeyPool>::const_iterator mi = mapKeyPool.find(*it);
+        if (mi == mapKeyPool.end())
             throw runtime_error(_(__func__) + "() : read failed");
-        keys.push_back(keypool.vchPubKey);
+        keys.push_back(mi->second.vchPubKey);
     }
 }
 
 int64_t CWallet::SearchKeyPool(const CBitcoinAddress& address) const
 {
     LOCK(cs_wallet);
-    CWalletDB walletdb(strWalletFile);
 
     for (set<int64_t>::iterator it = setKeyPool.begin(); it != setKeyPool.end(); it++) {
-        CKeyPool keypool;
-        if (!walletdb.ReadPool(*it, keypool))
+        std::map<int64_t, CKeyPool>::const_iterator mi = mapKeyPool.find(*it);
+        if (mi == mapKeyPool.end())
             throw runtime_error(_(__func__) + "() : read failed");
-        if (address == CBitcoinAddress(keypool.vchPubKey.GetID()))
+        if (address == CBitcoinAddress(mi->second.vchPubKey.GetID()))
             return (*it);
     }
     return -1;
@@ -2646,15 +2969,16 @@ void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool)
         if (setKeyPool.empty())
             return;
 
-        CWalletDB walletdb(strWalletFile);
-
         nIndex = *(setKeyPool.begin());
         setKeyPool.erase(setKeyPool.begin());
-        if (!walletdb.ReadPool(nIndex, keypool))
+        std::map<int64_t, CKeyPool>::const_iterator mi = mapKeyPool.find(nIndex);
+        if (mi == mapKeyPool.end())
             throw runtime_error(_(__func__) + "() : read failed");
+        keypool = mi->second;
         if (!HaveKey(keypool.vchPubKey.GetID()))
             throw runtime_error(_(__func__) + "() : unknown key in key pool");
         assert(keypool.vchPubKey.IsValid());
+        NotifyHDKeyPoolWorker();
         LogPrintf("keypool reserve %d\n", nIndex);
     }
 }
@@ -2670,14 +2994,16 @@ void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool, const CB
         if (setKeyPool.empty())
             return;
 
-        CWalletDB walletdb(strWalletFile);
         nIndex = SearchKeyPool(address);
-        setKeyPool.erase(nIndex);
-        if (!walletdb.ReadPool(nIndex, keypool))
+        std::map<int64_t, CKeyPool>::const_iterator mi = mapKeyPool.find(nIndex);
+        if (mi == mapKeyPool.end())
             throw runtime_error(_(__func__) + "() : read failed");
+        setKeyPool.erase(nIndex);
+        keypool = mi->second;
         if (!HaveKey(keypool.vchPubKey.GetID()))
             throw runtime_error(_(__func__) + "() : unknown key in key pool");
         assert(keypool.vchPubKey.IsValid());
+        NotifyHDKeyPoolWorker();
         LogPrintf("keypool reserve %d\n", nIndex);
     }
 }
@@ -2689,6 +3015,10 @@ void CWallet::KeepKey(int64_t nIndex)
         CWalletDB walletdb(strWalletFile);
         walletdb.ErasePool(nIndex);
     }
+    {
+        LOCK(cs_wallet);
+        mapKeyPool.erase(nIndex);
+    }
     LogPrintf("keypool keep %d\n", nIndex);
 }
 
@@ -2918,15 +3248,13 @@ void CWallet::GetAllReserveKeys(set<CKeyID>& setAddress) const
 {
     setAddress.clear();
 
-    CWalletDB walletdb(strWalletFile);
-
     LOCK2(cs_main, cs_wallet);
     BOOST_FOREACH(const int64_t& id, setKeyPool) {
-        CKeyPool keypool;
-        if (!walletdb.ReadPool(id, keypool))
+        std::map<int64_t, CKeyPool>::const_iterator mi = mapKeyPool.find(id);
+        if (mi == mapKeyPool.end())
             throw runtime_error("GetAllReserveKeyHashes(): read failed");
-        assert(keypool.vchPubKey.IsValid());
-        CKeyID keyID = keypool.vchPubKey.GetID();
+        assert(mi->second.vchPubKey.IsValid());
+        CKeyID keyID = mi->second.vchPubKey.GetID();
         if (!HaveKey(keyID))
             throw runtime_error("GetAllReserveKeyHashes(): unknown key in key pool");
         setAddress.insert(keyID);
@@ -3119,9 +3447,11 @@ string CWallet::MintMoney(const CAmount& nValue, const type_Color& color, CWalle
         int64_t num_of_coins = plicense->NumOfCoins(color), num_of_coins_in_pool = 0;
         {
             LOCK(mempool.cs);
-            BOOST_FOREACH(const PAIRTYPE(uint256, CTxMemPoolEntry)& entry, mempool.mapTx) {
-                const CTransaction& m_tx = entry.second.GetTx();
-                if ((m_tx.type != MINT) || (m_tx.vout[0].color != color)) continue;
+            std::pair<CTxMemPool::typeiter, CTxMemPool::typeiter> range =
+                mempool.mapTx.get<tx_type_index>().equal_range(MINT);
+            for (CTxMemPool::typeiter it = range.first; it != range.second; it++) {
+                const CTransaction& m_tx = it->GetTx();
+                if (m_tx.vout[0].color != color) continue;
                 num_of_coins_in_pool += m_tx.vout[0].nValue;
             }
         }
@@ -3501,52 +3831,6 @@ bool CWallet::HDAddHDChain(const std::string& chainPathIn, bool generateMaster,
     return true;
 }
 
-bool CWallet::HDGetChildPubKeyAtIndex(const HDChainID& chainID, CPubKey &pubKeyOut, unsigned int nIndex, bool internal)
-{
-    AssertLockHeld(cs_wallet);
-
-    CHDPubKey newHdPubKey;
-    if (!DeriveHDPubKeyAtIndex(chainID, newHdPubKey, nIndex, internal))
-        throw std::runtime_error("CWallet::HDGetChildPubKeyAtIndex(): Deriving child key faild!");
-
-    // Create new metadata
-    int64_t nCreationTime = GetTime();
-    mapKeyMetadata[newHdPubKey.pubkey.GetID()] = CKeyMetadata(nCreationTime);
-    if (!nTimeFirstKey || nCreationTime < nTimeFirstKey)
-        nTimeFirstKey = nCreationTime;
-
-    if (!LoadHDPubKey(newHdPubKey))
-        throw std::runtime_error("CWallet::HDGetChildPubKeyAtIndex(): Add key to keystore failed!");
-
-    if (!CWalletDB(strWalletFile).WriteHDPubKey(newHdPubKey, mapKeyMetadata[newHdPubKey.pubkey.GetID()]))
-        throw std::runtime_error("CWallet::HDGetChildPubKeyAtIndex(): Writing pubkey failed!");
-
-    pubKeyOut = newHdPubKey.pubkey;
-    return true;
-}
-
-bool CWallet::HDGetNextChildPubKey(const HDChainID& chainIDIn, CPubKey &pubKeyOut, std::string& newKeysChainpath, bool internal)
-{
-    AssertLockHeld(cs_wallet);
-
-    CHDChain chain;
-    HDChainID chainID = chainIDIn;
-    if (chainID.IsNull())
-        chainID = activeHDChain;
-
-    if (!GetChain(chainID, chain) || !chain.IsValid())
-        throw std::runtime_error("CWallet::HDGetNextChildPubKey(): Selected chain is not vailid!");
-
-    unsigned int nextIndex = GetNextChildIndex(chainID, internal);
-    if (!HDGetChildPubKeyAtIndex(chainID, pubKeyOut, nextIndex, internal))
-        return false;
-
-    newKeysChainpath = chain.chainPath;
-    boost::replace_all(newKeysChainpath, "c", itostr(internal)); //replace the chain switch index
-    newKeysChainpath += "/"+itostr(nextIndex);
-    return true;
-}
-
 bool CWallet::EncryptHDSeeds(CKeyingMaterial& vMasterKeyIn)
 {
     EncryptSeeds();
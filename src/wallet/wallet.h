@@ -54,6 +54,10 @@ static const unsigned int DEFAULT_TX_CONFIRM_TARGET = 2;
 static const CAmount nHighTransactionMaxFeeWarning = 100 * nHighTransactionFeeWarning;
 //! Largest (in bytes) free transaction we're willing to create
 static const unsigned int MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
+//! -hdkeypoolbuffer default, number of hd keys pre-derived in the background (0 = no background worker)
+static const unsigned int DEFAULT_HDKEYPOOL_BUFFER = 0;
+//! -hdkeypoolbatch default, number of hd keys derived and written per database transaction
+static const unsigned int DEFAULT_HDKEYPOOL_BATCH = 100;
 
 class CAccountingEntry;
 class CBlockIndex;
@@ -455,6 +459,8 @@ private:
                         CAmount& nValueRet) const;
     bool SelectCoins(const CAmount& nTargetValue, const type_Color& color, std::set<std::pair<const CWalletTx*, unsigned int> >& setCoinsRet,
                     CAmount& nValueRet, const CCoinControl *coinControl = NULL, const std::string& strFromAddress = "") const;
+    bool SelectCoinsFromAvailable(const CAmount& nTargetValue, const std::vector<COutput>& vCoins, std::set<std::pair<const CWalletTx*, unsigned int> >& setCoinsRet,
+                    CAmount& nValueRet, const CCoinControl *coinControl = NULL) const;
 
     CWalletDB *pwalletdbEncryption;
 
@@ -477,12 +483,20 @@ private:
     TxSpends mapTxSpends;
     void AddToSpends(const COutPoint& outpoint, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
+    //! Add the output to mapWalletColor or remove it from there, whichever its state calls for
+    void SyncColorIndex(const COutPoint& outpoint);
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
     //! state: current active hd chain
     HDChainID activeHDChain;
 
+    //! child indices of the active hd chain that are being derived outside cs_wallet
+    std::set<unsigned int> setHDIndexInFlight;
+
+    //! first unused keypool index, covering keys that are reserved but not yet kept
+    int64_t GetNextKeyPoolIndex() const;
+
 public:
     /*
      * Main wallet lock.
@@ -497,6 +511,8 @@ public:
     std::string strWalletFile;
 
     std::set<int64_t> setKeyPool;
+    //! in-memory copy of the pool records, including reserved keys until they are kept
+    std::map<int64_t, CKeyPool> mapKeyPool;
     std::map<CKeyID, CKeyMetadata> mapKeyMetadata;
 
     typedef std::map<unsigned int, CMasterKey> MasterKeyMap;
@@ -538,6 +554,9 @@ public:
 
     std::map<uint256, CWalletTx> mapWallet;
     std::map<std::string, std::set<std::pair<uint256, unsigned int> > > mapWalletAddr;
+    //! Our outputs of the NORMAL and MINT transactions in mapWallet that no transaction in the
+    //! active chain spends, by color, ordered by value
+    std::map<type_Color, std::set<std::pair<CAmount, COutPoint> > > mapWalletColor;
 
     int64_t nOrderPosNext;
     std::map<uint256, int> mapRequestCount;
@@ -555,10 +574,30 @@ public:
     //! check whether we are allowed to upgrade (or already support) to the named feature
     bool CanSupportFeature(enum WalletFeature wf) { AssertLockHeld(cs_wallet); return nWalletMaxVersion >= wf; }
 
+    //! Index the outputs of all of mapWallet in mapWalletColor anew
+    void RebuildColorIndex();
+
     void AvailableCoinsForLicense(std::vector<COutput>& vCoins, const type_Color& send_color, bool fOnlyConfirmed = true, bool fIncludeZeroValue = false) const;
     void AvailableCoins(std::vector<COutput>& vCoins, const type_Color& color, bool fOnlyConfirmed = true, const CCoinControl *coinControl = NULL,
                         bool fIncludeZeroValue = false, const std::string& strFromAddress = "") const;
-    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*, unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
+
+    /**
+     * Collect the available outputs of every color in setColors from mapWalletColor, visiting only those colors.
+     * Each color bucket comes in descending value, the order coin selection expects; with strFromAddress
+     * the outputs come from mapWalletAddr instead and fSortByValue sorts them.
+     */
+    void AvailableCoinsByColor(std::map<type_Color, std::vector<COutput> >& mapCoins, const std::set<type_Color>& setColors, bool fOnlyConfirmed = true,
+                               const CCoinControl *coinControl = NULL, bool fIncludeZeroValue = false, const std::string& strFromAddress = "",
+                               bool fSortByValue = true) const;
+    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, const std::vector<COutput>& vCoins, std::set<std::pair<const CWalletTx*, unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
+
+    /**
+     * Select coins for several colors at once from the buckets built by AvailableCoinsByColor.
+     * Every color is tried even after one fails, so the caller can tell from mapValueRet which target was missed.
+     */
+    bool SelectCoinsByColor(const colorAmount_t& mapTargetValue, const std::map<type_Color, std::vector<COutput> >& mapCoins,
+                            std::map<type_Color, std::set<std::pair<const CWalletTx*, unsigned int> > >& mapCoinsRet,
+                            colorAmount_t& mapValueRet, const CCoinControl *coinControl = NULL) const;
 
     bool IsSpent(const uint256& hash, unsigned int n) const;
 
@@ -679,6 +718,18 @@ public:
      * @return  True if the process is successful.
      */
     bool HDTopUpKeyPool(unsigned int kpSize = 0);
+
+    /*!
+     * @brief   Derive new external keys of the active hd chain and append them to the keypool.
+     *          Derivation runs without cs_wallet, the new records are written in one db transaction.
+     * @param   nCount  Number of keys to derive.
+     * @return  Number of keys added to the keypool.
+     */
+    unsigned int HDExtendKeyPool(unsigned int nCount);
+
+    //! wake the background hd keypool worker if the keypool fell below -hdkeypoolbuffer
+    void NotifyHDKeyPoolWorker();
+    void LoadKeyPool(int64_t nIndex, const CKeyPool &keypool);
     bool AddKeyPool(CPubKey& key);
     bool EraseKeyPool();
     void ViewKeyPool(std::vector<CPubKey>& keys);
@@ -792,12 +843,6 @@ public:
     //!adds a hd chain of keys to the wallet
     bool HDAddHDChain(const std::string& chainPath, bool generateMaster, CKeyingMaterial& vSeed, HDChainID& chainId, std::string &strBase58ExtPrivKey, std::string &strBase58ExtPubKey, bool overwrite = false);
 
-    //!gets a child key from the internal or external chain at given index
-    bool HDGetChildPubKeyAtIndex(const HDChainID& chainID, CPubKey &pubKeyOut, unsigned int nIndex, bool internal = false);
-
-    //!get next free child key
-    bool HDGetNextChildPubKey(const HDChainID& chainId, CPubKey &pubKeyOut, std::string& newKeysChainpathOut, bool internal = false);
-
     //!encrypt your master seeds
     bool EncryptHDSeeds(CKeyingMaterial& vMasterKeyIn);
 
@@ -940,4 +985,7 @@ private:
     std::vector<char> _ssExtra;
 };
 
+/** Keep -hdkeypoolbuffer keys of the active hd chain pre-derived in the keypool */
+void ThreadHDKeyPoolWorker(CWallet* pwallet);
+
 #endif // BITCOIN_WALLET_WALLET_H